@@ -0,0 +1,324 @@
+/*
+ * Load generator for the JSON IPC server.
+ *
+ * Build with "make tools". Start dmpv with --input-ipc-server=/tmp/dmpv-sock
+ * (and e.g. --idle), then run:
+ *
+ *      build/TOOLS/ipc-load [-c clients] [-t seconds] [-d depth] [-e rate]
+ *                           /tmp/dmpv-sock
+ *
+ * Each of the clients (default 100) keeps depth (default 1, 0 to disable)
+ * get_property requests in flight, and sends the next one as soon as a reply
+ * arrives. This measures request throughput and reply latency.
+ *
+ * A separate connection broadcasts rate (default 10) script-message commands
+ * per second, which every client receives as client-message event. This
+ * measures the latency of delivering an event to all clients.
+ *
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common/common.h"
+#include "misc/bstr.h"
+#include "misc/dmpv_talloc.h"
+#include "osdep/timer.h"
+
+struct client {
+    int fd;
+    bool control;           // sends the broadcasts, doesn't measure anything
+
+    char *rbuf;             // received data that is not a full line yet
+    int rbuf_len;
+    char *wbuf;             // data that could not be sent yet
+    int wbuf_len;
+
+    int64_t *sent;          // send time of requests in flight (FIFO)
+    int num_sent;
+    uint64_t next_id;       // for request_id (0 is used for setup commands)
+};
+
+struct stats {
+    int64_t *latencies;     // request -> reply
+    int num_latencies;
+    int64_t *event_latencies; // broadcast -> event received
+    int num_event_latencies;
+    int64_t errors;
+    int64_t other_lines;
+};
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, mp_strerror(errno));
+    exit(1);
+}
+
+static int connect_socket(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long\n");
+        exit(1);
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        die("socket");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+        die("connect");
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void flush_client(struct client *c)
+{
+    while (c->wbuf_len) {
+        ssize_t r = send(c->fd, c->wbuf, c->wbuf_len, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && errno == EAGAIN)
+            return;
+        if (r < 0)
+            die("send");
+        memmove(c->wbuf, c->wbuf + r, c->wbuf_len - r);
+        c->wbuf_len -= r;
+    }
+}
+
+static void send_line(struct client *c, const char *line)
+{
+    int len = strlen(line);
+    MP_TARRAY_GROW(c, c->wbuf, c->wbuf_len + len);
+    memcpy(c->wbuf + c->wbuf_len, line, len);
+    c->wbuf_len += len;
+    flush_client(c);
+}
+
+static void send_request(struct client *c)
+{
+    char line[100];
+    snprintf(line, sizeof(line),
+             "{\"command\":[\"get_property\",\"pid\"],\"request_id\":%" PRIu64 "}\n",
+             c->next_id++);
+    MP_TARRAY_APPEND(c, c->sent, c->num_sent, mp_time_ns());
+    send_line(c, line);
+}
+
+static void handle_line(struct client *c, struct stats *st, bstr line)
+{
+    if (c->control)
+        return;
+
+    int64_t now = mp_time_ns();
+
+    int pos = bstr_find0(line, "\"request_id\":");
+    if (pos >= 0) {
+        bstr rest = bstr_cut(line, pos + strlen("\"request_id\":"));
+        // Replies to the setup commands have request_id 0.
+        if (!bstrtoll(rest, NULL, 10) || !c->num_sent)
+            return;
+        // Replies to one client arrive in the order of the requests.
+        MP_TARRAY_APPEND(NULL, st->latencies, st->num_latencies,
+                         now - c->sent[0]);
+        MP_TARRAY_REMOVE_AT(c->sent, c->num_sent, 0);
+        if (bstr_find0(line, "\"error\":\"success\"") < 0)
+            st->errors++;
+        send_request(c);
+        return;
+    }
+
+    pos = bstr_find0(line, "[\"ipc-load\",\"");
+    if (pos >= 0) {
+        bstr rest = bstr_cut(line, pos + strlen("[\"ipc-load\",\""));
+        int64_t sent = bstrtoll(rest, NULL, 10);
+        MP_TARRAY_APPEND(NULL, st->event_latencies, st->num_event_latencies,
+                         now - sent);
+        return;
+    }
+
+    st->other_lines++;
+}
+
+static void read_client(struct client *c, struct stats *st)
+{
+    while (1) {
+        char buf[4096];
+        ssize_t r = recv(c->fd, buf, sizeof(buf), 0);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && errno == EAGAIN)
+            return;
+        if (r < 0)
+            die("recv");
+        if (r == 0) {
+            fprintf(stderr, "server closed the connection\n");
+            exit(1);
+        }
+
+        MP_TARRAY_GROW(c, c->rbuf, c->rbuf_len + r);
+        memcpy(c->rbuf + c->rbuf_len, buf, r);
+        c->rbuf_len += r;
+
+        bstr data = {c->rbuf, c->rbuf_len};
+        int nl;
+        while ((nl = bstrchr(data, '\n')) >= 0) {
+            handle_line(c, st, bstr_splice(data, 0, nl));
+            data = bstr_cut(data, nl + 1);
+        }
+        memmove(c->rbuf, data.start, data.len);
+        c->rbuf_len = data.len;
+    }
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t va = *(const int64_t *)a, vb = *(const int64_t *)b;
+    return va < vb ? -1 : va > vb;
+}
+
+static void print_latencies(const char *what, int64_t *v, int num)
+{
+    if (!num) {
+        printf("%s: none received\n", what);
+        return;
+    }
+    qsort(v, num, sizeof(v[0]), compare_int64);
+    int64_t sum = 0;
+    for (int n = 0; n < num; n++)
+        sum += v[n];
+    printf("%s latency (us): avg %.1f, p50 %.1f, p99 %.1f, max %.1f\n", what,
+           sum / (double)num / 1000, v[num / 2] / 1000.0,
+           v[(int)(num * 0.99)] / 1000.0, v[num - 1] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    int num_clients = 100;
+    double duration = 10;
+    int depth = 1;
+    double event_rate = 10;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:d:e:")) != -1) {
+        switch (opt) {
+        case 'c': num_clients = atoi(optarg); break;
+        case 't': duration = atof(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        case 'e': event_rate = atof(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-c clients] [-t seconds] [-d depth] "
+                    "[-e rate] socket\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || num_clients < 1) {
+        fprintf(stderr, "usage: %s [-c clients] [-t seconds] [-d depth] "
+                "[-e rate] socket\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[optind];
+
+    mp_time_init();
+
+    void *ta_ctx = talloc_new(NULL);
+    struct stats st = {0};
+    int num = num_clients + 1;
+    struct client **clients = talloc_array(ta_ctx, struct client *, num);
+    struct pollfd *fds = talloc_array(ta_ctx, struct pollfd, num);
+    for (int n = 0; n < num; n++) {
+        struct client *c = talloc_zero(ta_ctx, struct client);
+        c->fd = connect_socket(path);
+        c->next_id = 1;
+        c->control = n == num_clients;
+        clients[n] = c;
+    }
+
+    // Subscribe to nothing but the broadcasts (and replies).
+    for (int n = 0; n < num; n++)
+        send_line(clients[n], "{\"command\":[\"disable_event\",\"all\"]}\n");
+    for (int n = 0; n < num_clients; n++) {
+        send_line(clients[n],
+                  "{\"command\":[\"enable_event\",\"client-message\"]}\n");
+    }
+
+    int64_t start = mp_time_ns();
+    int64_t end = start + (int64_t)(duration * 1e9);
+    int64_t next_event = start;
+
+    for (int n = 0; n < num_clients; n++) {
+        for (int i = 0; i < depth; i++)
+            send_request(clients[n]);
+    }
+
+    int64_t now;
+    while ((now = mp_time_ns()) < end) {
+        if (event_rate > 0 && now >= next_event) {
+            char line[100];
+            snprintf(line, sizeof(line),
+                     "{\"command\":[\"script-message\",\"ipc-load\",\"%" PRId64 "\"]}\n",
+                     now);
+            send_line(clients[num_clients], line);
+            next_event += (int64_t)(1e9 / event_rate);
+        }
+
+        for (int n = 0; n < num; n++) {
+            fds[n] = (struct pollfd){
+                .fd = clients[n]->fd,
+                .events = POLLIN | (clients[n]->wbuf_len ? POLLOUT : 0),
+            };
+        }
+        int64_t wait_until = MPMIN(end, event_rate > 0 ? next_event : end);
+        int timeout = MPCLAMP((wait_until - now) / 1000000, 0, 100);
+        if (poll(fds, num, timeout) < 0 && errno != EINTR)
+            die("poll");
+
+        for (int n = 0; n < num; n++) {
+            if (fds[n].revents & POLLOUT)
+                flush_client(clients[n]);
+            if (fds[n].revents & (POLLIN | POLLHUP | POLLERR))
+                read_client(clients[n], &st);
+        }
+    }
+
+    double secs = (now - start) / 1e9;
+    printf("%d clients, %.1f s\n", num_clients, secs);
+    printf("requests: %d (%.0f/s), %" PRId64 " failed\n", st.num_latencies,
+           st.num_latencies / secs, st.errors);
+    print_latencies("reply", st.latencies, st.num_latencies);
+    printf("broadcast events received: %d (%.0f/s)\n", st.num_event_latencies,
+           st.num_event_latencies / secs);
+    print_latencies("event", st.event_latencies, st.num_event_latencies);
+    if (st.other_lines)
+        printf("other messages: %" PRId64 "\n", st.other_lines);
+
+    for (int n = 0; n < num; n++)
+        close(clients[n]->fd);
+    talloc_free(st.latencies);
+    talloc_free(st.event_latencies);
+    talloc_free(ta_ctx);
+    return 0;
+}
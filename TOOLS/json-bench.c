@@ -0,0 +1,234 @@
+/*
+ * Measure the speed of the JSON parser and writer on typical IPC messages.
+ *
+ * Build with "make tools", and run:
+ *
+ *      build/TOOLS/json-bench [file...]
+ *
+ * Without arguments, a built-in corpus of IPC commands, replies and events is
+ * used. Each given file is used as one corpus entry, with one JSON message per
+ * line (like a captured IPC session).
+ *
+ * Every entry is parsed with json_parse() into a new talloc context per
+ * message, which is what the IPC code did before it had a json_arena, and
+ * with json_parse_arena() into an arena that is reset after each message.
+ * Then the parsed messages are written back with json_write(). All times are
+ * per message.
+ *
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/common.h"
+#include "misc/bstr.h"
+#include "misc/dmpv_talloc.h"
+#include "misc/json.h"
+#include "osdep/timer.h"
+
+// Minimum run time per measurement.
+#define MIN_TIME_NS (200 * 1000 * 1000)
+
+static const struct {
+    const char *name;
+    const char *json;
+} corpus[] = {
+    {"set_property",
+     "{\"command\":[\"set_property\",\"volume\",57.5],\"request_id\":1024}"},
+    {"get_property",
+     "{\"command\":[\"get_property\",\"time-pos\"],\"request_id\":7}"},
+    {"observe_property",
+     "{\"command\":[\"observe_property\",1,\"track-list\"]}"},
+    {"named_args",
+     "{\"command\":{\"name\":\"seek\",\"target\":-10.5,"
+     "\"flags\":\"relative+exact\"},\"async\":true,\"request_id\":5}"},
+    {"escaped_path",
+     "{\"command\":[\"loadfile\",\"/media/Movies/A \\\"quoted\\\" "
+     "\\u00e9t\\u00e9\\ttitle\\\\part 2.mkv\",\"append-play\"],"
+     "\"request_id\":99}"},
+    {"reply",
+     "{\"data\":1234.567890,\"request_id\":7,\"error\":\"success\"}"},
+    {"event",
+     "{\"event\":\"property-change\",\"id\":1,\"name\":\"time-pos\","
+     "\"data\":123.456789}"},
+};
+
+struct entry {
+    const char *name;
+    char **msgs;
+    int num_msgs;
+    size_t bytes;
+};
+
+static void add_msg(struct entry *e, const char *msg)
+{
+    MP_TARRAY_APPEND(e, e->msgs, e->num_msgs, talloc_strdup(e, msg));
+    e->bytes += strlen(msg);
+}
+
+// A property-change event for "track-list" with 40 tracks.
+static void add_track_list(struct entry *e)
+{
+    char *s = talloc_strdup(NULL, "{\"event\":\"property-change\",\"id\":2,"
+                                  "\"name\":\"track-list\",\"data\":[");
+    for (int n = 0; n < 40; n++) {
+        const char *type = n == 0 ? "video" : n < 8 ? "audio" : "sub";
+        s = talloc_asprintf_append(s,
+            "%s{\"id\":%d,\"type\":\"%s\",\"src-id\":%d,\"title\":\"Track %d "
+            "\\\"%s\\\"\",\"lang\":\"eng\",\"default\":%s,\"forced\":false,"
+            "\"external\":false,\"selected\":%s,\"ff-index\":%d,"
+            "\"codec\":\"%s\",\"demux-channel-count\":%d,"
+            "\"demux-samplerate\":48000,\"demux-bitrate\":%d}",
+            n ? "," : "", n + 1, type, n, n, type, n == 1 ? "true" : "false",
+            n < 2 ? "true" : "false", n, n == 0 ? "hevc" : "opus",
+            n < 8 ? 6 : 0, 128000 + n * 1000);
+    }
+    s = talloc_strdup_append(s, "]}");
+    add_msg(e, s);
+    talloc_free(s);
+}
+
+static bool load_file(struct entry *e, const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f)
+        return false;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, f)) >= 0) {
+        bstr msg = bstr_strip(bstr0(line));
+        if (msg.len)
+            add_msg(e, bstrto0(e, msg));
+    }
+    free(line);
+    fclose(f);
+    return e->num_msgs > 0;
+}
+
+enum mode {
+    PARSE_TALLOC,
+    PARSE_ARENA,
+    WRITE,
+};
+
+static double bench(struct entry *e, enum mode mode)
+{
+    void *ta_ctx = talloc_new(NULL);
+    struct json_arena *arena = json_arena_create(ta_ctx);
+
+    // The parser modifies its input, so each message is copied before.
+    size_t max_len = 0;
+    for (int n = 0; n < e->num_msgs; n++)
+        max_len = MPMAX(max_len, strlen(e->msgs[n]) + 1);
+    char *buf = talloc_size(ta_ctx, max_len);
+
+    struct dmpv_node *nodes = talloc_zero_array(ta_ctx, struct dmpv_node,
+                                                e->num_msgs);
+    for (int n = 0; n < e->num_msgs; n++) {
+        char *src = talloc_strdup(ta_ctx, e->msgs[n]);
+        if (json_parse(ta_ctx, &nodes[n], &src, MAX_JSON_DEPTH) < 0) {
+            talloc_free(ta_ctx);
+            return -1;
+        }
+    }
+
+    int64_t start = mp_time_ns();
+    int64_t now = start;
+    int64_t runs = 0;
+    while (now - start < MIN_TIME_NS) {
+        for (int n = 0; n < e->num_msgs; n++) {
+            struct dmpv_node node;
+            char *src = buf;
+            switch (mode) {
+            case PARSE_TALLOC: {
+                strcpy(buf, e->msgs[n]);
+                void *tmp = talloc_new(NULL);
+                json_parse(tmp, &node, &src, MAX_JSON_DEPTH);
+                talloc_free(tmp);
+                break;
+            }
+            case PARSE_ARENA:
+                strcpy(buf, e->msgs[n]);
+                json_parse_arena(arena, &node, &src, MAX_JSON_DEPTH);
+                json_arena_reset(arena);
+                break;
+            case WRITE: {
+                char *out = talloc_strdup(NULL, "");
+                json_write(&out, &nodes[n]);
+                talloc_free(out);
+                break;
+            }
+            }
+        }
+        runs += e->num_msgs;
+        now = mp_time_ns();
+    }
+
+    talloc_free(ta_ctx);
+    return (now - start) / (double)runs;
+}
+
+int main(int argc, char *argv[])
+{
+    mp_time_init();
+
+    void *ta_ctx = talloc_new(NULL);
+    struct entry **entries = NULL;
+    int num_entries = 0;
+
+    if (argc > 1) {
+        for (int n = 1; n < argc; n++) {
+            struct entry *e = talloc_zero(ta_ctx, struct entry);
+            e->name = argv[n];
+            if (!load_file(e, argv[n])) {
+                fprintf(stderr, "failed to load '%s'\n", argv[n]);
+                return 1;
+            }
+            MP_TARRAY_APPEND(ta_ctx, entries, num_entries, e);
+        }
+    } else {
+        for (int n = 0; n < MP_ARRAY_SIZE(corpus); n++) {
+            struct entry *e = talloc_zero(ta_ctx, struct entry);
+            e->name = corpus[n].name;
+            add_msg(e, corpus[n].json);
+            MP_TARRAY_APPEND(ta_ctx, entries, num_entries, e);
+        }
+        struct entry *e = talloc_zero(ta_ctx, struct entry);
+        e->name = "track_list";
+        add_track_list(e);
+        MP_TARRAY_APPEND(ta_ctx, entries, num_entries, e);
+    }
+
+    printf("%-20s %9s %12s %12s %12s\n", "entry", "bytes/msg",
+           "talloc ns", "arena ns", "write ns");
+    for (int n = 0; n < num_entries; n++) {
+        struct entry *e = entries[n];
+        double t_talloc = bench(e, PARSE_TALLOC);
+        if (t_talloc < 0) {
+            printf("%-20s invalid JSON\n", e->name);
+            continue;
+        }
+        printf("%-20s %9zu %12.1f %12.1f %12.1f\n", e->name,
+               e->bytes / e->num_msgs, t_talloc, bench(e, PARSE_ARENA),
+               bench(e, WRITE));
+    }
+
+    talloc_free(ta_ctx);
+    return 0;
+}
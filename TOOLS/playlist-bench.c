@@ -0,0 +1,105 @@
+/*
+ * Measure the speed of playlist edits on a large playlist.
+ *
+ * Build with "make tools", and run:
+ *
+ *      build/TOOLS/playlist-bench [entries [operations]]
+ *
+ * This builds a playlist with the given number of entries (default 1000000)
+ * by appending, and then does the given number of operations (default 2000)
+ * of each kind at random positions: inserting, moving and removing entries,
+ * and looking up the index of an entry after the edits. The playlist is also
+ * shuffled and unshuffled once. All times are per operation.
+ *
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common/common.h"
+#include "common/playlist.h"
+#include "misc/dmpv_talloc.h"
+#include "osdep/timer.h"
+
+static unsigned seed = 1;
+
+static struct playlist_entry *random_entry(struct playlist *pl)
+{
+    return pl->entries[rand_r(&seed) % pl->num_entries];
+}
+
+static void report(const char *what, int64_t start, int ops)
+{
+    double ns = (mp_time_ns() - start) / (double)ops;
+    printf("%-16s %10d %14.1f\n", what, ops, ns);
+}
+
+int main(int argc, char *argv[])
+{
+    int num_entries = argc > 1 ? atoi(argv[1]) : 1000000;
+    int num_ops = argc > 2 ? atoi(argv[2]) : 2000;
+    if (num_entries < 1 || num_ops < 1 || argc > 3) {
+        fprintf(stderr, "usage: %s [entries [operations]]\n", argv[0]);
+        return 1;
+    }
+
+    mp_time_init();
+
+    struct playlist *pl = talloc_zero(NULL, struct playlist);
+    int64_t start;
+
+    printf("%-16s %10s %14s\n", "operation", "count", "ns/op");
+
+    start = mp_time_ns();
+    for (int n = 0; n < num_entries; n++)
+        playlist_append_file(pl, "file.mkv");
+    report("append", start, num_entries);
+
+    start = mp_time_ns();
+    for (int n = 0; n < num_ops; n++)
+        playlist_insert_at(pl, playlist_entry_new("file.mkv"), random_entry(pl));
+    report("insert-middle", start, num_ops);
+
+    start = mp_time_ns();
+    for (int n = 0; n < num_ops; n++)
+        playlist_move(pl, random_entry(pl), random_entry(pl));
+    report("move", start, num_ops);
+
+    start = mp_time_ns();
+    for (int n = 0; n < num_ops; n++)
+        playlist_remove(pl, random_entry(pl));
+    report("remove-middle", start, num_ops);
+
+    // The index hints of most entries are outdated after the edits above.
+    volatile int64_t sink = 0;
+    start = mp_time_ns();
+    for (int n = 0; n < num_ops; n++)
+        sink += playlist_entry_to_index(pl, random_entry(pl));
+    report("entry_to_index", start, num_ops);
+
+    start = mp_time_ns();
+    playlist_shuffle(pl);
+    report("shuffle", start, 1);
+
+    start = mp_time_ns();
+    playlist_unshuffle(pl);
+    report("unshuffle", start, 1);
+
+    (void)sink;
+    talloc_free(pl);
+    return 0;
+}
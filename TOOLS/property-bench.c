@@ -0,0 +1,155 @@
+/*
+ * Measure how fast properties are looked up by name.
+ *
+ * Build with "make tools", and run:
+ *
+ *      build/TOOLS/property-bench [property...]
+ *
+ * This first looks up every name in the player's property list, with the
+ * linear m_property_list_find() and with the hash index that command.c uses.
+ * Then it reads the given properties (or a default set, including
+ * sub-properties and options) through the client API, which includes the
+ * lookup and the cost of the property itself.
+ *
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/common.h"
+#include "misc/client.h"
+#include "misc/dmpv_talloc.h"
+#include "options/m_property.h"
+#include "osdep/timer.h"
+
+// Minimum run time per measurement.
+#define MIN_TIME_NS (300 * 1000 * 1000)
+
+static const char *const default_props[] = {
+    "pause",
+    "volume",
+    "idle-active",
+    "track-list/count",
+    "options/vo",
+    "option-info/volume/default-value",
+    NULL
+};
+
+static volatile uintptr_t sink;
+
+// Return lookups per second.
+static double bench_lookup(const struct m_property *list,
+                           const struct m_property_index *index,
+                           char **names, int num_names)
+{
+    int64_t start = mp_time_ns();
+    int64_t now = start;
+    int64_t runs = 0;
+    while (now - start < MIN_TIME_NS) {
+        for (int n = 0; n < num_names; n++) {
+            struct m_property *p = index
+                ? m_property_index_find(index, names[n], strlen(names[n]))
+                : m_property_list_find(list, names[n]);
+            sink += (uintptr_t)p;
+        }
+        runs += num_names;
+        now = mp_time_ns();
+    }
+    return runs / ((now - start) / 1e9);
+}
+
+// Return property reads per second, or -1 on failure.
+static double bench_get(dmpv_handle *ctx, const char *name)
+{
+    int64_t start = mp_time_ns();
+    int64_t now = start;
+    int64_t runs = 0;
+    while (now - start < MIN_TIME_NS) {
+        for (int n = 0; n < 100; n++) {
+            char *s = dmpv_get_property_string(ctx, name);
+            if (!s)
+                return -1;
+            dmpv_free(s);
+        }
+        runs += 100;
+        now = mp_time_ns();
+    }
+    return runs / ((now - start) / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+    mp_time_init();
+
+    dmpv_handle *ctx = dmpv_create();
+    if (!ctx) {
+        fprintf(stderr, "failed to create player\n");
+        return 1;
+    }
+    dmpv_set_option_string(ctx, "config", "no");
+    dmpv_set_option_string(ctx, "terminal", "no");
+    dmpv_set_option_string(ctx, "idle", "yes");
+    dmpv_set_option_string(ctx, "vo", "null");
+    dmpv_set_option_string(ctx, "ao", "null");
+    if (dmpv_initialize(ctx) < 0) {
+        fprintf(stderr, "failed to initialize player\n");
+        return 1;
+    }
+
+    dmpv_node plist;
+    if (dmpv_get_property(ctx, "property-list", DMPV_FORMAT_NODE, &plist) < 0 ||
+        plist.format != DMPV_FORMAT_NODE_ARRAY)
+    {
+        fprintf(stderr, "failed to get property list\n");
+        return 1;
+    }
+
+    void *ta_ctx = talloc_new(NULL);
+    int num_names = plist.u.list->num;
+    char **names = talloc_array(ta_ctx, char *, num_names);
+    struct m_property *list = talloc_zero_array(ta_ctx, struct m_property,
+                                                num_names + 1);
+    for (int n = 0; n < num_names; n++) {
+        names[n] = talloc_strdup(ta_ctx, plist.u.list->values[n].u.string);
+        list[n].name = names[n];
+    }
+    dmpv_free_node_contents(&plist);
+
+    struct m_property_index *index = m_property_index_create(ta_ctx, list);
+
+    printf("%d properties\n", num_names);
+    printf("%-40s %14.0f lookups/s\n", "m_property_list_find()",
+           bench_lookup(list, NULL, names, num_names));
+    printf("%-40s %14.0f lookups/s\n", "m_property_index_find()",
+           bench_lookup(list, index, names, num_names));
+
+    const char *const *props = argc > 1 ? (const char *const *)argv + 1
+                                        : default_props;
+    for (int n = 0; props[n]; n++) {
+        double r = bench_get(ctx, props[n]);
+        if (r < 0) {
+            printf("%-40s %14s\n", props[n], "(unavailable)");
+        } else {
+            printf("%-40s %14.0f reads/s\n", props[n], r);
+        }
+    }
+
+    talloc_free(ta_ctx);
+    dmpv_terminate_destroy(ctx);
+    return 0;
+}
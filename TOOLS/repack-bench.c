@@ -0,0 +1,163 @@
+/*
+ * Compare the speed of the vectorized repack scanline functions with the C
+ * versions, and check that both produce the same output.
+ *
+ * Build with "make tools", and run:
+ *
+ *      build/TOOLS/repack-bench [format...]
+ *
+ * Without arguments, all formats supported by repack are benchmarked. Each
+ * format is unpacked to its planar format, packed from it, and converted to
+ * and from float. The reported times are per pixel.
+ *
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/common.h"
+#include "misc/dmpv_talloc.h"
+#include "osdep/timer.h"
+#include "video/img_format.h"
+#include "video/mp_image.h"
+#include "video/repack.h"
+
+#define W 1920
+#define H 1080
+
+// Minimum run time per measurement.
+#define MIN_TIME_NS (200 * 1000 * 1000)
+
+static void fill_image(struct mp_image *img, unsigned *seed)
+{
+    bool is_float = img->fmt.flags & MP_IMGFLAG_TYPE_FLOAT;
+    for (int p = 0; p < img->num_planes; p++) {
+        size_t size = mp_image_plane_bytes(img, p, 0, img->w);
+        for (int y = 0; y < mp_image_plane_h(img, p); y++) {
+            uint8_t *line = img->planes[p] + y * (ptrdiff_t)img->stride[p];
+            if (is_float) {
+                for (size_t x = 0; x < size / sizeof(float); x++)
+                    ((float *)line)[x] = rand_r(seed) / (float)RAND_MAX;
+            } else {
+                for (size_t x = 0; x < size; x++)
+                    line[x] = rand_r(seed);
+            }
+        }
+    }
+}
+
+static bool same_image(struct mp_image *a, struct mp_image *b)
+{
+    for (int p = 0; p < a->num_planes; p++) {
+        size_t size = mp_image_plane_bytes(a, p, 0, a->w);
+        for (int y = 0; y < mp_image_plane_h(a, p); y++) {
+            if (memcmp(a->planes[p] + y * (ptrdiff_t)a->stride[p],
+                       b->planes[p] + y * (ptrdiff_t)b->stride[p], size))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void repack_all(struct mp_repack *rp)
+{
+    int align_y = mp_repack_get_align_y(rp);
+    for (int y = 0; y < H; y += align_y)
+        repack_line(rp, 0, y, 0, y, W);
+}
+
+// Return the time per pixel in ns, or -1 on failure.
+static double run(struct mp_repack *rp, struct mp_image *dst,
+                  struct mp_image *src)
+{
+    if (!repack_config_buffers(rp, 0, dst, 0, src, NULL))
+        return -1;
+
+    repack_all(rp); // warm up caches
+
+    int64_t start = mp_time_ns();
+    int64_t now = start;
+    int runs = 0;
+    while (now - start < MIN_TIME_NS) {
+        repack_all(rp);
+        runs++;
+        now = mp_time_ns();
+    }
+    return (now - start) / ((double)runs * W * H);
+}
+
+// Benchmark one direction. Return false if the repacker can't be created.
+static bool bench(void *ta_ctx, int imgfmt, bool pack, int flags)
+{
+    struct mp_repack *rp_c =
+        mp_repack_create_planar(imgfmt, pack, flags | REPACK_CREATE_NO_SIMD);
+    struct mp_repack *rp = mp_repack_create_planar(imgfmt, pack, flags);
+    talloc_steal(ta_ctx, rp_c);
+    talloc_steal(ta_ctx, rp);
+    if (!rp || !rp_c)
+        return false;
+
+    int fmt_src = mp_repack_get_format_src(rp);
+    int fmt_dst = mp_repack_get_format_dst(rp);
+    struct mp_image *src = talloc_steal(ta_ctx, mp_image_alloc(fmt_src, W, H));
+    struct mp_image *dst_c = talloc_steal(ta_ctx, mp_image_alloc(fmt_dst, W, H));
+    struct mp_image *dst = talloc_steal(ta_ctx, mp_image_alloc(fmt_dst, W, H));
+    if (!src || !dst_c || !dst)
+        return false;
+
+    unsigned seed = imgfmt;
+    fill_image(src, &seed);
+    mp_image_clear(dst_c, 0, 0, W, H);
+    mp_image_clear(dst, 0, 0, W, H);
+
+    double t_c = run(rp_c, dst_c, src);
+    double t = run(rp, dst, src);
+    if (t_c < 0 || t < 0)
+        return false;
+
+    printf("%-14s %-14s %8.3f %8.3f %6.2fx  %s\n",
+           mp_imgfmt_to_name(fmt_src), mp_imgfmt_to_name(fmt_dst), t_c, t,
+           t_c / t, same_image(dst_c, dst) ? "ok" : "MISMATCH");
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    mp_time_init();
+
+    printf("%-14s %-14s %8s %8s %7s\n", "from", "to", "C ns", "SIMD ns",
+           "speedup");
+
+    for (int imgfmt = IMGFMT_START; imgfmt < IMGFMT_END; imgfmt++) {
+        const char *name = mp_imgfmt_to_name(imgfmt);
+        bool want = argc < 2;
+        for (int n = 1; n < argc; n++)
+            want |= strcmp(argv[n], name) == 0;
+        if (!want || !mp_imgfmt_get_desc(imgfmt).id)
+            continue;
+
+        void *ta_ctx = talloc_new(NULL);
+        bench(ta_ctx, imgfmt, false, 0);
+        bench(ta_ctx, imgfmt, true, 0);
+        bench(ta_ctx, imgfmt, false, REPACK_CREATE_PLANAR_F32);
+        bench(ta_ctx, imgfmt, true, REPACK_CREATE_PLANAR_F32);
+        talloc_free(ta_ctx);
+    }
+
+    return 0;
+}
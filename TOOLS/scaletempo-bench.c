@@ -0,0 +1,228 @@
+/*
+ * Measure the speed of the af_scaletempo DSP functions for every instruction
+ * set the CPU supports, and check the results against the C versions.
+ *
+ * Build with "make tools", and run:
+ *
+ *      build/TOOLS/scaletempo-bench
+ *
+ * The buffer sizes are those af_scaletempo uses with its default options at
+ * 48 kHz, for several channel counts. The reported times are per audio frame
+ * (one sample of each channel) passed to the function.
+ *
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/cpu.h>
+
+#include "audio/filter/scaletempo_dsp.h"
+#include "common/common.h"
+#include "misc/dmpv_talloc.h"
+#include "osdep/timer.h"
+
+// Default af_scaletempo options (stride=60, overlap=0.2) at 48 kHz.
+#define FRAMES_OVERLAP (48 * 60 / 5)
+
+// Minimum run time per measurement.
+#define MIN_TIME_NS (100 * 1000 * 1000)
+
+// CPU flags to force for each instruction set (the flag values depend on the
+// architecture).
+static const int cpu_levels[] = {
+    0,
+#if defined(__x86_64__) || defined(__i386__)
+    AV_CPU_FLAG_SSE2,
+    AV_CPU_FLAG_SSE2 | AV_CPU_FLAG_AVX2,
+#elif defined(__aarch64__)
+    AV_CPU_FLAG_NEON,
+#endif
+};
+
+static const struct {
+    const char *name;
+    int channels;
+} layouts[] = {
+    {"mono", 1},
+    {"stereo", 2},
+    {"5.1", 6},
+    {"7.1", 8},
+};
+
+enum kernel {
+    DISTANCE_FLOAT,
+    DISTANCE_S16,
+    MIX_FLOAT,
+    MIX_S16,
+    NUM_KERNELS,
+};
+
+static const char *const kernel_names[NUM_KERNELS] = {
+    [DISTANCE_FLOAT] = "distance_float",
+    [DISTANCE_S16] = "distance_s16",
+    [MIX_FLOAT] = "mix_float",
+    [MIX_S16] = "mix_s16",
+};
+
+struct buffers {
+    float *fa, *fb, *fout, *fblend;
+    int16_t *sa, *sb, *sout;
+    int32_t *sblend;
+};
+
+// Run the kernel once; the result is written to out (for mix) or returned.
+static double run_kernel(const struct scaletempo_dsp *dsp, enum kernel k,
+                         struct buffers *b, int n)
+{
+    switch (k) {
+    case DISTANCE_FLOAT:
+        return dsp->distance_float(b->fa, b->fb, n);
+    case DISTANCE_S16:
+        return dsp->distance_s16(b->sa, b->sb, n);
+    case MIX_FLOAT:
+        dsp->mix_float(b->fout, b->fa, b->fb, b->fblend, n);
+        return 0;
+    case MIX_S16:
+        dsp->mix_s16(b->sout, b->sa, b->sb, b->sblend, n);
+        return 0;
+    }
+    return 0;
+}
+
+// Return whether the results of dsp match the reference.
+static bool check_kernel(const struct scaletempo_dsp *ref,
+                         const struct scaletempo_dsp *dsp, enum kernel k,
+                         struct buffers *b, int n)
+{
+    double r_ref = run_kernel(ref, k, b, n);
+    float *fout = talloc_memdup(NULL, b->fout, n * sizeof(float));
+    int16_t *sout = talloc_memdup(NULL, b->sout, n * sizeof(int16_t));
+    double r = run_kernel(dsp, k, b, n);
+
+    bool ok;
+    switch (k) {
+    case DISTANCE_FLOAT:
+        // Only the summation order differs.
+        ok = fabs(r - r_ref) <= 1e-4 * r_ref;
+        break;
+    case MIX_FLOAT:
+        ok = true;
+        for (int i = 0; i < n; i++)
+            ok &= fabsf(b->fout[i] - fout[i]) <= 1e-6f;
+        break;
+    case MIX_S16:
+        ok = memcmp(b->sout, sout, n * sizeof(int16_t)) == 0;
+        break;
+    default:
+        ok = r == r_ref;
+    }
+
+    talloc_free(fout);
+    talloc_free(sout);
+    return ok;
+}
+
+static double bench_kernel(const struct scaletempo_dsp *dsp, enum kernel k,
+                           struct buffers *b, int n)
+{
+    volatile double sink = 0;
+    int64_t start = mp_time_ns();
+    int64_t now = start;
+    int64_t runs = 0;
+    while (now - start < MIN_TIME_NS) {
+        for (int i = 0; i < 100; i++)
+            sink += run_kernel(dsp, k, b, n);
+        runs += 100;
+        now = mp_time_ns();
+    }
+    (void)sink;
+    return (now - start) / (double)runs;
+}
+
+int main(void)
+{
+    mp_time_init();
+
+    void *ta_ctx = talloc_new(NULL);
+    int n_max = FRAMES_OVERLAP * 8;
+    struct buffers b = {
+        .fa = talloc_array(ta_ctx, float, n_max),
+        .fb = talloc_array(ta_ctx, float, n_max),
+        .fout = talloc_zero_array(ta_ctx, float, n_max),
+        .fblend = talloc_array(ta_ctx, float, n_max),
+        .sa = talloc_array(ta_ctx, int16_t, n_max),
+        .sb = talloc_array(ta_ctx, int16_t, n_max),
+        .sout = talloc_zero_array(ta_ctx, int16_t, n_max),
+        .sblend = talloc_array(ta_ctx, int32_t, n_max),
+    };
+    srand(1);
+    for (int i = 0; i < n_max; i++) {
+        b.fa[i] = rand() / (float)RAND_MAX * 2 - 1;
+        b.fb[i] = rand() / (float)RAND_MAX * 2 - 1;
+        b.fblend[i] = i / (float)n_max;
+        b.sa[i] = rand();
+        b.sb[i] = rand();
+        b.sblend[i] = (int64_t)i * 65536 / n_max;
+    }
+
+    struct scaletempo_dsp ref;
+    av_force_cpu_flags(0);
+    scaletempo_dsp_init(&ref);
+
+    av_force_cpu_flags(-1);
+    int cpu_flags = av_get_cpu_flags();
+
+    printf("%-6s %-8s %-16s %10s  %s\n", "impl", "layout", "kernel",
+           "ns/frame", "check");
+
+    const char *last = NULL;
+    for (int l = 0; l < MP_ARRAY_SIZE(cpu_levels); l++) {
+        if ((cpu_flags & cpu_levels[l]) != cpu_levels[l])
+            continue;
+
+        struct scaletempo_dsp dsp;
+        av_force_cpu_flags(cpu_levels[l]);
+        scaletempo_dsp_init(&dsp);
+        // Skip instruction sets that dmpv has no functions for.
+        if (last && strcmp(dsp.name, last) == 0)
+            continue;
+        last = dsp.name;
+
+        for (int c = 0; c < MP_ARRAY_SIZE(layouts); c++) {
+            int nch = layouts[c].channels;
+            int frames = FRAMES_OVERLAP;
+            for (int k = 0; k < NUM_KERNELS; k++) {
+                // The overlap search skips the first frame (see
+                // best_overlap_offset_float()), the crossfade doesn't.
+                int skip = k == DISTANCE_FLOAT || k == DISTANCE_S16;
+                int n = (frames - skip) * nch;
+                double ns = bench_kernel(&dsp, k, &b, n);
+                bool ok = check_kernel(&ref, &dsp, k, &b, n);
+                printf("%-6s %-8s %-16s %10.3f  %s\n", dsp.name,
+                       layouts[c].name, kernel_names[k], ns / (frames - skip),
+                       ok ? "ok" : "MISMATCH");
+            }
+        }
+    }
+
+    av_force_cpu_flags(-1);
+    talloc_free(ta_ctx);
+    return 0;
+}
@@ -37,13 +37,20 @@
 #include "misc/mp_assert.h"
 #include <math.h>
 
+#include <libavutil/cpu.h>
+
 #include "audio/aframe.h"
 #include "audio/format.h"
 #include "common/common.h"
+#include "common/stats.h"
 #include "filters/f_autoconvert.h"
 #include "filters/filter_internal.h"
 #include "filters/user_filters.h"
+#include "misc/thread_pool.h"
 #include "options/m_option.h"
+#include "osdep/threads.h"
+
+#include "scaletempo_dsp.h"
 
 struct f_opts {
     float scale_nominal;
@@ -53,6 +60,25 @@ struct f_opts {
 #define SCALE_TEMPO 1
 #define SCALE_PITCH 2
     int speed_opt;
+    int threads;
+};
+
+#define MAX_THREADS 64
+
+// Don't bother splitting the crossfade into jobs if it's smaller.
+#define MIN_PARALLEL_MIX_SAMPLES 8192
+
+enum job_type {
+    JOB_SEARCH,     // compute coarse search distances [start, end)
+    JOB_MIX,        // crossfade samples [start, end)
+};
+
+struct job {
+    struct priv *s;
+    enum job_type type;
+    int start, end;
+    void *out;      // JOB_MIX only
+    void *in;
 };
 
 struct priv {
@@ -89,6 +115,23 @@ struct priv {
     int frames_search;
     int num_channels;
     int (*best_overlap_offset)(struct priv *s);
+    struct scaletempo_dsp dsp;
+    bool use_int;
+
+    // Multithreaded mode (threads option != no): the coarse search is done on
+    // a downmixed signal, and split into jobs.
+    bool mono_search;
+    int num_threads;                // including the filter thread
+    struct mp_thread_pool *pool;    // num_threads - 1 workers, or NULL
+    void *buf_mono_queue;           // downmixed buf_queue
+    void *buf_mono_overlap;         // downmixed buf_overlap
+    void *distances;                // coarse search results (float/int32_t)
+    struct job jobs[MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    int jobs_pending;               // protected by lock
+
+    struct stats_ctx *stats;
 };
 
 static bool reinit(struct mp_filter *f);
@@ -176,21 +219,91 @@ static void quadratic_interpolation_s16(
     }
 }
 
+static void run_jobs(struct priv *s, const struct job *tmpl, int total);
+
+#define SEARCH_STEP_SIZE 3
+
+static void downmix_float(float *dst, const float *src, int frames, int nch)
+{
+    const float f = 1.0f / nch;
+    for (int i = 0; i < frames; i++) {
+        float sum = 0;
+        for (int c = 0; c < nch; c++)
+            sum += src[i * nch + c];
+        dst[i] = sum * f;
+    }
+}
+
+static void downmix_s16(int16_t *dst, const int16_t *src, int frames, int nch)
+{
+    for (int i = 0; i < frames; i++) {
+        int32_t sum = 0;
+        for (int c = 0; c < nch; c++)
+            sum += src[i * nch + c];
+        dst[i] = sum / nch;
+    }
+}
+
+// Downmix the search region and the overlap, and compute the distances of all
+// coarse search offsets in parallel.
+static void prepare_mono_search(struct priv *s, bool use_int)
+{
+    int nch = s->num_channels;
+    int frames_overlap = s->samples_overlap / nch;
+    int frames_queue = s->frames_search + frames_overlap;
+
+    if (use_int) {
+        downmix_s16(s->buf_mono_overlap, s->buf_overlap, frames_overlap, nch);
+        downmix_s16(s->buf_mono_queue, (int16_t *)s->buf_queue, frames_queue, nch);
+    } else {
+        downmix_float(s->buf_mono_overlap, s->buf_overlap, frames_overlap, nch);
+        downmix_float(s->buf_mono_queue, (float *)s->buf_queue, frames_queue, nch);
+    }
+
+    int num = (s->frames_search + SEARCH_STEP_SIZE - 1) / SEARCH_STEP_SIZE;
+    run_jobs(s, &(struct job){.type = JOB_SEARCH}, num);
+}
+
+static void run_search_job(struct priv *s, struct job *j)
+{
+    int num_samples = s->samples_overlap / s->num_channels - 1;
+    for (int n = j->start; n < j->end; n++) {
+        int offset = n * SEARCH_STEP_SIZE;
+        if (s->use_int) {
+            int16_t *source = (int16_t *)s->buf_mono_queue + 1;
+            int16_t *target = (int16_t *)s->buf_mono_overlap + 1;
+            ((int32_t *)s->distances)[n] =
+                s->dsp.distance_s16(target, source + offset, num_samples);
+        } else {
+            float *source = (float *)s->buf_mono_queue + 1;
+            float *target = (float *)s->buf_mono_overlap + 1;
+            ((float *)s->distances)[n] =
+                s->dsp.distance_float(target, source + offset, num_samples);
+        }
+    }
+}
+
 static int best_overlap_offset_float(struct priv *s)
 {
     int num_channels = s->num_channels, frames_search = s->frames_search;
     float *source = (float *)s->buf_queue + num_channels;
     float *target = (float *)s->buf_overlap + num_channels;
     int num_samples = s->samples_overlap - num_channels;
-    int step_size = 3;
+    int step_size = SEARCH_STEP_SIZE;
     float history[3] = {};
 
+    // Only the coarse search uses the downmix; the fine search below compares
+    // all channels, like the single-threaded mode.
+    if (s->mono_search)
+        prepare_mono_search(s, false);
+
     float best_distance = FLT_MAX;
     int best_offset_approx = 0;
     for (int offset = 0; offset < frames_search; offset += step_size) {
-        float distance = 0;
-        for (int i = 0; i < num_samples; i++)
-            distance += fabsf(target[i] - source[offset * num_channels + i]);
+        float distance = s->mono_search
+            ? ((float *)s->distances)[offset / step_size]
+            : s->dsp.distance_float(target, source + offset * num_channels,
+                                    num_samples);
 
         int offset_approx = offset;
         history[0] = history[1];
@@ -213,9 +326,9 @@ static int best_overlap_offset_float(struct priv *s)
     int min_offset = MPMAX(0, best_offset_approx - step_size + 1);
     int max_offset = MPMIN(frames_search, best_offset_approx + step_size);
     for (int offset = min_offset; offset < max_offset; offset++) {
-        float distance = 0;
-        for (int i = 0; i < num_samples; i++)
-            distance += fabsf(target[i] - source[offset * num_channels + i]);
+        float distance = s->dsp.distance_float(target,
+                                               source + offset * num_channels,
+                                               num_samples);
         if (distance < best_distance) {
             best_distance = distance;
             best_offset  = offset;
@@ -231,15 +344,21 @@ static int best_overlap_offset_s16(struct priv *s)
     int16_t *source = (int16_t *)s->buf_queue + num_channels;
     int16_t *target = (int16_t *)s->buf_overlap + num_channels;
     int num_samples = s->samples_overlap - num_channels;
-    int step_size = 3;
+    int step_size = SEARCH_STEP_SIZE;
     int32_t history[3] = {};
 
+    // Only the coarse search uses the downmix; the fine search below compares
+    // all channels, like the single-threaded mode.
+    if (s->mono_search)
+        prepare_mono_search(s, true);
+
     int32_t best_distance = INT32_MAX;
     int best_offset_approx = 0;
     for (int offset = 0; offset < frames_search; offset += step_size) {
-        int32_t distance = 0;
-        for (int i = 0; i < num_samples; i++)
-            distance += abs((int32_t)target[i] - source[offset * num_channels + i]);
+        int32_t distance = s->mono_search
+            ? ((int32_t *)s->distances)[offset / step_size]
+            : s->dsp.distance_s16(target, source + offset * num_channels,
+                                  num_samples);
 
         int offset_approx = offset;
         history[0] = history[1];
@@ -262,9 +381,9 @@ static int best_overlap_offset_s16(struct priv *s)
     int min_offset = MPMAX(0, best_offset_approx - step_size + 1);
     int max_offset = MPMIN(frames_search, best_offset_approx + step_size);
     for (int offset = min_offset; offset < max_offset; offset++) {
-        int32_t distance = 0;
-        for (int i = 0; i < num_samples; i++)
-            distance += abs((int32_t)target[i] - source[offset * num_channels + i]);
+        int32_t distance = s->dsp.distance_s16(target,
+                                               source + offset * num_channels,
+                                               num_samples);
         if (distance < best_distance) {
             best_distance = distance;
             best_offset  = offset;
@@ -277,29 +396,99 @@ static int best_overlap_offset_s16(struct priv *s)
 static void output_overlap_float(struct priv *s, void *buf_out,
                                  int bytes_off)
 {
-    float *pout = buf_out;
-    float *pb   = s->table_blend;
-    float *po   = s->buf_overlap;
-    float *pin  = (float *)(s->buf_queue + bytes_off);
-    for (int i = 0; i < s->samples_overlap; i++) {
-        // the math is equal to *po * (1 - *pb) + *pin * *pb
-        float o = *po++;
-        *pout++ = o - *pb++ * (o - *pin++);
+    float *pin = (float *)(s->buf_queue + bytes_off);
+    if (s->num_threads > 1 && s->samples_overlap >= MIN_PARALLEL_MIX_SAMPLES) {
+        run_jobs(s, &(struct job){.type = JOB_MIX, .out = buf_out, .in = pin},
+                 s->samples_overlap / s->num_channels);
+        return;
     }
+    // the math is equal to *po * (1 - *pb) + *pin * *pb
+    s->dsp.mix_float(buf_out, s->buf_overlap, pin, s->table_blend,
+                     s->samples_overlap);
 }
 
 static void output_overlap_s16(struct priv *s, void *buf_out,
                                int bytes_off)
 {
-    int16_t *pout = buf_out;
-    int32_t *pb   = s->table_blend;
-    int16_t *po   = s->buf_overlap;
-    int16_t *pin  = (int16_t *)(s->buf_queue + bytes_off);
-    for (int i = 0; i < s->samples_overlap; i++) {
-        // the math is equal to *po * (1 - *pb) + *pin * *pb
-        int32_t o = *po++;
-        *pout++ = o - ((*pb++ *(o - *pin++)) >> 16);
+    int16_t *pin = (int16_t *)(s->buf_queue + bytes_off);
+    if (s->num_threads > 1 && s->samples_overlap >= MIN_PARALLEL_MIX_SAMPLES) {
+        run_jobs(s, &(struct job){.type = JOB_MIX, .out = buf_out, .in = pin},
+                 s->samples_overlap / s->num_channels);
+        return;
     }
+    // the math is equal to *po * (1 - *pb) + *pin * *pb
+    s->dsp.mix_s16(buf_out, s->buf_overlap, pin, s->table_blend,
+                   s->samples_overlap);
+}
+
+// Crossfade frames [start, end). Frames are interleaved, so this covers all
+// channels of each frame.
+static void run_mix_job(struct priv *s, struct job *j)
+{
+    int off = j->start * s->num_channels;
+    int num = (j->end - j->start) * s->num_channels;
+    if (s->use_int) {
+        s->dsp.mix_s16((int16_t *)j->out + off, (int16_t *)s->buf_overlap + off,
+                       (int16_t *)j->in + off, (int32_t *)s->table_blend + off,
+                       num);
+    } else {
+        s->dsp.mix_float((float *)j->out + off, (float *)s->buf_overlap + off,
+                         (float *)j->in + off, (float *)s->table_blend + off,
+                         num);
+    }
+}
+
+static void run_job(struct job *j)
+{
+    switch (j->type) {
+    case JOB_SEARCH: run_search_job(j->s, j); break;
+    case JOB_MIX:    run_mix_job(j->s, j); break;
+    }
+}
+
+static void worker_fn(void *ctx)
+{
+    struct job *j = ctx;
+    struct priv *s = j->s;
+
+    run_job(j);
+
+    mp_mutex_lock(&s->lock);
+    s->jobs_pending--;
+    if (!s->jobs_pending)
+        pthread_cond_signal(&s->wakeup);
+    mp_mutex_unlock(&s->lock);
+}
+
+// Split [0, total) into up to num_threads jobs of the given type, and run
+// them. Returns once all jobs are done.
+static void run_jobs(struct priv *s, const struct job *tmpl, int total)
+{
+    int num_jobs = MPCLAMP(s->pool ? s->num_threads : 1, 1, MPMAX(total, 1));
+
+    for (int n = 0; n < num_jobs; n++) {
+        struct job *j = &s->jobs[n];
+        *j = *tmpl;
+        j->s = s;
+        j->start = (int64_t)total * n / num_jobs;
+        j->end = (int64_t)total * (n + 1) / num_jobs;
+    }
+
+    mp_mutex_lock(&s->lock);
+    s->jobs_pending = num_jobs - 1;
+    mp_mutex_unlock(&s->lock);
+
+    for (int n = 1; n < num_jobs; n++) {
+        if (!mp_thread_pool_queue(s->pool, worker_fn, &s->jobs[n]))
+            worker_fn(&s->jobs[n]);
+    }
+
+    run_job(&s->jobs[0]);
+
+    mp_mutex_lock(&s->lock);
+    while (s->jobs_pending)
+        pthread_cond_wait(&s->wakeup, &s->lock);
+    mp_mutex_unlock(&s->lock);
 }
 
 static void af_scaletempo_process(struct mp_filter *f)
@@ -377,6 +566,8 @@ static void af_scaletempo_process(struct mp_filter *f)
         float tf;
         int bytes_off = 0;
 
+        stats_time_start(s->stats, "stride");
+
         // output stride
         if (s->output_overlap) {
             if (s->best_overlap_offset)
@@ -396,6 +587,8 @@ static void af_scaletempo_process(struct mp_filter *f)
         ti = (int)tf;
         s->frames_stride_error = tf - ti;
         s->bytes_to_slide = ti * s->bytes_per_frame;
+
+        stats_time_end(s->stats, "stride");
     }
     // Drain remaining buffered data.
     if (drain && s->bytes_queued) {
@@ -527,6 +720,20 @@ static bool reinit(struct mp_filter *f)
 
     s->bytes_per_frame = bps * nch;
     s->num_channels    = nch;
+    s->use_int         = use_int;
+
+    s->mono_search = s->best_overlap_offset && s->num_threads;
+    if (s->mono_search) {
+        int coarse = (s->frames_search + SEARCH_STEP_SIZE - 1) / SEARCH_STEP_SIZE;
+        s->buf_mono_queue = realloc(s->buf_mono_queue,
+                                    (s->frames_search + frames_overlap) * bps);
+        s->buf_mono_overlap = realloc(s->buf_mono_overlap, frames_overlap * bps);
+        s->distances = realloc(s->distances, coarse * 4);
+        if (!s->buf_mono_queue || !s->buf_mono_overlap || !s->distances) {
+            MP_FATAL(f, "Out of memory\n");
+            return false;
+        }
+    }
 
     s->bytes_queue = (s->frames_search + s->frames_stride + frames_overlap)
                         * bps * nch;
@@ -541,14 +748,14 @@ static bool reinit(struct mp_filter *f)
 
     MP_DBG(f, ""
            "%.2f stride_in, %i stride_out, %i standing, "
-           "%i overlap, %i search, %i queue, %s mode\n",
+           "%i overlap, %i search, %i queue, %s mode, %d threads\n",
            s->frames_stride_scaled,
            (int)(s->bytes_stride / nch / bps),
            (int)(s->bytes_standing / nch / bps),
            (int)(s->bytes_overlap / nch / bps),
            s->frames_search,
            (int)(s->bytes_queue / nch / bps),
-           (use_int ? "s16" : "float"));
+           (use_int ? "s16" : "float"), s->num_threads);
 
     mp_aframe_config_copy(s->cur_format, s->in);
 
@@ -593,6 +800,13 @@ static void af_scaletempo_destroy(struct mp_filter *f)
     free(s->buf_queue);
     free(s->buf_overlap);
     free(s->table_blend);
+    free(s->buf_mono_queue);
+    free(s->buf_mono_overlap);
+    free(s->distances);
+    TA_FREEP(&s->pool);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->wakeup);
+    TA_FREEP(&s->stats);
     TA_FREEP(&s->in);
     mp_filter_free_children(f);
 }
@@ -623,6 +837,25 @@ static struct mp_filter *af_scaletempo_create(struct mp_filter *parent,
     s->speed = 1.0;
     s->cur_format = talloc_steal(s, mp_aframe_create());
     s->out_pool = mp_aframe_pool_create(s);
+    scaletempo_dsp_init(&s->dsp);
+    MP_VERBOSE(f, "Using %s DSP functions.\n", s->dsp.name);
+    s->stats = stats_ctx_create(s, f->global, "af_scaletempo");
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->wakeup, NULL);
+
+    s->num_threads = s->opts->threads;
+    if (s->num_threads < 0)
+        s->num_threads = MPCLAMP(av_cpu_count(), 1, 8);
+    if (s->num_threads > 1) {
+        s->pool = mp_thread_pool_create(s, s->num_threads - 1,
+                                        s->num_threads - 1, s->num_threads - 1);
+        if (!s->pool) {
+            MP_WARN(f, "Could not create worker threads.\n");
+            s->num_threads = 1;
+        }
+    }
+    if (s->num_threads)
+        MP_VERBOSE(f, "Using %d threads.\n", s->num_threads);
 
     struct mp_autoconvert *conv = mp_autoconvert_create(f);
     if (!conv)
@@ -661,6 +894,8 @@ const struct mp_user_filter_entry af_scaletempo = {
                 {"tempo", SCALE_TEMPO},
                 {"none", 0},
                 {"both", SCALE_TEMPO | SCALE_PITCH})},
+            {"threads", OPT_CHOICE(threads, {"no", 0}, {"auto", -1}),
+                M_RANGE(1, MAX_THREADS)},
             {0}
         },
     },
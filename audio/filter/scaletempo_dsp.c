@@ -0,0 +1,296 @@
+/*
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <libavutil/cpu.h>
+
+#include "scaletempo_dsp.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DSP_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define DSP_NEON 1
+#include <arm_neon.h>
+#endif
+
+static float distance_float_c(const float *a, const float *b, int n)
+{
+    float distance = 0;
+    for (int i = 0; i < n; i++)
+        distance += fabsf(a[i] - b[i]);
+    return distance;
+}
+
+static int32_t distance_s16_c(const int16_t *a, const int16_t *b, int n)
+{
+    int32_t distance = 0;
+    for (int i = 0; i < n; i++)
+        distance += abs((int32_t)a[i] - b[i]);
+    return distance;
+}
+
+static void mix_float_c(float *out, const float *o, const float *in,
+                        const float *blend, int n)
+{
+    for (int i = 0; i < n; i++)
+        out[i] = o[i] - blend[i] * (o[i] - in[i]);
+}
+
+static void mix_s16_c(int16_t *out, const int16_t *o, const int16_t *in,
+                      const int32_t *blend, int n)
+{
+    for (int i = 0; i < n; i++) {
+        int32_t v = o[i];
+        out[i] = v - ((blend[i] * (v - in[i])) >> 16);
+    }
+}
+
+#ifdef DSP_X86
+
+#define TARGET(t) __attribute__((target(t)))
+
+TARGET("sse2")
+static float distance_float_sse2(const float *a, const float *b, int n)
+{
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+        acc0 = _mm_add_ps(acc0, _mm_and_ps(d0, mask));
+        acc1 = _mm_add_ps(acc1, _mm_and_ps(d1, mask));
+    }
+    float tmp[4];
+    _mm_storeu_ps(tmp, _mm_add_ps(acc0, acc1));
+    return tmp[0] + tmp[1] + tmp[2] + tmp[3] +
+           distance_float_c(a + i, b + i, n - i);
+}
+
+TARGET("sse2")
+static int32_t distance_s16_sse2(const int16_t *a, const int16_t *b, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        // |a - b| as unsigned 16 bit (may not fit into signed)
+        __m128i d = _mm_sub_epi16(_mm_max_epi16(va, vb), _mm_min_epi16(va, vb));
+        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(d, zero));
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(d, zero));
+    }
+    uint32_t tmp[4];
+    _mm_storeu_si128((__m128i *)tmp, acc);
+    return (int32_t)(tmp[0] + tmp[1] + tmp[2] + tmp[3] +
+                     (uint32_t)distance_s16_c(a + i, b + i, n - i));
+}
+
+TARGET("sse2")
+static void mix_float_sse2(float *out, const float *o, const float *in,
+                           const float *blend, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 vo = _mm_loadu_ps(o + i);
+        __m128 d = _mm_sub_ps(vo, _mm_loadu_ps(in + i));
+        _mm_storeu_ps(out + i, _mm_sub_ps(vo, _mm_mul_ps(_mm_loadu_ps(blend + i), d)));
+    }
+    mix_float_c(out + i, o + i, in + i, blend + i, n - i);
+}
+
+TARGET("avx2")
+static float distance_float_avx2(const float *a, const float *b, int n)
+{
+    const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8),
+                                  _mm256_loadu_ps(b + i + 8));
+        acc0 = _mm256_add_ps(acc0, _mm256_and_ps(d0, mask));
+        acc1 = _mm256_add_ps(acc1, _mm256_and_ps(d1, mask));
+    }
+    float tmp[8];
+    _mm256_storeu_ps(tmp, _mm256_add_ps(acc0, acc1));
+    float distance = 0;
+    for (int n2 = 0; n2 < 8; n2++)
+        distance += tmp[n2];
+    return distance + distance_float_c(a + i, b + i, n - i);
+}
+
+TARGET("avx2")
+static int32_t distance_s16_avx2(const int16_t *a, const int16_t *b, int n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i d = _mm256_sub_epi16(_mm256_max_epi16(va, vb),
+                                     _mm256_min_epi16(va, vb));
+        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(d, zero));
+        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(d, zero));
+    }
+    uint32_t tmp[8];
+    _mm256_storeu_si256((__m256i *)tmp, acc);
+    uint32_t distance = 0;
+    for (int n2 = 0; n2 < 8; n2++)
+        distance += tmp[n2];
+    return (int32_t)(distance + (uint32_t)distance_s16_c(a + i, b + i, n - i));
+}
+
+TARGET("avx2")
+static void mix_float_avx2(float *out, const float *o, const float *in,
+                           const float *blend, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 vo = _mm256_loadu_ps(o + i);
+        __m256 d = _mm256_sub_ps(vo, _mm256_loadu_ps(in + i));
+        __m256 r = _mm256_sub_ps(vo, _mm256_mul_ps(_mm256_loadu_ps(blend + i), d));
+        _mm256_storeu_ps(out + i, r);
+    }
+    mix_float_c(out + i, o + i, in + i, blend + i, n - i);
+}
+
+TARGET("avx2")
+static void mix_s16_avx2(int16_t *out, const int16_t *o, const int16_t *in,
+                         const int32_t *blend, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i vo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(o + i)));
+        __m256i vi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(blend + i));
+        __m256i p = _mm256_mullo_epi32(vb, _mm256_sub_epi32(vo, vi));
+        __m256i r = _mm256_sub_epi32(vo, _mm256_srai_epi32(p, 16));
+        // Truncate to 16 bit like the C version (packs would saturate).
+        r = _mm256_srai_epi32(_mm256_slli_epi32(r, 16), 16);
+        __m128i r16 = _mm_packs_epi32(_mm256_castsi256_si128(r),
+                                      _mm256_extracti128_si256(r, 1));
+        _mm_storeu_si128((__m128i *)(out + i), r16);
+    }
+    mix_s16_c(out + i, o + i, in + i, blend + i, n - i);
+}
+
+#endif /* DSP_X86 */
+
+#ifdef DSP_NEON
+
+static float distance_float_neon(const float *a, const float *b, int n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vaddq_f32(acc0, vabdq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+        acc1 = vaddq_f32(acc1, vabdq_f32(vld1q_f32(a + i + 4),
+                                         vld1q_f32(b + i + 4)));
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1)) +
+           distance_float_c(a + i, b + i, n - i);
+}
+
+static int32_t distance_s16_neon(const int16_t *a, const int16_t *b, int n)
+{
+    uint32x4_t acc = vdupq_n_u32(0);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t va = vld1q_s16(a + i);
+        int16x8_t vb = vld1q_s16(b + i);
+        acc = vreinterpretq_u32_s32(
+            vabal_s16(vreinterpretq_s32_u32(acc), vget_low_s16(va),
+                      vget_low_s16(vb)));
+        acc = vreinterpretq_u32_s32(
+            vabal_s16(vreinterpretq_s32_u32(acc), vget_high_s16(va),
+                      vget_high_s16(vb)));
+    }
+    return (int32_t)(vaddvq_u32(acc) +
+                     (uint32_t)distance_s16_c(a + i, b + i, n - i));
+}
+
+static void mix_float_neon(float *out, const float *o, const float *in,
+                           const float *blend, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t vo = vld1q_f32(o + i);
+        float32x4_t d = vsubq_f32(vo, vld1q_f32(in + i));
+        vst1q_f32(out + i, vsubq_f32(vo, vmulq_f32(vld1q_f32(blend + i), d)));
+    }
+    mix_float_c(out + i, o + i, in + i, blend + i, n - i);
+}
+
+static void mix_s16_neon(int16_t *out, const int16_t *o, const int16_t *in,
+                         const int32_t *blend, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int32x4_t vo = vmovl_s16(vld1_s16(o + i));
+        int32x4_t d = vsubq_s32(vo, vmovl_s16(vld1_s16(in + i)));
+        int32x4_t p = vmulq_s32(vld1q_s32(blend + i), d);
+        vst1_s16(out + i, vmovn_s32(vsubq_s32(vo, vshrq_n_s32(p, 16))));
+    }
+    mix_s16_c(out + i, o + i, in + i, blend + i, n - i);
+}
+
+#endif /* DSP_NEON */
+
+void scaletempo_dsp_init(struct scaletempo_dsp *dsp)
+{
+    *dsp = (struct scaletempo_dsp){
+        .name = "c",
+        .distance_float = distance_float_c,
+        .distance_s16 = distance_s16_c,
+        .mix_float = mix_float_c,
+        .mix_s16 = mix_s16_c,
+    };
+
+    int flags = av_get_cpu_flags();
+    (void)flags;
+
+#ifdef DSP_X86
+    if (flags & AV_CPU_FLAG_SSE2) {
+        dsp->name = "sse2";
+        dsp->distance_float = distance_float_sse2;
+        dsp->distance_s16 = distance_s16_sse2;
+        dsp->mix_float = mix_float_sse2;
+    }
+    if (flags & AV_CPU_FLAG_AVX2) {
+        dsp->name = "avx2";
+        dsp->distance_float = distance_float_avx2;
+        dsp->distance_s16 = distance_s16_avx2;
+        dsp->mix_float = mix_float_avx2;
+        dsp->mix_s16 = mix_s16_avx2;
+    }
+#endif
+#ifdef DSP_NEON
+    if (flags & AV_CPU_FLAG_NEON) {
+        dsp->name = "neon";
+        dsp->distance_float = distance_float_neon;
+        dsp->distance_s16 = distance_s16_neon;
+        dsp->mix_float = mix_float_neon;
+        dsp->mix_s16 = mix_s16_neon;
+    }
+#endif
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// Inner loops of af_scaletempo. The C versions are the reference; the others
+// must produce the same results (except for float summation order).
+struct scaletempo_dsp {
+    const char *name;
+
+    // Return the sum of |a[i] - b[i]| for i in [0, n).
+    float (*distance_float)(const float *a, const float *b, int n);
+    int32_t (*distance_s16)(const int16_t *a, const int16_t *b, int n);
+
+    // Crossfade: out[i] = o[i] - blend[i] * (o[i] - in[i])
+    // (for s16, blend is a 16.16 fixed point value)
+    void (*mix_float)(float *out, const float *o, const float *in,
+                      const float *blend, int n);
+    void (*mix_s16)(int16_t *out, const int16_t *o, const int16_t *in,
+                    const int32_t *blend, int n);
+};
+
+// Select the fastest implementations supported by the CPU.
+void scaletempo_dsp_init(struct scaletempo_dsp *dsp);
@@ -10,6 +10,7 @@ struct dmpv_global {
     struct mp_client_api *client_api;
     char *configdir;
     struct stats_base *stats;
+    struct mp_dir_cache *dir_cache;
 };
 
 #endif
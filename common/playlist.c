@@ -53,13 +53,50 @@ void playlist_entry_add_params(struct playlist_entry *e,
         playlist_entry_add_param(e, params[n].name, params[n].value);
 }
 
-static void playlist_update_indexes(struct playlist *pl, int start, int end)
+// Assign pl_order to the count entries at start, which have been inserted
+// there. Neighbouring entries are renumbered as well if there is not enough
+// space between their keys. Entries that are renumbered get pl_index updated.
+static void playlist_update_order(struct playlist *pl, int start, int count)
 {
-    start = MPMAX(start, 0);
-    end = end < 0 ? pl->num_entries : MPMIN(end, pl->num_entries);
+    int lo = start, hi = start + count;
+    for (int grow = 16;; grow *= 2) {
+        uint64_t a = lo > 0 ? pl->entries[lo - 1]->pl_order : 0;
+        uint64_t b = hi < pl->num_entries ? pl->entries[hi]->pl_order : UINT64_MAX;
+        uint64_t step = (b - a) / (hi - lo + 1);
+        // Leave some space for later insertions. This always succeeds if the
+        // full list is renumbered.
+        if (step > hi - lo || (lo == 0 && hi == pl->num_entries)) {
+            for (int n = lo; n < hi; n++) {
+                struct playlist_entry *e = pl->entries[n];
+                e->pl_order = a + step * (n - lo + 1);
+                e->pl_index = n;
+            }
+            return;
+        }
+        lo = MPMAX(lo - grow, 0);
+        hi = MPMIN(hi + grow, pl->num_entries);
+    }
+}
 
-    for (int n = start; n < end; n++)
-        pl->entries[n]->pl_index = n;
+// Return the index of e, which must be on pl.
+static int playlist_get_index(struct playlist *pl, struct playlist_entry *e)
+{
+    int index = e->pl_index;
+    if (index >= 0 && index < pl->num_entries && pl->entries[index] == e)
+        return index;
+
+    int a = 0, b = pl->num_entries;
+    while (a < b) {
+        int mid = a + (b - a) / 2;
+        if (pl->entries[mid]->pl_order < e->pl_order) {
+            a = mid + 1;
+        } else {
+            b = mid;
+        }
+    }
+    mp_assert(a < pl->num_entries && pl->entries[a] == e);
+    e->pl_index = a;
+    return a;
 }
 
 // Inserts the entry so that it takes "at"'s place, shifting "at" and all
@@ -70,14 +107,13 @@ void playlist_insert_at(struct playlist *pl, struct playlist_entry *add,
     mp_assert(add->filename);
     mp_assert(!at || at->pl == pl);
 
-    int index = at ? at->pl_index : pl->num_entries;
+    int index = at ? playlist_get_index(pl, at) : pl->num_entries;
     MP_TARRAY_INSERT_AT(pl, pl->entries, pl->num_entries, index, add);
 
     add->pl = pl;
-    add->pl_index = index;
     add->id = ++pl->id_alloc;
 
-    playlist_update_indexes(pl, index, pl->num_entries);
+    playlist_update_order(pl, index, 1);
 
     talloc_steal(pl, add);
 }
@@ -100,8 +136,8 @@ void playlist_remove(struct playlist *pl, struct playlist_entry *entry)
         pl->current_was_replaced = true;
     }
 
-    MP_TARRAY_REMOVE_AT(pl->entries, pl->num_entries, entry->pl_index);
-    playlist_update_indexes(pl, entry->pl_index, -1);
+    MP_TARRAY_REMOVE_AT(pl->entries, pl->num_entries,
+                        playlist_get_index(pl, entry));
 
     entry->pl = NULL;
     entry->pl_index = -1;
@@ -141,16 +177,18 @@ void playlist_move(struct playlist *pl, struct playlist_entry *entry,
     mp_assert(entry && entry->pl == pl);
     mp_assert(!at || at->pl == pl);
 
-    int index = at ? at->pl_index : pl->num_entries;
+    int index = at ? playlist_get_index(pl, at) : pl->num_entries;
+    int old_index = playlist_get_index(pl, entry);
     MP_TARRAY_INSERT_AT(pl, pl->entries, pl->num_entries, index, entry);
 
-    int old_index = entry->pl_index;
-    if (old_index >= index)
+    if (old_index >= index) {
         old_index += 1;
+    } else {
+        index -= 1;
+    }
     MP_TARRAY_REMOVE_AT(pl->entries, pl->num_entries, old_index);
 
-    playlist_update_indexes(pl, MPMIN(index - 1, old_index - 1),
-                                MPMAX(index + 1, old_index + 1));
+    playlist_update_order(pl, index, 1);
 }
 
 void playlist_append_file(struct playlist *pl, const char *filename)
@@ -175,7 +213,7 @@ void playlist_shuffle(struct playlist *pl)
         size_t j = mp_rand_in_range32(&s, n, pl->num_entries);
         MPSWAP(struct playlist_entry *, pl->entries[n], pl->entries[j]);
     }
-    playlist_update_indexes(pl, 0, -1);
+    playlist_update_order(pl, 0, pl->num_entries);
 }
 
 #define CMP_INT(a, b) ((a) == (b) ? 0 : ((a) > (b) ? 1 : -1))
@@ -187,14 +225,14 @@ static int cmp_unshuffle(const void *a, const void *b)
 
     if (ea->original_index >= 0 && ea->original_index != eb->original_index)
         return CMP_INT(ea->original_index, eb->original_index);
-    return CMP_INT(ea->pl_index, eb->pl_index);
+    return CMP_INT(ea->pl_order, eb->pl_order);
 }
 
 void playlist_unshuffle(struct playlist *pl)
 {
     if (pl->num_entries)
         qsort(pl->entries, pl->num_entries, sizeof(pl->entries[0]), cmp_unshuffle);
-    playlist_update_indexes(pl, 0, -1);
+    playlist_update_order(pl, 0, pl->num_entries);
 }
 
 // (Explicitly ignores current_was_replaced.)
@@ -233,7 +271,7 @@ struct playlist_entry *playlist_entry_get_rel(struct playlist_entry *e,
     mp_assert(direction == -1 || direction == +1);
     if (!e->pl)
         return NULL;
-    return playlist_entry_from_index(e->pl, e->pl_index + direction);
+    return playlist_entry_from_index(e->pl, playlist_get_index(e->pl, e) + direction);
 }
 
 struct playlist_entry *playlist_get_first_in_next_playlist(struct playlist *pl,
@@ -331,13 +369,12 @@ int64_t playlist_transfer_entries_to(struct playlist *pl, int dst_index,
     for (int n = 0; n < count; n++) {
         struct playlist_entry *e = source_pl->entries[n];
         e->pl = pl;
-        e->pl_index = dst_index + n;
         e->id = ++pl->id_alloc;
-        pl->entries[e->pl_index] = e;
+        pl->entries[dst_index + n] = e;
         talloc_steal(pl, e);
     }
 
-    playlist_update_indexes(pl, dst_index + count, -1);
+    playlist_update_order(pl, dst_index, count);
     source_pl->num_entries = 0;
 
     pl->playlist_completed = source_pl->playlist_completed;
@@ -356,7 +393,7 @@ int64_t playlist_transfer_entries(struct playlist *pl, struct playlist *source_p
 
     int add_at = pl->num_entries;
     if (pl->current) {
-        add_at = pl->current->pl_index + 1;
+        add_at = playlist_get_index(pl, pl->current) + 1;
         if (pl->current_was_replaced)
             add_at += 1;
     }
@@ -377,7 +414,7 @@ int playlist_entry_to_index(struct playlist *pl, struct playlist_entry *e)
 {
     if (!e || e->pl != pl)
         return -1;
-    return e->pl_index;
+    return playlist_get_index(pl, e);
 }
 
 int playlist_entry_count(struct playlist *pl)
@@ -19,6 +19,7 @@
 #define MPLAYER_PLAYLIST_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "misc/bstr.h"
 
 struct playlist_param {
@@ -26,9 +27,15 @@ struct playlist_param {
 };
 
 struct playlist_entry {
-    // Invariant: (pl && pl->entries[pl_index] == this) || (!pl && pl_index < 0)
+    // Invariant: (pl && pl->entries[playlist_entry_to_index(pl, this)] == this)
+    //            || (!pl && pl_index < 0)
     struct playlist *pl;
+    // Last known index; can be outdated after other entries were inserted or
+    // removed. Use playlist_entry_to_index() to read it.
     int pl_index;
+    // Increases strictly with the position in pl->entries. Used to find the
+    // index if pl_index is outdated.
+    uint64_t pl_order;
 
     uint64_t id;
 
@@ -15,26 +15,37 @@
  * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <libavutil/sha.h>
+
 #include "cache.h"
 #include "common/msg.h"
 #include "common/av_common.h"
 #include "demux.h"
+#include "misc/bstr.h"
 #include "misc/mp_assert.h"
 #include "options/path.h"
 #include "options/m_config.h"
 #include "options/m_option.h"
 #include "osdep/io.h"
+#include "stream/stream.h"
 
 struct demux_cache_opts {
     char *cache_dir;
     int unlink_files;
+    bool use_mmap;
+    bool persistent;
+    int64_t persistent_max_bytes;
 };
 
 #define OPT_BASE_STRUCT struct demux_cache_opts
@@ -45,11 +56,16 @@ const struct m_sub_options demux_cache_conf = {
         {"cache-unlink-files", OPT_CHOICE(unlink_files,
             {"immediate", 2}, {"whendone", 1}, {"no", 0}),
         },
+        {"cache-mmap", OPT_BOOL(use_mmap)},
+        {"cache-persistent", OPT_BOOL(persistent)},
+        {"cache-persistent-max-bytes", OPT_BYTE_SIZE(persistent_max_bytes),
+            M_RANGE(0, M_MAX_MEM_BYTES)},
         {0}
     },
     .size = sizeof(struct demux_cache_opts),
     .defaults = &(const struct demux_cache_opts){
         .unlink_files = 2,
+        .persistent_max_bytes = 10LL * 1024 * 1024 * 1024,
     },
 };
 
@@ -62,8 +78,45 @@ struct demux_cache {
     int fd;
     int64_t file_pos;
     uint64_t file_size;
+
+    // For use_mmap mode. Packets are appended to wbuf, and written to the file
+    // in one go when it is full. The part of the file before wbuf_pos is
+    // served from the read-only mapping (if mapping it succeeded).
+    bool use_mmap;
+    uint8_t *wbuf;
+    size_t wbuf_len;
+    size_t wbuf_size;
+    uint64_t wbuf_pos;      // file offset of wbuf[0] (== flushed file size)
+    uint8_t *map;
+    size_t map_size;
+    // Set if flushing wbuf failed. All reads and writes fail after this.
+    bool failed;
+
+    // For persistent mode. The cache file is named after the key, and is only
+    // ever appended to. The index file describes a prefix of it.
+    bool persistent;
+    char *dir;
+    char *key;
+    char *index_filename;
+    struct bstr index;          // payload loaded from the previous session
+    uint64_t index_data_size;   // size of the file the index refers to
+
+    struct demux_cache_stats stats;
 };
 
+static const char index_header[] = "dmpv demuxer cache index v1\n";
+
+// Persistent cache files are named "dmpv-cache-" + 64 hex digits + ".dat" or
+// ".idx". Temporary cache files are named differently.
+#define PERSISTENT_PREFIX "dmpv-cache-"
+#define PERSISTENT_HASH_LEN 64
+
+// Initial size of the write buffer (grows if a packet is larger).
+#define WBUF_SIZE (1 * 1024 * 1024)
+// Minimum size of the file mapping. The mapping can extend past the end of the
+// file; it is only accessed up to wbuf_pos.
+#define MAP_MIN_SIZE (64 * 1024 * 1024)
+
 struct pkt_header {
     uint32_t data_len;
     uint32_t av_flags;
@@ -79,6 +132,9 @@ static void cache_destroy(void *p)
 {
     struct demux_cache *cache = p;
 
+    if (cache->map)
+        munmap(cache->map, cache->map_size);
+
     if (cache->fd >= 0)
         close(cache->fd);
 
@@ -88,11 +144,196 @@ static void cache_destroy(void *p)
     }
 }
 
+static bool read_index(struct demux_cache *cache, struct bstr data)
+{
+    if (!bstr_eatstart0(&data, index_header))
+        return false;
+
+    uint32_t key_len;
+    if (data.len < sizeof(key_len))
+        return false;
+    memcpy(&key_len, data.start, sizeof(key_len));
+    data = bstr_cut(data, sizeof(key_len));
+
+    if (data.len < key_len || !bstr_equals0(bstr_splice(data, 0, key_len),
+                                            cache->key))
+        return false;
+    data = bstr_cut(data, key_len);
+
+    uint64_t data_size;
+    if (data.len < sizeof(data_size))
+        return false;
+    memcpy(&data_size, data.start, sizeof(data_size));
+    data = bstr_cut(data, sizeof(data_size));
+
+    struct stat st;
+    if (fstat(cache->fd, &st) || st.st_size < data_size)
+        return false;
+
+    cache->index = bstrdup(cache, data);
+    cache->index_data_size = data_size;
+    return true;
+}
+
+struct persistent_file {
+    char *base;             // path without ".dat"/".idx"
+    uint64_t size;          // size of both files
+    struct timespec mtime;  // of the data file (updated on every use)
+};
+
+static int compare_mtime(const void *pa, const void *pb)
+{
+    const struct timespec *a = &((const struct persistent_file *)pa)->mtime;
+    const struct timespec *b = &((const struct persistent_file *)pb)->mtime;
+    if (a->tv_sec != b->tv_sec)
+        return a->tv_sec < b->tv_sec ? -1 : 1;
+    if (a->tv_nsec != b->tv_nsec)
+        return a->tv_nsec < b->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// Delete the least recently used persistent cache files in cache->dir until
+// they use at most max_bytes in total. Files that are in use by another
+// instance are skipped. keep_base names a file that is never deleted, and
+// keep_size is added to the total for it (instead of its current size).
+static void prune_persistent(struct demux_cache *cache, uint64_t max_bytes,
+                             const char *keep_base, uint64_t keep_size)
+{
+    DIR *dp = opendir(cache->dir);
+    if (!dp)
+        return;
+
+    void *tmp = talloc_new(NULL);
+    struct persistent_file *files = NULL;
+    int num_files = 0;
+    uint64_t total = keep_size;
+
+    struct dirent *ep;
+    while ((ep = readdir(dp))) {
+        struct bstr name = bstr0(ep->d_name);
+        if (!bstr_eatstart0(&name, PERSISTENT_PREFIX) ||
+            !bstr_eatend0(&name, ".dat") ||
+            name.len != PERSISTENT_HASH_LEN)
+            continue;
+
+        char *path = mp_path_join(tmp, cache->dir, ep->d_name);
+        struct persistent_file f = {
+            .base = talloc_strndup(tmp, path, strlen(path) - 4),
+        };
+        if (keep_base && strcmp(f.base, keep_base) == 0)
+            continue;
+
+        struct stat st;
+        if (stat(path, &st))
+            continue;
+        f.size = st.st_size;
+        f.mtime = st.st_mtim;
+        char *index = talloc_asprintf(tmp, "%s.idx", f.base);
+        if (stat(index, &st) == 0)
+            f.size += st.st_size;
+
+        total += f.size;
+        MP_TARRAY_APPEND(tmp, files, num_files, f);
+    }
+    closedir(dp);
+
+    qsort(files, num_files, sizeof(files[0]), compare_mtime);
+
+    for (int n = 0; n < num_files && total > max_bytes; n++) {
+        char *path = talloc_asprintf(tmp, "%s.dat", files[n].base);
+        int fd = open(path, O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        // Holding the lock while deleting makes sure nobody is using it.
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            MP_VERBOSE(cache, "Deleting old persistent cache file '%s'.\n",
+                       path);
+            unlink(talloc_asprintf(tmp, "%s.idx", files[n].base));
+            if (unlink(path) == 0)
+                total -= files[n].size;
+        }
+        close(fd);
+    }
+
+    talloc_free(tmp);
+}
+
+// Open the cache file belonging to key, and load the index a previous session
+// left behind. Leaves cache->fd unset if a temporary file should be used.
+static void open_persistent(struct demux_cache *cache,
+                            struct dmpv_global *global,
+                            const char *cache_dir, const char *key)
+{
+    void *tmp = talloc_new(NULL);
+
+    struct AVSHA *sha = av_sha_alloc();
+    MP_HANDLE_OOM(sha);
+    av_sha_init(sha, 256);
+    av_sha_update(sha, key, strlen(key));
+
+    uint8_t hash[256 / 8];
+    av_sha_final(sha, hash);
+    av_free(sha);
+
+    char *name = talloc_strdup(tmp, PERSISTENT_PREFIX);
+    for (int n = 0; n < sizeof(hash); n++)
+        name = talloc_asprintf_append(name, "%02X", hash[n]);
+    char *base = mp_path_join(tmp, cache_dir, name);
+
+    char *filename = talloc_asprintf(cache, "%s.dat", base);
+    int fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        MP_ERR(cache, "Failed to open persistent cache file: %s\n",
+               mp_strerror(errno));
+        goto done;
+    }
+
+    // Two instances appending to the same file would corrupt it.
+    if (flock(fd, LOCK_EX | LOCK_NB)) {
+        MP_WARN(cache, "Persistent cache file is in use, using a temporary "
+                "file instead.\n");
+        close(fd);
+        goto done;
+    }
+
+    cache->fd = fd;
+    cache->filename = filename;
+    cache->persistent = true;
+    cache->key = talloc_strdup(cache, key);
+    cache->index_filename = talloc_asprintf(cache, "%s.idx", base);
+
+    if (stat(cache->index_filename, &(struct stat){0}) == 0) {
+        struct bstr data = stream_read_file(cache->index_filename, tmp, global,
+                                            1000000000); // 1 GB
+        if (read_index(cache, data)) {
+            MP_VERBOSE(cache, "Reopening persistent cache file '%s'.\n",
+                       filename);
+        } else {
+            MP_WARN(cache, "Persistent cache index invalid, discarding.\n");
+        }
+    }
+
+    // Drop whatever was written after the index was saved.
+    if (ftruncate(fd, cache->index_data_size))
+        MP_WARN(cache, "Failed to truncate cache file.\n");
+    cache->file_size = cache->wbuf_pos = cache->index_data_size;
+
+    // Mark the file as recently used, so it is deleted last.
+    futimens(fd, NULL);
+    prune_persistent(cache, cache->opts->persistent_max_bytes, base,
+                     cache->file_size);
+
+done:
+    talloc_free(tmp);
+}
+
 // Create a cache. This also initializes the cache file from the options. The
 // log parameter must stay valid until demux_cache is destroyed.
+// If key is not NULL, and persistent caching is enabled, the cache file is
+// reused across sessions using the same key (such as the source URL).
 // Free with talloc_free().
 struct demux_cache *demux_cache_create(struct dmpv_global *global,
-                                       struct mp_log *log)
+                                       struct mp_log *log, const char *key)
 {
     struct demux_cache *cache = talloc_zero(NULL, struct demux_cache);
     talloc_set_destructor(cache, cache_destroy);
@@ -111,21 +352,34 @@ struct demux_cache *demux_cache_create(struct dmpv_global *global,
         goto fail;
 
     mp_mkdirp(cache_dir);
-    cache->filename = mp_path_join(cache, cache_dir, "dmpv-cache-XXXXXX.dat");
-    cache->fd = mp_mkostemps(cache->filename, 4, O_CLOEXEC);
+    cache->dir = talloc_strdup(cache, cache_dir);
+
+    if (key && cache->opts->persistent)
+        open_persistent(cache, global, cache_dir, key);
+
     if (cache->fd < 0) {
-        MP_ERR(cache, "Failed to create cache temporary file.\n");
-        goto fail;
-    }
-    cache->need_unlink = true;
-    if (cache->opts->unlink_files >= 2) {
-        if (unlink(cache->filename)) {
-            MP_ERR(cache, "Failed to unlink cache temporary file after creation.\n");
-        } else {
-            cache->need_unlink = false;
+        cache->filename = mp_path_join(cache, cache_dir, "dmpv-cache-XXXXXX.dat");
+        cache->fd = mp_mkostemps(cache->filename, 4, O_CLOEXEC);
+        if (cache->fd < 0) {
+            MP_ERR(cache, "Failed to create cache temporary file.\n");
+            goto fail;
+        }
+        cache->need_unlink = true;
+        if (cache->opts->unlink_files >= 2) {
+            if (unlink(cache->filename)) {
+                MP_ERR(cache, "Failed to unlink cache temporary file after creation.\n");
+            } else {
+                cache->need_unlink = false;
+            }
         }
     }
 
+    cache->use_mmap = cache->opts->use_mmap;
+    if (cache->use_mmap) {
+        cache->wbuf_size = WBUF_SIZE;
+        cache->wbuf = talloc_size(cache, cache->wbuf_size);
+    }
+
     return cache;
 fail:
     talloc_free(cache);
@@ -137,12 +391,115 @@ uint64_t demux_cache_get_size(struct demux_cache *cache)
     return cache->file_size;
 }
 
+void demux_cache_get_stats(struct demux_cache *cache,
+                           struct demux_cache_stats *stats)
+{
+    *stats = cache->stats;
+}
+
+static bool flush_wbuf(struct demux_cache *cache);
+
+// Make sure everything written so far is in the file.
+bool demux_cache_flush(struct demux_cache *cache)
+{
+    return !cache->use_mmap || flush_wbuf(cache);
+}
+
+bool demux_cache_is_persistent(struct demux_cache *cache)
+{
+    return cache->persistent;
+}
+
+// Return the index payload saved by a previous session with
+// demux_cache_save_index(), or an empty string. Positions in it are valid for
+// demux_cache_read().
+struct bstr demux_cache_get_index(struct demux_cache *cache)
+{
+    return cache->index;
+}
+
+// Forget the previous session's index, e.g. if it turned out to be unusable.
+// If nothing was written yet, this also discards the old file contents.
+void demux_cache_drop_index(struct demux_cache *cache)
+{
+    cache->index = (struct bstr){0};
+
+    if (cache->file_size && cache->file_size == cache->index_data_size &&
+        !cache->wbuf_len)
+    {
+        if (ftruncate(cache->fd, 0)) {
+            MP_WARN(cache, "Failed to truncate cache file.\n");
+            return;
+        }
+        cache->stats.syscalls++;
+        cache->file_size = cache->wbuf_pos = 0;
+        cache->index_data_size = 0;
+    }
+}
+
+// Store an opaque index payload for the next session (persistent mode only).
+// It is tied to the current file contents.
+bool demux_cache_save_index(struct demux_cache *cache, struct bstr data)
+{
+    if (!cache->persistent || !demux_cache_flush(cache))
+        return false;
+
+    uint64_t max_bytes = cache->opts->persistent_max_bytes;
+    if (cache->file_size + data.len > max_bytes) {
+        MP_WARN(cache, "Cache file is larger than the persistent cache limit, "
+                "not keeping it.\n");
+        unlink(cache->index_filename);
+        unlink(cache->filename);
+        cache->persistent = false;
+        return false;
+    }
+
+    // The index must never refer to data that didn't make it to disk.
+    if (fsync(cache->fd)) {
+        MP_ERR(cache, "Failed to sync cache file: %s\n", mp_strerror(errno));
+        return false;
+    }
+    cache->stats.syscalls++;
+
+    char *tmpname = talloc_asprintf(NULL, "%s.tmp", cache->index_filename);
+    bool ok = false;
+
+    FILE *out = fopen(tmpname, "wb");
+    if (out) {
+        uint32_t key_len = strlen(cache->key);
+        uint64_t data_size = cache->file_size;
+        ok = fwrite(index_header, strlen(index_header), 1, out) == 1 &&
+             fwrite(&key_len, sizeof(key_len), 1, out) == 1 &&
+             fwrite(cache->key, key_len, 1, out) == 1 &&
+             fwrite(&data_size, sizeof(data_size), 1, out) == 1 &&
+             (!data.len || fwrite(data.start, data.len, 1, out) == 1);
+        ok &= fclose(out) == 0;
+        ok = ok && rename(tmpname, cache->index_filename) == 0;
+        if (!ok)
+            unlink(tmpname);
+    }
+
+    if (!ok) {
+        MP_ERR(cache, "Failed to write cache index file.\n");
+    } else {
+        MP_VERBOSE(cache, "Wrote cache index file '%s'.\n",
+                   cache->index_filename);
+        char *base = bstrdup0(NULL, bstr_splice(bstr0(cache->filename), 0, -4));
+        prune_persistent(cache, max_bytes, base, cache->file_size + data.len);
+        talloc_free(base);
+    }
+
+    talloc_free(tmpname);
+    return ok;
+}
+
 static bool do_seek(struct demux_cache *cache, uint64_t pos)
 {
     if (cache->file_pos == pos)
         return true;
 
     off_t res = lseek(cache->fd, pos, SEEK_SET);
+    cache->stats.syscalls++;
 
     if (res == (off_t)-1) {
         MP_ERR(cache, "Failed to seek in cache file.\n");
@@ -154,9 +511,133 @@ static bool do_seek(struct demux_cache *cache, uint64_t pos)
     return cache->file_pos >= 0;
 }
 
+// Write out the contents of the write buffer (use_mmap mode).
+static bool flush_wbuf(struct demux_cache *cache)
+{
+    if (cache->failed)
+        return false;
+
+    size_t done = 0;
+    while (done < cache->wbuf_len) {
+        ssize_t res = pwrite(cache->fd, cache->wbuf + done,
+                             cache->wbuf_len - done, cache->wbuf_pos + done);
+        cache->stats.syscalls++;
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0) {
+            MP_ERR(cache, "Failed to write to cache file: %s\n",
+                   res < 0 ? mp_strerror(errno) : "short write");
+            // Positions in the pending data were already returned, so the
+            // file can't be appended to at the last good position (later
+            // packets would overwrite what earlier positions refer to).
+            cache->failed = true;
+            return false;
+        }
+        done += res;
+    }
+
+    cache->wbuf_pos += done;
+    cache->wbuf_len = 0;
+    return true;
+}
+
+// Make sure len bytes can be appended to the write buffer (use_mmap mode).
+static bool reserve_wbuf(struct demux_cache *cache, size_t len)
+{
+    if (len > cache->wbuf_size - cache->wbuf_len) {
+        if (!flush_wbuf(cache))
+            return false;
+    }
+    if (len > cache->wbuf_size) {
+        cache->wbuf = talloc_realloc_size(cache, cache->wbuf, len);
+        cache->wbuf_size = len;
+    }
+    return true;
+}
+
+// Make sure the mapping covers all data that was written to the file so far
+// (use_mmap mode). If mapping fails, reads fall back to pread().
+static void update_map(struct demux_cache *cache)
+{
+    if (cache->map_size >= cache->wbuf_pos)
+        return;
+
+    if (cache->map)
+        munmap(cache->map, cache->map_size);
+    cache->map = NULL;
+    cache->map_size = 0;
+
+    if (cache->wbuf_pos > SIZE_MAX / 2)
+        return;
+
+    size_t size = MPMAX(MAP_MIN_SIZE, cache->wbuf_pos * 2);
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, cache->fd, 0);
+    cache->stats.syscalls++;
+    if (map == MAP_FAILED) {
+        MP_WARN(cache, "Failed to map cache file: %s\n", mp_strerror(errno));
+        return;
+    }
+
+    cache->map = map;
+    cache->map_size = size;
+}
+
+// Read from an arbitrary position (use_mmap mode). Serves data still in the
+// write buffer, or from the mapping, or with pread() as fallback.
+static bool read_at(struct demux_cache *cache, uint64_t pos, void *ptr,
+                    size_t len)
+{
+    if (pos > cache->file_size || len > cache->file_size - pos) {
+        MP_ERR(cache, "Could not read all data.\n");
+        return false;
+    }
+
+    cache->stats.bytes_read += len;
+
+    if (pos >= cache->wbuf_pos) {
+        memcpy(ptr, cache->wbuf + (pos - cache->wbuf_pos), len);
+        return true;
+    }
+
+    // A packet is always either completely flushed, or completely in wbuf.
+    if (pos + len > cache->wbuf_pos) {
+        MP_ERR(cache, "Could not read all data.\n");
+        return false;
+    }
+
+    update_map(cache);
+    if (cache->map) {
+        memcpy(ptr, cache->map + pos, len);
+        return true;
+    }
+
+    ssize_t res = pread(cache->fd, ptr, len, pos);
+    cache->stats.syscalls++;
+    if (res < 0) {
+        MP_ERR(cache, "Failed to read cache file: %s\n", mp_strerror(errno));
+        return false;
+    }
+    if (res != len) {
+        MP_ERR(cache, "Could not read all data.\n");
+        return false;
+    }
+    return true;
+}
+
 static bool write_raw(struct demux_cache *cache, void *ptr, size_t len)
 {
+    if (cache->use_mmap) {
+        // Space was reserved by the caller.
+        mp_assert(len <= cache->wbuf_size - cache->wbuf_len);
+        memcpy(cache->wbuf + cache->wbuf_len, ptr, len);
+        cache->wbuf_len += len;
+        cache->file_size = cache->wbuf_pos + cache->wbuf_len;
+        cache->stats.bytes_written += len;
+        return true;
+    }
+
     ssize_t res = write(cache->fd, ptr, len);
+    cache->stats.syscalls++;
 
     if (res < 0) {
         MP_ERR(cache, "Failed to write to cache file: %s\n", mp_strerror(errno));
@@ -165,6 +646,7 @@ static bool write_raw(struct demux_cache *cache, void *ptr, size_t len)
 
     cache->file_pos += res;
     cache->file_size = MPMAX(cache->file_size, cache->file_pos);
+    cache->stats.bytes_written += res;
 
     // Should never happen, unless the disk is full, or someone succeeded to
     // trick us to write into a pipe or a socket.
@@ -178,7 +660,14 @@ static bool write_raw(struct demux_cache *cache, void *ptr, size_t len)
 
 static bool read_raw(struct demux_cache *cache, void *ptr, size_t len)
 {
+    if (cache->use_mmap) {
+        bool ok = read_at(cache, cache->file_pos, ptr, len);
+        cache->file_pos += len;
+        return ok;
+    }
+
     ssize_t res = read(cache->fd, ptr, len);
+    cache->stats.syscalls++;
 
     if (res < 0) {
         MP_ERR(cache, "Failed to read cache file: %s\n", mp_strerror(errno));
@@ -186,6 +675,7 @@ static bool read_raw(struct demux_cache *cache, void *ptr, size_t len)
     }
 
     cache->file_pos += res;
+    cache->stats.bytes_read += res;
 
     // Should never happen, unless the file was cut short, or someone succeeded
     // to rick us to write into a pipe or a socket.
@@ -204,6 +694,9 @@ int64_t demux_cache_write(struct demux_cache *cache, struct demux_packet *dp)
 {
     mp_assert(dp->avpacket);
 
+    if (cache->failed)
+        return -1;
+
     // AV_PKT_FLAG_TRUSTED usually means there are embedded pointers and such
     // in the packet data. The pointer will become invalid if the packet is
     // unreferenced.
@@ -218,8 +711,18 @@ int64_t demux_cache_write(struct demux_cache *cache, struct demux_packet *dp)
     mp_assert(dp->avpacket->side_data_elems >= 0 &&
            dp->avpacket->side_data_elems <= INT32_MAX);
 
-    if (!do_seek(cache, cache->file_size))
+    if (cache->use_mmap) {
+        // Reserve space for the whole packet, so it's never split between
+        // file and write buffer.
+        size_t size = sizeof(struct pkt_header) + dp->len;
+        for (int n = 0; n < dp->avpacket->side_data_elems; n++)
+            size += sizeof(struct sd_header) + dp->avpacket->side_data[n].size;
+        if (!reserve_wbuf(cache, size))
+            return -1;
+        cache->file_pos = cache->file_size;
+    } else if (!do_seek(cache, cache->file_size)) {
         return -1;
+    }
 
     uint64_t pos = cache->file_pos;
 
@@ -277,22 +780,31 @@ int64_t demux_cache_write(struct demux_cache *cache, struct demux_packet *dp)
 
 fail:
     // Reset file_size (try not to append crap forever).
+    // (Can't happen in use_mmap mode, as space was reserved.)
     do_seek(cache, pos);
     cache->file_size = cache->file_pos;
     return -1;
 }
 
-struct demux_packet *demux_cache_read(struct demux_cache *cache, uint64_t pos)
+struct demux_packet *demux_cache_read(struct demux_cache *cache,
+                                     struct demux_packet_pool *pool,
+                                     uint64_t pos)
 {
-    if (!do_seek(cache, pos))
+    if (cache->failed)
+        return NULL;
+
+    if (cache->use_mmap) {
+        cache->file_pos = pos;
+    } else if (!do_seek(cache, pos)) {
         return NULL;
+    }
 
     struct pkt_header hd;
 
     if (!read_raw(cache, &hd, sizeof(hd)))
         return NULL;
 
-    struct demux_packet *dp = new_demux_packet(hd.data_len);
+    struct demux_packet *dp = new_demux_packet(pool, hd.data_len);
     if (!dp)
         goto fail;
 
@@ -1,16 +1,37 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "misc/bstr.h"
+
 struct demux_packet;
 struct mp_log;
 struct dmpv_global;
 
 struct demux_cache;
 
+// Counters since creation of the cache.
+struct demux_cache_stats {
+    uint64_t syscalls;          // number of file I/O syscalls
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+};
+
 struct demux_cache *demux_cache_create(struct dmpv_global *global,
-                                       struct mp_log *log);
+                                       struct mp_log *log, const char *key);
 
 int64_t demux_cache_write(struct demux_cache *cache, struct demux_packet *pkt);
-struct demux_packet *demux_cache_read(struct demux_cache *cache, uint64_t pos);
+struct demux_packet_pool;
+struct demux_packet *demux_cache_read(struct demux_cache *cache,
+                                     struct demux_packet_pool *pool,
+                                     uint64_t pos);
 uint64_t demux_cache_get_size(struct demux_cache *cache);
+void demux_cache_get_stats(struct demux_cache *cache,
+                           struct demux_cache_stats *stats);
+bool demux_cache_flush(struct demux_cache *cache);
+
+bool demux_cache_is_persistent(struct demux_cache *cache);
+struct bstr demux_cache_get_index(struct demux_cache *cache);
+void demux_cache_drop_index(struct demux_cache *cache);
+bool demux_cache_save_index(struct demux_cache *cache, struct bstr data);
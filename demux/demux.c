@@ -30,6 +30,8 @@
 
 #include "cache.h"
 #include "config.h"
+#include "packet_arena.h"
+#include "packet_pool.h"
 #include "options/m_config.h"
 #include "options/m_option.h"
 #include "misc/dmpv_talloc.h"
@@ -101,6 +103,8 @@ struct demux_opts {
     double back_seek_size;
     char *meta_cp;
     bool force_retry_eof;
+    int packet_pool_max;
+    double cold_secs;
 };
 
 #define OPT_BASE_STRUCT struct demux_opts
@@ -138,6 +142,9 @@ const struct m_sub_options demux_conf = {
             M_RANGE(0, DBL_MAX)},
         {"metadata-codepage", OPT_STRING(meta_cp)},
         {"demuxer-force-retry-on-eof", OPT_BOOL(force_retry_eof)},
+        {"demuxer-packet-pool-max", OPT_INT(packet_pool_max),
+            M_RANGE(0, 1000000)},
+        {"demuxer-cache-cold-secs", OPT_DOUBLE(cold_secs), M_RANGE(0, DBL_MAX)},
         {0}
     },
     .size = sizeof(struct demux_opts),
@@ -159,6 +166,7 @@ const struct m_sub_options demux_conf = {
             [STREAM_AUDIO] = 10,
         },
         .meta_cp = "utf-8",
+        .packet_pool_max = 1024,
     },
     .get_sub_options = get_demux_sub_opts,
 };
@@ -205,6 +213,7 @@ struct demux_internal {
     int events;
 
     struct demux_cache *cache;
+    bool persist_pending;       // cache has an index that wasn't loaded yet
 
     bool warned_queue_overflow;
     bool eof;                   // whether we're in EOF state
@@ -260,6 +269,7 @@ struct demux_internal {
     int num_ranges;
 
     size_t total_bytes;         // total sum of packet data buffered
+    size_t cold_bytes;          // part of total_bytes in range arenas
     // Range from which decoder is reading, and to which demuxer is appending.
     // This is normally never NULL. This is always ranges[num_ranges - 1].
     // This is can be NULL during initialization or deinitialization.
@@ -276,6 +286,10 @@ struct demux_internal {
     int64_t last_speed_query;
     double speed_query_prev_sample;
     uint64_t bytes_per_second;
+    struct demux_cache_stats cache_stats_prev;
+    uint64_t cache_syscall_rate;
+    uint64_t cache_write_rate;
+    uint64_t cache_read_rate;
     int64_t next_cache_update;
 
     // demux user state (user thread, somewhat similar to reader/decoder state)
@@ -319,6 +333,13 @@ struct demux_cached_range {
 
     struct timed_metadata **metadata;
     int num_metadata;
+
+    // Time (mp_time_ns()) the range stopped being in->current_range, or 0.
+    int64_t last_used;
+    bool compacted;
+    // If the range was compacted: holds the data of all packets that have
+    // is_cached set (only used if there is no disk cache).
+    struct demux_packet_arena *arena;
 };
 
 #define QUEUE_INDEX_SIZE_MASK(queue) ((queue)->index_size - 1)
@@ -332,6 +353,10 @@ struct demux_cached_range {
 // this amount of time (it's better to seek them manually).
 #define INDEX_STEP_SIZE 1.0
 
+// Number of packets the demuxer thread dequeues ahead for each stream, so that
+// readers usually don't need to take the lock. Must be a power of 2.
+#define READER_RING_SIZE 16
+
 struct index_entry {
     double pts;
     struct demux_packet *pkt;
@@ -448,6 +473,18 @@ struct demux_stream {
     // for closed captions (demuxer_feed_caption)
     struct sh_stream *cc;
     bool ignore_eof;        // ignore stream in underrun detection
+
+    // --- Lock-free handoff of packets to the reader. Only the demuxer thread
+    //     adds packets (with in->lock held). The reader removes them without
+    //     the lock; anyone holding in->lock may also remove them (flushing).
+    //     Packets in it were already dequeued from reader_head.
+    mp_atomic_ptr reader_ring[READER_RING_SIZE];
+    mp_atomic_double reader_ring_ts[READER_RING_SIZE]; // base_ts for the entry
+    atomic_uint reader_ring_rpos;   // next entry to remove
+    atomic_uint reader_ring_wpos;   // next entry to add
+    // base_ts of the last packet the reader took from the ring, or
+    // MP_NOPTS_VALUE. Moved to base_ts by sync_base_ts().
+    mp_atomic_double reader_ring_last_ts;
 };
 
 static void switch_to_fresh_cache_range(struct demux_internal *in);
@@ -465,6 +502,8 @@ static void find_backward_restart_pos(struct demux_stream *ds);
 static struct demux_packet *find_seek_target(struct demux_queue *queue,
                                              double pts, int flags);
 static void prune_old_packets(struct demux_internal *in);
+static void fill_reader_rings(struct demux_internal *in);
+static void save_persistent_ranges(struct demux_internal *in);
 static void dumper_close(struct demux_internal *in);
 static void demux_convert_tags_charset(struct demuxer *demuxer);
 
@@ -720,7 +759,7 @@ static void remove_head_packet(struct demux_queue *queue)
     if (!queue->head)
         queue->tail = NULL;
 
-    talloc_free(dp);
+    demux_packet_pool_push(queue->ds->in->d_thread->packet_pool, dp);
 }
 
 static void free_index(struct demux_queue *queue)
@@ -745,13 +784,9 @@ static void clear_queue(struct demux_queue *queue)
 
     free_index(queue);
 
-    struct demux_packet *dp = queue->head;
-    while (dp) {
-        struct demux_packet *dn = dp->next;
+    for (struct demux_packet *dp = queue->head; dp; dp = dp->next)
         mp_assert(ds->reader_head != dp);
-        talloc_free(dp);
-        dp = dn;
-    }
+    demux_packet_pool_push_list(in->d_thread->packet_pool, queue->head);
     queue->head = queue->tail = NULL;
     queue->keyframe_first = NULL;
     queue->keyframe_latest = NULL;
@@ -776,6 +811,13 @@ static void clear_cached_range(struct demux_internal *in,
         talloc_free(range->metadata[n]);
     range->num_metadata = 0;
 
+    if (range->arena) {
+        size_t size = demux_packet_arena_get_size(range->arena);
+        in->total_bytes -= size;
+        in->cold_bytes -= size;
+        TA_FREEP(&range->arena);
+    }
+
     update_seek_ranges(range);
 }
 
@@ -824,10 +866,63 @@ static void ds_clear_reader_queue_state(struct demux_stream *ds)
     ds->need_wakeup = true;
 }
 
+// Remove one packet from the reader ring. Can be called without lock. If ts
+// is not NULL, it is set to the timestamp base_ts should have for the packet.
+static bool reader_ring_pop(struct demux_stream *ds, struct demux_packet **res,
+                            double *ts)
+{
+    unsigned int rpos = atomic_load(&ds->reader_ring_rpos);
+    while (rpos != atomic_load(&ds->reader_ring_wpos)) {
+        // The slot must be read before the CAS, because once rpos is advanced,
+        // the demuxer thread may reuse it. The loads of wpos and of the slot
+        // synchronize with the stores in fill_reader_rings(). If the slot is
+        // reused concurrently anyway (flush + refill by the demuxer thread),
+        // rpos must have changed, and the CAS fails.
+        struct demux_packet *pkt =
+            atomic_load(&ds->reader_ring[rpos % READER_RING_SIZE]);
+        double pkt_ts = atomic_load(&ds->reader_ring_ts[rpos % READER_RING_SIZE]);
+        if (atomic_compare_exchange_strong(&ds->reader_ring_rpos, &rpos,
+                                           rpos + 1))
+        {
+            *res = pkt;
+            if (ts)
+                *ts = pkt_ts;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drop all packets the reader did not take yet. Called locked.
+static void reader_ring_flush(struct demux_stream *ds)
+{
+    struct demux_packet *pkt;
+    while (reader_ring_pop(ds, &pkt, NULL))
+        demux_packet_pool_push(ds->in->d_thread->packet_pool, pkt);
+    atomic_store(&ds->reader_ring_last_ts, MP_NOPTS_VALUE);
+}
+
+// Number of packets in the reader ring. Can be called without lock.
+static unsigned int reader_ring_count(struct demux_stream *ds)
+{
+    return atomic_load(&ds->reader_ring_wpos) -
+           atomic_load(&ds->reader_ring_rpos);
+}
+
+// base_ts is the timestamp of the last packet the reader took. Packets from
+// the reader ring are taken without lock, so apply them here. Called locked.
+static void sync_base_ts(struct demux_stream *ds)
+{
+    double ts = atomic_exchange(&ds->reader_ring_last_ts, MP_NOPTS_VALUE);
+    if (ts != MP_NOPTS_VALUE)
+        ds->base_ts = ts;
+}
+
 static void ds_clear_reader_state(struct demux_stream *ds,
                                   bool clear_back_state)
 {
     ds_clear_reader_queue_state(ds);
+    reader_ring_flush(ds);
 
     ds->base_ts = ds->last_br_ts = MP_NOPTS_VALUE;
     ds->last_br_bytes = 0;
@@ -1004,6 +1099,7 @@ static void demux_add_sh_stream_locked(struct demux_internal *in,
     };
 
     struct demux_stream *ds = sh->ds;
+    atomic_store(&ds->reader_ring_last_ts, MP_NOPTS_VALUE);
 
     if (!sh->codec->codec)
         sh->codec->codec = "";
@@ -1103,6 +1199,9 @@ static void demux_shutdown(struct demux_internal *in)
     demuxer->priv = NULL;
     in->d_thread->priv = NULL;
 
+    if (in->cache)
+        save_persistent_ranges(in);
+
     demux_flush(demuxer);
     mp_assert(in->total_bytes == 0);
 
@@ -1292,7 +1391,7 @@ void demuxer_feed_caption(struct sh_stream *stream, demux_packet_t *dp)
     struct sh_stream *sh = demuxer_get_cc_track_locked(stream);
     if (!sh) {
         mp_mutex_unlock(&in->lock);
-        talloc_free(dp);
+        demux_packet_pool_push(in->d_thread->packet_pool, dp);
         return;
     }
 
@@ -1655,6 +1754,61 @@ static void add_index_entry(struct demux_queue *queue, struct demux_packet *dp,
     };
 }
 
+// Turn the packets in a range compacted by compact_range() back into normal
+// packets. They keep referencing the arena memory, but the range does not own
+// the arena anymore. Returns false on allocation failure.
+static bool decompact_range(struct demux_internal *in,
+                            struct demux_cached_range *range)
+{
+    if (!range->arena)
+        return true;
+
+    for (int n = 0; n < range->num_streams; n++) {
+        struct demux_queue *queue = range->streams[n];
+        if (!queue->head)
+            continue;
+
+        uint64_t cum_pos = queue->head->cum_pos;
+        in->total_bytes -= queue->tail_cum_pos - cum_pos;
+
+        for (struct demux_packet *dp = queue->head; dp; dp = dp->next) {
+            if (dp->is_cached) {
+                struct demux_packet *tmp =
+                    demux_packet_arena_read(range->arena, NULL,
+                                            dp->cached_data.pos);
+                if (!tmp) {
+                    // Leave the remaining packets compacted.
+                    for (; dp; dp = dp->next) {
+                        dp->cum_pos = cum_pos;
+                        cum_pos += demux_packet_estimate_total_size(dp);
+                    }
+                    in->total_bytes += cum_pos - queue->head->cum_pos;
+                    queue->tail_cum_pos = cum_pos;
+                    return false;
+                }
+                dp->is_cached = false;
+                dp->avpacket = tmp->avpacket;
+                dp->buffer = tmp->buffer;
+                dp->len = tmp->len;
+                tmp->avpacket = NULL;
+                talloc_free(tmp);
+            }
+            dp->cum_pos = cum_pos;
+            cum_pos += demux_packet_estimate_total_size(dp);
+        }
+
+        in->total_bytes += cum_pos - queue->head->cum_pos;
+        queue->tail_cum_pos = cum_pos;
+    }
+
+    size_t size = demux_packet_arena_get_size(range->arena);
+    in->total_bytes -= size;
+    in->cold_bytes -= size;
+    TA_FREEP(&range->arena);
+    range->compacted = false;
+    return true;
+}
+
 // Check whether the next range in the list is, and if it appears to overlap,
 // try joining it into a single range.
 static void attempt_range_joining(struct demux_internal *in)
@@ -1686,6 +1840,13 @@ static void attempt_range_joining(struct demux_internal *in)
                current->seek_start, current->seek_end,
                next->seek_start, next->seek_end);
 
+    // The packets of a compacted range are stored in its arena, which is
+    // freed with the range when it is cleared below.
+    if (!decompact_range(in, next)) {
+        MP_WARN(in, "Failed to decompact cached range for join.\n");
+        goto failed;
+    }
+
     // Try to find a join point, where packets obviously overlap. (It would be
     // better and faster to do this incrementally, but probably too complex.)
     // The current range can overlap arbitrarily with the next one, not only by
@@ -1878,6 +2039,47 @@ static struct demux_packet *compute_keyframe_times(struct demux_packet *pkt,
     return pkt;
 }
 
+// Add the keyframe range starting at kf to the queue's index and seek range.
+// The caller must know that the range is complete (i.e. the next keyframe or
+// EOF was seen). Returns whether the range's seek range needs an update.
+static bool add_keyframe_range(struct demux_queue *queue,
+                               struct demux_packet *kf)
+{
+    bool update_ranges = false;
+
+    double kf_min, kf_max;
+    compute_keyframe_times(kf, &kf_min, &kf_max);
+
+    if (kf_min != MP_NOPTS_VALUE) {
+        add_index_entry(queue, kf, kf_min);
+
+        // Initialize the queue's start if it's unset.
+        if (queue->seek_start == MP_NOPTS_VALUE) {
+            update_ranges = true;
+            queue->seek_start = kf_min + queue->ds->sh->seek_preroll;
+        }
+    }
+
+    if (kf_max != MP_NOPTS_VALUE &&
+        (queue->seek_end == MP_NOPTS_VALUE || kf_max > queue->seek_end))
+    {
+        // If the queue was past the current range's end even before
+        // this update, it means _other_ streams are not there yet,
+        // and the seek range doesn't need to be updated. This means
+        // if the _old_ queue->seek_end was already after the range end,
+        // then the new seek_end won't extend the range either.
+        if (queue->range->seek_end == MP_NOPTS_VALUE ||
+            queue->seek_end <= queue->range->seek_end)
+        {
+            update_ranges = true;
+        }
+
+        queue->seek_end = kf_max;
+    }
+
+    return update_ranges;
+}
+
 // Determine seekable range when a packet is added. If dp==NULL, treat it as
 // EOF (i.e. closes the current block).
 // This has to deal with a number of corner cases, such as demuxers potentially
@@ -1896,46 +2098,305 @@ static void adjust_seek_range_on_packet(struct demux_stream *ds,
     queue->is_eof = new_eof;
 
     if (!dp || dp->keyframe) {
-        if (queue->keyframe_latest) {
-            double kf_min, kf_max;
-            compute_keyframe_times(queue->keyframe_latest, &kf_min, &kf_max);
+        if (queue->keyframe_latest)
+            update_ranges |= add_keyframe_range(queue, queue->keyframe_latest);
 
-            if (kf_min != MP_NOPTS_VALUE) {
-                add_index_entry(queue, queue->keyframe_latest, kf_min);
+        queue->keyframe_latest = dp;
+    }
 
-                // Initialize the queue's start if it's unset.
-                if (queue->seek_start == MP_NOPTS_VALUE) {
-                    update_ranges = true;
-                    queue->seek_start = kf_min + ds->sh->seek_preroll;
-                }
+    // Adding a sparse packet never changes the seek range.
+    if (update_ranges && ds->eager) {
+        update_seek_ranges(queue->range);
+        attempt_range_joining(ds->in);
+    }
+}
+
+// On-disk format of the cached ranges in a persistent cache index. Like the
+// cache file itself, this is a memory dump, and only meant to be read by the
+// same build on the same machine.
+struct persist_queue {
+    uint32_t num_packets;
+    uint8_t is_bof, is_eof;
+    double last_pruned;
+};
+
+struct persist_packet {
+    double pts, dts, duration;
+    int64_t pos;
+    uint64_t cache_pos;
+    uint8_t keyframe;
+};
+
+static void persist_put(void *ta_ctx, struct bstr *s, const void *data,
+                        size_t size)
+{
+    bstr_xappend(ta_ctx, s, (struct bstr){(unsigned char *)data, size});
+}
+
+static bool persist_get(struct bstr *s, void *data, size_t size)
+{
+    if (s->len < size)
+        return false;
+    memcpy(data, s->start, size);
+    *s = bstr_cut(*s, size);
+    return true;
+}
+
+// Describes the stream layout, so an index is not applied to a different
+// file that happens to be available under the same URL.
+static char *get_stream_identity(struct demux_internal *in, void *ta_ctx)
+{
+    char *res = talloc_strdup(ta_ctx, in->d_thread->desc->name);
+    for (int n = 0; n < in->num_streams; n++) {
+        struct sh_stream *sh = in->streams[n];
+        res = talloc_asprintf_append(res, ";%s:%s:%d:%d",
+                                     stream_type_name(sh->type),
+                                     sh->codec->codec ? sh->codec->codec : "",
+                                     sh->demuxer_id, sh->ff_index);
+    }
+    return res;
+}
+
+static bool range_is_persistable(struct demux_cached_range *range)
+{
+    if (range->seek_start == MP_NOPTS_VALUE)
+        return false;
+
+    for (int n = 0; n < range->num_streams; n++) {
+        for (struct demux_packet *dp = range->streams[n]->head; dp; dp = dp->next)
+        {
+            // Segmented packets reference codec params by pointer.
+            if (!dp->is_cached || dp->segmented)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Write the index of all cached ranges for the next session (if the cache is
+// in persistent mode).
+static void save_persistent_ranges(struct demux_internal *in)
+{
+    // Don't overwrite an index that was never used.
+    if (!demux_cache_is_persistent(in->cache) || in->persist_pending ||
+        !in->seekable_cache)
+        return;
+
+    void *tmp = talloc_new(NULL);
+    struct bstr data = {0};
+
+    char *id = get_stream_identity(in, tmp);
+    uint32_t id_len = strlen(id);
+    persist_put(tmp, &data, &id_len, sizeof(id_len));
+    persist_put(tmp, &data, id, id_len);
+
+    uint32_t num_ranges = 0;
+    for (int n = 0; n < in->num_ranges; n++)
+        num_ranges += range_is_persistable(in->ranges[n]);
+    persist_put(tmp, &data, &num_ranges, sizeof(num_ranges));
+
+    for (int n = 0; n < in->num_ranges; n++) {
+        struct demux_cached_range *range = in->ranges[n];
+        if (!range_is_persistable(range))
+            continue;
+
+        uint32_t num_streams = range->num_streams;
+        persist_put(tmp, &data, &num_streams, sizeof(num_streams));
+
+        for (int i = 0; i < range->num_streams; i++) {
+            struct demux_queue *queue = range->streams[i];
+
+            struct persist_queue pq;
+            memset(&pq, 0, sizeof(pq));
+            for (struct demux_packet *dp = queue->head; dp; dp = dp->next)
+                pq.num_packets++;
+            pq.is_bof = queue->is_bof;
+            pq.is_eof = queue->is_eof;
+            pq.last_pruned = queue->last_pruned;
+            persist_put(tmp, &data, &pq, sizeof(pq));
+
+            for (struct demux_packet *dp = queue->head; dp; dp = dp->next) {
+                struct persist_packet pp;
+                memset(&pp, 0, sizeof(pp));
+                pp.pts = dp->pts;
+                pp.dts = dp->dts;
+                pp.duration = dp->duration;
+                pp.pos = dp->pos;
+                pp.cache_pos = dp->cached_data.pos;
+                pp.keyframe = dp->keyframe;
+                persist_put(tmp, &data, &pp, sizeof(pp));
             }
+        }
+    }
 
-            if (kf_max != MP_NOPTS_VALUE &&
-                (queue->seek_end == MP_NOPTS_VALUE || kf_max > queue->seek_end))
-            {
-                // If the queue was past the current range's end even before
-                // this update, it means _other_ streams are not there yet,
-                // and the seek range doesn't need to be updated. This means
-                // if the _old_ queue->seek_end was already after the range end,
-                // then the new seek_end won't extend the range either.
-                if (queue->range->seek_end == MP_NOPTS_VALUE ||
-                    queue->seek_end <= queue->range->seek_end)
-                {
-                    update_ranges = true;
-                }
+    demux_cache_save_index(in->cache, data);
+    talloc_free(tmp);
+}
+
+// Recompute the incrementally maintained queue state for packets that were
+// appended to it directly.
+static void rebuild_queue_state(struct demux_queue *queue)
+{
+    struct demux_stream *ds = queue->ds;
 
-                queue->seek_end = kf_max;
+    for (struct demux_packet *dp = queue->head; dp; dp = dp->next) {
+        queue->correct_pos &= dp->pos >= 0 && dp->pos > queue->last_pos;
+        queue->correct_dts &= dp->dts != MP_NOPTS_VALUE && dp->dts > queue->last_dts;
+        queue->last_pos = dp->pos;
+        queue->last_dts = dp->dts;
+
+        double ts = MP_PTS_OR_DEF(dp->dts, dp->pts);
+        if (ts != MP_NOPTS_VALUE && (ts > queue->last_ts || ts + 10 < queue->last_ts))
+            queue->last_ts = ts;
+
+        if (dp->keyframe) {
+            if (queue->keyframe_latest)
+                add_keyframe_range(queue, queue->keyframe_latest);
+            queue->keyframe_latest = dp;
+        }
+    }
+
+    if (queue->is_eof && queue->keyframe_latest) {
+        add_keyframe_range(queue, queue->keyframe_latest);
+        queue->keyframe_latest = NULL;
+    }
+
+    ds->global_correct_pos &= queue->correct_pos;
+    ds->global_correct_dts &= queue->correct_dts;
+}
+
+static bool load_persistent_range(struct demux_internal *in, struct bstr *data)
+{
+    uint32_t num_streams;
+    if (!persist_get(data, &num_streams, sizeof(num_streams)) ||
+        num_streams != in->num_streams)
+        return false;
+
+    struct demux_cached_range *range = talloc_ptrtype(NULL, range);
+    *range = (struct demux_cached_range){
+        .seek_start = MP_NOPTS_VALUE,
+        .seek_end = MP_NOPTS_VALUE,
+    };
+    // Least recently used; in->current_range must stay the last entry.
+    MP_TARRAY_INSERT_AT(in, in->ranges, in->num_ranges, 0, range);
+    add_missing_streams(in, range);
+
+    bool ok = true;
+
+    for (int n = 0; n < range->num_streams; n++) {
+        struct demux_queue *queue = range->streams[n];
+        struct demux_stream *ds = queue->ds;
+
+        struct persist_queue pq;
+        if (!persist_get(data, &pq, sizeof(pq))) {
+            ok = false;
+            break;
+        }
+
+        for (uint32_t i = 0; i < pq.num_packets; i++) {
+            struct persist_packet pp;
+            if (!persist_get(data, &pp, sizeof(pp))) {
+                ok = false;
+                break;
             }
+
+            // Would be thrown away immediately.
+            if (!ds->selected)
+                continue;
+
+            struct demux_packet *dp =
+                new_demux_packet_cached(in->d_thread->packet_pool, pp.cache_pos);
+            dp->pts = pp.pts;
+            dp->dts = pp.dts;
+            dp->duration = pp.duration;
+            dp->pos = pp.pos;
+            dp->keyframe = pp.keyframe;
+            dp->stream = n;
+
+            size_t bytes = demux_packet_estimate_total_size(dp);
+            in->total_bytes += bytes;
+            dp->cum_pos = queue->tail_cum_pos;
+            queue->tail_cum_pos += bytes;
+
+            if (queue->tail) {
+                queue->tail->next = dp;
+            } else {
+                queue->head = dp;
+            }
+            queue->tail = dp;
         }
 
-        queue->keyframe_latest = dp;
+        if (!ok)
+            break;
+
+        if (queue->head) {
+            queue->is_bof = pq.is_bof;
+            queue->is_eof = pq.is_eof;
+            queue->last_pruned = pq.last_pruned;
+            rebuild_queue_state(queue);
+        }
     }
 
-    // Adding a sparse packet never changes the seek range.
-    if (update_ranges && ds->eager) {
-        update_seek_ranges(queue->range);
-        attempt_range_joining(ds->in);
+    // If the data was cut off, the range might still be fine, or it will be
+    // freed due to missing a valid seek range.
+    update_seek_ranges(range);
+
+    if (range->seek_start != MP_NOPTS_VALUE) {
+        MP_VERBOSE(in, "restored cached range %f <-> %f\n",
+                   range->seek_start, range->seek_end);
     }
+
+    return ok;
+}
+
+// Turn the index loaded from a persistent cache file into cached ranges. This
+// has to wait until streams are selected, because the queues of unselected
+// streams are dropped, and the seek ranges depend on the selection.
+static void load_persistent_ranges(struct demux_internal *in)
+{
+    if (!in->persist_pending)
+        return;
+
+    bool any_selected = false;
+    for (int n = 0; n < in->num_streams; n++)
+        any_selected |= in->streams[n]->ds->selected;
+    if (!any_selected || !in->current_range)
+        return;
+
+    in->persist_pending = false;
+
+    void *tmp = talloc_new(NULL);
+    struct bstr data = demux_cache_get_index(in->cache);
+
+    char *id = get_stream_identity(in, tmp);
+    uint32_t id_len;
+    if (!persist_get(&data, &id_len, sizeof(id_len)) || data.len < id_len ||
+        !bstr_equals0(bstr_splice(data, 0, id_len), id))
+    {
+        MP_WARN(in, "Persistent cache is for a different stream layout, "
+                "discarding.\n");
+        demux_cache_drop_index(in->cache);
+        goto done;
+    }
+    data = bstr_cut(data, id_len);
+
+    uint32_t num_ranges;
+    if (!persist_get(&data, &num_ranges, sizeof(num_ranges)))
+        goto broken;
+
+    for (uint32_t n = 0; n < num_ranges; n++) {
+        if (!load_persistent_range(in, &data))
+            goto broken;
+    }
+
+    goto done;
+
+broken:
+    MP_WARN(in, "Persistent cache index is truncated or broken.\n");
+done:
+    free_empty_cached_ranges(in);
+    talloc_free(tmp);
 }
 
 static struct mp_recorder *recorder_create(struct demux_internal *in,
@@ -2014,7 +2475,7 @@ static void add_packet_locked(struct sh_stream *stream, demux_packet_t *dp)
     struct demux_stream *ds = stream ? stream->ds : NULL;
     mp_assert(ds && ds->in);
     if (!dp->len || demux_cancel_test(ds->in->d_thread)) {
-        talloc_free(dp);
+        demux_packet_pool_push(ds->in->d_thread->packet_pool, dp);
         return;
     }
 
@@ -2062,7 +2523,7 @@ static void add_packet_locked(struct sh_stream *stream, demux_packet_t *dp)
     }
 
     if (drop) {
-        talloc_free(dp);
+        demux_packet_pool_push(in->d_thread->packet_pool, dp);
         return;
     }
 
@@ -2182,6 +2643,8 @@ static bool lazy_stream_needs_wait(struct demux_stream *ds)
 // Returns true if there was "progress" (lock was released temporarily).
 static bool read_packet(struct demux_internal *in)
 {
+    load_persistent_ranges(in);
+
     bool was_reading = in->reading;
     in->reading = false;
 
@@ -2207,6 +2670,7 @@ static bool read_packet(struct demux_internal *in)
             }
         }
         refresh_more |= ds->refreshing;
+        sync_base_ts(ds);
         if (ds->eager && ds->queue->last_ts != MP_NOPTS_VALUE &&
             in->min_secs > 0 && ds->base_ts != MP_NOPTS_VALUE &&
             ds->queue->last_ts >= ds->base_ts &&
@@ -2307,6 +2771,86 @@ static bool read_packet(struct demux_internal *in)
     return true;
 }
 
+// Move the data of all packets in the range into a single allocation. This
+// saves the per-packet AVPacket/AVBuffer overhead and allocator fragmentation.
+// The range stays fully usable (packets are read from the arena).
+static void compact_range(struct demux_internal *in,
+                          struct demux_cached_range *range)
+{
+    range->compacted = true;
+
+    size_t size = 0;
+    for (int n = 0; n < range->num_streams; n++) {
+        for (struct demux_packet *dp = range->streams[n]->head; dp; dp = dp->next)
+            size += demux_packet_arena_entry_size(dp);
+    }
+    if (!size)
+        return;
+
+    struct demux_packet_arena *arena = demux_packet_arena_create(range, size);
+    if (!arena) {
+        MP_WARN(in, "Failed to allocate cache arena.\n");
+        return;
+    }
+
+    // The estimated packet sizes change, so redo the byte accounting.
+    for (int n = 0; n < range->num_streams; n++) {
+        struct demux_queue *queue = range->streams[n];
+        if (!queue->head)
+            continue;
+
+        uint64_t cum_pos = queue->head->cum_pos;
+        in->total_bytes -= queue->tail_cum_pos - cum_pos;
+
+        for (struct demux_packet *dp = queue->head; dp; dp = dp->next) {
+            int64_t pos = demux_packet_arena_add(arena, dp);
+            if (pos >= 0) {
+                demux_packet_unref_contents(dp);
+                dp->is_cached = true;
+                dp->cached_data.pos = pos;
+            }
+            dp->cum_pos = cum_pos;
+            cum_pos += demux_packet_estimate_total_size(dp);
+        }
+
+        in->total_bytes += cum_pos - queue->head->cum_pos;
+        queue->tail_cum_pos = cum_pos;
+    }
+
+    range->arena = arena;
+    in->total_bytes += size;
+    in->cold_bytes += size;
+
+    MP_VERBOSE(in, "Compacted cached range %f - %f (%zu bytes).\n",
+               range->seek_start, range->seek_end, size);
+}
+
+// Compact at most 1 range that has not been used for a while. Returns whether
+// something was done.
+static bool compact_cold_ranges(struct demux_internal *in)
+{
+    // With the disk cache, there is little packet data in memory anyway.
+    if (in->cache || !in->opts->cold_secs)
+        return false;
+
+    int64_t now = mp_time_ns();
+    for (int n = 0; n < in->num_ranges; n++) {
+        struct demux_cached_range *range = in->ranges[n];
+        if (range == in->current_range || range->compacted ||
+            range->seek_start == MP_NOPTS_VALUE)
+            continue;
+        if (!range->last_used) {
+            range->last_used = now;
+            continue;
+        }
+        if ((now - range->last_used) / 1e9 < in->opts->cold_secs)
+            continue;
+        compact_range(in, range);
+        return true;
+    }
+    return false;
+}
+
 static void prune_old_packets(struct demux_internal *in)
 {
     mp_assert(in->current_range == in->ranges[in->num_ranges - 1]);
@@ -2330,6 +2874,14 @@ static void prune_old_packets(struct demux_internal *in)
 
         // (Start from least recently used range.)
         struct demux_cached_range *range = in->ranges[0];
+
+        // The arena memory is freed only with the whole range, so pruning
+        // single packets would achieve nothing.
+        if (range->arena && range != in->current_range) {
+            clear_cached_range(in, range);
+            free_empty_cached_ranges(in);
+            continue;
+        }
         double earliest_ts = MP_NOPTS_VALUE;
         struct demux_stream *earliest_stream = NULL;
 
@@ -2477,6 +3029,8 @@ static void update_opts(struct demux_internal *in)
     in->max_bytes = opts->max_bytes;
     in->max_bytes_bw = opts->max_bytes_bw;
 
+    demux_packet_pool_set_max(in->d_thread->packet_pool, opts->packet_pool_max);
+
     int seekable = opts->seekable_cache;
     bool is_streaming = in->d_thread->is_streaming;
     bool use_cache = is_streaming;
@@ -2503,9 +3057,14 @@ static void update_opts(struct demux_internal *in)
     }
 
     if (in->seekable_cache && opts->disk_cache && !in->cache) {
-        in->cache = demux_cache_create(in->global, in->log);
-        if (!in->cache)
+        in->cache = demux_cache_create(in->global, in->log,
+                                       in->d_thread->filename);
+        in->cache_stats_prev = (struct demux_cache_stats){0};
+        if (!in->cache) {
             MP_ERR(in, "Failed to create file cache.\n");
+        } else {
+            in->persist_pending = demux_cache_get_index(in->cache).len > 0;
+        }
     }
 
     // The filename option really decides whether recording should be active.
@@ -2554,8 +3113,11 @@ static bool thread_work(struct demux_internal *in)
         execute_seek(in);
         return true;
     }
+    fill_reader_rings(in);
     if (read_packet(in))
         return true; // read_packet unlocked, so recheck conditions
+    if (compact_cold_ranges(in))
+        return true;
     if (mp_time_ns() >= in->next_cache_update) {
         update_cache(in);
         return true;
@@ -2611,17 +3173,26 @@ static struct demux_packet *advance_reader_head(struct demux_stream *ds)
 
 // Return a newly allocated new packet. The pkt parameter may be either a
 // in-memory packet (then a new reference is made), or a reference to
-// packet in the disk cache (then the packet is read from disk).
+// packet in the disk cache (then the packet is read from disk) or in the
+// arena of the range it belongs to.
 static struct demux_packet *read_packet_from_cache(struct demux_internal *in,
+                                                   struct demux_cached_range *range,
                                                    struct demux_packet *pkt)
 {
     if (!pkt)
         return NULL;
 
     if (pkt->is_cached) {
-        mp_assert(in->cache);
+        mp_assert(in->cache || range->arena);
         struct demux_packet *meta = pkt;
-        pkt = demux_cache_read(in->cache, pkt->cached_data.pos);
+        if (in->cache) {
+            pkt = demux_cache_read(in->cache, in->d_thread->packet_pool,
+                                   pkt->cached_data.pos);
+        } else {
+            pkt = demux_packet_arena_read(range->arena,
+                                          in->d_thread->packet_pool,
+                                          pkt->cached_data.pos);
+        }
         if (pkt) {
             demux_packet_copy_attribs(pkt, meta);
         } else {
@@ -2629,12 +3200,113 @@ static struct demux_packet *read_packet_from_cache(struct demux_internal *in,
         }
     } else {
         // The returned packet is mutated etc. and will be owned by the user.
-        pkt = demux_copy_packet(pkt);
+        pkt = demux_copy_packet(in->d_thread->packet_pool, pkt);
     }
 
     return pkt;
 }
 
+// Update the reader state for a packet that is returned to the reader.
+// Returns the timestamp base_ts should be set to when the reader takes it.
+static double finish_reader_packet(struct demux_stream *ds,
+                                   struct demux_packet *pkt)
+{
+    struct demux_internal *in = ds->in;
+
+    double ts = MP_PTS_OR_DEF(pkt->dts, pkt->pts);
+
+    if (pkt->keyframe && ts != MP_NOPTS_VALUE) {
+        // Update bitrate - only at keyframe points, because we use the
+        // (possibly) reordered packet timestamps instead of realtime.
+        double d = ts - ds->last_br_ts;
+        if (ds->last_br_ts == MP_NOPTS_VALUE || d < 0) {
+            ds->bitrate = -1;
+            ds->last_br_ts = ts;
+            ds->last_br_bytes = 0;
+        } else if (d >= 0.5) { // a window of least 500ms for UI purposes
+            ds->bitrate = ds->last_br_bytes / d;
+            ds->last_br_ts = ts;
+            ds->last_br_bytes = 0;
+        }
+    }
+    ds->last_br_bytes += pkt->len;
+
+    pkt->pts = MP_ADD_PTS(pkt->pts, in->ts_offset);
+    pkt->dts = MP_ADD_PTS(pkt->dts, in->ts_offset);
+
+    if (pkt->segmented) {
+        pkt->start = MP_ADD_PTS(pkt->start, in->ts_offset);
+        pkt->end = MP_ADD_PTS(pkt->end, in->ts_offset);
+    }
+
+    return ts;
+}
+
+// Update the reader position for a packet that is handed to the user. This
+// must run on the user thread, because in->d_user is owned by it (and not at
+// dequeue time, because packets in the reader ring are dequeued early).
+static void update_user_filepos(struct demux_internal *in,
+                                struct demux_packet *pkt)
+{
+    if (pkt->pos >= in->d_user->filepos)
+        in->d_user->filepos = pkt->pos;
+}
+
+// Take a packet from the reader ring. Must run on the user thread; can be
+// called without lock.
+static bool reader_ring_take(struct demux_stream *ds, struct demux_packet **res)
+{
+    double ts;
+    if (!reader_ring_pop(ds, res, &ts))
+        return false;
+    update_user_filepos(ds->in, *res);
+    if (ts != MP_NOPTS_VALUE)
+        atomic_store(&ds->reader_ring_last_ts, ts);
+    return true;
+}
+
+// Dequeue packets ahead of the reader into the per-stream reader rings, as
+// long as only plain forward playback is going on. Anything else (seeks,
+// backward demuxing, lazily read streams) goes through dequeue_packet().
+static void fill_reader_rings(struct demux_internal *in)
+{
+    if (!in->threading || in->blocked || in->back_demuxing || !in->reading)
+        return;
+
+    bool added = false;
+    for (int n = 0; n < in->num_streams; n++) {
+        struct demux_stream *ds = in->streams[n]->ds;
+
+        if (!ds->selected || !ds->eager || ds->sh->attached_picture)
+            continue;
+
+        bool ds_added = false;
+        unsigned int wpos = atomic_load(&ds->reader_ring_wpos);
+        while (ds->reader_head &&
+               wpos - atomic_load(&ds->reader_ring_rpos) < READER_RING_SIZE)
+        {
+            struct demux_packet *pkt =
+                read_packet_from_cache(in, ds->queue->range,
+                                       advance_reader_head(ds));
+            if (!pkt)
+                break;
+            double ts = finish_reader_packet(ds, pkt);
+            atomic_store(&ds->reader_ring[wpos % READER_RING_SIZE], pkt);
+            atomic_store(&ds->reader_ring_ts[wpos % READER_RING_SIZE], ts);
+            wpos += 1;
+            atomic_store(&ds->reader_ring_wpos, wpos);
+            ds_added = true;
+        }
+
+        if (ds_added)
+            wakeup_ds(ds);
+        added |= ds_added;
+    }
+
+    if (added)
+        prune_old_packets(in);
+}
+
 // Returns:
 //   < 0: EOF was reached, *res is not set
 //  == 0: no new packet yet, wait, *res is not set
@@ -2654,7 +3326,8 @@ static int dequeue_packet(struct demux_stream *ds, double min_pts,
         if (ds->attached_picture_added)
             return -1;
         ds->attached_picture_added = true;
-        struct demux_packet *pkt = demux_copy_packet(ds->sh->attached_picture);
+        struct demux_packet *pkt =
+            demux_copy_packet(in->d_thread->packet_pool, ds->sh->attached_picture);
         MP_HANDLE_OOM(pkt);
         pkt->stream = ds->sh->index;
         *res = pkt;
@@ -2668,6 +3341,14 @@ static int dequeue_packet(struct demux_stream *ds, double min_pts,
 
     ds->force_read_until = min_pts;
 
+    in->d_user->filesize = in->stream_size;
+
+    // Packets the demuxer thread dequeued earlier come first.
+    if (reader_ring_take(ds, res)) {
+        sync_base_ts(ds);
+        return 1;
+    }
+
     if (ds->back_resuming || ds->back_restarting) {
         mp_assert(in->back_demuxing);
         return 0;
@@ -2714,7 +3395,7 @@ static int dequeue_packet(struct demux_stream *ds, double min_pts,
 
     struct demux_packet *pkt = advance_reader_head(ds);
     mp_assert(pkt);
-    pkt = read_packet_from_cache(in, pkt);
+    pkt = read_packet_from_cache(in, ds->queue->range, pkt);
     if (!pkt)
         return 0;
 
@@ -2735,38 +3416,12 @@ static int dequeue_packet(struct demux_stream *ds, double min_pts,
         }
     }
 
-    double ts = MP_PTS_OR_DEF(pkt->dts, pkt->pts);
+    // Packets taken from the ring earlier came before this one.
+    sync_base_ts(ds);
+    double ts = finish_reader_packet(ds, pkt);
     if (ts != MP_NOPTS_VALUE)
         ds->base_ts = ts;
-
-    if (pkt->keyframe && ts != MP_NOPTS_VALUE) {
-        // Update bitrate - only at keyframe points, because we use the
-        // (possibly) reordered packet timestamps instead of realtime.
-        double d = ts - ds->last_br_ts;
-        if (ds->last_br_ts == MP_NOPTS_VALUE || d < 0) {
-            ds->bitrate = -1;
-            ds->last_br_ts = ts;
-            ds->last_br_bytes = 0;
-        } else if (d >= 0.5) { // a window of least 500ms for UI purposes
-            ds->bitrate = ds->last_br_bytes / d;
-            ds->last_br_ts = ts;
-            ds->last_br_bytes = 0;
-        }
-    }
-    ds->last_br_bytes += pkt->len;
-
-    // This implies this function is actually called from "the" user thread.
-    if (pkt->pos >= in->d_user->filepos)
-        in->d_user->filepos = pkt->pos;
-    in->d_user->filesize = in->stream_size;
-
-    pkt->pts = MP_ADD_PTS(pkt->pts, in->ts_offset);
-    pkt->dts = MP_ADD_PTS(pkt->dts, in->ts_offset);
-
-    if (pkt->segmented) {
-        pkt->start = MP_ADD_PTS(pkt->start, in->ts_offset);
-        pkt->end = MP_ADD_PTS(pkt->end, in->ts_offset);
-    }
+    update_user_filepos(in, pkt);
 
     prune_old_packets(in);
     *res = pkt;
@@ -2802,6 +3457,18 @@ int demux_read_packet_async_until(struct sh_stream *sh, double min_pts,
         return -1;
     struct demux_internal *in = ds->in;
 
+    // Common case: the demuxer thread already dequeued the next packet.
+    // min_pts needs dequeue_packet() to set up forced read-ahead, so it always
+    // takes the locked path (which still drains the ring first). filesize is
+    // not touched here; demux_update() refreshes it.
+    if (min_pts == MP_NOPTS_VALUE && reader_ring_take(ds, out_pkt)) {
+        // Let it refill the ring. (Signaling without lock can miss the
+        // wakeup; then the locked path below picks up the slack.)
+        if (reader_ring_count(ds) <= READER_RING_SIZE / 2)
+            pthread_cond_signal(&in->wakeup);
+        return 1;
+    }
+
     mp_mutex_lock(&in->lock);
     int r = -1;
     while (1) {
@@ -3334,6 +4001,8 @@ static struct demuxer *open_given_type(struct dmpv_global *global,
     pthread_mutex_init(&in->lock, NULL);
     pthread_cond_init(&in->wakeup, NULL);
 
+    demuxer->packet_pool = demux_packet_pool_create(in, opts->packet_pool_max);
+
     *in->d_thread = *demuxer;
 
     in->d_thread->metadata = talloc_zero(in->d_thread, struct mp_tags);
@@ -3561,9 +4230,18 @@ static void switch_current_range(struct demux_internal *in,
     struct demux_cached_range *old = in->current_range;
     mp_assert(old != range);
 
+    // The current range is appended to and pruned packet by packet, and its
+    // arena would stay accounted as cold data. Packets are converted in
+    // place, so reader_head etc. stay valid. On failure, the rest of the
+    // range is still read from the arena, which is freed with the range.
+    if (!decompact_range(in, range))
+        MP_WARN(in, "Failed to decompact cached range.\n");
+
     set_current_range(in, range);
 
     if (old) {
+        old->last_used = mp_time_ns();
+
         // Remove packets which can't be used when seeking back to the range.
         for (int n = 0; n < in->num_streams; n++) {
             struct demux_queue *queue = old->streams[n];
@@ -3849,6 +4527,8 @@ static bool queue_seek(struct demux_internal *in, double seek_pts, int flags,
     bool block = flags & SEEK_BLOCK;
     flags &= ~(unsigned)SEEK_BLOCK;
 
+    load_persistent_ranges(in);
+
     struct demux_cached_range *cache_target =
         find_cache_seek_range(in, seek_pts, flags);
 
@@ -3935,6 +4615,7 @@ static void initiate_refresh_seek(struct demux_internal *in,
         if (!ds->selected)
             continue;
 
+        sync_base_ts(ds);
         if (ds->type == STREAM_VIDEO || ds->type == STREAM_AUDIO)
             start_ts = MP_PTS_MIN(start_ts, ds->base_ts);
 
@@ -4128,6 +4809,8 @@ void demux_block_reading(struct demuxer *demuxer, bool block)
     mp_mutex_lock(&in->lock);
     in->blocked = block;
     for (int n = 0; n < in->num_streams; n++) {
+        if (block)
+            reader_ring_flush(in->streams[n]->ds);
         in->streams[n]->ds->need_wakeup = true;
         wakeup_ds(in->streams[n]->ds);
     }
@@ -4199,6 +4882,23 @@ static void update_cache(struct demux_internal *in)
         in->bytes_per_second = 0.5 * in->speed_query_prev_sample +
                                0.5 * speed;
         in->speed_query_prev_sample = speed;
+
+        if (in->cache) {
+            struct demux_cache_stats st;
+            demux_cache_get_stats(in->cache, &st);
+            struct demux_cache_stats *prev = &in->cache_stats_prev;
+            double secs = diff / (double)MP_TIME_S_TO_NS(1);
+            in->cache_syscall_rate = (st.syscalls - prev->syscalls) / secs;
+            in->cache_write_rate = (st.bytes_written - prev->bytes_written) / secs;
+            in->cache_read_rate = (st.bytes_read - prev->bytes_read) / secs;
+            *prev = st;
+        }
+
+        struct demux_packet_pool_stats pst;
+        demux_packet_pool_get_stats(in->d_thread->packet_pool, &pst);
+        stats_value(in->stats, "packet-pool-hits", pst.hits);
+        stats_value(in->stats, "packet-pool-misses", pst.misses);
+        stats_value(in->stats, "packet-pool-free", pst.num_free);
     }
     // The idea is to update as long as there is "activity".
     if (in->bytes_per_second)
@@ -4300,7 +5000,7 @@ static void dump_cache(struct demux_internal *in, double start, double end)
             struct demux_stream *ds = in->streams[next->stream]->ds;
             ds->dump_pos = next->next;
 
-            struct demux_packet *dp = read_packet_from_cache(in, next);
+            struct demux_packet *dp = read_packet_from_cache(in, r, next);
             if (!dp) {
                 in->dumper_status = CONTROL_ERROR;
                 break;
@@ -4308,7 +5008,7 @@ static void dump_cache(struct demux_internal *in, double start, double end)
 
             write_dump_packet(in, dp);
 
-            talloc_free(dp);
+            demux_packet_pool_push(in->d_thread->packet_pool, dp);
         }
 
         if (in->dumper_status != CONTROL_OK)
@@ -4517,21 +5217,28 @@ void demux_get_reader_state(struct demuxer *demuxer, struct demux_reader_state *
         .ts_end = MP_NOPTS_VALUE,
         .ts_duration = -1,
         .total_bytes = in->total_bytes,
+        .cold_bytes = in->cold_bytes,
         .seeking = in->seeking_in_progress,
         .low_level_seeks = in->low_level_seeks,
         .ts_last = in->demux_ts,
         .bytes_per_second = in->bytes_per_second,
         .byte_level_seeks = in->byte_level_seeks,
         .file_cache_bytes = in->cache ? demux_cache_get_size(in->cache) : -1,
+        .file_cache_syscall_rate = in->cache_syscall_rate,
+        .file_cache_write_rate = in->cache_write_rate,
+        .file_cache_read_rate = in->cache_read_rate,
     };
     bool any_packets = false;
     for (int n = 0; n < in->num_streams; n++) {
         struct demux_stream *ds = in->streams[n]->ds;
+        sync_base_ts(ds);
         if (ds->eager && !(!ds->queue->head && ds->eof) && !ds->ignore_eof) {
-            r->underrun |= !ds->reader_head && !ds->eof && !ds->still_image;
+            // Packets in the reader ring are buffered too.
+            bool buffered = ds->reader_head || reader_ring_count(ds);
+            r->underrun |= !buffered && !ds->eof && !ds->still_image;
             r->ts_reader = MP_PTS_MAX(r->ts_reader, ds->base_ts);
             r->ts_end = MP_PTS_MAX(r->ts_end, ds->queue->last_ts);
-            any_packets |= !!ds->reader_head;
+            any_packets |= buffered;
         }
         r->fw_bytes += get_forward_buffered_bytes(ds);
     }
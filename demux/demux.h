@@ -44,7 +44,11 @@ struct demux_reader_state {
     double ts_end; // approx. timestamp of end of buffered range
     int64_t total_bytes;
     int64_t fw_bytes;
+    int64_t cold_bytes; // compacted packet data of unused ranges
     int64_t file_cache_bytes;
+    uint64_t file_cache_syscall_rate; // disk cache I/O syscalls per second
+    uint64_t file_cache_write_rate; // disk cache bytes written per second
+    uint64_t file_cache_read_rate; // disk cache bytes read per second
     double seeking; // current low level seek target, or NOPTS
     int low_level_seeks; // number of started low level seeks
     uint64_t byte_level_seeks; // number of byte stream level seeks
@@ -236,6 +240,10 @@ typedef struct demuxer {
     // internal to demux.c
     struct demux_internal *in;
 
+    // Recycles packets freed by the packet cache. Demuxers should pass this
+    // to the new_demux_packet*() functions. Thread-safe.
+    struct demux_packet_pool *packet_pool;
+
     // Triggered when ending demuxing forcefully. Usually bound to the stream too.
     struct mp_cancel *cancel;
 
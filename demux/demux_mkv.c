@@ -46,6 +46,8 @@
 #include "options/m_config.h"
 #include "options/m_option.h"
 #include "misc/bstr.h"
+#include "misc/thread_tools.h"
+#include "osdep/threads.h"
 #include "stream/stream.h"
 #include "video/csputils.h"
 #include "video/mp_image.h"
@@ -189,6 +191,9 @@ typedef struct mkv_demuxer {
     bool index_complete;
     int index_mode;
 
+    // Scans the file for keyframes while playing, if there are no cues.
+    struct mkv_bg_index *bg_index;
+
     int edition_id;
 
     struct header_elem {
@@ -226,6 +231,7 @@ struct demux_mkv_opts {
     double subtitle_preroll_secs_index;
     int probe_duration;
     bool probe_start_time;
+    bool background_index;
 };
 
 const struct m_sub_options demux_mkv_conf = {
@@ -239,6 +245,7 @@ const struct m_sub_options demux_mkv_conf = {
         {"probe-video-duration", OPT_CHOICE(probe_duration,
             {"no", 0}, {"yes", 1}, {"full", 2})},
         {"probe-start-time", OPT_BOOL(probe_start_time)},
+        {"background-index", OPT_BOOL(background_index)},
         {0}
     },
     .size = sizeof(struct demux_mkv_opts),
@@ -247,6 +254,7 @@ const struct m_sub_options demux_mkv_conf = {
         .subtitle_preroll_secs = 1.0,
         .subtitle_preroll_secs_index = 10.0,
         .probe_start_time = true,
+        .background_index = true,
     },
 };
 
@@ -966,6 +974,343 @@ done:
     return 0;
 }
 
+// Index built by a separate thread on its own stream handle. It reads only the
+// cluster and block headers, and hands the keyframe positions over to the
+// demuxer thread, which merges them into the normal incremental index.
+struct mkv_bg_index {
+    struct mp_log *log;
+    struct stream *s;
+    struct mp_cancel *cancel;
+    pthread_t thread;
+
+    // Immutable copies of demuxer state.
+    int64_t start_pos, segment_end;
+    struct mkv_bg_track {
+        int tnum;
+        bool video;
+        bool seen;      // (used by the thread only)
+    } *tracks;
+    int num_tracks;
+
+    // Entries of the cluster currently being scanned (used by the thread only).
+    mkv_index_t *cluster;
+    int num_cluster;
+
+    pthread_mutex_t lock;
+    // --- Protected by lock.
+    mkv_index_t *entries; // not yet merged (sorted by file position)
+    int num_entries;
+    bool done;            // thread exited
+    bool complete;        // whole file was scanned
+};
+
+static void bg_index_add(struct mkv_bg_index *bg, int64_t cluster_pos,
+                         int tnum, int64_t timecode, int64_t duration)
+{
+    for (int n = 0; n < bg->num_tracks; n++) {
+        struct mkv_bg_track *t = &bg->tracks[n];
+        if (t->tnum != tnum)
+            continue;
+        // All video keyframes are useful for seeking, but other tracks are
+        // mostly keyframe-only, so 1 entry per cluster is enough.
+        if (!t->video && t->seen)
+            return;
+        t->seen = true;
+        mkv_index_t entry = {
+            .tnum = tnum,
+            .timecode = timecode,
+            .duration = duration,
+            .filepos = cluster_pos,
+        };
+        MP_TARRAY_APPEND(bg, bg->cluster, bg->num_cluster, entry);
+        return;
+    }
+}
+
+// Read the header of a Block or SimpleBlock element, and skip the data.
+static bool bg_index_read_block(stream_t *s, int64_t end, int *tnum,
+                                int16_t *time, uint8_t *flags)
+{
+    uint64_t length = ebml_read_length(s);
+    if (length == EBML_UINT_INVALID || stream_tell(s) + length > (uint64_t)end)
+        return false;
+    int64_t endpos = stream_tell(s) + length;
+
+    uint64_t num = ebml_read_length(s);
+    if (num == EBML_UINT_INVALID || num > INT_MAX || stream_tell(s) + 3 > endpos)
+        return false;
+    *tnum = num;
+    uint8_t c1 = stream_read_char(s);
+    uint8_t c2 = stream_read_char(s);
+    *time = c1 << 8 | c2;
+    *flags = stream_read_char(s);
+
+    return stream_seek_skip(s, endpos);
+}
+
+static bool bg_index_read_block_group(struct mkv_bg_index *bg, int64_t end,
+                                      int64_t cluster_pos, int64_t cluster_tc)
+{
+    stream_t *s = bg->s;
+    bool keyframe = true, have_block = false;
+    uint64_t duration = 0;
+    int tnum = 0;
+    int16_t time = 0;
+    uint8_t flags;
+
+    while (stream_tell(s) < end) {
+        switch (ebml_read_id(s)) {
+        case MATROSKA_ID_BLOCKDURATION:
+            duration = ebml_read_uint(s);
+            if (duration == EBML_UINT_INVALID)
+                return false;
+            break;
+
+        case MATROSKA_ID_BLOCK:
+            if (!bg_index_read_block(s, end, &tnum, &time, &flags))
+                return false;
+            have_block = true;
+            break;
+
+        case MATROSKA_ID_REFERENCEBLOCK:
+            if (ebml_read_int(s) == EBML_INT_INVALID)
+                return false;
+            keyframe = false;
+            break;
+
+        case MATROSKA_ID_CLUSTER:
+        case EBML_ID_INVALID:
+            return false;
+
+        default:
+            if (ebml_read_skip(mp_null_log, end, s) != 0)
+                return false;
+            break;
+        }
+    }
+
+    if (have_block && keyframe)
+        bg_index_add(bg, cluster_pos, tnum, cluster_tc + time, duration);
+    return true;
+}
+
+static bool bg_index_read_cluster(struct mkv_bg_index *bg, int64_t cluster_pos,
+                                  int64_t end)
+{
+    stream_t *s = bg->s;
+    int64_t cluster_tc = 0;
+
+    bg->num_cluster = 0;
+    for (int n = 0; n < bg->num_tracks; n++)
+        bg->tracks[n].seen = false;
+
+    while (stream_tell(s) < end) {
+        switch (ebml_read_id(s)) {
+        case MATROSKA_ID_TIMECODE: {
+            uint64_t num = ebml_read_uint(s);
+            if (num == EBML_UINT_INVALID)
+                return false;
+            cluster_tc = num;
+            break;
+        }
+
+        case MATROSKA_ID_BLOCKGROUP: {
+            uint64_t len = ebml_read_length(s);
+            if (len == EBML_UINT_INVALID || stream_tell(s) + len > (uint64_t)end)
+                return false;
+            if (!bg_index_read_block_group(bg, stream_tell(s) + len,
+                                           cluster_pos, cluster_tc))
+                return false;
+            break;
+        }
+
+        case MATROSKA_ID_SIMPLEBLOCK: {
+            int tnum;
+            int16_t time;
+            uint8_t flags;
+            if (!bg_index_read_block(s, end, &tnum, &time, &flags))
+                return false;
+            if (flags & 0x80)
+                bg_index_add(bg, cluster_pos, tnum, cluster_tc + time, 0);
+            break;
+        }
+
+        case MATROSKA_ID_CLUSTER:
+        case EBML_ID_INVALID:
+            return false;
+
+        default:
+            if (ebml_read_skip(mp_null_log, end, s) != 0)
+                return false;
+            break;
+        }
+    }
+
+    return true;
+}
+
+static void *bg_index_thread(void *arg)
+{
+    struct mkv_bg_index *bg = arg;
+    stream_t *s = bg->s;
+    bool complete = false;
+
+    mpthread_set_name("mkv-index");
+
+    if (!stream_seek(s, bg->start_pos))
+        goto done;
+
+    while (!mp_cancel_test(bg->cancel)) {
+        int64_t pos = stream_tell(s);
+        uint32_t id = ebml_read_id(s);
+        if (s->eof || (id == EBML_ID_EBML && pos >= bg->segment_end)) {
+            complete = true;
+            break;
+        }
+        if (id != MATROSKA_ID_CLUSTER) {
+            // Same recovery as read_next_block_into_queue().
+            if ((!ebml_is_mkv_level1_id(id) && id != EBML_ID_VOID) ||
+                ebml_read_skip(mp_null_log, -1, s) != 0)
+            {
+                stream_seek(s, pos);
+                if (ebml_resync_cluster(mp_null_log, s) < 0) {
+                    complete = true;
+                    break;
+                }
+            }
+            continue;
+        }
+
+        uint64_t len = ebml_read_length(s);
+        if (len == EBML_UINT_INVALID) {
+            // Unknown-sized cluster: would need parsing all elements.
+            MP_VERBOSE(bg, "Stopping at cluster without size.\n");
+            break;
+        }
+        int64_t end = stream_tell(s) + len;
+        if (!bg_index_read_cluster(bg, pos, end)) {
+            stream_seek(s, pos + 1);
+            ebml_resync_cluster(mp_null_log, s);
+            continue;
+        }
+        stream_seek_skip(s, end);
+
+        // Publish only complete clusters; the demuxer thread may use any
+        // entry as proof that the cluster was indexed.
+        if (bg->num_cluster) {
+            mp_mutex_lock(&bg->lock);
+            for (int n = 0; n < bg->num_cluster; n++)
+                MP_TARRAY_APPEND(bg, bg->entries, bg->num_entries, bg->cluster[n]);
+            mp_mutex_unlock(&bg->lock);
+        }
+    }
+
+done:
+    mp_mutex_lock(&bg->lock);
+    bg->done = true;
+    bg->complete = complete;
+    mp_mutex_unlock(&bg->lock);
+    return NULL;
+}
+
+static void bg_index_destroy(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    struct mkv_bg_index *bg = mkv_d->bg_index;
+    if (!bg)
+        return;
+
+    mp_cancel_trigger(bg->cancel);
+    pthread_join(bg->thread, NULL);
+    pthread_mutex_destroy(&bg->lock);
+    free_stream(bg->s);
+    TA_FREEP(&mkv_d->bg_index);
+}
+
+static void bg_index_start(demuxer_t *demuxer, int64_t start_pos)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    stream_t *s = demuxer->stream;
+
+    if (!mkv_d->opts->background_index || mkv_d->index_complete ||
+        !s->is_local_file || !s->seekable || s->streaming || !mkv_d->num_tracks)
+        return;
+
+    // Deferred cues will be read on the first seek, so don't compete with them.
+    if (mkv_d->index_mode == 1) {
+        for (int n = 0; n < mkv_d->num_headers; n++) {
+            if (mkv_d->headers[n].id == MATROSKA_ID_CUES)
+                return;
+        }
+    }
+
+    struct mkv_bg_index *bg = talloc_zero(mkv_d, struct mkv_bg_index);
+    bg->log = mp_log_new(bg, demuxer->log, "index");
+    bg->start_pos = start_pos;
+    bg->segment_end = mkv_d->segment_end;
+    for (int n = 0; n < mkv_d->num_tracks; n++) {
+        struct mkv_bg_track t = {
+            .tnum = mkv_d->tracks[n]->tnum,
+            .video = mkv_d->tracks[n]->type == MATROSKA_TRACK_VIDEO,
+        };
+        MP_TARRAY_APPEND(bg, bg->tracks, bg->num_tracks, t);
+    }
+
+    bg->cancel = mp_cancel_new(bg);
+    if (demuxer->cancel)
+        mp_cancel_set_parent(bg->cancel, demuxer->cancel);
+    bg->s = stream_create(s->url, STREAM_READ | demuxer->stream_origin,
+                          bg->cancel, demuxer->global);
+    if (!bg->s) {
+        talloc_free(bg);
+        return;
+    }
+
+    pthread_mutex_init(&bg->lock, NULL);
+    if (pthread_create(&bg->thread, NULL, bg_index_thread, bg)) {
+        pthread_mutex_destroy(&bg->lock);
+        free_stream(bg->s);
+        talloc_free(bg);
+        return;
+    }
+
+    mkv_d->bg_index = bg;
+    MP_VERBOSE(demuxer, "No cues, indexing in background.\n");
+}
+
+// Move the entries found by the background indexer to the index.
+static void bg_index_merge(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    struct mkv_bg_index *bg = mkv_d->bg_index;
+    if (!bg)
+        return;
+
+    mp_mutex_lock(&bg->lock);
+    for (int n = 0; n < bg->num_entries; n++) {
+        mkv_index_t *e = &bg->entries[n];
+        for (int i = 0; i < mkv_d->num_tracks; i++) {
+            if (mkv_d->tracks[i]->tnum == e->tnum) {
+                // Skips entries already covered by the incremental index.
+                add_block_position(demuxer, mkv_d->tracks[i], e->filepos,
+                                   e->timecode, e->duration);
+                break;
+            }
+        }
+    }
+    bg->num_entries = 0;
+    bool done = bg->done, complete = bg->complete;
+    mp_mutex_unlock(&bg->lock);
+
+    if (done) {
+        bg_index_destroy(demuxer);
+        if (complete) {
+            MP_VERBOSE(demuxer, "Background index complete.\n");
+            mkv_d->index_complete = true;
+        }
+    }
+}
+
 static int demux_mkv_read_chapters(struct demuxer *demuxer)
 {
     mkv_demuxer_t *mkv_d = demuxer->priv;
@@ -1379,7 +1724,8 @@ static void add_coverart(struct demuxer *demuxer)
             continue;
         struct sh_stream *sh = demux_alloc_sh_stream(STREAM_VIDEO);
         sh->codec->codec = codec;
-        sh->attached_picture = new_demux_packet_from(att->data, att->data_size);
+        sh->attached_picture = new_demux_packet_from(demuxer->packet_pool,
+                                                     att->data, att->data_size);
         if (sh->attached_picture) {
             sh->attached_picture->pts = 0;
             talloc_steal(sh, sh->attached_picture);
@@ -2049,7 +2395,8 @@ static void probe_x264_garbage(demuxer_t *demuxer)
         if (!nblock.len)
             continue;
 
-        sh->codec->first_packet = new_demux_packet_from(nblock.start, nblock.len);
+        sh->codec->first_packet = new_demux_packet_from(demuxer->packet_pool,
+                                                        nblock.start, nblock.len);
         talloc_steal(mkv_d, sh->codec->first_packet);
 
         if (nblock.start != sblock.start)
@@ -2269,6 +2616,8 @@ static int demux_mkv_open(demuxer_t *demuxer, enum demux_check check)
         probe_last_timestamp(demuxer, start_pos);
     probe_x264_garbage(demuxer);
 
+    bg_index_start(demuxer, start_pos);
+
     return 0;
 }
 
@@ -2344,7 +2693,13 @@ static int demux_mkv_read_block_lacing(struct block_info *block, int type,
         if (stream_tell(s) + size > endpos || size > (1 << 30))
             goto error;
         int pad = MPMAX(AV_INPUT_BUFFER_PADDING_SIZE, AV_LZO_INPUT_PADDING);
-        AVBufferRef *buf = av_buffer_alloc(size + pad);
+        // Reference the data directly if the stream is memory or mapped.
+        AVBufferRef *buf = stream_read_ref(s, size, pad);
+        if (buf) {
+            block->laces[block->num_laces++] = buf;
+            continue;
+        }
+        buf = av_buffer_alloc(size + pad);
         if (!buf)
             goto error;
         buf->size = size;
@@ -2448,8 +2803,9 @@ static bool handle_realaudio(demuxer_t *demuxer, mkv_track_t *track,
             goto error;
         // Release all the audio packets
         for (int x = 0; x < sph * w / apk_usize; x++) {
-            dp = new_demux_packet_from(track->audio_buf + x * apk_usize,
-                                        apk_usize);
+            dp = new_demux_packet_from(demuxer->packet_pool,
+                                       track->audio_buf + x * apk_usize,
+                                       apk_usize);
             if (!dp)
                 goto error;
             /* Put timestamp only on packets that correspond to original
@@ -2586,7 +2942,8 @@ static void mkv_parse_and_add_packet(demuxer_t *demuxer, mkv_track_t *track,
         int size = dp->len;
         uint8_t *parsed;
         if (libav_parse_wavpack(track, dp->buffer, &parsed, &size) >= 0) {
-            struct demux_packet *new = new_demux_packet_from(parsed, size);
+            struct demux_packet *new = new_demux_packet_from(demuxer->packet_pool,
+                                                             parsed, size);
             if (new) {
                 demux_packet_copy_attribs(new, dp);
                 talloc_free(dp);
@@ -2598,7 +2955,7 @@ static void mkv_parse_and_add_packet(demuxer_t *demuxer, mkv_track_t *track,
 
     if (strcmp(stream->codec->codec, "prores") == 0) {
         size_t newlen = dp->len + 8;
-        struct demux_packet *new = new_demux_packet(newlen);
+        struct demux_packet *new = new_demux_packet(demuxer->packet_pool, newlen);
         if (new) {
             AV_WB32(new->buffer + 0, newlen);
             AV_WB32(new->buffer + 4, MKBETAG('i', 'c', 'p', 'f'));
@@ -2644,7 +3001,8 @@ static void mkv_parse_and_add_packet(demuxer_t *demuxer, mkv_track_t *track,
         dp->len -= len;
         dp->pos += len;
         if (size) {
-            struct demux_packet *new = new_demux_packet_from(data, size);
+            struct demux_packet *new = new_demux_packet_from(demuxer->packet_pool,
+                                                             data, size);
             if (!new)
                 break;
             if (copy_sidedata)
@@ -2818,9 +3176,10 @@ static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
 
             if (block.start != nblock.start || block.len != nblock.len) {
                 // (avoidable copy of the entire data)
-                dp = new_demux_packet_from(nblock.start, nblock.len);
+                dp = new_demux_packet_from(demuxer->packet_pool,
+                                           nblock.start, nblock.len);
             } else {
-                dp = new_demux_packet_from_buf(data);
+                dp = new_demux_packet_from_buf(demuxer->packet_pool, data);
             }
             if (!dp)
                 break;
@@ -3114,6 +3473,7 @@ static int create_index_until(struct demuxer *demuxer, int64_t timecode)
     struct stream *s = demuxer->stream;
 
     read_deferred_cues(demuxer);
+    bg_index_merge(demuxer);
 
     if (mkv_d->index_complete)
         return 0;
@@ -3274,6 +3634,7 @@ static void demux_mkv_seek(demuxer_t *demuxer, double seek_pts, int flags)
         stream_t *s = demuxer->stream;
 
         read_deferred_cues(demuxer);
+        bg_index_merge(demuxer);
 
         int64_t size = stream_get_size(s);
         int64_t target_filepos = size * MPCLAMP(seek_pts, 0, 1);
@@ -3405,6 +3766,7 @@ static void mkv_free(struct demuxer *demuxer)
     struct mkv_demuxer *mkv_d = demuxer->priv;
     if (!mkv_d)
         return;
+    bg_index_destroy(demuxer);
     mkv_seek_reset(demuxer);
     for (int i = 0; i < mkv_d->num_tracks; i++)
         demux_mkv_free_trackentry(mkv_d->tracks[i]);
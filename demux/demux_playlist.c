@@ -18,7 +18,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
-#include <dirent.h>
 
 #include <libavutil/common.h>
 
@@ -27,11 +26,11 @@
 #include "options/m_config.h"
 #include "common/msg.h"
 #include "common/playlist.h"
+#include "misc/dir_cache.h"
 #include "misc/thread_tools.h"
 #include "options/path.h"
 #include "stream/stream.h"
 #include "osdep/io.h"
-#include "misc/natural_sort.h"
 #include "demux.h"
 
 #define PROBE_SIZE (8 * 1024)
@@ -78,6 +77,7 @@ struct pl_parser {
     char buffer[2 * 1024 * 1024];
     int utf16;
     struct playlist *pl;
+    struct dmpv_global *global;
     bool error;
     bool probing;
     bool force;
@@ -331,94 +331,31 @@ static int parse_txt(struct pl_parser *p)
 
 #define MAX_DIR_STACK 20
 
-static bool same_st(struct stat *st1, struct stat *st2)
+static void scan_dir(struct pl_parser *p, struct mp_dir_listing *dir)
 {
-    return st1->st_dev == st2->st_dev && st1->st_ino == st2->st_ino;
-}
-
-struct pl_dir_entry {
-    char *path;
-    char *name;
-    struct stat st;
-    bool is_dir;
-};
-
-static int cmp_dir_entry(const void *a, const void *b)
-{
-    struct pl_dir_entry *a_entry = (struct pl_dir_entry*) a;
-    struct pl_dir_entry *b_entry = (struct pl_dir_entry*) b;
-    if (a_entry->is_dir == b_entry->is_dir) {
-        return mp_natural_sort_cmp(a_entry->name, b_entry->name);
-    } else {
-        return a_entry->is_dir ? 1 : -1;
-    }
-}
-
-// Return true if this was a readable directory.
-static bool scan_dir(struct pl_parser *p, char *path,
-                     struct stat *dir_stack, int num_dir_stack)
-{
-    if (strlen(path) >= 8192 || num_dir_stack == MAX_DIR_STACK)
-        return false; // things like mount bind loops
-
-    DIR *dp = opendir(path);
-    if (!dp) {
-        MP_ERR(p, "Could not read directory.\n");
-        return false;
-    }
-
-    struct pl_dir_entry *dir_entries = NULL;
-    int num_dir_entries = 0;
-    int path_len = strlen(path);
     int dir_mode = p->opts->dir_mode;
 
-    struct dirent *ep;
-    while ((ep = readdir(dp))) {
-        if (ep->d_name[0] == '.')
-            continue;
-
-        if (mp_cancel_test(p->s->cancel))
-            break;
-
-        char *file = mp_path_join(p, path, ep->d_name);
-
-        struct stat st;
-        if (stat(file, &st) == 0 && S_ISDIR(st.st_mode)) {
-            if (dir_mode != DIR_IGNORE) {
-                for (int n = 0; n < num_dir_stack; n++) {
-                    if (same_st(&dir_stack[n], &st)) {
-                        MP_VERBOSE(p, "Skip recursive entry: %s\n", file);
-                        goto skip;
-                    }
-                }
-
-                struct pl_dir_entry d = {file, &file[path_len], st, true};
-                MP_TARRAY_APPEND(p, dir_entries, num_dir_entries, d);
+    // Entries are in natural sort order already; files go before directories.
+    for (int pass = 0; pass < 2; pass++) {
+        for (int n = 0; n < dir->num_entries; n++) {
+            struct mp_dir_entry *e = &dir->entries[n];
+            if (e->name[0] == '.' || e->is_dir != (pass == 1))
+                continue;
+            if (e->is_dir && dir_mode == DIR_IGNORE)
+                continue;
+
+            char *file = mp_path_join(p, dir->path, e->name);
+
+            if (e->loop) {
+                MP_VERBOSE(p, "Skip recursive entry: %s\n", file);
+            } else if (e->is_dir && dir_mode == DIR_RECURSIVE) {
+                if (e->sub)
+                    scan_dir(p, e->sub);
+            } else {
+                playlist_append_file(p->pl, file);
             }
-        } else {
-            struct pl_dir_entry f = {file, &file[path_len], .is_dir = false};
-            MP_TARRAY_APPEND(p, dir_entries, num_dir_entries, f);
-        }
-
-        skip: ;
-    }
-    closedir(dp);
-
-    if (dir_entries)
-        qsort(dir_entries, num_dir_entries, sizeof(dir_entries[0]), cmp_dir_entry);
-
-    for (int n = 0; n < num_dir_entries; n++) {
-        if (dir_mode == DIR_RECURSIVE && dir_entries[n].is_dir) {
-            dir_stack[num_dir_stack] = dir_entries[n].st;
-            char *file = dir_entries[n].path;
-            scan_dir(p, file, dir_stack, num_dir_stack + 1);
-        }
-        else {
-            playlist_append_file(p->pl, dir_entries[n].path);
         }
     }
-
-    return true;
 }
 
 static int parse_dir(struct pl_parser *p)
@@ -432,9 +369,16 @@ static int parse_dir(struct pl_parser *p)
     if (!path)
         return -1;
 
-    struct stat dir_stack[MAX_DIR_STACK];
+    // The whole tree is read up front, with subdirectories in parallel.
+    int max_depth = p->opts->dir_mode == DIR_RECURSIVE ? MAX_DIR_STACK - 1 : 0;
+    struct mp_dir_listing *dir =
+        mp_dir_scan(p, p->global, path, max_depth, p->s->cancel);
+    if (!dir) {
+        MP_ERR(p, "Could not read directory.\n");
+        return -1;
+    }
 
-    scan_dir(p, path, dir_stack, 0);
+    scan_dir(p, dir);
 
     p->add_base = false;
 
@@ -512,6 +456,7 @@ static int open_file(struct demuxer *demuxer, enum demux_check check)
     p->s = demuxer->stream;
     p->utf16 = stream_skip_bom(p->s);
     p->opts = mp_get_config_group(demuxer, demuxer->global, &demux_playlist_conf);
+    p->global = demuxer->global;
     bool ok = fmt->parse(p) >= 0 && !p->error;
     if (p->add_base)
         playlist_add_base_path(p->pl, mp_dirname(demuxer->filename));
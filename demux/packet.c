@@ -30,6 +30,7 @@
 #include "demux/ebml.h"
 
 #include "packet.h"
+#include "packet_pool.h"
 
 // Free any refcounted data dp holds (but don't free dp itself). This does not
 // care about pointers that are _not_ refcounted (like demux_packet.codec).
@@ -51,10 +52,17 @@ static void packet_destroy(void *ptr)
     demux_packet_unref_contents(dp);
 }
 
-static struct demux_packet *packet_create(void)
+// pool can be NULL.
+static struct demux_packet *packet_create(struct demux_packet_pool *pool)
 {
-    struct demux_packet *dp = talloc(NULL, struct demux_packet);
-    talloc_set_destructor(dp, packet_destroy);
+    struct AVPacket *avpkt = NULL;
+    struct demux_packet *dp = demux_packet_pool_pop(pool);
+    if (dp) {
+        avpkt = dp->avpacket;
+    } else {
+        dp = talloc(NULL, struct demux_packet);
+        talloc_set_destructor(dp, packet_destroy);
+    }
     *dp = (struct demux_packet) {
         .pts = MP_NOPTS_VALUE,
         .dts = MP_NOPTS_VALUE,
@@ -63,7 +71,7 @@ static struct demux_packet *packet_create(void)
         .start = MP_NOPTS_VALUE,
         .end = MP_NOPTS_VALUE,
         .stream = -1,
-        .avpacket = av_packet_alloc(),
+        .avpacket = avpkt ? avpkt : av_packet_alloc(),
     };
     MP_HANDLE_OOM(dp->avpacket);
     return dp;
@@ -72,11 +80,12 @@ static struct demux_packet *packet_create(void)
 // This actually preserves only data and side data, not PTS/DTS/pos/etc.
 // It also allows avpkt->data==NULL with avpkt->size!=0 - the libavcodec API
 // does not allow it, but we do it to simplify new_demux_packet().
-struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt)
+struct demux_packet *new_demux_packet_from_avpacket(struct demux_packet_pool *pool,
+                                                    struct AVPacket *avpkt)
 {
     if (avpkt->size > 1000000000)
         return NULL;
-    struct demux_packet *dp = packet_create();
+    struct demux_packet *dp = packet_create(pool);
     int r = -1;
     if (avpkt->data) {
         // We hope that this function won't need/access AVPacket input padding,
@@ -95,14 +104,15 @@ struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt)
 }
 
 // (buf must include proper padding)
-struct demux_packet *new_demux_packet_from_buf(struct AVBufferRef *buf)
+struct demux_packet *new_demux_packet_from_buf(struct demux_packet_pool *pool,
+                                               struct AVBufferRef *buf)
 {
     if (!buf)
         return NULL;
     if (buf->size > 1000000000)
         return NULL;
 
-    struct demux_packet *dp = packet_create();
+    struct demux_packet *dp = packet_create(pool);
     dp->avpacket->buf = av_buffer_ref(buf);
     if (!dp->avpacket->buf) {
         talloc_free(dp);
@@ -114,21 +124,23 @@ struct demux_packet *new_demux_packet_from_buf(struct AVBufferRef *buf)
 }
 
 // Input data doesn't need to be padded.
-struct demux_packet *new_demux_packet_from(void *data, size_t len)
+struct demux_packet *new_demux_packet_from(struct demux_packet_pool *pool,
+                                           void *data, size_t len)
 {
-    struct demux_packet *dp = new_demux_packet(len);
+    struct demux_packet *dp = new_demux_packet(pool, len);
     if (!dp)
         return NULL;
     memcpy(dp->avpacket->data, data, len);
     return dp;
 }
 
-struct demux_packet *new_demux_packet(size_t len)
+struct demux_packet *new_demux_packet(struct demux_packet_pool *pool,
+                                      size_t len)
 {
     if (len > INT_MAX)
         return NULL;
 
-    struct demux_packet *dp = packet_create();
+    struct demux_packet *dp = packet_create(pool);
     int r = av_new_packet(dp->avpacket, len);
     if (r < 0) {
         talloc_free(dp);
@@ -139,6 +151,17 @@ struct demux_packet *new_demux_packet(size_t len)
     return dp;
 }
 
+// Create a packet whose data is stored in the demuxer disk cache at pos.
+struct demux_packet *new_demux_packet_cached(struct demux_packet_pool *pool,
+                                             uint64_t pos)
+{
+    struct demux_packet *dp = packet_create(pool);
+    demux_packet_unref_contents(dp);
+    dp->is_cached = true;
+    dp->cached_data.pos = pos;
+    return dp;
+}
+
 void demux_packet_shorten(struct demux_packet *dp, size_t len)
 {
     mp_assert(len <= dp->len);
@@ -169,14 +192,15 @@ void demux_packet_copy_attribs(struct demux_packet *dst, struct demux_packet *sr
     dst->stream = src->stream;
 }
 
-struct demux_packet *demux_copy_packet(struct demux_packet *dp)
+struct demux_packet *demux_copy_packet(struct demux_packet_pool *pool,
+                                       struct demux_packet *dp)
 {
     struct demux_packet *new = NULL;
     if (dp->avpacket) {
-        new = new_demux_packet_from_avpacket(dp->avpacket);
+        new = new_demux_packet_from_avpacket(pool, dp->avpacket);
     } else {
         // Some packets might be not created by new_demux_packet*().
-        new = new_demux_packet_from(dp->buffer, dp->len);
+        new = new_demux_packet_from(pool, dp->buffer, dp->len);
     }
     if (!new)
         return NULL;
@@ -65,14 +65,24 @@ typedef struct demux_packet {
 } demux_packet_t;
 
 struct AVBufferRef;
-
-struct demux_packet *new_demux_packet(size_t len);
-struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt);
-struct demux_packet *new_demux_packet_from(void *data, size_t len);
-struct demux_packet *new_demux_packet_from_buf(struct AVBufferRef *buf);
+struct demux_packet_pool;
+
+// All constructors take an optional packet pool (see packet_pool.h) to reuse
+// packets from. Pass NULL to always allocate.
+struct demux_packet *new_demux_packet(struct demux_packet_pool *pool,
+                                      size_t len);
+struct demux_packet *new_demux_packet_from_avpacket(struct demux_packet_pool *pool,
+                                                    struct AVPacket *avpkt);
+struct demux_packet *new_demux_packet_from(struct demux_packet_pool *pool,
+                                           void *data, size_t len);
+struct demux_packet *new_demux_packet_from_buf(struct demux_packet_pool *pool,
+                                               struct AVBufferRef *buf);
+struct demux_packet *new_demux_packet_cached(struct demux_packet_pool *pool,
+                                             uint64_t pos);
 void demux_packet_shorten(struct demux_packet *dp, size_t len);
 void free_demux_packet(struct demux_packet *dp);
-struct demux_packet *demux_copy_packet(struct demux_packet *dp);
+struct demux_packet *demux_copy_packet(struct demux_packet_pool *pool,
+                                       struct demux_packet *dp);
 size_t demux_packet_estimate_total_size(struct demux_packet *dp);
 
 void demux_packet_copy_attribs(struct demux_packet *dst, struct demux_packet *src);
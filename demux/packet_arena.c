@@ -0,0 +1,181 @@
+/*
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+
+#include "common/common.h"
+#include "misc/mp_assert.h"
+
+#include "packet.h"
+#include "packet_arena.h"
+
+// A single fixed-size allocation, which packets are serialized into (similar
+// to the disk cache format). Packets read from it reference the arena memory
+// instead of copying it, so the memory is released only when the arena and
+// all packets read from it are freed.
+struct demux_packet_arena {
+    AVBufferRef *buf;
+    size_t size;            // total allocated size
+    size_t used;            // append position
+};
+
+struct arena_pkt_header {
+    uint32_t data_len;
+    uint32_t av_flags;
+    uint32_t num_sd;
+    uint32_t data_offset;   // relative to the header start
+};
+
+struct arena_sd_header {
+    uint32_t av_type;
+    uint32_t len;
+};
+
+#define ARENA_ALIGN 16
+
+// Return the arena space needed to store dp, or 0 if it can't be stored.
+size_t demux_packet_arena_entry_size(struct demux_packet *dp)
+{
+    if (!dp->avpacket || dp->is_cached)
+        return 0;
+    // See demux_cache_write().
+    if (dp->avpacket->flags & AV_PKT_FLAG_TRUSTED)
+        return 0;
+
+    size_t size = sizeof(struct arena_pkt_header);
+    for (int n = 0; n < dp->avpacket->side_data_elems; n++)
+        size += sizeof(struct arena_sd_header) + dp->avpacket->side_data[n].size;
+    size = MP_ALIGN_UP(size, ARENA_ALIGN);
+    size += MP_ALIGN_UP(dp->len + AV_INPUT_BUFFER_PADDING_SIZE, ARENA_ALIGN);
+    return size;
+}
+
+static void arena_destroy(void *p)
+{
+    struct demux_packet_arena *arena = p;
+    av_buffer_unref(&arena->buf);
+}
+
+// Create an arena that can hold exactly size bytes (the sum of
+// demux_packet_arena_entry_size() of all packets to be added). Returns NULL
+// on allocation failure.
+struct demux_packet_arena *demux_packet_arena_create(void *ta_parent,
+                                                     size_t size)
+{
+    if (size > INT_MAX)
+        return NULL;
+    AVBufferRef *buf = av_buffer_allocz(size);
+    if (!buf)
+        return NULL;
+    struct demux_packet_arena *arena =
+        talloc_zero(ta_parent, struct demux_packet_arena);
+    talloc_set_destructor(arena, arena_destroy);
+    arena->buf = buf;
+    arena->size = size;
+    return arena;
+}
+
+size_t demux_packet_arena_get_size(struct demux_packet_arena *arena)
+{
+    return arena->size;
+}
+
+// Copy the packet's data and side data to the arena. Returns the position,
+// which can be passed to demux_packet_arena_read(), or -1 if it doesn't fit.
+int64_t demux_packet_arena_add(struct demux_packet_arena *arena,
+                               struct demux_packet *dp)
+{
+    size_t size = demux_packet_arena_entry_size(dp);
+    if (!size || size > arena->size - arena->used)
+        return -1;
+
+    uint64_t pos = arena->used;
+    uint8_t *ptr = arena->buf->data + pos;
+
+    struct arena_pkt_header hd = {
+        .data_len = dp->len,
+        .av_flags = dp->avpacket->flags,
+        .num_sd = dp->avpacket->side_data_elems,
+        .data_offset = size - MP_ALIGN_UP(dp->len + AV_INPUT_BUFFER_PADDING_SIZE,
+                                          ARENA_ALIGN),
+    };
+    memcpy(ptr, &hd, sizeof(hd));
+    size_t offset = sizeof(hd);
+
+    for (int n = 0; n < dp->avpacket->side_data_elems; n++) {
+        AVPacketSideData *sd = &dp->avpacket->side_data[n];
+        struct arena_sd_header sd_hd = {
+            .av_type = sd->type,
+            .len = sd->size,
+        };
+        memcpy(ptr + offset, &sd_hd, sizeof(sd_hd));
+        offset += sizeof(sd_hd);
+        memcpy(ptr + offset, sd->data, sd->size);
+        offset += sd->size;
+    }
+
+    // (The padding is already zeroed.)
+    if (dp->len)
+        memcpy(ptr + hd.data_offset, dp->buffer, dp->len);
+
+    arena->used += size;
+    return pos;
+}
+
+// Return a new packet for the data at pos. The packet data references the
+// arena; side data is copied.
+struct demux_packet *demux_packet_arena_read(struct demux_packet_arena *arena,
+                                             struct demux_packet_pool *pool,
+                                             uint64_t pos)
+{
+    mp_assert(pos < arena->used);
+
+    uint8_t *ptr = arena->buf->data + pos;
+    struct arena_pkt_header hd;
+    memcpy(&hd, ptr, sizeof(hd));
+
+    AVBufferRef *ref = av_buffer_ref(arena->buf);
+    if (!ref)
+        return NULL;
+    ref->data = ptr + hd.data_offset;
+    ref->size = hd.data_len;
+    struct demux_packet *dp = new_demux_packet_from_buf(pool, ref);
+    av_buffer_unref(&ref);
+    if (!dp)
+        return NULL;
+
+    dp->avpacket->flags = hd.av_flags;
+
+    size_t offset = sizeof(hd);
+    for (uint32_t n = 0; n < hd.num_sd; n++) {
+        struct arena_sd_header sd_hd;
+        memcpy(&sd_hd, ptr + offset, sizeof(sd_hd));
+        offset += sizeof(sd_hd);
+
+        uint8_t *sd = av_packet_new_side_data(dp->avpacket, sd_hd.av_type,
+                                              sd_hd.len);
+        if (!sd) {
+            talloc_free(dp);
+            return NULL;
+        }
+        memcpy(sd, ptr + offset, sd_hd.len);
+        offset += sd_hd.len;
+    }
+
+    return dp;
+}
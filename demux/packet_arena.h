@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct demux_packet;
+struct demux_packet_pool;
+struct demux_packet_arena;
+
+size_t demux_packet_arena_entry_size(struct demux_packet *dp);
+
+struct demux_packet_arena *demux_packet_arena_create(void *ta_parent,
+                                                     size_t size);
+size_t demux_packet_arena_get_size(struct demux_packet_arena *arena);
+
+int64_t demux_packet_arena_add(struct demux_packet_arena *arena,
+                               struct demux_packet *dp);
+struct demux_packet *demux_packet_arena_read(struct demux_packet_arena *arena,
+                                             struct demux_packet_pool *pool,
+                                             uint64_t pos);
@@ -0,0 +1,195 @@
+/*
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libavcodec/avcodec.h>
+
+#include "common/common.h"
+#include "osdep/threads.h"
+
+#include "packet.h"
+#include "packet_pool.h"
+
+// Keeps released demux_packets (and their AVPacket shells) for reuse, so that
+// the demuxer doesn't need to go through the allocator for every packet.
+struct demux_packet_pool {
+    pthread_mutex_t lock;
+
+    // Singly linked via demux_packet.next. All packets have their contents
+    // unreferenced.
+    struct demux_packet *head;
+    int num_free;
+    int max_free;
+
+    uint64_t hits, misses;
+};
+
+static void pool_destroy(void *p)
+{
+    struct demux_packet_pool *pool = p;
+
+    struct demux_packet *dp = pool->head;
+    while (dp) {
+        struct demux_packet *next = dp->next;
+        talloc_free(dp);
+        dp = next;
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+}
+
+// Create a pool which holds at most max_free unused packets. Free with
+// talloc_free(). Packets popped from the pool are independent allocations,
+// and may outlive it.
+struct demux_packet_pool *demux_packet_pool_create(void *ta_parent,
+                                                   int max_free)
+{
+    struct demux_packet_pool *pool = talloc_zero(ta_parent,
+                                                 struct demux_packet_pool);
+    talloc_set_destructor(pool, pool_destroy);
+    mp_mutex_init(&pool->lock);
+    pool->max_free = max_free;
+    return pool;
+}
+
+// Change the high-water mark. Excess packets are released immediately.
+void demux_packet_pool_set_max(struct demux_packet_pool *pool, int max_free)
+{
+    struct demux_packet *excess = NULL;
+
+    mp_mutex_lock(&pool->lock);
+    pool->max_free = max_free;
+    while (pool->num_free > pool->max_free) {
+        struct demux_packet *dp = pool->head;
+        pool->head = dp->next;
+        pool->num_free--;
+        dp->next = excess;
+        excess = dp;
+    }
+    mp_mutex_unlock(&pool->lock);
+
+    while (excess) {
+        struct demux_packet *next = excess->next;
+        talloc_free(excess);
+        excess = next;
+    }
+}
+
+// Return an unused packet, or NULL if the pool is empty (or NULL). The packet
+// has undefined field values, except avpacket, which is either NULL or an
+// unreferenced AVPacket.
+struct demux_packet *demux_packet_pool_pop(struct demux_packet_pool *pool)
+{
+    if (!pool)
+        return NULL;
+
+    mp_mutex_lock(&pool->lock);
+    struct demux_packet *dp = pool->head;
+    if (dp) {
+        pool->head = dp->next;
+        pool->num_free--;
+        pool->hits++;
+    } else {
+        pool->misses++;
+    }
+    mp_mutex_unlock(&pool->lock);
+
+    return dp;
+}
+
+static void release_contents(struct demux_packet *dp)
+{
+    // Keep the AVPacket itself; av_packet_alloc() is part of what we save.
+    if (dp->avpacket)
+        av_packet_unref(dp->avpacket);
+    dp->buffer = NULL;
+    dp->len = 0;
+    dp->is_cached = false;
+}
+
+// Give up ownership of dp. It is either kept for reuse, or freed. Like
+// talloc_free(), this accepts NULL for both arguments.
+void demux_packet_pool_push(struct demux_packet_pool *pool,
+                            struct demux_packet *dp)
+{
+    if (!dp)
+        return;
+    dp->next = NULL;
+    demux_packet_pool_push_list(pool, dp);
+}
+
+// Like demux_packet_pool_push(), but for a list of packets linked with
+// demux_packet.next.
+void demux_packet_pool_push_list(struct demux_packet_pool *pool,
+                                 struct demux_packet *head)
+{
+    if (!pool) {
+        while (head) {
+            struct demux_packet *next = head->next;
+            talloc_free(head);
+            head = next;
+        }
+        return;
+    }
+
+    // Do the potentially expensive unreferencing outside of the lock.
+    struct demux_packet *tail = NULL;
+    int num = 0;
+    for (struct demux_packet *dp = head; dp; dp = dp->next) {
+        release_contents(dp);
+        tail = dp;
+        num++;
+    }
+
+    if (!head)
+        return;
+
+    mp_mutex_lock(&pool->lock);
+    if (pool->num_free + num <= pool->max_free) {
+        tail->next = pool->head;
+        pool->head = head;
+        pool->num_free += num;
+        head = NULL;
+    } else {
+        while (head && pool->num_free < pool->max_free) {
+            struct demux_packet *next = head->next;
+            head->next = pool->head;
+            pool->head = head;
+            pool->num_free++;
+            head = next;
+        }
+    }
+    mp_mutex_unlock(&pool->lock);
+
+    // Above the high-water mark.
+    while (head) {
+        struct demux_packet *next = head->next;
+        talloc_free(head);
+        head = next;
+    }
+}
+
+void demux_packet_pool_get_stats(struct demux_packet_pool *pool,
+                                 struct demux_packet_pool_stats *stats)
+{
+    mp_mutex_lock(&pool->lock);
+    *stats = (struct demux_packet_pool_stats){
+        .hits = pool->hits,
+        .misses = pool->misses,
+        .num_free = pool->num_free,
+    };
+    mp_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+struct demux_packet;
+struct demux_packet_pool;
+
+struct demux_packet_pool_stats {
+    uint64_t hits;      // allocations served from the pool
+    uint64_t misses;    // allocations that had to use the allocator
+    int num_free;       // packets currently held by the pool
+};
+
+struct demux_packet_pool *demux_packet_pool_create(void *ta_parent,
+                                                   int max_free);
+void demux_packet_pool_set_max(struct demux_packet_pool *pool, int max_free);
+
+struct demux_packet *demux_packet_pool_pop(struct demux_packet_pool *pool);
+void demux_packet_pool_push(struct demux_packet_pool *pool,
+                            struct demux_packet *dp);
+void demux_packet_pool_push_list(struct demux_packet_pool *pool,
+                                 struct demux_packet *head);
+
+void demux_packet_pool_get_stats(struct demux_packet_pool *pool,
+                                 struct demux_packet_pool_stats *stats);
@@ -238,7 +238,12 @@ char *mp_json_encode_event(struct dmpv_event *event);
 
 // Given the raw IPC input buffer "buf", remove the first newline-separated
 // command, execute it and return the result (if any) as an allocated string.
+// The command is parsed in place, and *buf is only advanced past it; the
+// caller still owns the memory. If arena is not NULL, it's used for parsing
+// JSON, and reset afterwards.
 struct dmpv_handle;
-char *mp_ipc_consume_next_command(struct dmpv_handle *client, void *ctx, bstr *buf);
+struct json_arena;
+char *mp_ipc_consume_next_command(struct dmpv_handle *client, void *ctx,
+                                  bstr *buf, struct json_arena *arena);
 
 #endif /* MPLAYER_INPUT_H */
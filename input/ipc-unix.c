@@ -15,6 +15,8 @@
  * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
+
 #include <errno.h>
 #include <unistd.h>
 #include <limits.h>
@@ -25,6 +27,10 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 
+#if HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include "osdep/io.h"
 #include "osdep/threads.h"
 
@@ -33,6 +39,8 @@
 #include "common/msg.h"
 #include "input/input.h"
 #include "misc/client.h"
+#include "misc/json.h"
+#include "misc/thread_pool.h"
 #include "options/m_config.h"
 #include "options/options.h"
 #include "options/path.h"
@@ -42,13 +50,54 @@
 #define MSG_NOSIGNAL 0
 #endif
 
+// All clients are served by a single event loop thread. Only the commands
+// (which block on the core) run on a worker pool, one batch per client at a
+// time, so a client's replies and events are written in the same order as
+// they were with a thread per client.
+
+struct client_arg;
+
+struct ipc_watch {
+    int fd;
+    int events;                 // watched POLLIN/POLLOUT, 0 if not watched
+    struct client_arg *client;  // NULL for the loop's own fds
+};
+
 struct mp_ipc_ctx {
     struct mp_log *log;
     struct mp_client_api *client_api;
     const char *path;
+    int64_t max_buffer;         // per-client output/input limit
 
     pthread_t thread;
-    int death_pipe[2];
+    int wakeup_pipe[2];
+    struct mp_thread_pool *pool;
+
+    pthread_mutex_t lock;
+
+    // -- protected by lock
+    struct client_arg **new_clients;
+    int num_new_clients;
+    struct client_arg **done_clients;   // command batch finished on a worker
+    int num_done_clients;
+    int num_active;             // clients queued or being served
+    bool terminate;             // exit once no clients are left
+    bool detached;              // thread frees the ctx on exit
+
+    // -- event loop thread only
+    struct ipc_watch wakeup_watch;
+    struct ipc_watch listen_watch;
+    struct client_arg **clients;
+    int num_clients;
+    int client_num;
+    // Encoded events that have no payload, and are the same for all clients.
+    char *event_cache[64];
+#if HAVE_EPOLL
+    int epoll_fd;
+#else
+    struct pollfd *fds;
+    struct ipc_watch **fd_watches;
+#endif
 };
 
 struct client_arg {
@@ -61,191 +110,379 @@ struct client_arg {
     bool quit_on_close;
 
     bool writable;
+
+    // -- event loop thread only
+    struct ipc_watch pipe_watch;    // dmpv_get_wakeup_pipe()
+    struct ipc_watch fd_watch;      // client_fd
+    bstr client_msg;                // received, not yet executed
+    bstr out;                       // not yet written
+    bool busy;                      // a worker is executing cmd_msg
+    bool eof;                       // no more input
+    bool dead;                      // destroy when not busy
+
+    // -- owned by the worker while busy
+    struct mp_ipc_ctx *ipc;
+    bstr cmd_msg;
+    bstr reply;
+    struct json_arena *json;        // reused for parsing each command
 };
 
-static int ipc_write_str(struct client_arg *client, const char *buf)
+static void wakeup_loop(struct mp_ipc_ctx *ctx)
 {
-    size_t count = strlen(buf);
-    while (count > 0) {
-        ssize_t rc = send(client->client_fd, buf, count, MSG_NOSIGNAL);
-        if (rc <= 0) {
-            if (rc == 0)
-                return -1;
-
-            if (errno == EBADF || errno == ENOTSOCK) {
-                client->writable = false;
-                return 0;
-            }
+    (void)write(ctx->wakeup_pipe[1], &(char){0}, 1);
+}
 
-            if (errno == EINTR || errno == EAGAIN)
-                continue;
+static void watch_fd(struct mp_ipc_ctx *ctx, struct ipc_watch *w, int events)
+{
+    if (w->events == events)
+        return;
+#if HAVE_EPOLL
+    struct epoll_event ev = {
+        .events = ((events & POLLIN) ? EPOLLIN : 0) |
+                  ((events & POLLOUT) ? EPOLLOUT : 0),
+        .data.ptr = w,
+    };
+    int op = !w->events ? EPOLL_CTL_ADD : events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    if (epoll_ctl(ctx->epoll_fd, op, w->fd, &ev) < 0)
+        MP_ERR(ctx, "Could not watch fd (%s)\n", mp_strerror(errno));
+#endif
+    w->events = events;
+}
 
-            return rc;
-        }
+struct ipc_ready {
+    struct ipc_watch *w;
+    int revents;
+};
 
-        count -= rc;
-        buf   += rc;
+// Wait until any watched fd is ready. Returns the number of entries in ready.
+static int wait_fds(struct mp_ipc_ctx *ctx, struct ipc_ready *ready, int max)
+{
+#if HAVE_EPOLL
+    struct epoll_event evs[64];
+    int num = epoll_wait(ctx->epoll_fd, evs, MPMIN(max, 64), -1);
+    if (num < 0) {
+        if (errno != EINTR)
+            MP_ERR(ctx, "Poll error\n");
+        return 0;
     }
-
-    return 0;
+    for (int n = 0; n < num; n++) {
+        uint32_t e = evs[n].events;
+        ready[n] = (struct ipc_ready){
+            .w = evs[n].data.ptr,
+            .revents = ((e & EPOLLIN) ? POLLIN : 0) |
+                       ((e & EPOLLOUT) ? POLLOUT : 0) |
+                       ((e & (EPOLLHUP | EPOLLERR)) ? POLLHUP : 0),
+        };
+    }
+    return num;
+#else
+    int num_fds = 0;
+    struct ipc_watch *watches[2] = {&ctx->wakeup_watch, &ctx->listen_watch};
+    for (int n = 0; n < 2 + ctx->num_clients * 2; n++) {
+        struct ipc_watch *w = n < 2 ? watches[n] :
+            (n & 1) ? &ctx->clients[n / 2 - 1]->fd_watch
+                    : &ctx->clients[n / 2 - 1]->pipe_watch;
+        if (!w->events)
+            continue;
+        MP_TARRAY_GROW(ctx, ctx->fds, num_fds);
+        MP_TARRAY_GROW(ctx, ctx->fd_watches, num_fds);
+        ctx->fds[num_fds] = (struct pollfd){.fd = w->fd, .events = w->events};
+        ctx->fd_watches[num_fds] = w;
+        num_fds++;
+    }
+    if (poll(ctx->fds, num_fds, -1) < 0) {
+        if (errno != EINTR)
+            MP_ERR(ctx, "Poll error\n");
+        return 0;
+    }
+    int num = 0;
+    for (int n = 0; n < num_fds && num < max; n++) {
+        int e = ctx->fds[n].revents;
+        if (!e)
+            continue;
+        ready[num++] = (struct ipc_ready){
+            .w = ctx->fd_watches[n],
+            .revents = (e & (POLLIN | POLLOUT)) |
+                       ((e & (POLLHUP | POLLERR | POLLNVAL)) ? POLLHUP : 0),
+        };
+    }
+    return num;
+#endif
 }
 
-static void *client_thread(void *p)
+// Append the encoded event to the client's output buffer.
+static bool append_event(struct mp_ipc_ctx *ctx, struct client_arg *arg,
+                         dmpv_event *event)
 {
-    pthread_detach(pthread_self());
+    bool shared = !event->data && !event->error && !event->reply_userdata &&
+                  event->event_id < MP_ARRAY_SIZE(ctx->event_cache);
+    char *msg = shared ? ctx->event_cache[event->event_id] : NULL;
+    if (!msg) {
+        msg = mp_json_encode_event(event);
+        if (!msg)
+            return false;
+        if (shared)
+            ctx->event_cache[event->event_id] = talloc_steal(ctx, msg);
+    }
+    bstr_xappend(arg, &arg->out, bstr0(msg));
+    if (!shared)
+        talloc_free(msg);
+    return true;
+}
 
-    // We don't use MSG_NOSIGNAL because the moldy fruit OS doesn't support it.
-    struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_RESTART };
-    sigfillset(&sa.sa_mask);
-    sigaction(SIGPIPE, &sa, NULL);
+// Move events from the client API queue to the output buffer, until it's full.
+static bool drain_events(struct mp_ipc_ctx *ctx, struct client_arg *arg)
+{
+    while (arg->out.len < ctx->max_buffer) {
+        dmpv_event *event = dmpv_wait_event(arg->client, 0);
 
-    int rc;
+        if (event->event_id == DMPV_EVENT_NONE)
+            break;
 
-    struct client_arg *arg = p;
-    bstr client_msg = { talloc_strdup(NULL, ""), 0 };
+        if (event->event_id == DMPV_EVENT_SHUTDOWN)
+            return false;
 
-    mpthread_set_name(arg->client_name);
+        if (!arg->writable)
+            continue;
 
-    int pipe_fd = dmpv_get_wakeup_pipe(arg->client);
-    if (pipe_fd < 0) {
-        MP_ERR(arg, "Could not get wakeup pipe\n");
-        goto done;
+        if (!append_event(ctx, arg, event)) {
+            MP_ERR(arg, "Encoding error\n");
+            return false;
+        }
     }
+    return true;
+}
 
-    MP_VERBOSE(arg, "Client connected\n");
+// Write as much of the output buffer as possible without blocking.
+static bool flush_output(struct client_arg *arg)
+{
+    size_t done = 0;
+    while (done < arg->out.len && arg->writable) {
+        ssize_t rc = send(arg->client_fd, arg->out.start + done,
+                          arg->out.len - done, MSG_NOSIGNAL);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
 
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = pipe_fd},
-        {.events = POLLIN, .fd = arg->client_fd},
-    };
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
 
-    fcntl(arg->client_fd, F_SETFL, fcntl(arg->client_fd, F_GETFL, 0) | O_NONBLOCK);
+            if (errno == EBADF || errno == ENOTSOCK) {
+                arg->writable = false;
+                break;
+            }
 
-    while (1) {
-        rc = poll(fds, 2, 0);
-        if (rc == 0)
-            rc = poll(fds, 2, -1);
-        if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
-            continue;
+            MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
+            return false;
         }
+        if (rc == 0)
+            return false;
 
-        if (fds[0].revents & POLLIN) {
-            mp_flush_wakeup_pipe(pipe_fd);
-
-            while (1) {
-                dmpv_event *event = dmpv_wait_event(arg->client, 0);
+        done += rc;
+    }
 
-                if (event->event_id == DMPV_EVENT_NONE)
-                    break;
+    if (!arg->writable)
+        done = arg->out.len;
+    memmove(arg->out.start, arg->out.start + done, arg->out.len - done);
+    arg->out.len -= done;
+    return true;
+}
 
-                if (event->event_id == DMPV_EVENT_SHUTDOWN)
-                    goto done;
+static bool read_input(struct mp_ipc_ctx *ctx, struct client_arg *arg)
+{
+    while (arg->client_msg.len < ctx->max_buffer) {
+        char buf[4096];
 
-                if (!arg->writable)
-                    continue;
+        ssize_t bytes = read(arg->client_fd, buf, sizeof(buf));
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
 
-                char *event_msg = mp_json_encode_event(event);
-                if (!event_msg) {
-                    MP_ERR(arg, "Encoding error\n");
-                    goto done;
-                }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
 
-                rc = ipc_write_str(arg, event_msg);
-                talloc_free(event_msg);
-                if (rc < 0) {
-                    MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
-            }
+            MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
+            return false;
         }
 
-        if (fds[1].revents & (POLLIN | POLLHUP | POLLNVAL)) {
-            while (1) {
-                char buf[128];
-                bstr append = { buf, 0 };
+        if (bytes == 0) {
+            MP_VERBOSE(arg, "Client disconnected\n");
+            return false;
+        }
 
-                ssize_t bytes = read(arg->client_fd, buf, sizeof(buf));
-                if (bytes < 0) {
-                    if (errno == EAGAIN)
-                        break;
+        bstr_xappend(arg, &arg->client_msg, (bstr){buf, bytes});
+    }
+    return true;
+}
 
-                    MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
+static void run_commands(void *p)
+{
+    struct client_arg *arg = p;
+    struct mp_ipc_ctx *ctx = arg->ipc;
+
+    if (!arg->json)
+        arg->json = json_arena_create(NULL);
+
+    bstr msg = arg->cmd_msg;
+    while (bstrchr(msg, '\n') != -1) {
+        char *reply_msg = mp_ipc_consume_next_command(arg->client, NULL,
+                                                      &msg, arg->json);
+        if (reply_msg)
+            bstr_xappend(NULL, &arg->reply, bstr0(reply_msg));
+        talloc_free(reply_msg);
+    }
 
-                if (bytes == 0) {
-                    MP_VERBOSE(arg, "Client disconnected\n");
-                    goto done;
-                }
+    mp_mutex_lock(&ctx->lock);
+    MP_TARRAY_APPEND(ctx, ctx->done_clients, ctx->num_done_clients, arg);
+    wakeup_loop(ctx);
+    mp_mutex_unlock(&ctx->lock);
+}
 
-                append.len = bytes;
+// Hand all complete lines received so far to a worker.
+static void start_commands(struct mp_ipc_ctx *ctx, struct client_arg *arg)
+{
+    int end = bstrrchr(arg->client_msg, '\n') + 1;
+    arg->cmd_msg = bstrdup(NULL, bstr_splice(arg->client_msg, 0, end));
+    bstr rest = bstrdup(arg, bstr_cut(arg->client_msg, end));
+    talloc_free(arg->client_msg.start);
+    arg->client_msg = rest;
+    arg->busy = true;
+
+    if (!mp_thread_pool_queue(ctx->pool, run_commands, arg))
+        run_commands(arg);
+}
 
-                bstr_xappend(NULL, &client_msg, append);
+// Make progress on everything that can be done for this client right now,
+// and update the watched fds accordingly.
+static void update_client(struct mp_ipc_ctx *ctx, struct client_arg *arg)
+{
+    if (arg->dead)
+        return;
 
-                while (bstrchr(client_msg, '\n') != -1) {
-                    char *reply_msg = mp_ipc_consume_next_command(arg->client,
-                        NULL, &client_msg);
+    while (1) {
+        if (!arg->busy && !drain_events(ctx, arg))
+            goto kill;
+        bool full = arg->out.len >= ctx->max_buffer;
+        if (!flush_output(arg))
+            goto kill;
+        // If the buffer was full, more events may be left in the queue.
+        if (!full || arg->out.len >= ctx->max_buffer || arg->busy)
+            break;
+    }
 
-                    if (reply_msg && arg->writable) {
-                        rc = ipc_write_str(arg, reply_msg);
-                        if (rc < 0) {
-                            MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                            talloc_free(reply_msg);
-                            goto done;
-                        }
-                    }
+    bool have_cmd = bstrchr(arg->client_msg, '\n') != -1;
+    if (!arg->busy && have_cmd && arg->out.len < ctx->max_buffer) {
+        start_commands(ctx, arg);
+        have_cmd = false;
+    }
 
-                    talloc_free(reply_msg);
-                }
-            }
-        }
+    if (!have_cmd && arg->client_msg.len >= ctx->max_buffer) {
+        MP_ERR(arg, "Command too long\n");
+        goto kill;
     }
 
-done:
-    if (client_msg.len > 0)
+    if (arg->eof && !arg->busy && !have_cmd && !arg->out.len)
+        goto kill;
+
+    bool ready = !arg->busy && arg->out.len < ctx->max_buffer;
+    watch_fd(ctx, &arg->pipe_watch, ready ? POLLIN : 0);
+    watch_fd(ctx, &arg->fd_watch, (ready && !arg->eof ? POLLIN : 0) |
+                                  (arg->out.len ? POLLOUT : 0));
+    return;
+
+kill:
+    arg->dead = true;
+    watch_fd(ctx, &arg->pipe_watch, 0);
+    watch_fd(ctx, &arg->fd_watch, 0);
+}
+
+static void destroy_handle(void *p)
+{
+    dmpv_destroy(p);
+}
+
+static void *terminate_thread(void *p)
+{
+    mpthread_set_name("ipc quit");
+    dmpv_terminate_destroy(p);
+    return NULL;
+}
+
+static void destroy_client(struct mp_ipc_ctx *ctx, struct client_arg *arg)
+{
+    watch_fd(ctx, &arg->pipe_watch, 0);
+    watch_fd(ctx, &arg->fd_watch, 0);
+
+    if (arg->client_msg.len > 0)
         MP_WARN(arg, "Ignoring unterminated command on disconnect.\n");
-    talloc_free(client_msg.start);
     if (arg->close_client_fd)
         close(arg->client_fd);
+
+    // Destroying the handle can block (for example on outstanding async
+    // requests), and terminating the core waits until all clients are gone,
+    // which requires this thread to keep running.
     struct dmpv_handle *h = arg->client;
-    bool quit = arg->quit_on_close;
-    talloc_free(arg);
-    if (quit) {
-        dmpv_terminate_destroy(h);
-    } else {
+    if (h && arg->quit_on_close) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, terminate_thread, h)) {
+            dmpv_terminate_destroy(h);
+        } else {
+            pthread_detach(thread);
+        }
+    } else if (h && !mp_thread_pool_queue(ctx->pool, destroy_handle, h)) {
         dmpv_destroy(h);
     }
-    return NULL;
+
+    talloc_free(arg->json);
+    talloc_free(arg);
+
+    mp_mutex_lock(&ctx->lock);
+    ctx->num_active -= 1;
+    mp_mutex_unlock(&ctx->lock);
 }
 
-static bool ipc_start_client(struct mp_ipc_ctx *ctx, struct client_arg *client,
-                             bool free_on_init_fail)
+static void add_client(struct mp_ipc_ctx *ctx, struct client_arg *arg)
 {
-    if (!client->client)
-        client->client = mp_new_client(ctx->client_api, client->client_name);
-    if (!client->client)
-        goto err;
+    if (!arg->client)
+        arg->client = mp_new_client(ctx->client_api, arg->client_name);
+    if (!arg->client) {
+        destroy_client(ctx, arg);
+        return;
+    }
 
-    client->log = mp_client_get_log(client->client);
+    arg->log = mp_client_get_log(arg->client);
+    arg->ipc = ctx;
 
-    pthread_t client_thr;
-    if (pthread_create(&client_thr, NULL, client_thread, client))
-        goto err;
+    MP_TARRAY_APPEND(ctx, ctx->clients, ctx->num_clients, arg);
 
-    return true;
+    int pipe_fd = dmpv_get_wakeup_pipe(arg->client);
+    if (pipe_fd < 0) {
+        MP_ERR(arg, "Could not get wakeup pipe\n");
+        arg->dead = true;
+        return;
+    }
+
+    MP_VERBOSE(arg, "Client connected\n");
 
-err:
-    if (free_on_init_fail) {
-        if (client->client)
-            dmpv_destroy(client->client);
+    fcntl(arg->client_fd, F_SETFL, fcntl(arg->client_fd, F_GETFL, 0) | O_NONBLOCK);
 
-        if (client->close_client_fd)
-            close(client->client_fd);
-    }
+    arg->pipe_watch = (struct ipc_watch){.fd = pipe_fd, .client = arg};
+    arg->fd_watch = (struct ipc_watch){.fd = arg->client_fd, .client = arg};
+    update_client(ctx, arg);
+}
 
-    talloc_free(client);
-    return false;
+// Pass a client to the event loop, which takes over ownership.
+static bool ipc_start_client(struct mp_ipc_ctx *ctx, struct client_arg *client)
+{
+    mp_mutex_lock(&ctx->lock);
+    bool ok = !ctx->terminate;
+    if (ok) {
+        MP_TARRAY_APPEND(ctx, ctx->new_clients, ctx->num_new_clients, client);
+        ctx->num_active += 1;
+        wakeup_loop(ctx);
+    }
+    mp_mutex_unlock(&ctx->lock);
+    return ok;
 }
 
 static void ipc_start_client_json(struct mp_ipc_ctx *ctx, int id, int fd)
@@ -260,12 +497,19 @@ static void ipc_start_client_json(struct mp_ipc_ctx *ctx, int id, int fd)
         .writable = true,
     };
 
-    ipc_start_client(ctx, client, true);
+    if (!ipc_start_client(ctx, client)) {
+        if (client->close_client_fd)
+            close(client->client_fd);
+        talloc_free(client);
+    }
 }
 
 bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct dmpv_handle *h,
                               int out_fd[2])
 {
+    if (!ctx)
+        return false;
+
     int pair[2];
     if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair))
         return false;
@@ -281,7 +525,8 @@ bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct dmpv_handle *h,
         .writable = true,
     };
 
-    if (!ipc_start_client(ctx, client, false)) {
+    if (!ipc_start_client(ctx, client)) {
+        talloc_free(client);
         close(pair[0]);
         close(pair[1]);
         return false;
@@ -292,23 +537,19 @@ bool mp_ipc_start_anon_client(struct mp_ipc_ctx *ctx, struct dmpv_handle *h,
     return true;
 }
 
-static void *ipc_thread(void *p)
+static int open_listener(struct mp_ipc_ctx *arg)
 {
     int rc;
 
     int ipc_fd;
     struct sockaddr_un ipc_un = {0};
 
-    struct mp_ipc_ctx *arg = p;
-
-    mpthread_set_name("ipc socket listener");
-
     MP_VERBOSE(arg, "Starting IPC master\n");
 
     ipc_fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (ipc_fd < 0) {
         MP_ERR(arg, "Could not create IPC socket\n");
-        goto done;
+        goto error;
     }
 
     fchmod(ipc_fd, 0600);
@@ -316,7 +557,7 @@ static void *ipc_thread(void *p)
     size_t path_len = strlen(arg->path);
     if (path_len >= sizeof(ipc_un.sun_path) - 1) {
         MP_ERR(arg, "Could not create IPC socket\n");
-        goto done;
+        goto error;
     }
 
     ipc_un.sun_family = AF_UNIX,
@@ -333,49 +574,155 @@ static void *ipc_thread(void *p)
     rc = bind(ipc_fd, (struct sockaddr *) &ipc_un, addr_len);
     if (rc < 0) {
         MP_ERR(arg, "Could not bind IPC socket\n");
-        goto done;
+        goto error;
     }
 
     rc = listen(ipc_fd, 10);
     if (rc < 0) {
         MP_ERR(arg, "Could not listen on IPC socket\n");
-        goto done;
+        goto error;
     }
 
     MP_VERBOSE(arg, "Listening to IPC socket.\n");
 
-    int client_num = 0;
+    return ipc_fd;
 
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = arg->death_pipe[0]},
-        {.events = POLLIN, .fd = ipc_fd},
-    };
+error:
+    if (ipc_fd >= 0)
+        close(ipc_fd);
+    return -1;
+}
+
+static void close_listener(struct mp_ipc_ctx *ctx)
+{
+    if (ctx->listen_watch.fd >= 0) {
+        watch_fd(ctx, &ctx->listen_watch, 0);
+        close(ctx->listen_watch.fd);
+        ctx->listen_watch.fd = -1;
+    }
+}
+
+static void handle_wakeup(struct mp_ipc_ctx *ctx)
+{
+    mp_flush_wakeup_pipe(ctx->wakeup_pipe[0]);
+
+    mp_mutex_lock(&ctx->lock);
+    struct client_arg **new_clients = ctx->new_clients;
+    int num_new_clients = ctx->num_new_clients;
+    struct client_arg **done_clients = ctx->done_clients;
+    int num_done_clients = ctx->num_done_clients;
+    ctx->new_clients = ctx->done_clients = NULL;
+    ctx->num_new_clients = ctx->num_done_clients = 0;
+    bool terminate = ctx->terminate;
+    mp_mutex_unlock(&ctx->lock);
+
+    if (terminate)
+        close_listener(ctx);
+
+    for (int n = 0; n < num_done_clients; n++) {
+        struct client_arg *arg = done_clients[n];
+        bstr_xappend(arg, &arg->out, arg->reply);
+        TA_FREEP(&arg->reply.start);
+        arg->reply.len = 0;
+        TA_FREEP(&arg->cmd_msg.start);
+        arg->cmd_msg.len = 0;
+        arg->busy = false;
+        update_client(ctx, arg);
+    }
+
+    for (int n = 0; n < num_new_clients; n++)
+        add_client(ctx, new_clients[n]);
+
+    talloc_free(new_clients);
+    talloc_free(done_clients);
+}
+
+static void handle_listener(struct mp_ipc_ctx *ctx)
+{
+    int client_fd = accept(ctx->listen_watch.fd, NULL, NULL);
+    if (client_fd < 0) {
+        MP_ERR(ctx, "Could not accept IPC client\n");
+        close_listener(ctx);
+        return;
+    }
+
+    ipc_start_client_json(ctx, ctx->client_num++, client_fd);
+}
+
+static void free_ipc_ctx(struct mp_ipc_ctx *ctx)
+{
+    close(ctx->wakeup_pipe[0]);
+    close(ctx->wakeup_pipe[1]);
+    pthread_mutex_destroy(&ctx->lock);
+    talloc_free(ctx);
+}
+
+static void *ipc_thread(void *p)
+{
+    struct mp_ipc_ctx *ctx = p;
+
+    mpthread_set_name("ipc");
+
+    // We don't use MSG_NOSIGNAL because the moldy fruit OS doesn't support it.
+    struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_RESTART };
+    sigfillset(&sa.sa_mask);
+    sigaction(SIGPIPE, &sa, NULL);
+
+    watch_fd(ctx, &ctx->wakeup_watch, POLLIN);
+    if (ctx->path && ctx->path[0]) {
+        ctx->listen_watch.fd = open_listener(ctx);
+        if (ctx->listen_watch.fd >= 0)
+            watch_fd(ctx, &ctx->listen_watch, POLLIN);
+    }
 
     while (1) {
-        rc = poll(fds, 2, -1);
-        if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
-            continue;
+        struct ipc_ready ready[64];
+        int num = wait_fds(ctx, ready, MP_ARRAY_SIZE(ready));
+
+        for (int n = 0; n < num; n++) {
+            struct ipc_watch *w = ready[n].w;
+            struct client_arg *arg = w->client;
+
+            if (w == &ctx->wakeup_watch) {
+                handle_wakeup(ctx);
+            } else if (w == &ctx->listen_watch) {
+                if (w->fd >= 0)
+                    handle_listener(ctx);
+            } else if (!arg->dead) {
+                if (w == &arg->pipe_watch)
+                    mp_flush_wakeup_pipe(w->fd);
+                if (w == &arg->fd_watch && (w->events & POLLIN) &&
+                    (ready[n].revents & (POLLIN | POLLHUP)))
+                    arg->eof |= !read_input(ctx, arg);
+                update_client(ctx, arg);
+            }
         }
 
-        if (fds[0].revents & POLLIN)
-            goto done;
-
-        if (fds[1].revents & POLLIN) {
-            int client_fd = accept(ipc_fd, NULL, NULL);
-            if (client_fd < 0) {
-                MP_ERR(arg, "Could not accept IPC client\n");
-                goto done;
+        // Only free clients here, as ready[] might still reference them.
+        for (int n = ctx->num_clients - 1; n >= 0; n--) {
+            struct client_arg *arg = ctx->clients[n];
+            if (arg->dead && !arg->busy) {
+                MP_TARRAY_REMOVE_AT(ctx->clients, ctx->num_clients, n);
+                destroy_client(ctx, arg);
             }
+        }
 
-            ipc_start_client_json(arg, client_num++, client_fd);
+        mp_mutex_lock(&ctx->lock);
+        bool exit = ctx->terminate && !ctx->num_active;
+        bool detached = ctx->detached;
+        mp_mutex_unlock(&ctx->lock);
+        if (exit) {
+            close_listener(ctx);
+            watch_fd(ctx, &ctx->wakeup_watch, 0);
+#if HAVE_EPOLL
+            close(ctx->epoll_fd);
+#endif
+            if (detached)
+                free_ipc_ctx(ctx);
+            break;
         }
     }
 
-done:
-    if (ipc_fd >= 0)
-        close(ipc_fd);
-
     return NULL;
 }
 
@@ -389,8 +736,26 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
         .log        = mp_log_new(arg, global->log, "ipc"),
         .client_api = client_api,
         .path       = mp_get_user_path(arg, global, opts->ipc_path),
-        .death_pipe = {-1, -1},
+        .max_buffer = opts->ipc_max_buffer,
+        .wakeup_pipe = {-1, -1},
+        .listen_watch = {.fd = -1},
+#if HAVE_EPOLL
+        .epoll_fd   = -1,
+#endif
     };
+    pthread_mutex_init(&arg->lock, NULL);
+
+    arg->pool = mp_thread_pool_create(arg, 0, 0, opts->ipc_threads);
+
+    if (mp_make_wakeup_pipe(arg->wakeup_pipe) < 0)
+        goto out;
+    arg->wakeup_watch.fd = arg->wakeup_pipe[0];
+
+#if HAVE_EPOLL
+    arg->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (arg->epoll_fd < 0)
+        goto out;
+#endif
 
     if (opts->ipc_client && opts->ipc_client[0]) {
         int fd = -1;
@@ -408,12 +773,7 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
     }
 
     talloc_free(opts);
-
-    if (!arg->path || !arg->path[0])
-        goto out;
-
-    if (mp_make_wakeup_pipe(arg->death_pipe) < 0)
-        goto out;
+    opts = NULL;
 
     if (pthread_create(&arg->thread, NULL, ipc_thread, arg))
         goto out;
@@ -421,10 +781,22 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
     return arg;
 
 out:
-    if (arg->death_pipe[0] >= 0) {
-        close(arg->death_pipe[0]);
-        close(arg->death_pipe[1]);
+    talloc_free(opts);
+    for (int n = 0; n < arg->num_new_clients; n++) {
+        struct client_arg *client = arg->new_clients[n];
+        if (client->close_client_fd)
+            close(client->client_fd);
+        talloc_free(client);
+    }
+#if HAVE_EPOLL
+    if (arg->epoll_fd >= 0)
+        close(arg->epoll_fd);
+#endif
+    if (arg->wakeup_pipe[0] >= 0) {
+        close(arg->wakeup_pipe[0]);
+        close(arg->wakeup_pipe[1]);
     }
+    pthread_mutex_destroy(&arg->lock);
     talloc_free(arg);
     return NULL;
 }
@@ -434,10 +806,20 @@ void mp_uninit_ipc(struct mp_ipc_ctx *arg)
     if (!arg)
         return;
 
-    (void)write(arg->death_pipe[1], &(char){0}, 1);
-    pthread_join(arg->thread, NULL);
+    mp_mutex_lock(&arg->lock);
+    pthread_t thread = arg->thread;
+    arg->terminate = true;
+    // Clients that are still connected keep being served in the background,
+    // and the thread frees everything once the last one is gone.
+    bool detached = arg->detached = arg->num_active > 0;
+    wakeup_loop(arg);
+    mp_mutex_unlock(&arg->lock);
+
+    if (detached) {
+        pthread_detach(thread);
+        return;
+    }
 
-    close(arg->death_pipe[0]);
-    close(arg->death_pipe[1]);
-    talloc_free(arg);
+    pthread_join(thread, NULL);
+    free_ipc_ctx(arg);
 }
@@ -112,7 +112,7 @@ char *mp_json_encode_event(dmpv_event *event)
 
 // Function is allowed to modify src[n].
 static char *json_execute_command(struct dmpv_handle *client, void *ta_parent,
-                                  char *src)
+                                  char *src, struct json_arena *arena)
 {
     int rc;
     const char *cmd = NULL;
@@ -126,7 +126,11 @@ static char *json_execute_command(struct dmpv_handle *client, void *ta_parent,
     bool async = false;
     bool send_reply = true;
 
-    rc = json_parse(ta_parent, &msg_node, &src, MAX_JSON_DEPTH);
+    if (arena) {
+        rc = json_parse_arena(arena, &msg_node, &src, MAX_JSON_DEPTH);
+    } else {
+        rc = json_parse(ta_parent, &msg_node, &src, MAX_JSON_DEPTH);
+    }
     if (rc < 0) {
         mp_err(log, "malformed JSON received: '%s'\n", src);
         rc = DMPV_ERROR_INVALID_PARAMETER;
@@ -388,15 +392,19 @@ static char *text_execute_command(struct dmpv_handle *client, void *tmp, char *s
     return NULL;
 }
 
-char *mp_ipc_consume_next_command(struct dmpv_handle *client, void *ctx, bstr *buf)
+char *mp_ipc_consume_next_command(struct dmpv_handle *client, void *ctx,
+                                  bstr *buf, struct json_arena *arena)
 {
     void *tmp = talloc_new(NULL);
 
-    bstr rest;
-    bstr line = bstr_getline(*buf, &rest);
-    char *line0 = bstrto0(tmp, line);
-    talloc_steal(tmp, buf->start);
-    *buf = bstrdup(NULL, rest);
+    bstr line = bstr_getline(*buf, buf);
+    char *line0;
+    if (bstr_endswith0(line, "\n")) {
+        line.start[line.len - 1] = '\0';
+        line0 = line.start;
+    } else {
+        line0 = bstrto0(tmp, line);
+    }
 
     json_skip_whitespace(&line0);
 
@@ -404,12 +412,14 @@ char *mp_ipc_consume_next_command(struct dmpv_handle *client, void *ctx, bstr *b
     if (line0[0] == '\0' || line0[0] == '#') {
         // skip
     } else if (line0[0] == '{') {
-        reply_msg = json_execute_command(client, tmp, line0);
+        reply_msg = json_execute_command(client, tmp, line0, arena);
     } else {
         reply_msg = text_execute_command(client, tmp, line0);
     }
 
     talloc_steal(ctx, reply_msg);
     talloc_free(tmp);
+    if (arena)
+        json_arena_reset(arena);
     return reply_msg;
 }
@@ -0,0 +1,396 @@
+/*
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "common/common.h"
+#include "common/global.h"
+#include "misc/natural_sort.h"
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
+#include "options/path.h"
+#include "osdep/threads.h"
+
+#include "dir_cache.h"
+
+// Limits for the memory used by the cache.
+#define MAX_CACHED_DIRS 256
+#define MAX_CACHED_ENTRIES (64 * 1024)
+
+// Maximum number of threads used by mp_dir_scan(). This is all I/O bound, so
+// it can be more than the number of CPUs (e.g. for network filesystems).
+#define MAX_SCAN_THREADS 8
+
+// mp_dir_scan() doesn't descend into longer paths (things like mount bind
+// loops).
+#define MAX_PATH_LEN 8192
+
+struct cached_dir {
+    uint32_t hash;
+    time_t mtime;
+    struct mp_dir_listing *listing; // has the path, dev and ino
+};
+
+struct mp_dir_cache {
+    pthread_mutex_t lock;
+    struct cached_dir *dirs;    // least recently used first
+    int num_dirs;
+    int num_entries;            // sum of listing->num_entries over dirs
+    struct mp_thread_pool *pool;
+};
+
+static void dir_cache_destroy(void *ptr)
+{
+    struct mp_dir_cache *c = ptr;
+    talloc_free(c->pool);
+    pthread_mutex_destroy(&c->lock);
+}
+
+void mp_dir_cache_init(struct dmpv_global *global)
+{
+    mp_assert(!global->dir_cache);
+    struct mp_dir_cache *c = talloc_zero(global, struct mp_dir_cache);
+    ta_set_destructor(c, dir_cache_destroy);
+    pthread_mutex_init(&c->lock, NULL);
+    c->pool = mp_thread_pool_create(c, 0, 0, MAX_SCAN_THREADS);
+
+    global->dir_cache = c;
+}
+
+// FNV-1a
+static uint32_t hash_path(const char *path)
+{
+    uint32_t h = 2166136261u;
+    for (; *path; path++)
+        h = (h ^ (unsigned char)*path) * 16777619u;
+    return h;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+    const struct mp_dir_entry *a_entry = a;
+    const struct mp_dir_entry *b_entry = b;
+    return mp_natural_sort_cmp(a_entry->name, b_entry->name);
+}
+
+// Read the directory from disk, and set *st to its stat() result.
+static struct mp_dir_listing *read_dir(void *ta_parent, const char *path,
+                                       struct stat *st)
+{
+    DIR *dp = opendir(path);
+    if (!dp)
+        return NULL;
+
+    int fd = dirfd(dp);
+    if (fstat(fd, st)) {
+        closedir(dp);
+        return NULL;
+    }
+
+    struct mp_dir_listing *l = talloc_ptrtype(ta_parent, l);
+    *l = (struct mp_dir_listing){
+        .path = talloc_strdup(l, path),
+        .dev = st->st_dev,
+        .ino = st->st_ino,
+    };
+
+    // readdir() fetches entries in large batches (getdents64() on Linux).
+    // d_type avoids a stat() for anything that can't be a directory, and the
+    // remaining entries are stat()ed relative to fd, which avoids building the
+    // full path and resolving it from the start each time.
+    struct dirent *ep;
+    while ((ep = readdir(dp))) {
+        if (strcmp(ep->d_name, ".") == 0 || strcmp(ep->d_name, "..") == 0)
+            continue;
+
+        struct mp_dir_entry e = {.name = talloc_strdup(l, ep->d_name)};
+
+        if (ep->d_type == DT_DIR || ep->d_type == DT_LNK ||
+            ep->d_type == DT_UNKNOWN)
+        {
+            struct stat est;
+            if (fstatat(fd, ep->d_name, &est, 0) == 0 && S_ISDIR(est.st_mode)) {
+                e.is_dir = true;
+                e.dev = est.st_dev;
+                e.ino = est.st_ino;
+            }
+        }
+
+        MP_TARRAY_APPEND(l, l->entries, l->num_entries, e);
+    }
+    closedir(dp);
+
+    if (l->entries)
+        qsort(l->entries, l->num_entries, sizeof(l->entries[0]), cmp_entry);
+
+    return l;
+}
+
+static struct mp_dir_listing *copy_listing(void *ta_parent,
+                                           const struct mp_dir_listing *src)
+{
+    struct mp_dir_listing *l = talloc_ptrtype(ta_parent, l);
+    *l = *src;
+    l->path = talloc_strdup(l, src->path);
+    l->entries = talloc_array(l, struct mp_dir_entry, src->num_entries);
+    for (int n = 0; n < src->num_entries; n++) {
+        l->entries[n] = src->entries[n];
+        l->entries[n].name = talloc_strdup(l, src->entries[n].name);
+    }
+    return l;
+}
+
+// Return the index of path in c->dirs, or -1. Caller holds c->lock.
+static int find_dir(struct mp_dir_cache *c, const char *path, uint32_t hash)
+{
+    for (int n = c->num_dirs - 1; n >= 0; n--) {
+        struct cached_dir *d = &c->dirs[n];
+        if (d->hash == hash && strcmp(d->listing->path, path) == 0)
+            return n;
+    }
+    return -1;
+}
+
+// Caller holds c->lock.
+static void remove_dir(struct mp_dir_cache *c, int index)
+{
+    struct cached_dir *d = &c->dirs[index];
+    c->num_entries -= d->listing->num_entries;
+    talloc_free(d->listing);
+    MP_TARRAY_REMOVE_AT(c->dirs, c->num_dirs, index);
+}
+
+static void add_dir(struct mp_dir_cache *c, const struct mp_dir_listing *l,
+                    uint32_t hash, time_t mtime)
+{
+    if (l->num_entries > MAX_CACHED_ENTRIES / 4)
+        return;
+
+    struct cached_dir d = {
+        .hash = hash,
+        .mtime = mtime,
+        .listing = copy_listing(NULL, l),
+    };
+
+    mp_mutex_lock(&c->lock);
+    talloc_steal(c, d.listing);
+    int index = find_dir(c, l->path, hash);
+    if (index >= 0)
+        remove_dir(c, index);
+    while (c->num_dirs && (c->num_dirs >= MAX_CACHED_DIRS ||
+           c->num_entries + l->num_entries > MAX_CACHED_ENTRIES))
+        remove_dir(c, 0);
+    MP_TARRAY_APPEND(c, c->dirs, c->num_dirs, d);
+    c->num_entries += l->num_entries;
+    mp_mutex_unlock(&c->lock);
+}
+
+struct mp_dir_listing *mp_dir_list(void *ta_parent, struct dmpv_global *global,
+                                   const char *path)
+{
+    struct mp_dir_cache *c = global ? global->dir_cache : NULL;
+    struct stat st;
+
+    if (!c)
+        return read_dir(ta_parent, path, &st);
+
+    uint32_t hash = hash_path(path);
+
+    if (stat(path, &st) == 0) {
+        struct mp_dir_listing *res = NULL;
+        mp_mutex_lock(&c->lock);
+        int index = find_dir(c, path, hash);
+        if (index >= 0) {
+            struct cached_dir d = c->dirs[index];
+            if (d.mtime == st.st_mtime && d.listing->dev == st.st_dev &&
+                d.listing->ino == st.st_ino)
+            {
+                res = copy_listing(ta_parent, d.listing);
+                // Move to the end, as most recently used.
+                MP_TARRAY_REMOVE_AT(c->dirs, c->num_dirs, index);
+                MP_TARRAY_APPEND(c, c->dirs, c->num_dirs, d);
+            } else {
+                remove_dir(c, index);
+            }
+        }
+        mp_mutex_unlock(&c->lock);
+        if (res)
+            return res;
+    }
+
+    struct mp_dir_listing *l = read_dir(ta_parent, path, &st);
+
+    // mtime has a granularity of 1 second on some filesystems, so a change
+    // right after reading the directory could go unnoticed. Don't cache it
+    // until it has been unchanged for a while.
+    if (l && st.st_mtime < time(NULL) - 2)
+        add_dir(c, l, hash, st.st_mtime);
+
+    return l;
+}
+
+struct scan_dir_id {
+    dev_t dev;
+    ino_t ino;
+};
+
+struct scan_state {
+    struct dmpv_global *global;
+    struct mp_thread_pool *pool;
+    struct mp_cancel *cancel;
+    int max_depth;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    int pending;                // number of queued or running jobs
+    void *ta_root;              // owns all listings (modified under lock only)
+    struct mp_dir_listing *root;
+};
+
+struct scan_job {
+    struct scan_state *s;
+    char *path;
+    // Where to store the result. Written under s->lock.
+    struct mp_dir_listing **out;
+    // Directories from the scan root to the parent of path.
+    struct scan_dir_id *stack;
+    int depth;
+};
+
+static void queue_scan(struct scan_state *s, struct mp_dir_listing **out,
+                       const char *path, struct scan_dir_id *stack,
+                       int depth);
+
+static void scan_job_run(void *ptr)
+{
+    struct scan_job *job = ptr;
+    struct scan_state *s = job->s;
+
+    // Each job allocates under its own talloc root, and listings are moved to
+    // the shared one only under the lock.
+    struct mp_dir_listing *l = NULL;
+    if (!mp_cancel_test(s->cancel))
+        l = mp_dir_list(job, s->global, job->path);
+
+    if (l && job->depth < s->max_depth) {
+        // The stack passed to subdirectories includes this directory.
+        MP_TARRAY_APPEND(job, job->stack, job->depth,
+                         (struct scan_dir_id){l->dev, l->ino});
+
+        for (int n = 0; n < l->num_entries; n++) {
+            struct mp_dir_entry *e = &l->entries[n];
+            if (!e->is_dir || e->name[0] == '.')
+                continue;
+
+            for (int i = 0; i < job->depth; i++) {
+                if (job->stack[i].dev == e->dev && job->stack[i].ino == e->ino)
+                    e->loop = true;
+            }
+            if (e->loop)
+                continue;
+
+            char *path = mp_path_join(job, l->path, e->name);
+            if (strlen(path) < MAX_PATH_LEN)
+                queue_scan(s, &e->sub, path, job->stack, job->depth);
+        }
+    }
+
+    mp_mutex_lock(&s->lock);
+    if (l) {
+        talloc_steal(s->ta_root, l);
+        *job->out = l;
+    }
+    s->pending -= 1;
+    if (!s->pending)
+        pthread_cond_broadcast(&s->wakeup);
+    mp_mutex_unlock(&s->lock);
+
+    talloc_free(job);
+}
+
+static void queue_scan(struct scan_state *s, struct mp_dir_listing **out,
+                       const char *path, struct scan_dir_id *stack,
+                       int depth)
+{
+    struct scan_job *job = talloc_ptrtype(NULL, job);
+    *job = (struct scan_job){
+        .s = s,
+        .path = talloc_strdup(job, path),
+        .out = out,
+        .stack = talloc_memdup(job, stack, depth * sizeof(stack[0])),
+        .depth = depth,
+    };
+
+    mp_mutex_lock(&s->lock);
+    s->pending += 1;
+    mp_mutex_unlock(&s->lock);
+
+    // Run it on the calling thread if no worker could be created.
+    if (!s->pool || !mp_thread_pool_queue(s->pool, scan_job_run, job))
+        scan_job_run(job);
+}
+
+struct mp_dir_listing *mp_dir_scan(void *ta_parent, struct dmpv_global *global,
+                                   const char *path, int max_depth,
+                                   struct mp_cancel *cancel)
+{
+    struct mp_dir_cache *c = global ? global->dir_cache : NULL;
+
+    struct scan_state s = {
+        .global = global,
+        .pool = c ? c->pool : NULL,
+        .cancel = cancel,
+        .max_depth = max_depth,
+        .ta_root = talloc_new(NULL),
+    };
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.wakeup, NULL);
+
+    // The top level is read on the calling thread, which then only waits.
+    struct scan_job *job = talloc_ptrtype(NULL, job);
+    *job = (struct scan_job){
+        .s = &s,
+        .path = talloc_strdup(job, path),
+        .out = &s.root,
+    };
+    s.pending = 1;
+    scan_job_run(job);
+
+    mp_mutex_lock(&s.lock);
+    while (s.pending)
+        pthread_cond_wait(&s.wakeup, &s.lock);
+    mp_mutex_unlock(&s.lock);
+
+    pthread_cond_destroy(&s.wakeup);
+    pthread_mutex_destroy(&s.lock);
+
+    // Make the top level listing own everything.
+    struct mp_dir_listing *root = s.root;
+    if (root) {
+        talloc_steal(ta_parent, root);
+        talloc_steal(root, s.ta_root);
+    } else {
+        talloc_free(s.ta_root);
+    }
+    return root;
+}
@@ -0,0 +1,64 @@
+/*
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct dmpv_global;
+struct mp_cancel;
+
+struct mp_dir_entry {
+    char *name;
+    bool is_dir;                // after following symlinks
+    dev_t dev;                  // only set if is_dir
+    ino_t ino;                  // only set if is_dir
+    // Set by mp_dir_scan() only.
+    struct mp_dir_listing *sub; // contents, if this directory was scanned
+    bool loop;                  // same directory as the listing or a parent
+};
+
+struct mp_dir_listing {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    // All entries except "." and "..", sorted with mp_natural_sort_cmp().
+    struct mp_dir_entry *entries;
+    int num_entries;
+};
+
+// Create global->dir_cache, which caches directory listings for the lifetime
+// of global. A cached listing is used as long as the directory's mtime does
+// not change.
+void mp_dir_cache_init(struct dmpv_global *global);
+
+// Return the contents of the directory at path, or NULL if it can't be read.
+// The result is a copy allocated under ta_parent. global can be NULL, or have
+// no cache, in which case the directory is always read.
+// This function is thread-safe.
+struct mp_dir_listing *mp_dir_list(void *ta_parent, struct dmpv_global *global,
+                                   const char *path);
+
+// Like mp_dir_list(), and also scan subdirectories up to max_depth levels
+// below path, setting mp_dir_entry.sub. Subdirectories are listed in
+// parallel. Subdirectories whose names start with '.', that would loop, or
+// whose paths get too long are not scanned. If cancel is triggered, the
+// remaining directories are not read, and the result is incomplete.
+struct mp_dir_listing *mp_dir_scan(void *ta_parent, struct dmpv_global *global,
+                                   const char *path, int max_depth,
+                                   struct mp_cancel *cancel);
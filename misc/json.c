@@ -53,6 +53,88 @@
 
 #include "json.h"
 
+#if defined(__SSE2__) && defined(__GNUC__)
+#define JSON_SSE2 1
+#include <emmintrin.h>
+// The scanners read whole aligned blocks, including bytes past the end of the
+// string, which is safe, but looks like an overflow to ASAN.
+#define NO_ASAN __attribute__((no_sanitize_address))
+#else
+#define NO_ASAN
+#endif
+
+// Parser state. json_parse() uses a temporary instance which allocates the
+// result with talloc; a json_arena is kept by the caller, and allocates the
+// result from memory that is reused for the next message.
+struct json_arena {
+    void *ta_parent;            // result parent if extra==NULL (json_parse())
+    void *tmp;                  // parent of the scratch buffers below
+
+    // Bump allocator for the result. Allocations which don't fit go to
+    // "extra", and the next reset grows mem to cover them, so that a stream of
+    // similar messages stops allocating after the first few.
+    char *mem;
+    size_t size, pos, overflow;
+    void *extra;
+
+    // Items of all lists currently being parsed, innermost list last.
+    struct dmpv_node *values;
+    char **keys;
+    int num_items;
+
+    bstr unescaped;             // for decoding strings with escapes
+};
+
+// Memory kept by an arena between messages is limited to this.
+#define ARENA_MAX_KEEP (1024 * 1024)
+
+struct json_arena *json_arena_create(void *ta_parent)
+{
+    struct json_arena *arena = talloc_zero(ta_parent, struct json_arena);
+    arena->tmp = arena;
+    arena->extra = talloc_new(arena);
+    arena->size = 4096;
+    arena->mem = talloc_size(arena, arena->size);
+    return arena;
+}
+
+// Invalidate everything returned by json_parse_arena() so far, and make the
+// memory available for the next call.
+void json_arena_reset(struct json_arena *arena)
+{
+    talloc_free_children(arena->extra);
+    size_t need = arena->pos + arena->overflow;
+    if (arena->overflow && need <= ARENA_MAX_KEEP) {
+        talloc_free(arena->mem);
+        arena->size = MP_ALIGN_UP(need, 4096);
+        arena->mem = talloc_size(arena, arena->size);
+    }
+    arena->pos = arena->overflow = 0;
+
+    mp_assert(!arena->num_items);
+    if (talloc_get_size(arena->values) > ARENA_MAX_KEEP) {
+        TA_FREEP(&arena->values);
+        TA_FREEP(&arena->keys);
+    }
+    if (talloc_get_size(arena->unescaped.start) > ARENA_MAX_KEEP)
+        TA_FREEP(&arena->unescaped.start);
+    arena->unescaped.len = 0;
+}
+
+static void *alloc_result(struct json_arena *p, size_t size)
+{
+    if (!p->extra)
+        return talloc_size(p->ta_parent, size);
+    size = MP_ALIGN_UP(size, 16);
+    if (size > p->size - p->pos) {
+        p->overflow += size;
+        return talloc_size(p->extra, size);
+    }
+    void *res = p->mem + p->pos;
+    p->pos += size;
+    return res;
+}
+
 static bool eat_c(char **s, char c)
 {
     if (**s == c) {
@@ -77,7 +159,7 @@ void json_skip_whitespace(char **src)
     eat_ws(src);
 }
 
-static int read_id(void *ta_parent, struct dmpv_node *dst, char **src)
+static int read_id(struct json_arena *p, struct dmpv_node *dst, char **src)
 {
     char *start = *src;
     if (!mp_isalpha(**src) && **src != '_')
@@ -88,27 +170,63 @@ static int read_id(void *ta_parent, struct dmpv_node *dst, char **src)
         **src = '\0'; // we're allowed to mutate it => can avoid the strndup
         *src += 1;
     } else {
-        start = talloc_strndup(ta_parent, start, *src - start);
+        size_t len = *src - start;
+        char *id = alloc_result(p, len + 1);
+        memcpy(id, start, len);
+        id[len] = '\0';
+        start = id;
     }
     dst->format = DMPV_FORMAT_STRING;
     dst->u.string = start;
     return 0;
 }
 
-static int read_str(void *ta_parent, struct dmpv_node *dst, char **src)
+// Return the first '"', '\\' or '\0' in s.
+NO_ASAN
+static char *find_str_special(char *s)
+{
+#ifdef JSON_SSE2
+    // Aligned loads never cross a page boundary, so reading all of the block
+    // which contains the terminating '\0' is safe.
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i zero = _mm_setzero_si128();
+    uintptr_t off = (uintptr_t)s & 15;
+    const __m128i *cur = (const __m128i *)(s - off);
+    unsigned mask = 0xFFFFu << off;
+    while (1) {
+        __m128i v = _mm_load_si128(cur);
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                              _mm_cmpeq_epi8(v, bslash)),
+                                 _mm_cmpeq_epi8(v, zero));
+        mask &= _mm_movemask_epi8(m);
+        if (mask)
+            return (char *)cur + __builtin_ctz(mask);
+        mask = 0xFFFFu;
+        cur++;
+    }
+#else
+    while (*s && *s != '"' && *s != '\\')
+        s++;
+    return s;
+#endif
+}
+
+static int read_str(struct json_arena *p, struct dmpv_node *dst, char **src)
 {
     if (!eat_c(src, '"'))
         return -1; // not a string
     char *str = *src;
     char *cur = str;
     bool has_escapes = false;
-    while (cur[0] && cur[0] != '"') {
-        if (cur[0] == '\\') {
-            has_escapes = true;
-            // skip >\"< and >\\< (latter to handle >\\"< correctly)
-            if (cur[1] == '"' || cur[1] == '\\')
-                cur++;
-        }
+    while (1) {
+        cur = find_str_special(cur);
+        if (cur[0] != '\\')
+            break;
+        has_escapes = true;
+        // skip >\"< and >\\< (latter to handle >\\"< correctly)
+        if (cur[1] == '"' || cur[1] == '\\')
+            cur++;
         cur++;
     }
     if (cur[0] != '"')
@@ -118,18 +236,24 @@ static int read_str(void *ta_parent, struct dmpv_node *dst, char **src)
     cur[0] = '\0';
     *src = cur + 1;
     if (has_escapes) {
-        bstr unescaped = {0};
-        bstr r = bstr0(str);
-        if (!mp_append_escaped_string(ta_parent, &unescaped, &r))
+        // Decoding never makes a string longer, so write it back in place.
+        bstr r = {str, cur - str};
+        p->unescaped.len = 0;
+        if (!mp_append_escaped_string(p->tmp, &p->unescaped, &r))
             return -1; // broken escapes
-        str = unescaped.start; // the function guarantees null-termination
+        mp_assert(p->unescaped.len <= cur - str);
+        memcpy(str, p->unescaped.start, p->unescaped.len);
+        str[p->unescaped.len] = '\0';
     }
     dst->format = DMPV_FORMAT_STRING;
     dst->u.string = str;
     return 0;
 }
 
-static int read_sub(void *ta_parent, struct dmpv_node *dst, char **src,
+static int parse_value(struct json_arena *p, struct dmpv_node *dst,
+                       char **src, int max_depth);
+
+static int read_sub(struct json_arena *p, struct dmpv_node *dst, char **src,
                     int max_depth)
 {
     bool is_arr = eat_c(src, '[');
@@ -137,53 +261,93 @@ static int read_sub(void *ta_parent, struct dmpv_node *dst, char **src,
     if (!is_arr && !is_obj)
         return -1; // not an array or object
     char term = is_obj ? '}' : ']';
-    struct dmpv_node_list *list = talloc_zero(ta_parent, struct dmpv_node_list);
+    // Items are collected on the shared stack, so that the list can be
+    // allocated in one piece once its size is known.
+    int base = p->num_items;
+    int r = -1;
     while (1) {
         eat_ws(src);
         if (eat_c(src, term))
             break;
-        if (list->num > 0 && !eat_c(src, ','))
-            return -1; // missing ','
+        if (p->num_items > base && !eat_c(src, ','))
+            goto done; // missing ','
         eat_ws(src);
         // non-standard extension: allow a trailing ","
         if (eat_c(src, term))
             break;
+        struct dmpv_node keynode = {0};
         if (is_obj) {
-            struct dmpv_node keynode;
             // non-standard extension: allow unquoted strings as keys
-            if (read_id(list, &keynode, src) < 0 &&
-                read_str(list, &keynode, src) < 0)
-                return -1; // key is not a string
+            if (read_id(p, &keynode, src) < 0 &&
+                read_str(p, &keynode, src) < 0)
+                goto done; // key is not a string
             eat_ws(src);
             // non-standard extension: allow "=" instead of ":"
             if (!eat_c(src, ':') && !eat_c(src, '='))
-                return -1; // ':' missing
+                goto done; // ':' missing
             eat_ws(src);
-            MP_TARRAY_GROW(list, list->keys, list->num);
-            list->keys[list->num] = keynode.u.string;
         }
-        MP_TARRAY_GROW(list, list->values, list->num);
-        if (json_parse(ta_parent, &list->values[list->num], src, max_depth) < 0)
-            return -1;
-        list->num++;
+        struct dmpv_node value;
+        if (parse_value(p, &value, src, max_depth) < 0)
+            goto done;
+        MP_TARRAY_GROW(p->tmp, p->values, p->num_items);
+        MP_TARRAY_GROW(p->tmp, p->keys, p->num_items);
+        p->values[p->num_items] = value;
+        p->keys[p->num_items] = keynode.u.string;
+        p->num_items++;
     }
+
+    int num = p->num_items - base;
+    size_t list_size = MP_ALIGN_UP(sizeof(struct dmpv_node_list), 16);
+    size_t values_size = num * sizeof(struct dmpv_node);
+    size_t keys_size = is_obj ? num * sizeof(char *) : 0;
+    char *mem = alloc_result(p, list_size + values_size + keys_size);
+    struct dmpv_node_list *list = (struct dmpv_node_list *)mem;
+    *list = (struct dmpv_node_list){
+        .num = num,
+        .values = num ? (struct dmpv_node *)(mem + list_size) : NULL,
+        .keys = keys_size ? (char **)(mem + list_size + values_size) : NULL,
+    };
+    if (list->values)
+        memcpy(list->values, p->values + base, values_size);
+    if (list->keys)
+        memcpy(list->keys, p->keys + base, keys_size);
+
     dst->format = is_obj ? DMPV_FORMAT_NODE_MAP : DMPV_FORMAT_NODE_ARRAY;
     dst->u.list = list;
-    return 0;
+    r = 0;
+done:
+    p->num_items = base;
+    return r;
 }
 
-/* Parse the string in *src as JSON, and write the result into *dst.
- * max_depth limits the recursion and JSON tree depth.
- * Warning: this overwrites the input string (what *src points to)!
- * Returns:
- *   0: success, *dst is valid, *src points to the end (the caller must check
- *      whether *src really terminates)
- *  -1: failure, *dst is invalid, there may be dead allocs under ta_parent
- *      (ta_free_children(ta_parent) is the only way to free them)
- * The input string can be mutated in both cases. *dst might contain string
- * elements, which point into the (mutated) input string.
- */
-int json_parse(void *ta_parent, struct dmpv_node *dst, char **src, int max_depth)
+// Plain decimal integers (request IDs, property IDs, most command arguments)
+// don't need the strtoll()/strtod() dance below. Returns false if the number
+// is anything else.
+static bool read_int(struct dmpv_node *dst, char **src)
+{
+    char *cur = *src;
+    bool neg = eat_c(&cur, '-');
+    // Leading zeros select octal or hex with strtoll().
+    if (cur[0] < '1' || cur[0] > '9')
+        return false;
+    int64_t v = 0;
+    for (int digits = 0; cur[0] >= '0' && cur[0] <= '9'; digits++) {
+        if (digits == 18)
+            return false; // might overflow
+        v = v * 10 + (cur[0] - '0');
+        cur++;
+    }
+    if (cur[0] == '.' || cur[0] == 'e' || cur[0] == 'E')
+        return false;
+    *src = cur;
+    dst->format = DMPV_FORMAT_INT64;
+    dst->u.int64 = neg ? -v : v;
+    return true;
+}
+
+static int parse_value(struct json_arena *p, struct dmpv_node *dst,
+                       char **src, int max_depth)
 {
     max_depth -= 1;
     if (max_depth < 0)
@@ -209,10 +373,12 @@ int json_parse(void *ta_parent, struct dmpv_node *dst, char **src, int max_depth
         dst->u.flag = 0;
         return 0;
     } else if (c == '"') {
-        return read_str(ta_parent, dst, src);
+        return read_str(p, dst, src);
     } else if (c == '[' || c == '{') {
-        return read_sub(ta_parent, dst, src, max_depth);
+        return read_sub(p, dst, src, max_depth);
     } else if (c == '-' || (c >= '0' && c <= '9')) {
+        if (read_int(dst, src))
+            return 0;
         // The number could be either a float or an int. JSON doesn't make a
         // difference, but the client API does.
         char *nsrci = *src, *nsrcf = *src;
@@ -241,6 +407,35 @@ int json_parse(void *ta_parent, struct dmpv_node *dst, char **src, int max_depth
     return -1; // character doesn't start a valid token
 }
 
+/* Parse the string in *src as JSON, and write the result into *dst.
+ * max_depth limits the recursion and JSON tree depth.
+ * Warning: this overwrites the input string (what *src points to)!
+ * Returns:
+ *   0: success, *dst is valid, *src points to the end (the caller must check
+ *      whether *src really terminates)
+ *  -1: failure, *dst is invalid, there may be dead allocs under ta_parent
+ *      (ta_free_children(ta_parent) is the only way to free them)
+ * The input string can be mutated in both cases. *dst might contain string
+ * elements, which point into the (mutated) input string.
+ */
+int json_parse(void *ta_parent, struct dmpv_node *dst, char **src, int max_depth)
+{
+    struct json_arena p = {.ta_parent = ta_parent};
+    int r = parse_value(&p, dst, src, max_depth);
+    talloc_free(p.values);
+    talloc_free(p.keys);
+    talloc_free(p.unescaped.start);
+    return r;
+}
+
+// Same as json_parse(), but allocate the result from the arena. The result
+// (and the input string) must stay valid until json_arena_reset() is called.
+int json_parse_arena(struct json_arena *arena, struct dmpv_node *dst,
+                     char **src, int max_depth)
+{
+    return parse_value(arena, dst, src, max_depth);
+}
+
 
 #define APPEND(b, s) bstr_xappend(NULL, (b), bstr0(s))
 
@@ -252,18 +447,46 @@ static const char special_escape[] = {
     ['\t'] = 't',
 };
 
+// Return the first char in s that needs escaping, or the terminating '\0'.
+NO_ASAN
+static unsigned char *find_json_special(unsigned char *s)
+{
+#ifdef JSON_SSE2
+    // See find_str_special().
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(31);
+    uintptr_t off = (uintptr_t)s & 15;
+    const __m128i *cur = (const __m128i *)(s - off);
+    unsigned mask = 0xFFFFu << off;
+    while (1) {
+        __m128i v = _mm_load_si128(cur);
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                              _mm_cmpeq_epi8(v, bslash)),
+                                 _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+        mask &= _mm_movemask_epi8(m);
+        if (mask)
+            return (unsigned char *)cur + __builtin_ctz(mask);
+        mask = 0xFFFFu;
+        cur++;
+    }
+#else
+    while (s[0] >= 32 && s[0] != '"' && s[0] != '\\')
+        s++;
+    return s;
+#endif
+}
+
 static void write_json_str(bstr *b, unsigned char *str)
 {
     mp_assert(str);
 
     APPEND(b, "\"");
     while (1) {
-        unsigned char *cur = str;
-        while (cur[0] >= 32 && cur[0] != '"' && cur[0] != '\\')
-            cur++;
+        unsigned char *cur = find_json_special(str);
+        bstr_xappend(NULL, b, (bstr){str, cur - str});
         if (!cur[0])
             break;
-        bstr_xappend(NULL, b, (bstr){str, cur - str});
         if (cur[0] == '\"') {
             bstr_xappend(NULL, b, (bstr){"\\\"", 2});
         } else if (cur[0] == '\\') {
@@ -275,7 +498,6 @@ static void write_json_str(bstr *b, unsigned char *str)
         }
         str = cur + 1;
     }
-    APPEND(b, str);
     APPEND(b, "\"");
 }
 
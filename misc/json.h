@@ -24,6 +24,13 @@
 #define MAX_JSON_DEPTH 50
 
 int json_parse(void *ta_parent, struct dmpv_node *dst, char **src, int max_depth);
+
+// Reusable memory for parsing a stream of messages.
+struct json_arena;
+struct json_arena *json_arena_create(void *ta_parent);
+void json_arena_reset(struct json_arena *arena);
+int json_parse_arena(struct json_arena *arena, struct dmpv_node *dst,
+                     char **src, int max_depth);
 void json_skip_whitespace(char **src);
 int json_write(char **s, struct dmpv_node *src);
 int json_write_pretty(char **s, struct dmpv_node *src);
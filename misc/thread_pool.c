@@ -15,7 +15,10 @@
 
 
 #include "common/common.h"
+#include "common/stats.h"
 #include "misc/mp_assert.h"
+#include "misc/thread_tools.h"
+#include "osdep/atomic.h"
 #include "osdep/threads.h"
 #include "osdep/timer.h"
 
@@ -28,84 +31,250 @@
 struct work {
     void (*fn)(void *ctx);
     void *fn_ctx;
+    struct mp_cancel *cancel;
+    void (*cancel_fn)(void *ctx);
+};
+
+// Ring buffer of work items.
+struct work_queue {
+    struct work *items;
+    int alloc;
+    int start;
+    int num;
+};
+
+// One slot per potential thread. Slots are allocated on pool creation and
+// never move or go away before the pool, so they can be scanned for stealing
+// without holding mp_thread_pool.lock.
+struct worker {
+    struct mp_thread_pool *pool;
+    int index;
+
+    // Protects queues. Nested inside mp_thread_pool.lock if both are taken.
+    pthread_mutex_t lock;
+    struct work_queue queues[MP_THREAD_POOL_PRIO_COUNT];
+    atomic_int num_queued;      // sum of queues[].num, for cheap peeking
+
+    // --- the following fields are protected by mp_thread_pool.lock
+    pthread_cond_t wakeup;
+    pthread_t thread;
+    bool running;               // thread exists and uses this slot
+    bool woken;                 // removed from idle list by a submitter
 };
 
 struct mp_thread_pool {
     int min_threads, max_threads;
 
+    struct worker *workers;     // max_threads entries
+
+    // Total number of queued (not yet started) work items.
+    atomic_int num_work;
+    // Number of threads which have taken up work and are still processing it.
+    atomic_int busy_threads;
+
+    mp_atomic_uint64 steals;
+    mp_atomic_uint64 cancelled;
+
+    atomic_bool fifo;
+
     pthread_mutex_t lock;
-    pthread_cond_t wakeup;
 
     // --- the following fields are protected by lock
 
-    pthread_t *threads;
     int num_threads;
 
-    // Number of threads which have taken up work and are still processing it.
-    int busy_threads;
+    // Stack of indexes of sleeping workers.
+    int *idle;
+    int num_idle;
 
+    int next_target;            // round robin for queuing to busy workers
     bool terminate;
 
-    struct work *work;
-    int num_work;
+    // Set before any work is queued, and then only read.
+    struct stats_ctx *stats;
 };
 
-static void *worker_thread(void *arg)
+static void work_queue_push(void *ta_parent, struct work_queue *q,
+                            struct work work)
 {
-    struct mp_thread_pool *pool = arg;
+    if (q->num == q->alloc) {
+        int alloc = MPMAX(16, q->alloc * 2);
+        struct work *items = talloc_array(ta_parent, struct work, alloc);
+        for (int n = 0; n < q->num; n++)
+            items[n] = q->items[(q->start + n) % q->alloc];
+        talloc_free(q->items);
+        q->items = items;
+        q->alloc = alloc;
+        q->start = 0;
+    }
+    q->items[(q->start + q->num) % q->alloc] = work;
+    q->num += 1;
+}
 
-    mpthread_set_name("worker");
+static bool work_queue_pop(struct work_queue *q, bool front, struct work *out)
+{
+    if (!q->num)
+        return false;
+    if (front) {
+        *out = q->items[q->start];
+        q->start = (q->start + 1) % q->alloc;
+    } else {
+        *out = q->items[(q->start + q->num - 1) % q->alloc];
+    }
+    q->num -= 1;
+    return true;
+}
 
-    mp_mutex_lock(&pool->lock);
+static bool pop_from(struct worker *w, int prio, bool front, struct work *out)
+{
+    if (!atomic_load(&w->num_queued))
+        return false;
 
-    struct timespec ts = {0};
-    bool got_timeout = false;
-    while (1) {
-        struct work work = {0};
-        if (pool->num_work > 0) {
-            work = pool->work[pool->num_work - 1];
-            pool->num_work -= 1;
-        }
+    mp_mutex_lock(&w->lock);
+    bool r = work_queue_pop(&w->queues[prio], front, out);
+    if (r)
+        atomic_fetch_add(&w->num_queued, -1);
+    mp_mutex_unlock(&w->lock);
+    return r;
+}
 
-        if (!work.fn) {
-            if (got_timeout || pool->terminate)
-                break;
+// Can be called without lock.
+static void update_queue_stats(struct mp_thread_pool *pool)
+{
+    if (!pool->stats)
+        return;
 
-            if (pool->num_threads > pool->min_threads) {
-                if (!ts.tv_sec && !ts.tv_nsec)
-                    ts = mp_rel_time_to_timespec(DESTROY_TIMEOUT);
-                if (pthread_cond_timedwait(&pool->wakeup, &pool->lock, &ts))
-                    got_timeout = pool->num_threads > pool->min_threads;
-            } else {
-                pthread_cond_wait(&pool->wakeup, &pool->lock);
+    stats_value(pool->stats, "queue-depth", atomic_load(&pool->num_work));
+    stats_value(pool->stats, "steals", atomic_load(&pool->steals));
+    stats_value(pool->stats, "cancelled", atomic_load(&pool->cancelled));
+}
+
+// Called locked.
+static void update_stats(struct mp_thread_pool *pool)
+{
+    if (!pool->stats)
+        return;
+
+    update_queue_stats(pool);
+    stats_value(pool->stats, "threads", pool->num_threads);
+    stats_value(pool->stats, "idle-threads", pool->num_idle);
+}
+
+// Take the next item from the worker's own queue, or steal one from another
+// worker. In FIFO mode (the default, and the order of the old single queue),
+// a worker takes the oldest item of its own queue, and steals the newest item
+// of others, so that it does not compete with the owner for the same end.
+// Higher priorities are drained first.
+static bool take_work(struct worker *w, struct work *out)
+{
+    struct mp_thread_pool *pool = w->pool;
+    bool fifo = atomic_load(&pool->fifo);
+
+    for (int prio = MP_THREAD_POOL_PRIO_COUNT - 1; prio >= 0; prio--) {
+        if (pop_from(w, prio, fifo, out))
+            goto found;
+        for (int n = 1; n < pool->max_threads; n++) {
+            struct worker *victim =
+                &pool->workers[(w->index + n) % pool->max_threads];
+            if (pop_from(victim, prio, !fifo, out)) {
+                atomic_fetch_add(&pool->steals, 1);
+                goto found;
             }
-            continue;
         }
+    }
+    return false;
 
-        pool->busy_threads += 1;
-        mp_mutex_unlock(&pool->lock);
+found:
+    atomic_fetch_add(&pool->busy_threads, 1);
+    atomic_fetch_add(&pool->num_work, -1);
+    update_queue_stats(pool);
+    return true;
+}
 
-        work.fn(work.fn_ctx);
+static void run_work(struct mp_thread_pool *pool, struct work *work)
+{
+    if (work->cancel && mp_cancel_test(work->cancel)) {
+        if (work->cancel_fn)
+            work->cancel_fn(work->fn_ctx);
+        atomic_fetch_add(&pool->cancelled, 1);
+        update_queue_stats(pool);
+    } else {
+        work->fn(work->fn_ctx);
+    }
 
-        mp_mutex_lock(&pool->lock);
-        pool->busy_threads -= 1;
+    atomic_fetch_add(&pool->busy_threads, -1);
+}
 
-        ts = (struct timespec){0};
-        got_timeout = false;
+// Called locked.
+static void remove_idle(struct mp_thread_pool *pool, int index)
+{
+    for (int n = 0; n < pool->num_idle; n++) {
+        if (pool->idle[n] == index) {
+            MP_TARRAY_REMOVE_AT(pool->idle, pool->num_idle, n);
+            return;
+        }
     }
+}
+
+static void *worker_thread(void *arg)
+{
+    struct worker *w = arg;
+    struct mp_thread_pool *pool = w->pool;
+
+    mpthread_set_name("worker");
+
+    while (1) {
+        struct work work;
+        if (take_work(w, &work)) {
+            run_work(pool, &work);
+            continue;
+        }
+
+        mp_mutex_lock(&pool->lock);
 
-    // If no termination signal was given, it must mean we died because of a
-    // timeout, and nobody is waiting for us. We have to remove ourselves.
-    if (!pool->terminate) {
-        for (int n = 0; n < pool->num_threads; n++) {
-            if (pthread_equal(pool->threads[n], pthread_self())) {
-                pthread_detach(pthread_self());
-                MP_TARRAY_REMOVE_AT(pool->threads, pool->num_threads, n);
-                mp_mutex_unlock(&pool->lock);
-                return NULL;
+        // Work is queued with the lock held, so this catches all items that
+        // were added after take_work() looked at the queues.
+        if (atomic_load(&pool->num_work) > 0) {
+            mp_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        if (pool->terminate)
+            break;
+
+        w->woken = false;
+        pool->idle[pool->num_idle++] = w->index;
+        update_stats(pool);
+
+        struct timespec ts = mp_rel_time_to_timespec(DESTROY_TIMEOUT);
+        bool got_timeout = false;
+        while (!w->woken && !pool->terminate && !got_timeout) {
+            if (pool->num_threads > pool->min_threads) {
+                if (pthread_cond_timedwait(&w->wakeup, &pool->lock, &ts))
+                    got_timeout = true;
+            } else {
+                pthread_cond_wait(&w->wakeup, &pool->lock);
             }
         }
-        MP_ASSERT_UNREACHABLE();
+
+        if (!w->woken)
+            remove_idle(pool, w->index);
+
+        // We died because of a timeout, and nobody is waiting for us. We have
+        // to remove ourselves.
+        if (got_timeout && !w->woken && !pool->terminate &&
+            pool->num_threads > pool->min_threads &&
+            atomic_load(&pool->num_work) == 0)
+        {
+            pthread_detach(pthread_self());
+            w->running = false;
+            pool->num_threads -= 1;
+            update_stats(pool);
+            mp_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        mp_mutex_unlock(&pool->lock);
     }
 
     mp_mutex_unlock(&pool->lock);
@@ -120,34 +289,51 @@ static void thread_pool_dtor(void *ctx)
     mp_mutex_lock(&pool->lock);
 
     pool->terminate = true;
-    pthread_cond_broadcast(&pool->wakeup);
 
-    pthread_t *threads = pool->threads;
-    int num_threads = pool->num_threads;
+    pthread_t *threads = talloc_array(NULL, pthread_t, pool->max_threads);
+    int num_threads = 0;
 
-    pool->threads = NULL;
+    for (int n = 0; n < pool->max_threads; n++) {
+        struct worker *w = &pool->workers[n];
+        pthread_cond_signal(&w->wakeup);
+        if (w->running) {
+            threads[num_threads++] = w->thread;
+            w->running = false;
+        }
+    }
     pool->num_threads = 0;
 
     mp_mutex_unlock(&pool->lock);
 
     for (int n = 0; n < num_threads; n++)
         pthread_join(threads[n], NULL);
+    talloc_free(threads);
 
-    mp_assert(pool->num_work == 0);
-    mp_assert(pool->num_threads == 0);
-    pthread_cond_destroy(&pool->wakeup);
+    mp_assert(atomic_load(&pool->num_work) == 0);
+    for (int n = 0; n < pool->max_threads; n++) {
+        struct worker *w = &pool->workers[n];
+        pthread_cond_destroy(&w->wakeup);
+        pthread_mutex_destroy(&w->lock);
+    }
     pthread_mutex_destroy(&pool->lock);
 }
 
+// Called locked.
 static bool add_thread(struct mp_thread_pool *pool)
 {
-    pthread_t thread;
+    for (int n = 0; n < pool->max_threads; n++) {
+        struct worker *w = &pool->workers[n];
+        if (w->running)
+            continue;
 
-    if (pthread_create(&thread, NULL, worker_thread, pool) != 0)
-        return false;
+        if (pthread_create(&w->thread, NULL, worker_thread, w) != 0)
+            return false;
 
-    MP_TARRAY_APPEND(pool, pool->threads, pool->num_threads, thread);
-    return true;
+        w->running = true;
+        pool->num_threads += 1;
+        return true;
+    }
+    return false;
 }
 
 struct mp_thread_pool *mp_thread_pool_create(void *ta_parent, int init_threads,
@@ -158,13 +344,24 @@ struct mp_thread_pool *mp_thread_pool_create(void *ta_parent, int init_threads,
     mp_assert(max_threads > 0 && max_threads >= min_threads);
 
     struct mp_thread_pool *pool = talloc_zero(ta_parent, struct mp_thread_pool);
-    talloc_set_destructor(pool, thread_pool_dtor);
 
     pthread_mutex_init(&pool->lock, NULL);
-    pthread_cond_init(&pool->wakeup, NULL);
 
     pool->min_threads = min_threads;
     pool->max_threads = max_threads;
+    atomic_store(&pool->fifo, true);
+
+    pool->idle = talloc_array(pool, int, max_threads);
+    pool->workers = talloc_zero_array(pool, struct worker, max_threads);
+    for (int n = 0; n < max_threads; n++) {
+        struct worker *w = &pool->workers[n];
+        w->pool = pool;
+        w->index = n;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->wakeup, NULL);
+    }
+
+    talloc_set_destructor(pool, thread_pool_dtor);
 
     mp_mutex_lock(&pool->lock);
     for (int n = 0; n < init_threads; n++)
@@ -178,21 +375,45 @@ struct mp_thread_pool *mp_thread_pool_create(void *ta_parent, int init_threads,
     return pool;
 }
 
-static bool thread_pool_add(struct mp_thread_pool *pool, void (*fn)(void *ctx),
-                            void *fn_ctx, bool allow_queue)
+void mp_thread_pool_set_fifo(struct mp_thread_pool *pool, bool fifo)
+{
+    atomic_store(&pool->fifo, fifo);
+}
+
+void mp_thread_pool_set_stats(struct mp_thread_pool *pool,
+                              struct dmpv_global *global, const char *prefix)
+{
+    mp_mutex_lock(&pool->lock);
+    talloc_free(pool->stats);
+    pool->stats = global ? stats_ctx_create(pool, global, prefix) : NULL;
+    update_stats(pool);
+    mp_mutex_unlock(&pool->lock);
+}
+
+static bool thread_pool_add(struct mp_thread_pool *pool,
+                            const struct mp_thread_pool_job *job,
+                            bool allow_queue)
 {
     bool ok = true;
 
-    mp_assert(fn);
+    mp_assert(job->fn);
+    mp_assert(job->prio >= 0 && job->prio < MP_THREAD_POOL_PRIO_COUNT);
 
     mp_mutex_lock(&pool->lock);
-    struct work work = {fn, fn_ctx};
+    struct work work = {
+        .fn = job->fn,
+        .fn_ctx = job->fn_ctx,
+        .cancel = job->cancel,
+        .cancel_fn = job->cancel_fn,
+    };
 
     // If there are not enough threads to process all at once, but we can
     // create a new thread, then do so. If work is queued quickly, it can
     // happen that not all available threads have picked up work yet (up to
     // num_threads - busy_threads threads), which has to be accounted for.
-    if (pool->busy_threads + pool->num_work + 1 > pool->num_threads &&
+    int busy = atomic_load(&pool->busy_threads);
+    int num_work = atomic_load(&pool->num_work);
+    if (busy + num_work + 1 > pool->num_threads &&
         pool->num_threads < pool->max_threads)
     {
         if (!add_thread(pool)) {
@@ -202,8 +423,32 @@ static bool thread_pool_add(struct mp_thread_pool *pool, void (*fn)(void *ctx),
     }
 
     if (ok) {
-        MP_TARRAY_INSERT_AT(pool, pool->work, pool->num_work, 0, work);
-        pthread_cond_signal(&pool->wakeup);
+        // Prefer handing the item to a sleeping worker. Otherwise, spread it
+        // over the running workers, and let whoever is free first steal it.
+        struct worker *target = NULL;
+        if (pool->num_idle) {
+            target = &pool->workers[pool->idle[--pool->num_idle]];
+            target->woken = true;
+            pthread_cond_signal(&target->wakeup);
+        } else {
+            for (int n = 0; n < pool->max_threads; n++) {
+                int i = (pool->next_target + n) % pool->max_threads;
+                if (pool->workers[i].running) {
+                    target = &pool->workers[i];
+                    pool->next_target = i + 1;
+                    break;
+                }
+            }
+        }
+        mp_assert(target);
+
+        mp_mutex_lock(&target->lock);
+        work_queue_push(pool, &target->queues[job->prio], work);
+        atomic_fetch_add(&target->num_queued, 1);
+        mp_mutex_unlock(&target->lock);
+
+        atomic_fetch_add(&pool->num_work, 1);
+        update_queue_stats(pool);
     }
 
     mp_mutex_unlock(&pool->lock);
@@ -213,11 +458,23 @@ static bool thread_pool_add(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                           void *fn_ctx)
 {
-    return thread_pool_add(pool, fn, fn_ctx, true);
+    return mp_thread_pool_queue_job(pool, &(struct mp_thread_pool_job){
+        .fn = fn,
+        .fn_ctx = fn_ctx,
+    });
 }
 
 bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                         void *fn_ctx)
 {
-    return thread_pool_add(pool, fn, fn_ctx, false);
+    return thread_pool_add(pool, &(struct mp_thread_pool_job){
+        .fn = fn,
+        .fn_ctx = fn_ctx,
+    }, false);
+}
+
+bool mp_thread_pool_queue_job(struct mp_thread_pool *pool,
+                              const struct mp_thread_pool_job *job)
+{
+    return thread_pool_add(pool, job, true);
 }
@@ -2,6 +2,8 @@
 #define DMPV_MP_THREAD_POOL_H
 
 #include <stdbool.h>
+struct dmpv_global;
+struct mp_cancel;
 struct mp_thread_pool;
 
 // Create a thread pool with the given number of worker threads. This can return
@@ -32,4 +34,40 @@ bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                         void *fn_ctx);
 
+enum mp_thread_pool_prio {
+    MP_THREAD_POOL_PRIO_NORMAL = 0,
+    MP_THREAD_POOL_PRIO_HIGH,
+    MP_THREAD_POOL_PRIO_COUNT,
+};
+
+struct mp_thread_pool_job {
+    void (*fn)(void *ctx);
+    void *fn_ctx;
+    // Queued items with higher priority are started first.
+    enum mp_thread_pool_prio prio;
+    // If set, and triggered before the item was started, fn is not called.
+    // cancel_fn(fn_ctx) is called instead, if set (e.g. to free fn_ctx).
+    // Must stay valid until the item was started or dropped.
+    struct mp_cancel *cancel;
+    void (*cancel_fn)(void *ctx);
+};
+
+// Like mp_thread_pool_queue(), with additional parameters.
+bool mp_thread_pool_queue_job(struct mp_thread_pool *pool,
+                              const struct mp_thread_pool_job *job);
+
+// Each worker thread has its own queue, and idle workers take items from the
+// queues of busy workers. If fifo is true (default), workers run items from
+// their own queue in the order they were queued, and steal the most recently
+// queued items of other workers. If it is false, it is the other way around.
+void mp_thread_pool_set_fifo(struct mp_thread_pool *pool, bool fifo);
+
+// Export queue depth, thread counts, the number of work items idle workers
+// took from other workers' queues, and the number of cancelled work items,
+// with the given stats prefix. The stats
+// context is owned by the pool, so the pool must be destroyed before global.
+// Must be called before any work is queued. Pass global=NULL to disable.
+void mp_thread_pool_set_stats(struct mp_thread_pool *pool,
+                              struct dmpv_global *global, const char *prefix);
+
 #endif
@@ -35,15 +35,14 @@
 #include "common/common.h"
 
 static int m_property_multiply(struct mp_log *log,
-                               const struct m_property *prop_list,
-                               const char *property, double f, void *ctx)
+                               const struct m_property_handle *h,
+                               double f, void *ctx)
 {
     union m_option_value val = m_option_value_default;
     struct m_option opt = {0};
     int r;
 
-    r = m_property_do(log, prop_list, property, M_PROPERTY_GET_CONSTRICTED_TYPE,
-                      &opt, ctx);
+    r = m_property_do_handle(log, h, M_PROPERTY_GET_CONSTRICTED_TYPE, &opt, ctx);
     if (r != M_PROPERTY_OK)
         return r;
     mp_assert(opt.type);
@@ -51,11 +50,11 @@ static int m_property_multiply(struct mp_log *log,
     if (!opt.type->multiply)
         return M_PROPERTY_NOT_IMPLEMENTED;
 
-    r = m_property_do(log, prop_list, property, M_PROPERTY_GET, &val, ctx);
+    r = m_property_do_handle(log, h, M_PROPERTY_GET, &val, ctx);
     if (r != M_PROPERTY_OK)
         return r;
     opt.type->multiply(&opt, &val, f);
-    r = m_property_do(log, prop_list, property, M_PROPERTY_SET, &val, ctx);
+    r = m_property_do_handle(log, h, M_PROPERTY_SET, &val, ctx);
     m_option_free(&opt, &val);
     return r;
 }
@@ -70,49 +69,121 @@ struct m_property *m_property_list_find(const struct m_property *list,
     return NULL;
 }
 
-static int do_action(const struct m_property *prop_list, const char *name,
-                     int action, void *arg, void *ctx)
+struct m_property_index {
+    // Open addressing with linear probing; at most half of the slots are used.
+    struct m_property **slots;
+    uint32_t mask;              // number of slots - 1
+};
+
+// FNV-1a
+static uint32_t hash_name(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t n = 0; n < len; n++)
+        h = (h ^ (unsigned char)name[n]) * 16777619u;
+    return h;
+}
+
+struct m_property_index *m_property_index_create(void *ta_parent,
+                                                 const struct m_property *list)
+{
+    int num = 0;
+    while (list && list[num].name)
+        num++;
+
+    uint32_t size = 16;
+    while (size < num * 2u)
+        size *= 2;
+
+    struct m_property_index *index = talloc_ptrtype(ta_parent, index);
+    *index = (struct m_property_index){
+        .slots = talloc_zero_array(index, struct m_property *, size),
+        .mask = size - 1,
+    };
+
+    for (int n = 0; n < num; n++) {
+        const char *name = list[n].name;
+        size_t len = strlen(name);
+        // On duplicates, the first entry wins (as with m_property_list_find()).
+        if (m_property_index_find(index, name, len))
+            continue;
+        uint32_t i = hash_name(name, len) & index->mask;
+        while (index->slots[i])
+            i = (i + 1) & index->mask;
+        index->slots[i] = (struct m_property *)&list[n];
+    }
+
+    return index;
+}
+
+struct m_property *m_property_index_find(const struct m_property_index *index,
+                                         const char *name, size_t len)
+{
+    uint32_t i = hash_name(name, len) & index->mask;
+    for (struct m_property *p; (p = index->slots[i]); i = (i + 1) & index->mask) {
+        if (strncmp(p->name, name, len) == 0 && !p->name[len])
+            return p;
+    }
+    return NULL;
+}
+
+void m_property_resolve(const struct m_property_index *index, const char *name,
+                        struct m_property_handle *h)
 {
-    struct m_property *prop;
-    struct m_property_action_arg ka;
     const char *sep = strchr(name, '/');
-    if (sep && sep[1]) {
-        char base[128];
-        snprintf(base, sizeof(base), "%.*s", (int)(sep - name), name);
-        prop = m_property_list_find(prop_list, base);
-        ka = (struct m_property_action_arg) {
-            .key = sep + 1,
+    bool sub = sep && sep[1];
+    *h = (struct m_property_handle){
+        .name = name,
+        .prop = m_property_index_find(index, name,
+                                      sub ? sep - name : strlen(name)),
+        .key = sub ? sep + 1 : NULL,
+    };
+}
+
+static int do_action(const struct m_property_handle *h, int action, void *arg,
+                     void *ctx)
+{
+    struct m_property *prop = h->prop;
+    if (!prop)
+        return M_PROPERTY_UNKNOWN;
+    if (h->key) {
+        struct m_property_action_arg ka = {
+            .key = h->key,
             .action = action,
             .arg = arg,
         };
-        action = M_PROPERTY_KEY_ACTION;
-        arg = &ka;
-    } else
-        prop = m_property_list_find(prop_list, name);
-    if (!prop)
-        return M_PROPERTY_UNKNOWN;
+        return prop->call(ctx, prop, M_PROPERTY_KEY_ACTION, &ka);
+    }
     return prop->call(ctx, prop, action, arg);
 }
 
-// (as a hack, log can be NULL on read-only paths)
-int m_property_do(struct mp_log *log, const struct m_property *prop_list,
+int m_property_do(struct mp_log *log, const struct m_property_index *index,
                   const char *name, int action, void *arg, void *ctx)
+{
+    struct m_property_handle h;
+    m_property_resolve(index, name, &h);
+    return m_property_do_handle(log, &h, action, arg, ctx);
+}
+
+// (as a hack, log can be NULL on read-only paths)
+int m_property_do_handle(struct mp_log *log, const struct m_property_handle *h,
+                         int action, void *arg, void *ctx)
 {
     union m_option_value val = m_option_value_default;
     int r;
 
     struct m_option opt = {0};
-    r = do_action(prop_list, name, M_PROPERTY_GET_TYPE, &opt, ctx);
+    r = do_action(h, M_PROPERTY_GET_TYPE, &opt, ctx);
     if (r <= 0)
         return r;
     mp_assert(opt.type);
 
     switch (action) {
     case M_PROPERTY_PRINT: {
-        if ((r = do_action(prop_list, name, M_PROPERTY_PRINT, arg, ctx)) >= 0)
+        if ((r = do_action(h, M_PROPERTY_PRINT, arg, ctx)) >= 0)
             return r;
         // Fallback to m_option
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET, &val, ctx)) <= 0)
+        if ((r = do_action(h, M_PROPERTY_GET, &val, ctx)) <= 0)
             return r;
         char *str = m_option_pretty_print(&opt, &val);
         m_option_free(&opt, &val);
@@ -120,7 +191,7 @@ int m_property_do(struct mp_log *log, const struct m_property *prop_list,
         return str != NULL;
     }
     case M_PROPERTY_GET_STRING: {
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET, &val, ctx)) <= 0)
+        if ((r = do_action(h, M_PROPERTY_GET, &val, ctx)) <= 0)
             return r;
         char *str = m_option_print(&opt, &val);
         m_option_free(&opt, &val);
@@ -129,49 +200,49 @@ int m_property_do(struct mp_log *log, const struct m_property *prop_list,
     }
     case M_PROPERTY_SET_STRING: {
         struct dmpv_node node = { .format = DMPV_FORMAT_STRING, .u.string = arg };
-        return m_property_do(log, prop_list, name, M_PROPERTY_SET_NODE, &node, ctx);
+        return m_property_do_handle(log, h, M_PROPERTY_SET_NODE, &node, ctx);
     }
     case M_PROPERTY_MULTIPLY: {
-        return m_property_multiply(log, prop_list, name, *(double *)arg, ctx);
+        return m_property_multiply(log, h, *(double *)arg, ctx);
     }
     case M_PROPERTY_SWITCH: {
         if (!log)
             return M_PROPERTY_ERROR;
         struct m_property_switch_arg *sarg = arg;
-        if ((r = do_action(prop_list, name, M_PROPERTY_SWITCH, arg, ctx)) !=
+        if ((r = do_action(h, M_PROPERTY_SWITCH, arg, ctx)) !=
             M_PROPERTY_NOT_IMPLEMENTED)
             return r;
         // Fallback to m_option
-        r = m_property_do(log, prop_list, name, M_PROPERTY_GET_CONSTRICTED_TYPE,
-                          &opt, ctx);
+        r = m_property_do_handle(log, h, M_PROPERTY_GET_CONSTRICTED_TYPE,
+                                 &opt, ctx);
         if (r <= 0)
             return r;
         mp_assert(opt.type);
         if (!opt.type->add)
             return M_PROPERTY_NOT_IMPLEMENTED;
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET, &val, ctx)) <= 0)
+        if ((r = do_action(h, M_PROPERTY_GET, &val, ctx)) <= 0)
             return r;
         opt.type->add(&opt, &val, sarg->inc, sarg->wrap);
-        r = do_action(prop_list, name, M_PROPERTY_SET, &val, ctx);
+        r = do_action(h, M_PROPERTY_SET, &val, ctx);
         m_option_free(&opt, &val);
         return r;
     }
     case M_PROPERTY_GET_CONSTRICTED_TYPE: {
-        r = do_action(prop_list, name, action, arg, ctx);
+        r = do_action(h, action, arg, ctx);
         if (r >= 0 || r == M_PROPERTY_UNAVAILABLE)
             return r;
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET_TYPE, arg, ctx)) >= 0)
+        if ((r = do_action(h, M_PROPERTY_GET_TYPE, arg, ctx)) >= 0)
             return r;
         return M_PROPERTY_NOT_IMPLEMENTED;
     }
     case M_PROPERTY_SET: {
-        return do_action(prop_list, name, M_PROPERTY_SET, arg, ctx);
+        return do_action(h, M_PROPERTY_SET, arg, ctx);
     }
     case M_PROPERTY_GET_NODE: {
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET_NODE, arg, ctx)) !=
+        if ((r = do_action(h, M_PROPERTY_GET_NODE, arg, ctx)) !=
             M_PROPERTY_NOT_IMPLEMENTED)
             return r;
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET, &val, ctx)) <= 0)
+        if ((r = do_action(h, M_PROPERTY_GET, &val, ctx)) <= 0)
             return r;
         struct dmpv_node *node = arg;
         int err = m_option_get_node(&opt, NULL, node, &val);
@@ -188,22 +259,22 @@ int m_property_do(struct mp_log *log, const struct m_property *prop_list,
     case M_PROPERTY_SET_NODE: {
         if (!log)
             return M_PROPERTY_ERROR;
-        if ((r = do_action(prop_list, name, M_PROPERTY_SET_NODE, arg, ctx)) !=
+        if ((r = do_action(h, M_PROPERTY_SET_NODE, arg, ctx)) !=
             M_PROPERTY_NOT_IMPLEMENTED)
             return r;
-        int err = m_option_set_node_or_string(log, &opt, name, &val, arg);
+        int err = m_option_set_node_or_string(log, &opt, h->name, &val, arg);
         if (err == M_OPT_UNKNOWN) {
             r = M_PROPERTY_NOT_IMPLEMENTED;
         } else if (err < 0) {
             r = M_PROPERTY_INVALID_FORMAT;
         } else {
-            r = do_action(prop_list, name, M_PROPERTY_SET, &val, ctx);
+            r = do_action(h, M_PROPERTY_SET, &val, ctx);
         }
         m_option_free(&opt, &val);
         return r;
     }
     default:
-        return do_action(prop_list, name, action, arg, ctx);
+        return do_action(h, action, arg, ctx);
     }
 }
 
@@ -234,11 +305,11 @@ static void m_property_unkey(int *action, void **arg)
     }
 }
 
-static int m_property_do_bstr(const struct m_property *prop_list, bstr name,
+static int m_property_do_bstr(const struct m_property_index *index, bstr name,
                               int action, void *arg, void *ctx)
 {
     char *name0 = bstrdup0(NULL, name);
-    int ret = m_property_do(NULL, prop_list, name0, action, arg, ctx);
+    int ret = m_property_do(NULL, index, name0, action, arg, ctx);
     talloc_free(name0);
     return ret;
 }
@@ -251,7 +322,7 @@ static void append_str(char **s, int *len, bstr append)
     *len = *len + append.len;
 }
 
-static int expand_property(const struct m_property *prop_list, char **ret,
+static int expand_property(const struct m_property_index *index, char **ret,
                            int *ret_len, bstr prop, bool silent_error, void *ctx)
 {
     bool cond_yes = bstr_eatstart0(&prop, "?");
@@ -265,7 +336,7 @@ static int expand_property(const struct m_property *prop_list, char **ret,
     int method = raw ? M_PROPERTY_GET_STRING : M_PROPERTY_PRINT;
 
     char *s = NULL;
-    int r = m_property_do_bstr(prop_list, prop, method, &s, ctx);
+    int r = m_property_do_bstr(index, prop, method, &s, ctx);
     bool skip;
     if (comp) {
         skip = ((s && bstr_equals0(comp_with, s)) != cond_yes);
@@ -282,7 +353,7 @@ static int expand_property(const struct m_property *prop_list, char **ret,
     return skip;
 }
 
-char *m_properties_expand_string(const struct m_property *prop_list,
+char *m_properties_expand_string(const struct m_property_index *index,
                                  const char *str0, void *ctx)
 {
     char *ret = NULL;
@@ -308,7 +379,7 @@ char *m_properties_expand_string(const struct m_property *prop_list,
             bool have_fallback = bstr_eatstart0(&str, ":");
 
             if (!skip) {
-                skip = expand_property(prop_list, &ret, &ret_len, name,
+                skip = expand_property(index, &ret, &ret_len, name,
                                        have_fallback, ctx);
                 if (skip)
                     skip_level = level;
@@ -143,13 +143,41 @@ struct m_property {
 struct m_property *m_property_list_find(const struct m_property *list,
                                         const char *name);
 
+// Hash table over a property list, for constant time lookups by name.
+struct m_property_index;
+
+// Create an index for list, which is terminated with a {0} item. The list must
+// not be changed or freed while the index is in use.
+struct m_property_index *m_property_index_create(void *ta_parent,
+                                                 const struct m_property *list);
+
+// Find the property whose name is the first len chars of name.
+struct m_property *m_property_index_find(const struct m_property_index *index,
+                                         const char *name, size_t len);
+
+// A property path, looked up once with m_property_resolve(). This can be kept
+// and used for any number of accesses, as long as index and name are valid.
+struct m_property_handle {
+    const char *name;           // full path, e.g. "track-list/3/lang"
+    struct m_property *prop;    // e.g. "track-list", NULL if unknown
+    const char *key;            // e.g. "3/lang", NULL if not a sub-property
+};
+
+// Set *h to the property for the given path. name is not copied.
+void m_property_resolve(const struct m_property_index *index, const char *name,
+                        struct m_property_handle *h);
+
 // Access a property.
 // action: one of m_property_action
 // ctx: opaque value passed through to property implementation
 // returns: one of mp_property_return
-int m_property_do(struct mp_log *log, const struct m_property* prop_list,
+int m_property_do(struct mp_log *log, const struct m_property_index *index,
                   const char* property_name, int action, void* arg, void *ctx);
 
+// Like m_property_do(), but with a resolved property.
+int m_property_do_handle(struct mp_log *log, const struct m_property_handle *h,
+                         int action, void *arg, void *ctx);
+
 // Given a path of the form "a/b/c", this function will set *prefix to "a",
 // and rem to "b/c", and return true.
 // If there is no '/' in the path, set prefix to path, and rem to "", and
@@ -172,7 +200,7 @@ void m_properties_print_help_list(struct mp_log *log,
 // STR is recursively expanded using the same rules.
 // "$$" can be used to escape "$", and "$}" to escape "}".
 // "$>" disables parsing of "$" for the rest of the string.
-char* m_properties_expand_string(const struct m_property *prop_list,
+char* m_properties_expand_string(const struct m_property_index *index,
                                  const char *str, void *ctx);
 
 // Trivial helpers for implementing properties.
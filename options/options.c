@@ -724,12 +724,21 @@ static const m_option_t mp_opts[] = {
 
     {"input-ipc-server", OPT_STRING(ipc_path), .flags = M_OPT_FILE},
     {"input-ipc-client", OPT_STRING(ipc_client)},
+    {"input-ipc-max-buffer", OPT_BYTE_SIZE(ipc_max_buffer),
+        M_RANGE(4096, M_MAX_MEM_BYTES)},
+    {"input-ipc-threads", OPT_INT(ipc_threads), M_RANGE(1, 64)},
+    {"observe-max-rate", OPT_DOUBLE(observe_max_rate), M_RANGE(0, 1000)},
 
     {"screenshot", OPT_SUBSTRUCT(screenshot_image_opts, screenshot_conf)},
     {"screenshot-template", OPT_STRING(screenshot_template)},
     {"screenshot-directory", OPT_STRING(screenshot_directory),
         .flags = M_OPT_FILE},
     {"screenshot-sw", OPT_BOOL(screenshot_sw)},
+    {"screenshot-threads", OPT_CHOICE(screenshot_threads, {"auto", 0}),
+        M_RANGE(1, 64)},
+    {"screenshot-max-queue-bytes", OPT_BYTE_SIZE(screenshot_max_queue_bytes),
+        M_RANGE(0, M_MAX_MEM_BYTES)},
+    {"screenshot-each-frame-parallel", OPT_BOOL(screenshot_each_frame_parallel)},
 
     {"", OPT_SUBSTRUCT(resample_opts, resample_conf)},
 
@@ -847,6 +856,9 @@ static const struct MPOpts mp_default_opts = {
     .coverart_whitelist = true,
     .osd_bar_visible = true,
     .screenshot_template = "dmpv-%n",
+    .screenshot_max_queue_bytes = 256 * 1024 * 1024,
+    .ipc_max_buffer = 4 * 1024 * 1024,
+    .ipc_threads = 4,
     .play_dir = 1,
 
     .audio_output_channels = {
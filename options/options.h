@@ -281,6 +281,9 @@ typedef struct MPOpts {
     char *screenshot_template;
     char *screenshot_directory;
     bool screenshot_sw;
+    int screenshot_threads;
+    int64_t screenshot_max_queue_bytes;
+    bool screenshot_each_frame_parallel;
 
     int index_mode;
 
@@ -333,6 +336,9 @@ typedef struct MPOpts {
 
     char *ipc_path;
     char *ipc_client;
+    int64_t ipc_max_buffer;
+    int ipc_threads;
+    double observe_max_rate;
 
     int wingl_dwm_flush;
 
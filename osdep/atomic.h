@@ -28,6 +28,7 @@ typedef _Atomic float mp_atomic_float;
 typedef _Atomic double mp_atomic_double;
 typedef _Atomic int64_t mp_atomic_int64;
 typedef _Atomic uint64_t mp_atomic_uint64;
+typedef _Atomic(void *) mp_atomic_ptr;
 #else
 
 // Emulate the parts of C11 stdatomic.h needed by dmpv.
@@ -44,6 +45,7 @@ typedef struct { float v;              } mp_atomic_float;
 typedef struct { double v;             } mp_atomic_double;
 typedef struct { int64_t v;            } mp_atomic_int64;
 typedef struct { uint64_t v;           } mp_atomic_uint64;
+typedef struct { void *v;              } mp_atomic_ptr;
 
 #define ATOMIC_VAR_INIT(x) \
     {.v = (x)}
@@ -83,12 +83,38 @@ struct mp_client_api {
     int num_custom_protocols;
 
     struct dmpv_render_context *render_context;
+
+    // Observed properties of all clients, indexed by property ID + 1 (unknown
+    // properties have the ID -1).
+    struct observe_list *observers;
+    int num_observers;
+
+    // -- only accessed by the core thread
+
+    // Values read by the current mp_client_send_property_changes() call, so a
+    // property observed by multiple clients is read only once.
+    struct cached_value *value_cache;
+    int num_value_cache;
+};
+
+struct observe_list {
+    struct observe_property **props;
+    int num_props;
+};
+
+struct cached_value {
+    int id;
+    char *name;
+    dmpv_format format;
+    int status;
+    union m_option_value value;
 };
 
 struct observe_property {
     // -- immutable
     struct dmpv_handle *owner;
     char *name;
+    struct m_property_handle handle; // ==mp_property_resolve(name)
     int id;                 // ==mp_get_property_id(name)
     uint64_t event_mask;    // ==mp_get_property_event_mask(name)
     int64_t reply_id;
@@ -147,6 +173,7 @@ struct dmpv_handle {
     struct observe_property **properties;
     int num_properties;
     bool has_pending_properties; // (maybe) new property events (producer side)
+    double next_tick_update;    // for --observe-max-rate (mp_time_sec() units)
     bool new_property_events; // new property events (consumer side)
     int cur_property_index; // round-robin for property events (consumer side)
     uint64_t property_event_masks; // or-ed together event masks of all properties
@@ -178,6 +205,35 @@ static void prop_unref(struct observe_property *prop)
         talloc_free(prop);
 }
 
+// Must be called with clients->lock held.
+static void add_observer(struct mp_client_api *clients,
+                         struct observe_property *prop)
+{
+    int slot = prop->id + 1;
+    if (slot >= clients->num_observers) {
+        MP_TARRAY_GROW(clients, clients->observers, slot);
+        for (int n = clients->num_observers; n <= slot; n++)
+            clients->observers[n] = (struct observe_list){0};
+        clients->num_observers = slot + 1;
+    }
+    struct observe_list *list = &clients->observers[slot];
+    MP_TARRAY_APPEND(clients, list->props, list->num_props, prop);
+}
+
+// Must be called with clients->lock held.
+static void remove_observer(struct mp_client_api *clients,
+                            struct observe_property *prop)
+{
+    struct observe_list *list = &clients->observers[prop->id + 1];
+    for (int n = 0; n < list->num_props; n++) {
+        if (list->props[n] == prop) {
+            MP_TARRAY_REMOVE_AT(list->props, list->num_props, n);
+            return;
+        }
+    }
+    mp_assert(0);
+}
+
 void mp_clients_init(struct MPContext *mpctx)
 {
     mpctx->clients = talloc_ptrtype(NULL, mpctx->clients);
@@ -446,12 +502,15 @@ static void mp_destroy_client(dmpv_handle *ctx, bool terminate)
     if (terminate)
         dmpv_command(ctx, (const char*[]){"quit", NULL});
 
+    mp_mutex_lock(&clients->lock);
     mp_mutex_lock(&ctx->lock);
 
     ctx->destroying = true;
 
-    for (int n = 0; n < ctx->num_properties; n++)
+    for (int n = 0; n < ctx->num_properties; n++) {
+        remove_observer(clients, ctx->properties[n]);
         prop_unref(ctx->properties[n]);
+    }
     ctx->num_properties = 0;
     ctx->properties_change_ts += 1;
 
@@ -459,6 +518,7 @@ static void mp_destroy_client(dmpv_handle *ctx, bool terminate)
     ctx->cur_property = NULL;
 
     mp_mutex_unlock(&ctx->lock);
+    mp_mutex_unlock(&clients->lock);
 
     abort_async(mpctx, ctx, 0, 0);
 
@@ -1386,6 +1446,7 @@ int dmpv_set_property_async(dmpv_handle *ctx, uint64_t ud, const char *name,
 struct getproperty_request {
     struct MPContext *mpctx;
     const char *name;
+    const struct m_property_handle *handle; // optional, resolved name
     dmpv_format format;
     void *data;
     int status;
@@ -1400,6 +1461,13 @@ static void free_prop_data(void *ptr)
     m_option_free(type, prop->data);
 }
 
+static int get_property(struct getproperty_request *req, int action, void *arg)
+{
+    if (req->handle)
+        return mp_property_do_handle(req->handle, action, arg, req->mpctx);
+    return mp_property_do(req->name, action, arg, req->mpctx);
+}
+
 static void getproperty_fn(void *arg)
 {
     struct getproperty_request *req = arg;
@@ -1411,11 +1479,11 @@ static void getproperty_fn(void *arg)
     int err = -1;
     switch (req->format) {
     case DMPV_FORMAT_OSD_STRING:
-        err = mp_property_do(req->name, M_PROPERTY_PRINT, data, req->mpctx);
+        err = get_property(req, M_PROPERTY_PRINT, data);
         break;
     case DMPV_FORMAT_STRING: {
         char *s = NULL;
-        err = mp_property_do(req->name, M_PROPERTY_GET_STRING, &s, req->mpctx);
+        err = get_property(req, M_PROPERTY_GET_STRING, &s);
         if (err == M_PROPERTY_OK)
             *(char **)data = s;
         break;
@@ -1425,13 +1493,12 @@ static void getproperty_fn(void *arg)
     case DMPV_FORMAT_INT64:
     case DMPV_FORMAT_DOUBLE: {
         struct dmpv_node node = {{0}};
-        err = mp_property_do(req->name, M_PROPERTY_GET_NODE, &node, req->mpctx);
+        err = get_property(req, M_PROPERTY_GET_NODE, &node);
         if (err == M_PROPERTY_NOT_IMPLEMENTED) {
             // Go through explicit string conversion. Same reasoning as on the
             // GET code path.
             char *s = NULL;
-            err = mp_property_do(req->name, M_PROPERTY_GET_STRING, &s,
-                                 req->mpctx);
+            err = get_property(req, M_PROPERTY_GET_STRING, &s);
             if (err != M_PROPERTY_OK)
                 break;
             node.format = DMPV_FORMAT_STRING;
@@ -1549,6 +1616,7 @@ int dmpv_observe_property(dmpv_handle *ctx, uint64_t userdata,
     if (format == DMPV_FORMAT_OSD_STRING)
         return DMPV_ERROR_PROPERTY_FORMAT;
 
+    mp_mutex_lock(&ctx->clients->lock);
     mp_mutex_lock(&ctx->lock);
     mp_assert(!ctx->destroying);
     struct observe_property *prop = talloc_ptrtype(ctx, prop);
@@ -1564,19 +1632,24 @@ int dmpv_observe_property(dmpv_handle *ctx, uint64_t userdata,
         .change_ts = 1, // force initial event
         .refcount = 1,
     };
+    // The property table is immutable, so this is safe from any thread.
+    mp_property_resolve(ctx->mpctx, prop->name, &prop->handle);
     ctx->properties_change_ts += 1;
     MP_TARRAY_APPEND(ctx, ctx->properties, ctx->num_properties, prop);
+    add_observer(ctx->clients, prop);
     ctx->property_event_masks |= prop->event_mask;
     ctx->new_property_events = true;
     ctx->cur_property_index = 0;
     ctx->has_pending_properties = true;
     mp_mutex_unlock(&ctx->lock);
+    mp_mutex_unlock(&ctx->clients->lock);
     mp_wakeup_core(ctx->mpctx);
     return 0;
 }
 
 int dmpv_unobserve_property(dmpv_handle *ctx, uint64_t userdata)
 {
+    mp_mutex_lock(&ctx->clients->lock);
     mp_mutex_lock(&ctx->lock);
     int count = 0;
     for (int n = ctx->num_properties - 1; n >= 0; n--) {
@@ -1584,6 +1657,7 @@ int dmpv_unobserve_property(dmpv_handle *ctx, uint64_t userdata)
         // Perform actual removal of the property lazily to avoid creating
         // dangling pointers and such.
         if (prop->reply_id == userdata) {
+            remove_observer(ctx->clients, prop);
             prop_unref(prop);
             ctx->properties_change_ts += 1;
             MP_TARRAY_REMOVE_AT(ctx->properties, ctx->num_properties, n);
@@ -1592,6 +1666,7 @@ int dmpv_unobserve_property(dmpv_handle *ctx, uint64_t userdata)
         }
     }
     mp_mutex_unlock(&ctx->lock);
+    mp_mutex_unlock(&ctx->clients->lock);
     return count;
 }
 
@@ -1628,18 +1703,19 @@ void mp_client_property_change(struct MPContext *mpctx, const char *name)
 
     mp_mutex_lock(&clients->lock);
 
-    for (int n = 0; n < clients->num_clients; n++) {
-        struct dmpv_handle *client = clients->clients[n];
-        mp_mutex_lock(&client->lock);
-        for (int i = 0; i < client->num_properties; i++) {
-            if (client->properties[i]->id == id &&
-                property_shared_prefix(name, client->properties[i]->name)) {
-                client->properties[i]->change_ts += 1;
-                client->has_pending_properties = true;
-                any_pending = true;
-            }
+    if (id + 1 < clients->num_observers) {
+        struct observe_list *list = &clients->observers[id + 1];
+        for (int n = 0; n < list->num_props; n++) {
+            struct observe_property *prop = list->props[n];
+            if (!property_shared_prefix(name, prop->name))
+                continue;
+            struct dmpv_handle *client = prop->owner;
+            mp_mutex_lock(&client->lock);
+            prop->change_ts += 1;
+            client->has_pending_properties = true;
+            mp_mutex_unlock(&client->lock);
+            any_pending = true;
         }
-        mp_mutex_unlock(&client->lock);
     }
 
     mp_mutex_unlock(&clients->lock);
@@ -1669,29 +1745,89 @@ static void notify_property_events(struct dmpv_handle *ctx, int event)
         mp_dispatch_adjust_timeout(ctx->mpctx->dispatch, 0);
 }
 
+// Read the property into *val, or copy the value if it was already read for
+// another observer during this mp_client_send_property_changes() call.
+// Called on the core thread, without locks.
+static int read_observed_property(struct mp_client_api *clients,
+                                  struct observe_property *prop,
+                                  union m_option_value *val)
+{
+    for (int n = 0; n < clients->num_value_cache; n++) {
+        struct cached_value *c = &clients->value_cache[n];
+        if (c->id == prop->id && c->format == prop->format &&
+            strcmp(c->name, prop->name) == 0)
+        {
+            if (c->status >= 0)
+                m_option_copy(prop->type, val, &c->value);
+            return c->status;
+        }
+    }
+
+    struct getproperty_request req = {
+        .mpctx = clients->mpctx,
+        .name = prop->name,
+        .handle = &prop->handle,
+        .format = prop->format,
+        .data = val,
+    };
+    getproperty_fn(&req);
+
+    struct cached_value c = {
+        .id = prop->id,
+        .name = talloc_strdup(clients, prop->name),
+        .format = prop->format,
+        .status = req.status,
+    };
+    if (req.status >= 0)
+        m_option_copy(prop->type, &c.value, val);
+    MP_TARRAY_APPEND(clients, clients->value_cache, clients->num_value_cache, c);
+    return req.status;
+}
+
+static void clear_value_cache(struct mp_client_api *clients)
+{
+    for (int n = 0; n < clients->num_value_cache; n++) {
+        struct cached_value *c = &clients->value_cache[n];
+        if (c->status >= 0)
+            m_option_free(get_mp_type_get(c->format), &c->value);
+        talloc_free(c->name);
+    }
+    clients->num_value_cache = 0;
+}
+
 // Call with ctx->lock held (only). May temporarily drop the lock.
 static void send_client_property_changes(struct dmpv_handle *ctx)
 {
+    struct MPContext *mpctx = ctx->mpctx;
     uint64_t cur_ts = ctx->properties_change_ts;
 
     ctx->has_pending_properties = false;
 
+    // Properties updated on every DMPV_EVENT_TICK (like time-pos) are
+    // coalesced to at most --observe-max-rate updates per second.
+    double max_rate = mpctx->opts->observe_max_rate;
+    double now = mp_time_sec();
+    bool tick_update = max_rate <= 0 || now >= ctx->next_tick_update;
+    bool tick_deferred = false, tick_sent = false;
+
     for (int n = 0; n < ctx->num_properties; n++) {
         struct observe_property *prop = ctx->properties[n];
 
         if (prop->value_ts == prop->change_ts)
             continue;
 
+        if (prop->event_mask & (1ULL << DMPV_EVENT_TICK)) {
+            if (!tick_update) {
+                tick_deferred = true;
+                continue;
+            }
+            tick_sent = true;
+        }
+
         bool changed = false;
         if (prop->format) {
             const struct m_option *type = prop->type;
             union m_option_value val = {0};
-            struct getproperty_request req = {
-                .mpctx = ctx->mpctx,
-                .name = prop->name,
-                .format = prop->format,
-                .data = &val,
-            };
 
             // Temporarily unlock and read the property. The very important
             // thing is that property getters can do whatever they want, _and_
@@ -1699,7 +1835,7 @@ static void send_client_property_changes(struct dmpv_handle *ctx)
             prop->refcount += 1; // keep prop alive (esp. prop->name)
             ctx->async_counter += 1; // keep ctx alive
             mp_mutex_unlock(&ctx->lock);
-            getproperty_fn(&req);
+            int status = read_observed_property(ctx->clients, prop, &val);
             mp_mutex_lock(&ctx->lock);
             ctx->async_counter -= 1;
             prop_unref(prop);
@@ -1714,7 +1850,7 @@ static void send_client_property_changes(struct dmpv_handle *ctx)
             }
             mp_assert(prop->refcount > 0);
 
-            bool val_valid = req.status >= 0;
+            bool val_valid = status >= 0;
             changed = prop->value_valid != val_valid;
             if (prop->value_valid && val_valid)
                 changed = !equal_dmpv_value(&prop->value, &val, prop->format);
@@ -1749,6 +1885,13 @@ static void send_client_property_changes(struct dmpv_handle *ctx)
         prop->value_ts = prop->change_ts;
     }
 
+    if (tick_sent && max_rate > 0)
+        ctx->next_tick_update = now + 1.0 / max_rate;
+    if (tick_deferred) {
+        ctx->has_pending_properties = true;
+        mp_set_timeout(mpctx, ctx->next_tick_update - now);
+    }
+
     if (ctx->destroying || ctx->new_property_events)
         wakeup_client(ctx);
 }
@@ -1781,6 +1924,8 @@ void mp_client_send_property_changes(struct MPContext *mpctx)
     }
 
     mp_mutex_unlock(&clients->lock);
+
+    clear_value_cache(clients);
 }
 
 // Set ctx->cur_event to a generated property change event, if there is any
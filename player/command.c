@@ -79,6 +79,8 @@
 struct command_ctx {
     // All properties, terminated with a {0} item.
     struct m_property *properties;
+    // Name lookup for properties[].
+    struct m_property_index *prop_index;
 
     double last_seek_time;
     double last_seek_pts;
@@ -1526,8 +1528,14 @@ static int mp_property_demuxer_cache_state(void *ctx, struct m_property *prop,
     node_map_add_flag(r, "idle", s.idle);
     node_map_add_int64(r, "total-bytes", s.total_bytes);
     node_map_add_int64(r, "fw-bytes", s.fw_bytes);
-    if (s.file_cache_bytes >= 0)
+    node_map_add_int64(r, "cold-bytes", s.cold_bytes);
+    if (s.file_cache_bytes >= 0) {
         node_map_add_int64(r, "file-cache-bytes", s.file_cache_bytes);
+        node_map_add_int64(r, "file-cache-syscall-rate",
+                           s.file_cache_syscall_rate);
+        node_map_add_int64(r, "file-cache-write-rate", s.file_cache_write_rate);
+        node_map_add_int64(r, "file-cache-read-rate", s.file_cache_read_rate);
+    }
     if (s.bytes_per_second > 0)
         node_map_add_int64(r, "raw-input-rate", s.bytes_per_second);
     if (s.seeking != MP_NOPTS_VALUE)
@@ -3036,6 +3044,64 @@ static int mp_property_sub_end(void *ctx, struct m_property *prop,
     return m_property_double_ro(action, arg, end);
 }
 
+static int mp_property_sub_preload_state(void *ctx, struct m_property *prop,
+                                         int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    int track_ind = *(int *)prop->priv;
+    struct track *track = mpctx->current_track[track_ind][STREAM_SUB];
+    struct sub_preload_state st;
+    if (!track || !track->d_sub || !sub_get_preload_state(track->d_sub, &st))
+        return M_PROPERTY_UNAVAILABLE;
+
+    if (action == M_PROPERTY_GET_TYPE) {
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    }
+    if (action != M_PROPERTY_GET)
+        return M_PROPERTY_NOT_IMPLEMENTED;
+
+    struct dmpv_node *r = (struct dmpv_node *)arg;
+    node_init(r, DMPV_FORMAT_NODE_MAP, NULL);
+    node_map_add_flag(r, "active", st.active);
+    node_map_add_flag(r, "done", st.done);
+    node_map_add_int64(r, "packets", st.packets);
+    if (st.pts != MP_NOPTS_VALUE)
+        node_map_add_double(r, "pts", st.pts);
+    node_map_add_double(r, "time", st.time);
+    return M_PROPERTY_OK;
+}
+
+static int mp_property_sub_render_cache(void *ctx, struct m_property *prop,
+                                        int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    int track_ind = *(int *)prop->priv;
+    struct track *track = mpctx->current_track[track_ind][STREAM_SUB];
+    if (!track || !track->d_sub)
+        return M_PROPERTY_UNAVAILABLE;
+
+    if (action == M_PROPERTY_GET_TYPE) {
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    }
+    if (action != M_PROPERTY_GET)
+        return M_PROPERTY_NOT_IMPLEMENTED;
+
+    struct sub_render_stats st;
+    sub_get_render_stats(track->d_sub, &st);
+
+    struct dmpv_node *r = (struct dmpv_node *)arg;
+    node_init(r, DMPV_FORMAT_NODE_MAP, NULL);
+    node_map_add_int64(r, "hits", st.hits);
+    node_map_add_int64(r, "misses", st.misses);
+    node_map_add_int64(r, "prerendered", st.prerendered);
+    node_map_add_double(r, "render-time", st.render_time);
+    node_map_add_double(r, "render-time-max", st.render_time_max);
+    node_map_add_double(r, "prerender-time", st.prerender_time);
+    return M_PROPERTY_OK;
+}
+
 static int mp_property_sub_forced_only_cur(void *ctx, struct m_property *prop,
                                            int action, void *arg)
 {
@@ -3992,6 +4058,14 @@ static const struct m_property mp_properties_base[] = {
         .priv = (void *)&(const int){0}},
     {"secondary-sub-end", mp_property_sub_end,
         .priv = (void *)&(const int){1}},
+    {"sub-preload-state", mp_property_sub_preload_state,
+        .priv = (void *)&(const int){0}},
+    {"secondary-sub-preload-state", mp_property_sub_preload_state,
+        .priv = (void *)&(const int){1}},
+    {"sub-render-cache", mp_property_sub_render_cache,
+        .priv = (void *)&(const int){0}},
+    {"secondary-sub-render-cache", mp_property_sub_render_cache,
+        .priv = (void *)&(const int){1}},
     {"sub-forced-only-cur", mp_property_sub_forced_only_cur},
 
     {"vf", mp_property_vf},
@@ -4074,6 +4148,8 @@ static const char *const *const mp_event_property_change[] = {
       "audio-bitrate", "video-bitrate", "sub-bitrate", "decoder-frame-drop-count",
       "frame-drop-count", "video-frame-info", "vf-metadata", "af-metadata",
       "sub-start", "sub-end", "secondary-sub-start", "secondary-sub-end",
+      "sub-preload-state", "secondary-sub-preload-state",
+      "sub-render-cache", "secondary-sub-render-cache",
       "deinterlace-active"),
     E(MP_EVENT_DURATION_UPDATE, "duration"),
     E(DMPV_EVENT_VIDEO_RECONFIG, "video-out-params", "video-params",
@@ -4148,11 +4224,12 @@ uint64_t mp_get_property_event_mask(const char *name)
 int mp_get_property_id(struct MPContext *mpctx, const char *name)
 {
     struct command_ctx *ctx = mpctx->command_ctx;
-    for (int n = 0; ctx->properties[n].name; n++) {
-        if (match_property(ctx->properties[n].name, name))
-            return n;
-    }
-    return -1;
+    // Give options and properties the same ID each, like match_property().
+    if (strncmp(name, "options/", 8) == 0)
+        name += 8;
+    struct m_property *prop =
+        m_property_index_find(ctx->prop_index, name, strcspn(name, "/"));
+    return prop ? prop - ctx->properties : -1;
 }
 
 static bool is_property_set(int action, void *val)
@@ -4173,11 +4250,25 @@ static bool is_property_set(int action, void *val)
     }
 }
 
+void mp_property_resolve(struct MPContext *mpctx, const char *name,
+                         struct m_property_handle *h)
+{
+    m_property_resolve(mpctx->command_ctx->prop_index, name, h);
+}
+
 int mp_property_do(const char *name, int action, void *val,
                    struct MPContext *ctx)
 {
-    struct command_ctx *cmd = ctx->command_ctx;
-    int r = m_property_do(ctx->log, cmd->properties, name, action, val, ctx);
+    struct m_property_handle h;
+    mp_property_resolve(ctx, name, &h);
+    return mp_property_do_handle(&h, action, val, ctx);
+}
+
+int mp_property_do_handle(const struct m_property_handle *h, int action,
+                          void *val, struct MPContext *ctx)
+{
+    const char *name = h->name;
+    int r = m_property_do_handle(ctx->log, h, action, val, ctx);
 
     if (mp_msg_test(ctx->log, MSGL_V) && is_property_set(action, val)) {
         struct m_option option_type = {0};
@@ -4202,7 +4293,7 @@ int mp_property_do(const char *name, int action, void *val,
 char *mp_property_expand_string(struct MPContext *mpctx, const char *str)
 {
     struct command_ctx *ctx = mpctx->command_ctx;
-    return m_properties_expand_string(ctx->properties, str, mpctx);
+    return m_properties_expand_string(ctx->prop_index, str, mpctx);
 }
 
 // Before expanding properties, parse C-style escapes like "\n"
@@ -6696,6 +6787,7 @@ const struct mp_cmd_def mp_cmds[] = {
                 .flags = MP_CMD_OPT_ARG},
         },
         .spawn_thread = true,
+        .exec_async = true,
     },
     { "screenshot-to-file", cmd_screenshot_to_file,
         {
@@ -6707,6 +6799,7 @@ const struct mp_cmd_def mp_cmds[] = {
                 OPTDEF_INT(2)},
         },
         .spawn_thread = true,
+        .exec_async = true,
     },
     { "screenshot-raw", cmd_screenshot_raw,
         {
@@ -7032,6 +7125,8 @@ void command_init(struct MPContext *mpctx)
         ctx->properties[count++] = prop;
     }
 
+    ctx->prop_index = m_property_index_create(ctx, ctx->properties);
+
     node_init(&ctx->udata, DMPV_FORMAT_NODE_MAP, NULL);
     talloc_steal(ctx, ctx->udata.u.list);
     talloc_free(prop_names);
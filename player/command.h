@@ -28,6 +28,7 @@ struct mp_cmd;
 struct mp_log;
 struct dmpv_node;
 struct m_config_option;
+struct m_property_handle;
 
 void command_init(struct MPContext *mpctx);
 void command_uninit(struct MPContext *mpctx);
@@ -78,6 +79,11 @@ char *mp_property_expand_escaped_string(struct MPContext *mpctx, const char *str
 void property_print_help(struct MPContext *mpctx);
 int mp_property_do(const char* name, int action, void* val,
                    struct MPContext *mpctx);
+// Look up name once, for repeated use with mp_property_do_handle().
+void mp_property_resolve(struct MPContext *mpctx, const char *name,
+                         struct m_property_handle *h);
+int mp_property_do_handle(const struct m_property_handle *h, int action,
+                          void *val, struct MPContext *mpctx);
 
 void mp_option_change_callback(void *ctx, struct m_config_option *co, int flags,
                                bool self_update);
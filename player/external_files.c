@@ -15,7 +15,6 @@
  * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <dirent.h>
 #include <string.h>
 #include <strings.h>
 #include <stdlib.h>
@@ -27,6 +26,7 @@
 #include "common/msg.h"
 #include "misc/ctype.h"
 #include "misc/charset_conv.h"
+#include "misc/dir_cache.h"
 #include "options/options.h"
 #include "options/path.h"
 #include "external_files.h"
@@ -199,14 +199,17 @@ static void append_dir_subtitles(struct dmpv_global *global, struct MPOpts *opts
     if (mp_is_url(bstr0(path0)))
         goto out;
 
-    DIR *d = opendir(path0);
-    if (!d)
+    // Cached, since this is done again for each file in the same directory.
+    struct mp_dir_listing *dir = mp_dir_list(tmpmem, global, path0);
+    if (!dir)
         goto out;
     mp_verbose(log, "Loading external files in %.*s\n", BSTR_P(path));
-    struct dirent *de;
-    while ((de = readdir(d))) {
+    for (int i = 0; i < dir->num_entries; i++) {
+        struct mp_dir_entry *de = &dir->entries[i];
+        if (de->is_dir)
+            continue;
         void *tmpmem2 = talloc_new(tmpmem);
-        struct bstr den = bstr0(de->d_name);
+        struct bstr den = bstr0(de->name);
         struct bstr dename = mp_iconv_to_utf8(log, den,
                                               "UTF-8-MAC", MP_NO_LATIN1_FALLBACK);
         // retrieve various parts of the filename
@@ -277,7 +280,7 @@ static void append_dir_subtitles(struct dmpv_global *global, struct MPOpts *opts
             prio |= 1;
 
         mp_trace(log, "Potential external file: \"%s\"  Priority: %d\n",
-               de->d_name, prio);
+               de->name, prio);
 
         if (prio) {
             char *subpath = mp_path_join_bstr(*slist, path, dename);
@@ -300,7 +303,6 @@ static void append_dir_subtitles(struct dmpv_global *global, struct MPOpts *opts
     next_sub:
         talloc_free(tmpmem2);
     }
-    closedir(d);
 
  out:
     talloc_free(tmpmem);
@@ -754,6 +754,35 @@ local function add_audio(s)
 end
 
 
+local function add_subtitles(s)
+    local r = mp.get_property_native("sub-render-cache")
+    if not r then
+        return
+    end
+
+    append(s, "", {prefix=o.nl .. o.nl .. "Subtitles:", nl="", indent=""})
+    append_property(s, "current-tracks/sub/codec", {prefix_sep="", nl="", indent=""})
+    local total = r["hits"] + r["misses"]
+    if total > 0 then
+        append(s, format("%.1f%%", r["hits"] / total * 100),
+               {prefix="Render Cache:", suffix=" hits"})
+        append(s, r["prerendered"], {prefix="(", suffix=" pre-rendered)", nl="",
+               no_prefix_markup=true, prefix_sep="", indent=o.prefix_sep})
+    end
+    if r["misses"] > 0 then
+        append(s, format("%.2f ms", r["render-time"] / r["misses"] * 1e3),
+               {prefix="Render Time:", suffix=" (avg)"})
+        append(s, format("%.2f ms", r["render-time-max"] * 1e3),
+               {suffix=" (max)", nl="", indent=""})
+    end
+    local p = mp.get_property_native("sub-preload-state")
+    if p then
+        append(s, format("%.3f s", p["time"]), {prefix="Preload:",
+               suffix=p["active"] and " (loading)" or ""})
+    end
+end
+
+
 -- Determine whether ASS formatting shall/can be used and set formatting sequences
 local function eval_ass_formatting()
     o.use_ass = o.ass_formatting and has_vo_window()
@@ -785,6 +814,7 @@ local function default_stats()
     add_file(stats)
     add_video(stats)
     add_audio(stats)
+    add_subtitles(stats)
     return table.concat(stats)
 end
 
@@ -919,6 +949,10 @@ local function cache_stats()
            {prefix = "Total RAM:"})
     append(stats, utils.format_bytes_humanized(info["fw-bytes"]),
            {prefix = "Forward RAM:"})
+    if info["cold-bytes"] and info["cold-bytes"] > 0 then
+        append(stats, utils.format_bytes_humanized(info["cold-bytes"]),
+               {prefix = "Compacted RAM:"})
+    end
 
     local fc = info["file-cache-bytes"]
     if fc ~= nil then
@@ -927,6 +961,13 @@ local function cache_stats()
         fc = "(disabled)"
     end
     append(stats, fc, {prefix = "Disk cache:"})
+    if info["file-cache-syscall-rate"] ~= nil then
+        append(stats, format("%s/s written, %s/s read, %d syscalls/s",
+                       utils.format_bytes_humanized(info["file-cache-write-rate"]),
+                       utils.format_bytes_humanized(info["file-cache-read-rate"]),
+                       info["file-cache-syscall-rate"]),
+               {prefix = "Disk cache I/O:"})
+    end
 
     append(stats, info["debug-low-level-seeks"], {prefix = "Media seeks:"})
     append(stats, info["debug-byte-level-seeks"], {prefix = "Stream seeks:"})
@@ -32,6 +32,7 @@
 
 #include "misc/dmpv_talloc.h"
 
+#include "misc/dir_cache.h"
 #include "misc/dispatch.h"
 #include "misc/random.h"
 #include "misc/thread_pool.h"
@@ -168,6 +169,9 @@ void mp_destroy(struct MPContext *mpctx)
 
     mp_clients_destroy(mpctx);
 
+    // Owns a stats context, so it must go away before mpctx->global.
+    TA_FREEP(&mpctx->thread_pool);
+
     osd_free(mpctx->osd);
 
     if (cas_terminal_owner(mpctx, mpctx)) {
@@ -257,6 +261,9 @@ struct MPContext *mp_create(void)
     mpctx->global = talloc_zero(mpctx, struct dmpv_global);
 
     stats_global_init(mpctx->global);
+    mp_dir_cache_init(mpctx->global);
+
+    mp_thread_pool_set_stats(mpctx->thread_pool, mpctx->global, "thread_pool");
 
     // Nothing must call mp_msg*() and related before this
     mp_msg_init(mpctx->global);
@@ -347,6 +347,13 @@ static void mp_seek(MPContext *mpctx, struct seek_params seek)
 
     demux_flags |= SEEK_BLOCK;
 
+    // A running subtitle preload must not decode packets from the new
+    // position. (sub_reset() would stop it too, but only after the seek.)
+    for (int t = 0; t < mpctx->num_tracks; t++) {
+        if (mpctx->tracks[t]->d_sub)
+            sub_preload_stop(mpctx->tracks[t]->d_sub);
+    }
+
     if (!demux_seek(mpctx->demuxer, demux_pts, demux_flags)) {
         if (!mpctx->demuxer->seekable) {
             MP_ERR(mpctx, "Cannot seek in this stream.\n");
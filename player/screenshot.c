@@ -18,8 +18,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <libavcodec/avcodec.h>
+#include <libavutil/cpu.h>
 
 #include "common/global.h"
 #include "osdep/io.h"
@@ -28,14 +30,17 @@
 #include "screenshot.h"
 #include "core.h"
 #include "command.h"
+#include "client.h"
 #include "input/cmd.h"
 #include "misc/bstr.h"
 #include "misc/dispatch.h"
 #include "misc/mp_assert.h"
 #include "misc/node.h"
+#include "misc/thread_pool.h"
 #include "misc/thread_tools.h"
 #include "common/msg.h"
 #include "options/path.h"
+#include "osdep/threads.h"
 #include "video/mp_image.h"
 #include "video/mp_image_pool.h"
 #include "video/out/vo.h"
@@ -54,11 +59,45 @@ typedef struct screenshot_ctx {
 
     // Command to repeat in each-frame mode.
     struct mp_cmd *each_frame;
+    // Each-frame commands issued and captured (or completed).
+    uint64_t each_frame_seq, each_frame_done;
 
     int frameno;
     uint64_t last_frame_count;
+
+    // Encoder threads, created on first use.
+    struct mp_thread_pool *pool;
+    // Filenames of screenshots not written yet (owned by encode_job).
+    char **pending_names;
+    int num_pending_names;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    int64_t queued_bytes;       // image memory of pending jobs; protected by lock
 } screenshot_ctx;
 
+// A screenshot being encoded on ctx->pool.
+struct encode_job {
+    struct mp_cmd_ctx *cmd;
+    struct mp_image *image;
+    char *filename;
+    struct image_writer_opts opts;
+    bool overwrite;
+    bool report_filename;       // return filename as command result
+    int64_t bytes;
+    bool ok;
+};
+
+static void screenshot_destroy(void *p)
+{
+    screenshot_ctx *ctx = p;
+
+    // All jobs were finished, because they count as outstanding_async.
+    talloc_free(ctx->pool);
+    pthread_mutex_destroy(&ctx->lock);
+    pthread_cond_destroy(&ctx->wakeup);
+}
+
 void screenshot_init(struct MPContext *mpctx)
 {
     mpctx->screenshot_ctx = talloc(mpctx, screenshot_ctx);
@@ -67,6 +106,9 @@ void screenshot_init(struct MPContext *mpctx)
         .frameno = 1,
         .log = mp_log_new(mpctx, mpctx->log, "screenshot")
     };
+    pthread_mutex_init(&mpctx->screenshot_ctx->lock, NULL);
+    pthread_cond_init(&mpctx->screenshot_ctx->wakeup, NULL);
+    talloc_set_destructor(mpctx->screenshot_ctx, screenshot_destroy);
 }
 
 static char *stripext(void *talloc_ctx, const char *s)
@@ -77,29 +119,122 @@ static char *stripext(void *talloc_ctx, const char *s)
     return talloc_asprintf(talloc_ctx, "%.*s", (int)(end - s), s);
 }
 
-static bool write_screenshot(struct mp_cmd_ctx *cmd, struct mp_image *img,
-                             const char *filename, struct image_writer_opts *opts,
-                             bool overwrite)
+// Runs on the core thread.
+static void finish_encode_job(void *p)
 {
+    struct encode_job *job = p;
+    struct mp_cmd_ctx *cmd = job->cmd;
     struct MPContext *mpctx = cmd->mpctx;
-    struct image_writer_opts *gopts = mpctx->opts->screenshot_image_opts;
-    struct image_writer_opts opts_copy = opts ? *opts : *gopts;
+
+    if (job->ok) {
+        mp_cmd_msg(cmd, MSGL_INFO, "Screenshot: '%s'", job->filename);
+        if (job->report_filename) {
+            node_init(&cmd->result, DMPV_FORMAT_NODE_MAP, NULL);
+            node_map_add_string(&cmd->result, "filename", job->filename);
+        }
+    } else {
+        mp_cmd_msg(cmd, MSGL_ERR, "Error writing screenshot!");
+    }
+    cmd->success = job->ok;
+
+    screenshot_ctx *ctx = mpctx->screenshot_ctx;
+    for (int n = 0; n < ctx->num_pending_names; n++) {
+        if (ctx->pending_names[n] == job->filename) {
+            MP_TARRAY_REMOVE_AT(ctx->pending_names, ctx->num_pending_names, n);
+            break;
+        }
+    }
+    talloc_free(job);
+
+    mpctx->outstanding_async -= 1;
+    if (!mpctx->outstanding_async && mp_is_shutting_down(mpctx))
+        mp_wakeup_core(mpctx);
+
+    mp_cmd_ctx_complete(cmd);
+}
+
+static void run_encode_job(void *p)
+{
+    struct encode_job *job = p;
+    struct MPContext *mpctx = job->cmd->mpctx;
+    screenshot_ctx *ctx = mpctx->screenshot_ctx;
+
+    job->ok = write_image(job->image, &job->opts, job->filename, mpctx->global,
+                          ctx->log, job->overwrite);
+    TA_FREEP(&job->image);
+
+    mp_mutex_lock(&ctx->lock);
+    ctx->queued_bytes -= job->bytes;
+    pthread_cond_broadcast(&ctx->wakeup);
+    mp_mutex_unlock(&ctx->lock);
+
+    mp_dispatch_enqueue(mpctx->dispatch, finish_encode_job, job);
+}
+
+static int64_t image_bytes(struct mp_image *img)
+{
+    int64_t size = 0;
+    for (int p = 0; p < img->num_planes; p++)
+        size += (int64_t)abs(img->stride[p]) * mp_image_plane_h(img, p);
+    return size;
+}
+
+// Encode img to filename on the encoder threads, and complete cmd once done.
+// Takes ownership of img. The command must have been declared with exec_async.
+// Must be called with the core locked from a thread other than the core thread
+// (i.e. from a spawn_thread command), as this may unlock the core to wait for
+// queued screenshots to be written.
+static void queue_screenshot(struct mp_cmd_ctx *cmd, struct mp_image *img,
+                             const char *filename,
+                             struct image_writer_opts *opts, bool overwrite,
+                             bool report_filename)
+{
+    struct MPContext *mpctx = cmd->mpctx;
+    screenshot_ctx *ctx = mpctx->screenshot_ctx;
+
+    struct encode_job *job = talloc_ptrtype(NULL, job);
+    *job = (struct encode_job){
+        .cmd = cmd,
+        .image = talloc_steal(job, img),
+        .filename = talloc_strdup(job, filename),
+        .opts = opts ? *opts : *mpctx->opts->screenshot_image_opts,
+        .overwrite = overwrite,
+        .report_filename = report_filename,
+        .bytes = image_bytes(img),
+    };
+    MP_TARRAY_APPEND(ctx, ctx->pending_names, ctx->num_pending_names,
+                     job->filename);
 
     mp_cmd_msg(cmd, MSGL_V, "Starting screenshot: '%s'", filename);
 
-    mp_core_unlock(mpctx);
+    if (!ctx->pool) {
+        int threads = mpctx->opts->screenshot_threads;
+        if (!threads)
+            threads = MPCLAMP(av_cpu_count(), 1, 8);
+        ctx->pool = mp_thread_pool_create(ctx, 0, 1, threads);
+    }
 
-    bool ok = img && write_image(img, &opts_copy, filename, mpctx->global,
-                                 mpctx->screenshot_ctx->log, overwrite);
+    // Stay within the memory budget (but always allow 1 image).
+    int64_t max_bytes = mpctx->opts->screenshot_max_queue_bytes;
+    mp_mutex_lock(&ctx->lock);
+    if (ctx->queued_bytes && ctx->queued_bytes + job->bytes > max_bytes) {
+        mp_core_unlock(mpctx);
+        while (ctx->queued_bytes && ctx->queued_bytes + job->bytes > max_bytes)
+            pthread_cond_wait(&ctx->wakeup, &ctx->lock);
+        mp_mutex_unlock(&ctx->lock);
+        mp_core_lock(mpctx);
+        mp_mutex_lock(&ctx->lock);
+    }
+    ctx->queued_bytes += job->bytes;
+    mp_mutex_unlock(&ctx->lock);
 
-    mp_core_lock(mpctx);
+    mpctx->outstanding_async += 1; // prevent that core disappears
 
-    if (ok) {
-        mp_cmd_msg(cmd, MSGL_INFO, "Screenshot: '%s'", filename);
-    } else {
-        mp_cmd_msg(cmd, MSGL_ERR, "Error writing screenshot!");
+    if (!mp_thread_pool_queue(ctx->pool, run_encode_job, job)) {
+        mp_core_unlock(mpctx);
+        run_encode_job(job);
+        mp_core_lock(mpctx);
     }
-    return ok;
 }
 
 #define ILLEGAL_FILENAME_CHARS "/"
@@ -308,7 +443,11 @@ static char *gen_fname(struct mp_cmd_ctx *cmd, const char *file_ext)
             mp_mkdirp(full_dir);
         }
 
-        if (!mp_path_exists(fname))
+        bool pending = false;
+        for (int n = 0; n < ctx->num_pending_names; n++)
+            pending |= strcmp(ctx->pending_names[n], fname) == 0;
+
+        if (!mp_path_exists(fname) && !pending)
             return fname;
 
         if (sequence == prev_sequence) {
@@ -480,17 +619,16 @@ void cmd_screenshot_to_file(void *p)
     if (!image) {
         mp_cmd_msg(cmd, MSGL_ERR, "Taking screenshot failed.");
         cmd->success = false;
+        mp_cmd_ctx_complete(cmd);
         return;
     }
-    cmd->success = write_screenshot(cmd, image, filename, &opts, true);
-    talloc_free(image);
+    queue_screenshot(cmd, image, filename, &opts, true, false);
 }
 
 void cmd_screenshot(void *p)
 {
     struct mp_cmd_ctx *cmd = p;
     struct MPContext *mpctx = cmd->mpctx;
-    struct dmpv_node *res = &cmd->result;
     int mode = cmd->args[0].v.i & 3;
     bool each_frame_toggle = (cmd->args[0].v.i | cmd->args[1].v.i) & 8;
     bool each_frame_mode = cmd->args[0].v.i & 16;
@@ -504,6 +642,7 @@ void cmd_screenshot(void *p)
         if (each_frame_toggle) {
             if (ctx->each_frame) {
                 TA_FREEP(&ctx->each_frame);
+                mp_cmd_ctx_complete(cmd);
                 return;
             }
             ctx->each_frame = talloc_steal(ctx, mp_cmd_clone(cmd->cmd));
@@ -523,18 +662,21 @@ void cmd_screenshot(void *p)
     if (image) {
         char *filename = gen_fname(cmd, image_writer_file_ext(opts));
         if (filename) {
-            cmd->success = write_screenshot(cmd, image, filename, NULL, false);
-            if (cmd->success) {
-                node_init(res, DMPV_FORMAT_NODE_MAP, NULL);
-                node_map_add_string(res, "filename", filename);
+            queue_screenshot(cmd, image, filename, NULL, false, true);
+            talloc_free(filename);
+            // The each-frame loop can continue with the next frame.
+            if (each_frame_mode && mpctx->opts->screenshot_each_frame_parallel) {
+                ctx->each_frame_done = ctx->each_frame_seq;
+                mp_wakeup_core(mpctx);
             }
+            return;
         }
-        talloc_free(filename);
     } else {
         mp_cmd_msg(cmd, MSGL_ERR, "Taking screenshot failed.");
     }
 
     talloc_free(image);
+    mp_cmd_ctx_complete(cmd);
 }
 
 void cmd_screenshot_raw(void *p)
@@ -572,11 +714,12 @@ void cmd_screenshot_raw(void *p)
 
 static void screenshot_fin(struct mp_cmd_ctx *cmd)
 {
-    void **a = cmd->on_completion_priv;
-    struct MPContext *mpctx = a[0];
-    struct mp_waiter *waiter = a[1];
+    uint64_t *seq = cmd->on_completion_priv;
+    struct MPContext *mpctx = cmd->mpctx;
+    screenshot_ctx *ctx = mpctx->screenshot_ctx;
 
-    mp_waiter_wakeup(waiter, 0);
+    ctx->each_frame_done = MPMAX(ctx->each_frame_done, *seq);
+    talloc_free(seq);
     mp_wakeup_core(mpctx);
 }
 
@@ -591,14 +734,14 @@ void handle_each_frame_screenshot(struct MPContext *mpctx)
         return;
     ctx->last_frame_count = mpctx->shown_vframes;
 
-    struct mp_waiter wait = MP_WAITER_INITIALIZER;
-    void *a[] = {mpctx, &wait};
-    run_command(mpctx, mp_cmd_clone(ctx->each_frame), NULL, screenshot_fin, a);
+    uint64_t *seq = talloc_ptrtype(NULL, seq);
+    *seq = ++ctx->each_frame_seq;
+    run_command(mpctx, mp_cmd_clone(ctx->each_frame), NULL, screenshot_fin, seq);
 
-    // Block (in a reentrant way) until the screenshot was written. Otherwise,
-    // we could pile up screenshot requests forever.
-    while (!mp_waiter_poll(&wait))
+    // Block (in a reentrant way) until the screenshot was written, or with
+    // --screenshot-each-frame-parallel, until it was queued for encoding.
+    // Otherwise, we could pile up screenshot requests forever.
+    uint64_t wait_seq = ctx->each_frame_seq;
+    while (ctx->each_frame_done < wait_seq)
         mp_idle(mpctx);
-
-    mp_waiter_wait(&wait);
 }
@@ -96,6 +96,7 @@ static bool update_subtitle(struct MPContext *mpctx, double video_pts,
     if (track->demuxer->fully_read && sub_can_preload(dec_sub)) {
         // Assume fully_read implies no interleaved audio/video streams.
         // (Reading packets will change the demuxer position.)
+        sub_preload_stop(dec_sub);
         demux_seek(track->demuxer, 0, 0);
         sub_preload(dec_sub);
     }
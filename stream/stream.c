@@ -20,6 +20,10 @@
 #include <limits.h>
 
 #include <strings.h>
+#include <sys/uio.h>
+
+#include <libavutil/buffer.h>
+
 #include "misc/mp_assert.h"
 
 #include "osdep/io.h"
@@ -82,6 +86,10 @@ static const stream_info_t *const stream_list[] = {
 struct stream_opts {
     int64_t buffer_size;
     bool load_unsafe_playlists;
+    bool adaptive_readahead;
+    int64_t readahead_max;
+    bool io_uring;
+    bool mmap;
 };
 
 #define OPT_BASE_STRUCT struct stream_opts
@@ -91,11 +99,17 @@ const struct m_sub_options stream_conf = {
         {"stream-buffer-size", OPT_BYTE_SIZE(buffer_size),
             M_RANGE(STREAM_MIN_BUFFER_SIZE, STREAM_MAX_BUFFER_SIZE)},
         {"load-unsafe-playlists", OPT_BOOL(load_unsafe_playlists)},
+        {"stream-adaptive-readahead", OPT_BOOL(adaptive_readahead)},
+        {"stream-readahead-max", OPT_BYTE_SIZE(readahead_max),
+            M_RANGE(STREAM_MIN_BUFFER_SIZE, STREAM_MAX_BUFFER_SIZE)},
+        {"stream-io-uring", OPT_BOOL(io_uring)},
+        {"stream-mmap", OPT_BOOL(mmap)},
         {0}
     },
     .size = sizeof(struct stream_opts),
     .defaults = &(const struct stream_opts){
         .buffer_size = 128 * 1024,
+        .readahead_max = 16 * 1024 * 1024,
     },
 };
 
@@ -259,6 +273,10 @@ static bool stream_resize_buffer(struct stream *s, int keep, int new)
     mp_assert(keep <= new);
 
     new = MPMAX(new, s->requested_buffer_size);
+    // Don't shrink back after read-ahead was raised; it would have to be
+    // reallocated again on the next refill.
+    if (s->adaptive_readahead)
+        new = MPMAX(new, s->readahead_size * 2);
     new = MPMIN(new, STREAM_MAX_BUFFER_SIZE);
     new = mp_round_next_power_of_2(new);
 
@@ -334,6 +352,8 @@ static int stream_create_instance(const stream_info_t *sinfo,
     s->path = talloc_strdup(s, path);
     s->mode = flags & (STREAM_READ | STREAM_WRITE);
     s->requested_buffer_size = opts->buffer_size;
+    if (opts->adaptive_readahead)
+        s->readahead_max = MPMAX(opts->readahead_max, opts->buffer_size);
 
     if (flags & STREAM_LESS_NOISE)
         mp_msg_set_max_level(s->log, MSGL_WARN);
@@ -469,16 +489,26 @@ stream_t *open_output_stream(const char *filename, struct dmpv_global *global)
 // s->buffer, but into buf[0..len] instead.
 // Returns 0 on error or EOF, and length of bytes read on success.
 // Partial reads are possible, even if EOF is not reached.
-static int stream_read_unbuffered(stream_t *s, void *buf, int len)
+// If iovcnt > 1, s->fill_buffer_iov must be set.
+static int stream_read_unbuffered_iov(stream_t *s, struct iovec *iov,
+                                      int iovcnt)
 {
+    int len = 0;
+    for (int n = 0; n < iovcnt; n++)
+        len += iov[n].iov_len;
     mp_assert(len >= 0);
     if (len <= 0)
         return 0;
 
     int res = 0;
     // we will retry even if we already reached EOF previously.
-    if (s->fill_buffer && !mp_cancel_test(s->cancel))
-        res = s->fill_buffer(s, buf, len);
+    if (!mp_cancel_test(s->cancel)) {
+        if (iovcnt > 1) {
+            res = s->fill_buffer_iov(s, iov, iovcnt);
+        } else if (s->fill_buffer) {
+            res = s->fill_buffer(s, iov[0].iov_base, len);
+        }
+    }
     if (res <= 0) {
         s->eof = 1;
         return 0;
@@ -491,6 +521,30 @@ static int stream_read_unbuffered(stream_t *s, void *buf, int len)
     return res;
 }
 
+static int stream_read_unbuffered(stream_t *s, void *buf, int len)
+{
+    return stream_read_unbuffered_iov(s, &(struct iovec){buf, len}, 1);
+}
+
+// Refills that follow each other within this time raise the read-ahead size.
+#define READAHEAD_FAST_REFILL MP_TIME_MS_TO_NS(100)
+
+static void update_readahead(struct stream *s)
+{
+    int64_t now = mp_time_ns();
+    int min_size = s->requested_buffer_size / 2;
+    if (s->readahead_size < min_size)
+        s->readahead_size = min_size;
+    if (s->readahead_last_refill &&
+        now - s->readahead_last_refill < READAHEAD_FAST_REFILL &&
+        s->readahead_size < s->readahead_max / 2)
+    {
+        s->readahead_size = MPMIN(s->readahead_size * 2, s->readahead_max / 2);
+        MP_DBG(s, "raising read-ahead to %d bytes\n", s->readahead_size);
+    }
+    s->readahead_last_refill = now;
+}
+
 // Ask for having at most "forward" bytes ready to read in the buffer.
 // To read everything, you may have to call this in a loop.
 //  forward: desired amount of bytes in buffer after s->cur_pos
@@ -505,6 +559,10 @@ static bool stream_read_more(struct stream *s, int forward)
 
     // Avoid that many small reads will lead to many low-level read calls.
     forward = MPMAX(forward, s->requested_buffer_size / 2);
+    if (s->adaptive_readahead) {
+        update_readahead(s);
+        forward = MPMAX(forward, s->readahead_size);
+    }
     mp_assert(forward_avail < forward);
 
     // Keep guaranteed seek-back.
@@ -527,12 +585,19 @@ static bool stream_read_more(struct stream *s, int forward)
     int read = buf_alloc - (buf_old + forward_avail); // free buffer past end
 
     int pos = s->buf_end & s->buffer_mask;
-    read = MPMIN(read, buf_alloc - pos);
+    struct iovec iov[2] = {{&s->buffer[pos], MPMIN(read, buf_alloc - pos)}};
+    int iovcnt = 1;
 
     // Note: if wrap-around happens, we need to make two calls. This may
     // affect latency (e.g. waiting for new data on a socket), so do only
-    // 1 read call always.
-    read = stream_read_unbuffered(s, &s->buffer[pos], read);
+    // 1 read call always. Streams which support scattered reads can fill
+    // both parts at once.
+    if (s->fill_buffer_iov && read > iov[0].iov_len) {
+        iov[1] = (struct iovec){s->buffer, read - iov[0].iov_len};
+        iovcnt = 2;
+    }
+
+    read = stream_read_unbuffered_iov(s, iov, iovcnt);
 
     s->buf_end += read;
 
@@ -617,6 +682,35 @@ int stream_read_peek(stream_t *s, void *buf, int buf_size)
     return ring_copy(s, buf, buf_size, s->buf_cur);
 }
 
+// Like stream_read(), but return a reference to the data instead of copying
+// it, if the stream supports it (see stream.read_ref). Returns NULL and does
+// not change the position if it's not supported; use stream_read() then.
+struct AVBufferRef *stream_read_ref(stream_t *s, int len, int padding)
+{
+    if (!s->read_ref || len <= 0)
+        return NULL;
+
+    unsigned int avail = s->buf_end - s->buf_cur;
+    if (len > avail && !s->seekable)
+        return NULL;
+
+    int64_t pos = stream_tell(s);
+    struct AVBufferRef *ref = s->read_ref(s, pos, len, padding);
+    if (!ref)
+        return NULL;
+
+    // Skip the data. Usually, it's either still buffered (small packets), or
+    // it's cheap to skip by seeking in the underlying stream.
+    if (len <= avail) {
+        s->buf_cur += len;
+    } else if (!stream_seek(s, pos + len)) {
+        av_buffer_unref(&ref);
+        return NULL;
+    }
+
+    return ref;
+}
+
 int stream_write_buffer(stream_t *s, void *buf, int len)
 {
     if (!s->write_buffer)
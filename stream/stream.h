@@ -28,6 +28,9 @@
 
 #include "misc/bstr.h"
 
+struct AVBufferRef;
+struct iovec;
+
 // Minimum guaranteed buffer and seek-back size. For any reads <= of this size,
 // it's guaranteed that you can seek back by <= of this size again.
 #define STREAM_BUFFER_SIZE 2048
@@ -102,6 +105,16 @@ typedef struct stream {
 
     // Read
     int (*fill_buffer)(struct stream *s, void *buffer, int max_len);
+    // Optional: like fill_buffer, but scatter the data over the given buffers
+    // (like readv()). Used to fill a wrapped-around buffer with 1 call.
+    int (*fill_buffer_iov)(struct stream *s, struct iovec *iov, int iovcnt);
+    // Optional: return a read-only reference to len bytes at pos, without
+    // copying. At least padding bytes after the data must be readable. They
+    // are the data that follows in the stream, and 0 after its end, so that
+    // decoders overreading damaged packets stay within readable memory.
+    // Return NULL if this is not possible for this range.
+    struct AVBufferRef *(*read_ref)(struct stream *s, int64_t pos, int len,
+                                    int padding);
     // Write
     int (*write_buffer)(struct stream *s, void *buffer, int len);
     // Seek
@@ -130,6 +143,7 @@ typedef struct stream {
     bool is_local_file : 1; // from the filesystem
     bool is_directory : 1; // directory on the filesystem
     bool access_references : 1; // open other streams
+    bool adaptive_readahead : 1; // grow read size if data is consumed quickly
     struct mp_log *log;
     struct dmpv_global *global;
 
@@ -144,6 +158,11 @@ typedef struct stream {
     // Buffer size requested by user; s->buffer may have a different size
     int requested_buffer_size;
 
+    // Adaptive read-ahead (used only if adaptive_readahead is set).
+    int readahead_max;      // limit from options (0 if disabled by user)
+    int readahead_size;     // current minimum read size
+    int64_t readahead_last_refill; // mp_time_ns() of last buffer refill
+
     // This is a ring buffer. It is reset only on seeks (or when buffers are
     // dropped). Otherwise old contents always stay valid.
     // The valid buffer is from buf_start to buf_end; buf_end can be larger
@@ -194,6 +213,7 @@ int stream_read(stream_t *s, void *mem, int total);
 int stream_read_partial(stream_t *s, void *buf, int buf_size);
 int stream_peek(stream_t *s, int forward_size);
 int stream_read_peek(stream_t *s, void *buf, int buf_size);
+struct AVBufferRef *stream_read_ref(stream_t *s, int len, int padding);
 void stream_drop_buffers(stream_t *s);
 int64_t stream_get_size(stream_t *s);
 
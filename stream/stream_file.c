@@ -27,13 +27,20 @@
 #include <errno.h>
 
 #include <poll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <libavutil/buffer.h>
 
 #include "osdep/io.h"
+#include "osdep/timer.h"
 
 #include "common/common.h"
 #include "common/msg.h"
+#include "common/stats.h"
 #include "misc/thread_tools.h"
 #include "stream.h"
+#include "options/m_config.h"
 #include "options/m_option.h"
 #include "options/path.h"
 
@@ -46,6 +53,10 @@
 #include <sys/vfs.h>
 #endif
 
+#if HAVE_LIBURING
+#include <liburing.h>
+#endif
+
 struct priv {
     int fd;
     bool close;
@@ -54,6 +65,21 @@ struct priv {
     bool appending;
     int64_t orig_size;
     struct mp_cancel *cancel;
+
+    // Regular files only: end of the range the kernel was asked to prefetch.
+    int64_t hint_end;
+
+    struct stats_ctx *stats;
+    int64_t stats_time;     // start of current stats period
+    int64_t stats_bytes;    // read in current period
+    int64_t stats_read_ns;  // time spent in read calls in current period
+
+    struct uring_state *uring;
+
+    // Read-only mapping of the whole file (orig_size bytes), followed by
+    // zeroed memory up to map_size, or NULL.
+    AVBufferRef *map;
+    size_t map_size;
 };
 
 // Total timeout = RETRY_TIMEOUT * MAX_RETRIES
@@ -73,6 +99,44 @@ static int64_t get_size(stream_t *s)
     return -1;
 }
 
+// Called after a successful read of len bytes from a regular file, which
+// started at time start (mp_time_ns()).
+static void after_read(stream_t *s, int len, int64_t start)
+{
+    struct priv *p = s->priv;
+    int64_t now = mp_time_ns();
+
+    p->stats_bytes += len;
+    p->stats_read_ns += now - start;
+    if (now - p->stats_time >= MP_TIME_S_TO_NS(1)) {
+        double secs = (now - p->stats_time) / (double)MP_TIME_S_TO_NS(1);
+        stats_size_value(p->stats, "read-rate", p->stats_bytes / secs);
+        if (p->stats_read_ns > 0) {
+            stats_size_value(p->stats, "read-throughput",
+                p->stats_bytes / (p->stats_read_ns / (double)MP_TIME_S_TO_NS(1)));
+        }
+        stats_size_value(p->stats, "readahead", s->readahead_size);
+        p->stats_time = now;
+        p->stats_bytes = 0;
+        p->stats_read_ns = 0;
+    }
+
+#ifdef POSIX_FADV_WILLNEED
+    // Ask the kernel to fetch what will likely be read next, so the next
+    // read (possibly over the network) does not wait for it.
+    if (s->adaptive_readahead) {
+        int64_t pos = s->pos + len; // s->pos is updated by the caller
+        int64_t window = MPMAX(s->readahead_size, s->requested_buffer_size);
+        if (p->hint_end - pos < window) {
+            int64_t start_hint = MPMAX(pos, p->hint_end);
+            posix_fadvise(p->fd, start_hint, pos + window * 2 - start_hint,
+                          POSIX_FADV_WILLNEED);
+            p->hint_end = pos + window * 2;
+        }
+    }
+#endif
+}
+
 static int fill_buffer(stream_t *s, void *buffer, int max_len)
 {
     struct priv *p = s->priv;
@@ -89,9 +153,13 @@ static int fill_buffer(stream_t *s, void *buffer, int max_len)
     }
 
     for (int retries = 0; retries < MAX_RETRIES; retries++) {
+        int64_t start = mp_time_ns();
         int r = read(p->fd, buffer, max_len);
-        if (r > 0)
+        if (r > 0) {
+            if (p->regular_file)
+                after_read(s, r, start);
             return r;
+        }
 
         // Try to detect and handle files being appended during playback.
         int64_t size = get_size(s);
@@ -111,6 +179,318 @@ static int fill_buffer(stream_t *s, void *buffer, int max_len)
     return 0;
 }
 
+// Used for regular files only.
+static int fill_buffer_iov(stream_t *s, struct iovec *iov, int iovcnt)
+{
+    struct priv *p = s->priv;
+
+    int64_t start = mp_time_ns();
+    ssize_t r = readv(p->fd, iov, iovcnt);
+    if (r > 0) {
+        after_read(s, r, start);
+        return r;
+    }
+
+    // EOF or error; let the normal path deal with files being appended.
+    return fill_buffer(s, iov[0].iov_base, iov[0].iov_len);
+}
+
+#if HAVE_LIBURING
+
+// Number of reads kept in flight, and their size.
+#define URING_BLOCKS 4
+#define URING_BLOCK_SIZE (1024 * 1024)
+
+struct uring_block {
+    uint8_t *data;
+    int64_t pos;            // file offset of data[0]
+    int len;                // valid bytes (after completion)
+    int consumed;           // bytes already returned from data
+    bool pending;           // read submitted, not completed yet
+    int err;                // negative errno of the read, or 0
+};
+
+// Asynchronous read-ahead. The blocks form a queue (starting at head) of
+// consecutive file ranges, starting at read_pos. fill_buffer() copies from
+// the head block, while the following blocks are being read.
+struct uring_state {
+    struct io_uring ring;
+    struct uring_block blocks[URING_BLOCKS];
+    int head;
+    int num;                // number of used blocks
+    int num_pending;
+    int64_t read_pos;       // file offset of the next byte to return
+    int64_t next_pos;       // file offset of the next block to submit
+};
+
+static void uring_handle_cqe(struct uring_state *u, struct io_uring_cqe *cqe)
+{
+    struct uring_block *b = io_uring_cqe_get_data(cqe);
+    if (b) { // (cancel requests have no data)
+        mp_assert(b->pending);
+        b->pending = false;
+        b->len = MPMAX(cqe->res, 0);
+        b->err = MPMIN(cqe->res, 0);
+        u->num_pending -= 1;
+    }
+    io_uring_cqe_seen(&u->ring, cqe);
+}
+
+// Wait until all submitted reads are done; pending reads are canceled.
+// Returns false if waiting failed; then reads might still write to the blocks.
+static bool uring_drain(struct uring_state *u)
+{
+    if (!u->num_pending)
+        return true;
+
+    for (int n = 0; n < URING_BLOCKS; n++) {
+        struct uring_block *b = &u->blocks[n];
+        if (!b->pending)
+            continue;
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&u->ring);
+        if (!sqe)
+            break; // just wait for it then
+        io_uring_prep_cancel(sqe, b, 0);
+        io_uring_sqe_set_data(sqe, NULL);
+    }
+    io_uring_submit(&u->ring);
+
+    while (u->num_pending) {
+        struct io_uring_cqe *cqe;
+        int r = io_uring_wait_cqe(&u->ring, &cqe);
+        if (r == -EINTR)
+            continue;
+        if (r < 0)
+            return false;
+        uring_handle_cqe(u, cqe);
+    }
+    return true;
+}
+
+// Discard all read-ahead and continue reading at pos. If the pending reads
+// can't be waited for, the ring is unusable, and the stream switches to normal
+// reads (continuing at pos).
+static void uring_reset(stream_t *s, int64_t pos)
+{
+    struct priv *p = s->priv;
+    struct uring_state *u = p->uring;
+
+    if (!uring_drain(u)) {
+        MP_WARN(s, "Failed to cancel io_uring reads, using normal reads.\n");
+        // Leak it; the kernel might still write to the buffers.
+        talloc_steal(NULL, u);
+        p->uring = NULL;
+        s->fill_buffer = fill_buffer;
+        s->fill_buffer_iov = fill_buffer_iov;
+        if (lseek(p->fd, pos, SEEK_SET) == (off_t)-1)
+            MP_ERR(s, "Failed to seek in file.\n");
+        return;
+    }
+
+    u->head = u->num = 0;
+    u->read_pos = u->next_pos = pos;
+}
+
+// Submit reads for all free blocks.
+static void uring_submit(struct priv *p)
+{
+    struct uring_state *u = p->uring;
+
+    int added = 0;
+    while (u->num < URING_BLOCKS) {
+        struct uring_block *b = &u->blocks[(u->head + u->num) % URING_BLOCKS];
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&u->ring);
+        if (!sqe)
+            break;
+        *b = (struct uring_block){
+            .data = b->data,
+            .pos = u->next_pos,
+            .pending = true,
+        };
+        io_uring_prep_read(sqe, p->fd, b->data, URING_BLOCK_SIZE, b->pos);
+        io_uring_sqe_set_data(sqe, b);
+        u->next_pos += URING_BLOCK_SIZE;
+        u->num += 1;
+        u->num_pending += 1;
+        added += 1;
+    }
+
+    if (added)
+        io_uring_submit(&u->ring);
+}
+
+static int fill_buffer_uring(stream_t *s, void *buffer, int max_len)
+{
+    struct priv *p = s->priv;
+    struct uring_state *u = p->uring;
+
+    uring_submit(p);
+
+    struct uring_block *b = &u->blocks[u->head];
+    int64_t start = mp_time_ns();
+    while (b->pending) {
+        struct io_uring_cqe *cqe;
+        int r = io_uring_wait_cqe(&u->ring, &cqe);
+        if (r == -EINTR)
+            continue;
+        if (r < 0)
+            break;
+        uring_handle_cqe(u, cqe);
+    }
+
+    if (b->pending || b->err || !b->len) {
+        // EOF or error. Use the normal code, which e.g. also handles files
+        // being appended to.
+        if (b->err)
+            MP_VERBOSE(s, "io_uring read error: %s\n", mp_strerror(-b->err));
+        int64_t pos = u->read_pos;
+        uring_reset(s, pos);
+        if (lseek(p->fd, pos, SEEK_SET) == (off_t)-1)
+            return -1;
+        int r = fill_buffer(s, buffer, max_len);
+        if (p->uring)
+            uring_reset(s, pos + MPMAX(r, 0));
+        return r;
+    }
+
+    int copy = MPMIN(max_len, b->len - b->consumed);
+    memcpy(buffer, b->data + b->consumed, copy);
+    b->consumed += copy;
+    u->read_pos += copy;
+
+    if (b->consumed == b->len) {
+        if (b->len < URING_BLOCK_SIZE) {
+            // Short read; the following blocks don't continue at read_pos.
+            uring_reset(s, u->read_pos);
+        } else {
+            u->head = (u->head + 1) % URING_BLOCKS;
+            u->num -= 1;
+        }
+        // Keep the reads going while the caller processes the data.
+        if (p->uring)
+            uring_submit(p);
+    }
+
+    after_read(s, copy, start);
+    return copy;
+}
+
+static void uring_destroy(struct priv *p)
+{
+    if (p->uring) {
+        if (uring_drain(p->uring)) {
+            io_uring_queue_exit(&p->uring->ring);
+        } else {
+            // Leak it; the kernel might still write to the buffers.
+            talloc_steal(NULL, p->uring);
+        }
+        p->uring = NULL;
+    }
+}
+
+static void uring_init(stream_t *s)
+{
+    struct priv *p = s->priv;
+
+    bool enable = false;
+    mp_read_option_raw(s->global, "stream-io-uring", &m_option_type_bool,
+                       &enable);
+    if (!enable)
+        return;
+
+    struct uring_state *u = talloc_zero(p, struct uring_state);
+    if (io_uring_queue_init(URING_BLOCKS * 2, &u->ring, 0) < 0) {
+        MP_VERBOSE(s, "io_uring not available, using normal reads.\n");
+        talloc_free(u);
+        return;
+    }
+    for (int n = 0; n < URING_BLOCKS; n++)
+        u->blocks[n].data = talloc_size(u, URING_BLOCK_SIZE);
+
+    p->uring = u;
+    s->fill_buffer = fill_buffer_uring;
+    s->fill_buffer_iov = NULL;
+    MP_VERBOSE(s, "Using io_uring.\n");
+}
+
+#else
+
+static void uring_destroy(struct priv *p)
+{
+}
+
+static void uring_init(stream_t *s)
+{
+}
+
+#endif
+
+static void unmap_buffer(void *opaque, uint8_t *data)
+{
+    munmap(data, (uintptr_t)opaque);
+}
+
+static AVBufferRef *read_ref(stream_t *s, int64_t pos, int len, int padding)
+{
+    struct priv *p = s->priv;
+    if (pos < 0 || pos + len > p->orig_size || pos + len + padding > p->map_size)
+        return NULL;
+    AVBufferRef *ref = av_buffer_ref(p->map);
+    if (!ref)
+        return NULL;
+    ref->data += pos;
+    ref->size = len;
+    return ref;
+}
+
+// Map the file, so that demuxers can reference packet data in it without
+// copying. Note that the file being truncated while mapped makes accesses to
+// the mapping crash (SIGBUS); so this is opt-in, and not used for network
+// filesystems or files being appended to.
+static void map_init(stream_t *s)
+{
+    struct priv *p = s->priv;
+
+    bool enable = false;
+    mp_read_option_raw(s->global, "stream-mmap", &m_option_type_bool, &enable);
+    if (!enable || s->streaming || p->appending || p->orig_size <= 0 ||
+        p->orig_size > SIZE_MAX / 2)
+        return;
+
+    // Reserve an extra page of zeros after the end of the file, so that
+    // packets at the end get zeroed padding. The file is mapped over the
+    // start of it; the rest of its last page is zero-filled by the kernel.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = p->orig_size;
+    size_t map_size = MP_ALIGN_UP(size, page) + page;
+    void *addr = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    if (addr == MAP_FAILED) {
+        MP_VERBOSE(s, "Could not map file: %s\n", mp_strerror(errno));
+        return;
+    }
+    if (mmap(addr, size, PROT_READ, MAP_SHARED | MAP_FIXED, p->fd, 0) == MAP_FAILED) {
+        MP_VERBOSE(s, "Could not map file: %s\n", mp_strerror(errno));
+        munmap(addr, map_size);
+        return;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(addr, size, MADV_SEQUENTIAL);
+#endif
+
+    p->map = av_buffer_create(addr, size, unmap_buffer,
+                              (void *)(uintptr_t)map_size,
+                              AV_BUFFER_FLAG_READONLY);
+    if (!p->map) {
+        munmap(addr, map_size);
+        return;
+    }
+    p->map_size = map_size;
+
+    s->read_ref = read_ref;
+    MP_VERBOSE(s, "Mapped file.\n");
+}
+
 static int write_buffer(stream_t *s, void *buffer, int len)
 {
     struct priv *p = s->priv;
@@ -120,12 +500,20 @@ static int write_buffer(stream_t *s, void *buffer, int len)
 static int seek(stream_t *s, int64_t newpos)
 {
     struct priv *p = s->priv;
+    p->hint_end = 0;
+#if HAVE_LIBURING
+    if (p->uring)
+        uring_reset(s, newpos);
+#endif
     return lseek(p->fd, newpos, SEEK_SET) != (off_t)-1;
 }
 
 static void s_close(stream_t *s)
 {
     struct priv *p = s->priv;
+    uring_destroy(p);
+    // Packets may still reference the mapping; it's unmapped with the last one.
+    av_buffer_unref(&p->map);
     if (p->close)
         close(p->fd);
 }
@@ -289,12 +677,30 @@ static int open_f(stream_t *stream, const struct stream_open_args *args)
     stream->get_size = get_size;
     stream->close = s_close;
 
+    if (p->regular_file && !write) {
+        stream->fill_buffer_iov = fill_buffer_iov;
+        stream->adaptive_readahead = stream->readahead_max > 0;
+#ifdef POSIX_FADV_SEQUENTIAL
+        if (stream->adaptive_readahead)
+            posix_fadvise(p->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        p->stats = stats_ctx_create(p, stream->global, "stream_file");
+        p->stats_time = mp_time_ns();
+    }
+
     if (is_sock_or_fifo || check_stream_network(p->fd)) {
         stream->streaming = true;
     }
 
     p->orig_size = get_size(stream);
 
+    // io_uring reads would be cancelled by every skip over referenced data.
+    if (p->regular_file && !write) {
+        map_init(stream);
+        if (!p->map)
+            uring_init(stream);
+    }
+
     p->cancel = mp_cancel_new(p);
     if (stream->cancel)
         mp_cancel_set_parent(p->cancel, stream->cancel);
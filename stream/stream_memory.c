@@ -15,12 +15,19 @@
  * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <libavutil/buffer.h>
+
 #include "common/common.h"
 #include "misc/mp_assert.h"
 #include "stream.h"
 
+// Zero bytes allocated after the data, so that read_ref() can be used for
+// packets at the end (AV_INPUT_BUFFER_PADDING_SIZE).
+#define MEMORY_PADDING 64
+
 struct priv {
-    bstr data;
+    bstr data;              // points into buf
+    AVBufferRef *buf;
 };
 
 static int fill_buffer(stream_t *s, void *buffer, int len)
@@ -45,12 +52,33 @@ static int64_t get_size(stream_t *s)
     return p->data.len;
 }
 
+static AVBufferRef *read_ref(stream_t *s, int64_t pos, int len, int padding)
+{
+    struct priv *p = s->priv;
+    if (pos < 0 || pos + len > p->data.len || padding > MEMORY_PADDING)
+        return NULL;
+    AVBufferRef *ref = av_buffer_ref(p->buf);
+    if (!ref)
+        return NULL;
+    ref->data += pos;
+    ref->size = len;
+    return ref;
+}
+
+static void s_close(stream_t *s)
+{
+    struct priv *p = s->priv;
+    av_buffer_unref(&p->buf);
+}
+
 static int open2(stream_t *stream, const struct stream_open_args *args)
 {
     stream->fill_buffer = fill_buffer;
     stream->seek = seek;
     stream->seekable = true;
     stream->get_size = get_size;
+    stream->read_ref = read_ref;
+    stream->close = s_close;
 
     struct priv *p = talloc_zero(stream, struct priv);
     stream->priv = p;
@@ -64,13 +92,19 @@ static int open2(stream_t *stream, const struct stream_open_args *args)
     if (args->special_arg)
         data = *(bstr *)args->special_arg;
 
-    p->data = bstrdup(stream, data);
-
-    if (use_hex && !bstr_decode_hex(stream, p->data, &p->data)) {
+    if (use_hex && !bstr_decode_hex(stream, data, &data)) {
         MP_FATAL(stream, "Invalid data.\n");
         return STREAM_ERROR;
     }
 
+    // Refcounted, so that packets can reference it (and outlive the stream).
+    p->buf = av_buffer_alloc(data.len + MEMORY_PADDING);
+    MP_HANDLE_OOM(p->buf);
+    if (data.len)
+        memcpy(p->buf->data, data.start, data.len);
+    memset(p->buf->data + data.len, 0, MEMORY_PADDING);
+    p->data = (bstr){p->buf->data, data.len};
+
     return STREAM_OK;
 }
 
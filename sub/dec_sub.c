@@ -31,6 +31,8 @@
 #include "common/recorder.h"
 #include "misc/dispatch.h"
 #include "osdep/threads.h"
+#include "osdep/timer.h"
+#include "video/mp_image.h"
 
 extern const struct sd_functions sd_ass;
 extern const struct sd_functions sd_lavc;
@@ -41,6 +43,18 @@ static const struct sd_functions *const sd_list[] = {
     NULL
 };
 
+// Number of rendered subtitle states kept per track.
+#define RENDER_CACHE_SIZE 8
+
+struct render_entry {
+    double start, end;          // video PTS range with this output
+    struct mp_osd_res dim;
+    int format;
+    struct sub_bitmaps *res;    // NULL if nothing is visible
+    uint64_t id;
+    uint64_t last_use;
+};
+
 struct dec_sub {
     pthread_mutex_t lock;
 
@@ -70,6 +84,44 @@ struct dec_sub {
     struct demux_packet *new_segment;
 
     bool forced_only_def;
+
+    // Background preload, see sub_preload().
+    pthread_t preload_thread;
+    bool preload_thread_valid;  // (player thread only)
+    bool preload_running;       // thread is still reading packets
+    bool preload_abort;
+    bool preload_done;          // all packets were decoded
+    pthread_cond_t preload_wakeup;
+    struct mp_dispatch_queue *demux_waiter;
+    int preload_waiters;
+    // Highest packet PTS decoded so far. All packets before it were decoded.
+    // This is kept if the preload is restarted (e.g. after a seek), as long as
+    // the decoder keeps its events (sd->preload_ok). For this to hold, the
+    // preload is stopped before the demuxer is seeked (sub_preload_stop()).
+    double preload_pts;
+    int64_t preload_packets;
+    int64_t preload_start, preload_end;
+
+    struct mp_image_params video_params;
+
+    // Rendered states, and look-ahead rendering of the following state.
+    // Protected by render_lock instead of lock, so that cache hits never wait
+    // for a look-ahead render. Lock order: lock, then render_lock.
+    pthread_mutex_t render_lock;
+    pthread_cond_t render_wakeup;
+    struct render_entry render_cache[RENDER_CACHE_SIZE];
+    int num_render_cache;
+    uint64_t render_counter;
+    uint64_t render_last_id;    // entry last returned by sub_get_bitmaps()
+    bool render_vo_synced;      // sd's last render was returned last
+    bool render_pending;        // look-ahead request for render_pts
+    double render_pts;
+    struct mp_osd_res render_dim;
+    int render_format;
+    bool render_exit;
+    pthread_t render_thread;
+    bool render_thread_valid;
+    struct sub_render_stats render_stats;
 };
 
 static void update_subtitle_speed(struct dec_sub *sub)
@@ -116,16 +168,253 @@ static void wakeup_demux(void *ctx)
     mp_dispatch_interrupt(q);
 }
 
+// Stop the preload thread, if any. If it didn't get to the end of the file,
+// sub_can_preload() will return true again. Called from the player thread.
+void sub_preload_stop(struct dec_sub *sub)
+{
+    if (!sub->preload_thread_valid)
+        return;
+
+    mp_mutex_lock(&sub->lock);
+    sub->preload_abort = true;
+    mp_mutex_unlock(&sub->lock);
+
+    mp_dispatch_interrupt(sub->demux_waiter);
+    pthread_join(sub->preload_thread, NULL);
+    sub->preload_thread_valid = false;
+    demux_set_stream_wakeup_cb(sub->sh, NULL, NULL);
+
+    mp_mutex_lock(&sub->lock);
+    if (!sub->preload_done)
+        sub->preload_attempted = false;
+    mp_mutex_unlock(&sub->lock);
+}
+
+// Drop cached renders whose time range ends after pts (video PTS), or all of
+// them if pts is MP_NOPTS_VALUE.
+static void invalidate_render_cache(struct dec_sub *sub, double pts)
+{
+    mp_mutex_lock(&sub->render_lock);
+    for (int n = sub->num_render_cache - 1; n >= 0; n--) {
+        struct render_entry *e = &sub->render_cache[n];
+        if (pts == MP_NOPTS_VALUE || e->end > pts) {
+            talloc_free(e->res);
+            MP_TARRAY_REMOVE_AT(sub->render_cache, sub->num_render_cache, n);
+        }
+    }
+    if (pts == MP_NOPTS_VALUE)
+        sub->render_pending = false;
+    mp_mutex_unlock(&sub->render_lock);
+}
+
+static void *render_thread(void *p);
+
+// Ask the render thread to render the state at pts, unless it's cached.
+static void request_prerender(struct dec_sub *sub, struct mp_osd_res dim,
+                              int format, double pts)
+{
+    if (!isfinite(pts))
+        return;
+
+    mp_mutex_lock(&sub->render_lock);
+    for (int n = 0; n < sub->num_render_cache; n++) {
+        struct render_entry *e = &sub->render_cache[n];
+        if (pts >= e->start && pts < e->end && e->format == format &&
+            osd_res_equals(e->dim, dim))
+            goto done;
+    }
+    sub->render_pending = true;
+    sub->render_pts = pts;
+    sub->render_dim = dim;
+    sub->render_format = format;
+    if (!sub->render_thread_valid) {
+        sub->render_thread_valid =
+            !pthread_create(&sub->render_thread, NULL, render_thread, sub);
+    }
+    pthread_cond_signal(&sub->render_wakeup);
+done:
+    mp_mutex_unlock(&sub->render_lock);
+}
+
+// Called locked. Render the state at pts (video PTS), and cache it if the
+// decoder knows for how long it stays the same. A look-ahead render only goes
+// into the cache, and NULL is returned. Otherwise, returns a new reference.
+// *next is set to the video PTS of the following state, if known.
+static struct sub_bitmaps *render_state(struct dec_sub *sub,
+                                        struct mp_osd_res dim, int format,
+                                        double pts, bool prerender,
+                                        double *next)
+{
+    const struct sd_functions *driver = sub->sd->driver;
+    double spts = pts_to_subtitle(sub, pts);
+
+    int64_t start = mp_time_ns();
+    struct sub_bitmaps *res = NULL;
+    if (!(sub->end != MP_NOPTS_VALUE && spts >= sub->end) && driver->get_bitmaps)
+        res = driver->get_bitmaps(sub->sd, dim, format, spts);
+    double time = MP_TIME_NS_TO_S(mp_time_ns() - start);
+
+    // Segment switches and reverse playback are rare enough to not bother.
+    struct sd_times times;
+    bool cacheable = driver->get_static_times && pts != MP_NOPTS_VALUE &&
+                     sub->play_dir > 0 && sub->start == MP_NOPTS_VALUE &&
+                     !sub->new_segment &&
+                     driver->get_static_times(sub->sd, spts, &times);
+    // Later events might not have been decoded yet.
+    if (cacheable && sub->preload_running)
+        times.end = MPMIN(times.end, sub->preload_pts);
+
+    mp_mutex_lock(&sub->render_lock);
+    struct sub_render_stats *st = &sub->render_stats;
+    if (prerender) {
+        st->prerendered++;
+        st->prerender_time += time;
+    } else {
+        st->misses++;
+        st->render_time += time;
+        st->render_time_max = MPMAX(st->render_time_max, time);
+    }
+
+    uint64_t id = 0;
+    if (cacheable && times.start < times.end) {
+        if (sub->num_render_cache == RENDER_CACHE_SIZE) {
+            int lru = 0;
+            for (int n = 1; n < sub->num_render_cache; n++) {
+                if (sub->render_cache[n].last_use < sub->render_cache[lru].last_use)
+                    lru = n;
+            }
+            talloc_free(sub->render_cache[lru].res);
+            MP_TARRAY_REMOVE_AT(sub->render_cache, sub->num_render_cache, lru);
+        }
+        id = ++sub->render_counter;
+        struct render_entry *e = &sub->render_cache[sub->num_render_cache++];
+        *e = (struct render_entry){
+            .start = pts_from_subtitle(sub, times.start),
+            .end = pts_from_subtitle(sub, times.end),
+            .dim = dim,
+            .format = format,
+            .res = prerender ? res : sub_bitmaps_copy(NULL, res),
+            .id = id,
+            .last_use = id,
+        };
+        if (prerender)
+            res = NULL;
+        if (next)
+            *next = e->end;
+    }
+
+    if (prerender) {
+        sub->render_vo_synced = false;
+    } else {
+        // The sd compares against what it rendered last, which is not
+        // necessarily what the VO got last.
+        if (res && !sub->render_vo_synced)
+            res->change_id = MPMAX(res->change_id, 1);
+        sub->render_vo_synced = true;
+        sub->render_last_id = id;
+    }
+    mp_mutex_unlock(&sub->render_lock);
+
+    if (prerender)
+        TA_FREEP(&res);
+    return res;
+}
+
+static void *render_thread(void *p)
+{
+    struct dec_sub *sub = p;
+    mpthread_set_name("subrender");
+
+    mp_mutex_lock(&sub->render_lock);
+    while (!sub->render_exit) {
+        if (!sub->render_pending) {
+            pthread_cond_wait(&sub->render_wakeup, &sub->render_lock);
+            continue;
+        }
+        sub->render_pending = false;
+        struct mp_osd_res dim = sub->render_dim;
+        int format = sub->render_format;
+        double pts = sub->render_pts;
+        mp_mutex_unlock(&sub->render_lock);
+
+        mp_mutex_lock(&sub->lock);
+        // Don't wait for the preload; not rendering ahead is fine.
+        double spts = pts_to_subtitle(sub, pts);
+        if (!sub->preload_running || sub->preload_pts > spts)
+            render_state(sub, dim, format, pts, true, NULL);
+        mp_mutex_unlock(&sub->lock);
+
+        mp_mutex_lock(&sub->render_lock);
+    }
+    mp_mutex_unlock(&sub->render_lock);
+    return NULL;
+}
+
+// Return a cached render for the given parameters in *res, if available.
+static bool lookup_render_cache(struct dec_sub *sub, struct mp_osd_res dim,
+                                int format, double pts,
+                                struct sub_bitmaps **res)
+{
+    if (pts == MP_NOPTS_VALUE)
+        return false;
+
+    double next = MP_NOPTS_VALUE;
+    mp_mutex_lock(&sub->render_lock);
+    for (int n = 0; n < sub->num_render_cache; n++) {
+        struct render_entry *e = &sub->render_cache[n];
+        if (pts >= e->start && pts < e->end && e->format == format &&
+            osd_res_equals(e->dim, dim))
+        {
+            *res = sub_bitmaps_copy(NULL, e->res);
+            if (*res)
+                (*res)->change_id = e->id != sub->render_last_id;
+            sub->render_last_id = e->id;
+            sub->render_vo_synced = false;
+            e->last_use = ++sub->render_counter;
+            sub->render_stats.hits++;
+            next = e->end;
+            break;
+        }
+    }
+    mp_mutex_unlock(&sub->render_lock);
+
+    if (next == MP_NOPTS_VALUE)
+        return false;
+    request_prerender(sub, dim, format, next);
+    return true;
+}
+
+void sub_get_render_stats(struct dec_sub *sub, struct sub_render_stats *st)
+{
+    mp_mutex_lock(&sub->render_lock);
+    *st = sub->render_stats;
+    mp_mutex_unlock(&sub->render_lock);
+}
+
 void sub_destroy(struct dec_sub *sub)
 {
     if (!sub)
         return;
+    sub_preload_stop(sub);
+
+    mp_mutex_lock(&sub->render_lock);
+    sub->render_exit = true;
+    pthread_cond_signal(&sub->render_wakeup);
+    bool join = sub->render_thread_valid;
+    mp_mutex_unlock(&sub->render_lock);
+    if (join)
+        pthread_join(sub->render_thread, NULL);
+    invalidate_render_cache(sub, MP_NOPTS_VALUE);
+
     demux_set_stream_wakeup_cb(sub->sh, NULL, NULL);
     if (sub->sd) {
         sub_reset(sub);
         sub->sd->driver->uninit(sub->sd);
     }
     talloc_free(sub->sd);
+    pthread_cond_destroy(&sub->preload_wakeup);
+    pthread_cond_destroy(&sub->render_wakeup);
+    pthread_mutex_destroy(&sub->render_lock);
     pthread_mutex_destroy(&sub->lock);
     talloc_free(sub);
 }
@@ -182,9 +471,13 @@ struct dec_sub *sub_create(struct dmpv_global *global, struct track *track,
         .start = MP_NOPTS_VALUE,
         .end = MP_NOPTS_VALUE,
         .forced_only_def = track->forced_only_def,
+        .preload_pts = MP_NOPTS_VALUE,
     };
     sub->opts = sub->opts_cache->opts;
     mpthread_mutex_init_recursive(&sub->lock);
+    pthread_cond_init(&sub->preload_wakeup, NULL);
+    pthread_mutex_init(&sub->render_lock, NULL);
+    pthread_cond_init(&sub->render_wakeup, NULL);
 
     sub->sd = init_decoder(sub);
     if (sub->sd) {
@@ -196,6 +489,16 @@ struct dec_sub *sub_create(struct dmpv_global *global, struct track *track,
     return NULL;
 }
 
+// Called locked.
+static void decode_packet(struct dec_sub *sub, struct demux_packet *pkt)
+{
+    // The packet can change the output from its start time on.
+    double pts = pkt ? pkt->pts : MP_NOPTS_VALUE;
+    invalidate_render_cache(sub, pts == MP_NOPTS_VALUE ? pts
+                                                       : pts_from_subtitle(sub, pts));
+    sub->sd->driver->decode(sub->sd, pkt);
+}
+
 // Called locked.
 static void update_segment(struct dec_sub *sub)
 {
@@ -208,6 +511,8 @@ static void update_segment(struct dec_sub *sub)
         sub->codec = sub->new_segment->codec;
         sub->start = sub->new_segment->start;
         sub->end = sub->new_segment->end;
+        sub->preload_pts = MP_NOPTS_VALUE;
+        invalidate_render_cache(sub, MP_NOPTS_VALUE);
         struct sd *new = init_decoder(sub);
         if (new) {
             sub->sd->driver->uninit(sub->sd);
@@ -220,7 +525,7 @@ static void update_segment(struct dec_sub *sub)
             // invalid data (not our fault if it crashes or something).
             MP_ERR(sub, "Can't change to new codec.\n");
         }
-        sub->sd->driver->decode(sub->sd, sub->new_segment);
+        decode_packet(sub, sub->new_segment);
         talloc_free(sub->new_segment);
         sub->new_segment = NULL;
     }
@@ -235,32 +540,116 @@ bool sub_can_preload(struct dec_sub *sub)
     return r;
 }
 
-void sub_preload(struct dec_sub *sub)
+static void run_preload(struct dec_sub *sub)
 {
     mp_mutex_lock(&sub->lock);
-
-    struct mp_dispatch_queue *demux_waiter = mp_dispatch_create(NULL);
-    demux_set_stream_wakeup_cb(sub->sh, wakeup_demux, demux_waiter);
-
-    sub->preload_attempted = true;
-
-    for (;;) {
+    while (!sub->preload_abort) {
+        // Read without the lock, so that rendering can go on meanwhile.
+        mp_mutex_unlock(&sub->lock);
         struct demux_packet *pkt = NULL;
         int r = demux_read_packet_async(sub->sh, &pkt);
-        if (r == 0) {
-            mp_dispatch_queue_process(demux_waiter, INFINITY);
+        if (r == 0)
+            mp_dispatch_queue_process(sub->demux_waiter, INFINITY);
+        mp_mutex_lock(&sub->lock);
+        if (r == 0)
             continue;
+        // The packet may have been read after a seek or after the decoder
+        // dropped its events; it must not raise preload_pts.
+        if (sub->preload_abort) {
+            talloc_free(pkt);
+            break;
         }
-        if (!pkt)
+        if (!pkt) {
+            sub->preload_done = true;
             break;
-        sub->sd->driver->decode(sub->sd, pkt);
+        }
+        decode_packet(sub, pkt);
+        sub->preload_pts = MP_PTS_MAX(sub->preload_pts, pkt->pts);
+        sub->preload_packets++;
         talloc_free(pkt);
+        if (sub->preload_waiters)
+            pthread_cond_broadcast(&sub->preload_wakeup);
     }
+    sub->preload_running = false;
+    sub->preload_end = mp_time_ns();
+    pthread_cond_broadcast(&sub->preload_wakeup);
+
+    MP_VERBOSE(sub, "Preloaded %"PRId64" packets in %.3f s%s.\n",
+               sub->preload_packets,
+               MP_TIME_NS_TO_S(sub->preload_end - sub->preload_start),
+               sub->preload_done ? "" : " (aborted)");
+    mp_mutex_unlock(&sub->lock);
+}
 
-    demux_set_stream_wakeup_cb(sub->sh, NULL, NULL);
-    talloc_free(demux_waiter);
+static void *preload_thread(void *p)
+{
+    mpthread_set_name("subpreload");
+    run_preload(p);
+    return NULL;
+}
+
+// Start decoding all packets of the stream on a separate thread. Rendering
+// functions wait until the packets for the requested time are decoded.
+void sub_preload(struct dec_sub *sub)
+{
+    sub_preload_stop(sub);
 
+    if (!sub->demux_waiter)
+        sub->demux_waiter = mp_dispatch_create(sub);
+    demux_set_stream_wakeup_cb(sub->sh, wakeup_demux, sub->demux_waiter);
+
+    mp_mutex_lock(&sub->lock);
+    sub->preload_attempted = true;
+    sub->preload_running = true;
+    sub->preload_abort = false;
+    sub->preload_done = false;
+    // Restarting reads from the start again, but the events decoded by the
+    // previous run don't need to be waited for. (It was stopped before any
+    // seek, so it decoded everything up to preload_pts.)
+    if (!sub->sd->preload_ok)
+        sub->preload_pts = MP_NOPTS_VALUE;
+    sub->preload_packets = 0;
+    sub->preload_start = mp_time_ns();
     mp_mutex_unlock(&sub->lock);
+
+    if (pthread_create(&sub->preload_thread, NULL, preload_thread, sub)) {
+        MP_WARN(sub, "Could not start preload thread, preloading synchronously.\n");
+        run_preload(sub);
+        demux_set_stream_wakeup_cb(sub->sh, NULL, NULL);
+        return;
+    }
+    sub->preload_thread_valid = true;
+}
+
+// Called locked. Wait until the preload thread has decoded all packets which
+// can be visible at pts. This relies on packets being sorted by PTS, which is
+// the case for the fully read formats which are preloaded.
+static void wait_preload(struct dec_sub *sub, double pts)
+{
+    if (pts == MP_NOPTS_VALUE)
+        return;
+    sub->preload_waiters++;
+    while (sub->preload_running && !(sub->preload_pts > pts))
+        pthread_cond_wait(&sub->preload_wakeup, &sub->lock);
+    sub->preload_waiters--;
+}
+
+bool sub_get_preload_state(struct dec_sub *sub, struct sub_preload_state *st)
+{
+    mp_mutex_lock(&sub->lock);
+    bool started = sub->preload_start > 0;
+    if (started) {
+        int64_t end = sub->preload_running ? mp_time_ns() : sub->preload_end;
+        *st = (struct sub_preload_state){
+            .active = sub->preload_running,
+            .done = sub->preload_done,
+            .packets = sub->preload_packets,
+            .pts = pts_from_subtitle(sub, sub->preload_pts),
+            .time = MP_TIME_NS_TO_S(end - sub->preload_start),
+        };
+    }
+    mp_mutex_unlock(&sub->lock);
+    return started;
 }
 
 static bool is_new_segment(struct dec_sub *sub, struct demux_packet *p)
@@ -277,7 +666,8 @@ bool sub_read_packets(struct dec_sub *sub, double video_pts, bool force)
     bool r = true;
     mp_mutex_lock(&sub->lock);
     video_pts = pts_to_subtitle(sub, video_pts);
-    while (1) {
+    // The preload thread owns the stream until it's done.
+    while (!sub->preload_running) {
         bool read_more = true;
         if (sub->sd->driver->accepts_packet)
             read_more = sub->sd->driver->accepts_packet(sub->sd, video_pts);
@@ -316,13 +706,14 @@ bool sub_read_packets(struct dec_sub *sub, double video_pts, bool force)
 
         if (is_new_segment(sub, pkt)) {
             sub->new_segment = pkt;
+            invalidate_render_cache(sub, MP_NOPTS_VALUE);
             // Note that this can be delayed to a much later point in time.
             update_segment(sub);
             break;
         }
 
         if (!(sub->preload_attempted && sub->sd->preload_ok))
-            sub->sd->driver->decode(sub->sd, pkt);
+            decode_packet(sub, pkt);
 
         talloc_free(pkt);
     }
@@ -334,20 +725,24 @@ bool sub_read_packets(struct dec_sub *sub, double video_pts, bool force)
 struct sub_bitmaps *sub_get_bitmaps(struct dec_sub *sub, struct mp_osd_res dim,
                                     int format, double pts)
 {
+    struct sub_bitmaps *res = NULL;
+    if (lookup_render_cache(sub, dim, format, pts, &res))
+        return res;
+
     mp_mutex_lock(&sub->lock);
 
-    pts = pts_to_subtitle(sub, pts);
+    double spts = pts_to_subtitle(sub, pts);
+    wait_preload(sub, spts);
 
-    sub->last_vo_pts = pts;
+    sub->last_vo_pts = spts;
     update_segment(sub);
 
-    struct sub_bitmaps *res = NULL;
-
-    if (!(sub->end != MP_NOPTS_VALUE && pts >= sub->end) &&
-        sub->sd->driver->get_bitmaps)
-        res = sub->sd->driver->get_bitmaps(sub->sd, dim, format, pts);
+    double next = MP_NOPTS_VALUE;
+    res = render_state(sub, dim, format, pts, false, &next);
 
     mp_mutex_unlock(&sub->lock);
+
+    request_prerender(sub, dim, format, next);
     return res;
 }
 
@@ -358,6 +753,7 @@ char *sub_get_text(struct dec_sub *sub, double pts, enum sd_text_type type)
     char *text = NULL;
 
     pts = pts_to_subtitle(sub, pts);
+    wait_preload(sub, pts);
 
     sub->last_vo_pts = pts;
     update_segment(sub);
@@ -374,6 +770,7 @@ struct sd_times sub_get_times(struct dec_sub *sub, double pts)
     struct sd_times res = { .start = MP_NOPTS_VALUE, .end = MP_NOPTS_VALUE };
 
     pts = pts_to_subtitle(sub, pts);
+    wait_preload(sub, pts);
 
     sub->last_vo_pts = pts;
     update_segment(sub);
@@ -387,9 +784,15 @@ struct sd_times sub_get_times(struct dec_sub *sub, double pts)
 
 void sub_reset(struct dec_sub *sub)
 {
+    // Seeking moves the demuxer, so a running preload would miss packets.
+    sub_preload_stop(sub);
+
     mp_mutex_lock(&sub->lock);
+    invalidate_render_cache(sub, MP_NOPTS_VALUE);
     if (sub->sd->driver->reset)
         sub->sd->driver->reset(sub->sd);
+    if (!sub->sd->preload_ok)
+        sub->preload_pts = MP_NOPTS_VALUE;
     sub->last_pkt_pts = MP_NOPTS_VALUE;
     sub->last_vo_pts = MP_NOPTS_VALUE;
     talloc_free(sub->new_segment);
@@ -400,6 +803,7 @@ void sub_reset(struct dec_sub *sub)
 void sub_select(struct dec_sub *sub, bool selected)
 {
     mp_mutex_lock(&sub->lock);
+    invalidate_render_cache(sub, MP_NOPTS_VALUE);
     if (sub->sd->driver->select)
         sub->sd->driver->select(sub->sd, selected);
     mp_mutex_unlock(&sub->lock);
@@ -410,6 +814,17 @@ int sub_control(struct dec_sub *sub, enum sd_ctrl cmd, void *arg)
     int r = CONTROL_UNKNOWN;
     mp_mutex_lock(&sub->lock);
     bool propagate = false;
+    // Anything but stepping can change how subtitles are rendered.
+    if (cmd == SD_CTRL_SET_VIDEO_PARAMS) {
+        // (This is set on every playloop iteration.)
+        struct mp_image_params *p = arg;
+        if (!mp_image_params_equal(p, &sub->video_params)) {
+            sub->video_params = *p;
+            invalidate_render_cache(sub, MP_NOPTS_VALUE);
+        }
+    } else if (cmd != SD_CTRL_SUB_STEP) {
+        invalidate_render_cache(sub, MP_NOPTS_VALUE);
+    }
     switch (cmd) {
     case SD_CTRL_SET_VIDEO_DEF_FPS:
         sub->video_fps = *(double *)arg;
@@ -435,6 +850,13 @@ int sub_control(struct dec_sub *sub, enum sd_ctrl cmd, void *arg)
             // UPDATE_SUB_HARD will cause a sub reinit
             // that clears all preloaded sub packets
             sub->preload_attempted = false;
+            // The events up to preload_pts are gone. Make a running preload
+            // stop (it's joined when it's restarted), so that it doesn't
+            // raise the mark again with packets decoded after this point.
+            sub->preload_abort = true;
+            sub->preload_pts = MP_NOPTS_VALUE;
+            if (sub->demux_waiter)
+                mp_dispatch_interrupt(sub->demux_waiter);
         }
         break;
     }
@@ -457,6 +879,7 @@ void sub_set_recorder_sink(struct dec_sub *sub, struct mp_recorder_sink *sink)
 void sub_set_play_dir(struct dec_sub *sub, int dir)
 {
     mp_mutex_lock(&sub->lock);
+    invalidate_render_cache(sub, MP_NOPTS_VALUE);
     sub->play_dir = dir;
     mp_mutex_unlock(&sub->lock);
 }
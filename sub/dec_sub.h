@@ -37,15 +37,35 @@ struct attachment_list {
     int num_entries;
 };
 
+struct sub_render_stats {
+    int64_t hits;           // sub_get_bitmaps() calls served from the cache
+    int64_t misses;         // sub_get_bitmaps() calls that had to render
+    int64_t prerendered;    // states rendered ahead of time
+    double render_time;     // seconds spent rendering on misses
+    double render_time_max; // slowest render on a miss
+    double prerender_time;  // seconds spent rendering ahead of time
+};
+
+struct sub_preload_state {
+    bool active;        // still decoding in the background
+    bool done;          // all packets were decoded
+    int64_t packets;    // number of packets decoded
+    double pts;         // packets up to this time were decoded
+    double time;        // seconds spent on preloading
+};
+
 struct dec_sub *sub_create(struct dmpv_global *global, struct track *track,
                            struct attachment_list *attachments, int order);
 void sub_destroy(struct dec_sub *sub);
 
 bool sub_can_preload(struct dec_sub *sub);
 void sub_preload(struct dec_sub *sub);
+void sub_preload_stop(struct dec_sub *sub);
+bool sub_get_preload_state(struct dec_sub *sub, struct sub_preload_state *st);
 bool sub_read_packets(struct dec_sub *sub, double video_pts, bool force);
 struct sub_bitmaps *sub_get_bitmaps(struct dec_sub *sub, struct mp_osd_res dim,
                                     int format, double pts);
+void sub_get_render_stats(struct dec_sub *sub, struct sub_render_stats *st);
 char *sub_get_text(struct dec_sub *sub, double pts, enum sd_text_type type);
 struct sd_times sub_get_times(struct dec_sub *sub, double pts);
 void sub_reset(struct dec_sub *sub);
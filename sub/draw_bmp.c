@@ -20,10 +20,16 @@
 #include "misc/mp_assert.h"
 #include <math.h>
 #include <inttypes.h>
+#include <pthread.h>
+
+#include <libavutil/cpu.h>
 
 #include "common/common.h"
 #include "draw_bmp.h"
+#include "draw_bmp_dsp.h"
 #include "img_convert.h"
+#include "misc/thread_pool.h"
+#include "osdep/threads.h"
 #include "video/mp_image.h"
 #include "video/repack.h"
 #include "video/sws_utils.h"
@@ -58,6 +64,40 @@ struct slice {
     uint16_t x0, x1;
 };
 
+// Blending is split into horizontal bands of lines, each blended by its own
+// thread. Bands are only used if each gets at least MIN_BAND_H dirty lines.
+#define MAX_BLEND_THREADS 8
+#define MIN_BAND_H 32
+
+// Per-thread state for blend_overlay_with_video(). The repackers and slice
+// buffers can't be shared between threads.
+struct blend_worker {
+    struct mp_repack *overlay_to_f32;
+    struct mp_repack *calpha_to_f32;
+    struct mp_repack *video_to_f32;
+    struct mp_repack *video_from_f32;
+    struct mp_image *overlay_tmp;
+    struct mp_image *calpha_tmp;
+    struct mp_image *video_tmp;
+
+    // Current job.
+    struct mp_draw_sub_cache *p;
+    struct blend_threads *bt;
+    struct mp_image *dst;
+    int y0, y1;
+    bool ok;
+};
+
+struct blend_threads {
+    struct mp_thread_pool *pool;
+    int num_threads;                // including the caller
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    int pending;                    // protected by lock
+    // workers[0] refers to the repackers in mp_draw_sub_cache.
+    struct blend_worker workers[MAX_BLEND_THREADS];
+};
+
 struct mp_draw_sub_cache
 {
     struct dmpv_global *global;
@@ -100,37 +140,21 @@ struct mp_draw_sub_cache
     struct mp_sws_context *unpremul; // reverse
     struct mp_image *premul_tmp;
 
+    int rflags;                     // flags the repackers were created with
+
     // Function that works on the _f32 data.
     void (*blend_line)(void *dst, void *src, void *src_a, int w);
 
+    struct blend_threads *threads;  // lazily created, NULL if unused
+
     struct mp_image res_overlay;    // returned by mp_draw_sub_overlay()
 };
 
-static void blend_line_f32(void *dst, void *src, void *src_a, int w)
-{
-    float *dst_f = dst;
-    float *src_f = src;
-    float *src_a_f = src_a;
-
-    for (int x = 0; x < w; x++)
-        dst_f[x] = src_f[x] + dst_f[x] * (1.0f - src_a_f[x]);
-}
-
-static void blend_line_u8(void *dst, void *src, void *src_a, int w)
+static void blend_slice(struct mp_draw_sub_cache *p, struct blend_worker *w)
 {
-    uint8_t *dst_i = dst;
-    uint8_t *src_i = src;
-    uint8_t *src_a_i = src_a;
-
-    for (int x = 0; x < w; x++)
-        dst_i[x] = src_i[x] + dst_i[x] * (255u - src_a_i[x]) / 255u;
-}
-
-static void blend_slice(struct mp_draw_sub_cache *p)
-{
-    struct mp_image *ov = p->overlay_tmp;
-    struct mp_image *ca = p->calpha_tmp;
-    struct mp_image *vid = p->video_tmp;
+    struct mp_image *ov = w->overlay_tmp;
+    struct mp_image *ca = w->calpha_tmp;
+    struct mp_image *vid = w->video_tmp;
 
     for (int plane = 0; plane < vid->num_planes; plane++) {
         int xs = vid->fmt.xs[plane];
@@ -147,18 +171,19 @@ static void blend_slice(struct mp_draw_sub_cache *p)
     }
 }
 
-static bool blend_overlay_with_video(struct mp_draw_sub_cache *p,
-                                     struct mp_image *dst)
+// Blend lines [y0, y1) of dst.
+static bool blend_lines(struct mp_draw_sub_cache *p, struct blend_worker *bw,
+                        struct mp_image *dst, int y0, int y1)
 {
-    if (!repack_config_buffers(p->video_to_f32, 0, p->video_tmp, 0, dst, NULL))
+    if (!repack_config_buffers(bw->video_to_f32, 0, bw->video_tmp, 0, dst, NULL))
         return false;
-    if (!repack_config_buffers(p->video_from_f32, 0, dst, 0, p->video_tmp, NULL))
+    if (!repack_config_buffers(bw->video_from_f32, 0, dst, 0, bw->video_tmp, NULL))
         return false;
 
     int xs = dst->fmt.chroma_xs;
     int ys = dst->fmt.chroma_ys;
 
-    for (int y = 0; y < dst->h; y += p->align_y) {
+    for (int y = y0; y < y1; y += p->align_y) {
         struct slice *line = &p->slices[y * p->s_w];
 
         for (int sx = 0; sx < p->s_w; sx++) {
@@ -173,20 +198,199 @@ static bool blend_overlay_with_video(struct mp_draw_sub_cache *p,
             mp_assert(MP_IS_ALIGNED(w, p->align_x));
             mp_assert(x + w <= p->w);
 
-            repack_line(p->overlay_to_f32, 0, 0, x, y, w);
-            repack_line(p->video_to_f32, 0, 0, x, y, w);
-            if (p->calpha_to_f32)
-                repack_line(p->calpha_to_f32, 0, 0, x >> xs, y >> ys, w >> xs);
+            repack_line(bw->overlay_to_f32, 0, 0, x, y, w);
+            repack_line(bw->video_to_f32, 0, 0, x, y, w);
+            if (bw->calpha_to_f32)
+                repack_line(bw->calpha_to_f32, 0, 0, x >> xs, y >> ys, w >> xs);
 
-            blend_slice(p);
+            blend_slice(p, bw);
 
-            repack_line(p->video_from_f32, x, y, 0, 0, w);
+            repack_line(bw->video_from_f32, x, y, 0, 0, w);
         }
     }
 
     return true;
 }
 
+// The worker using the state in p (for the calling thread).
+static struct blend_worker main_blend_worker(struct mp_draw_sub_cache *p)
+{
+    return (struct blend_worker){
+        .overlay_to_f32 = p->overlay_to_f32,
+        .calpha_to_f32 = p->calpha_to_f32,
+        .video_to_f32 = p->video_to_f32,
+        .video_from_f32 = p->video_from_f32,
+        .overlay_tmp = p->overlay_tmp,
+        .calpha_tmp = p->calpha_tmp,
+        .video_tmp = p->video_tmp,
+    };
+}
+
+static void destroy_blend_threads(void *ptr)
+{
+    struct blend_threads *bt = ptr;
+
+    // Terminates the worker threads.
+    talloc_free(bt->pool);
+    pthread_mutex_destroy(&bt->lock);
+    pthread_cond_destroy(&bt->wakeup);
+}
+
+// Create the repackers and slice buffers of an additional worker, using the
+// same formats as the ones in p.
+static bool init_blend_worker(struct mp_draw_sub_cache *p,
+                              struct blend_threads *bt, struct blend_worker *w)
+{
+    struct mp_image *overlay = p->video_overlay ? p->video_overlay
+                                                : p->rgba_overlay;
+
+    w->video_to_f32 = mp_repack_create_planar(p->params.imgfmt, false, p->rflags);
+    w->video_from_f32 = mp_repack_create_planar(p->params.imgfmt, true, p->rflags);
+    w->overlay_to_f32 = mp_repack_create_planar(overlay->imgfmt, false, p->rflags);
+    talloc_steal(bt, w->video_to_f32);
+    talloc_steal(bt, w->video_from_f32);
+    talloc_steal(bt, w->overlay_to_f32);
+    if (!w->video_to_f32 || !w->video_from_f32 || !w->overlay_to_f32)
+        return false;
+
+    w->overlay_tmp = talloc_steal(bt, mp_image_alloc(p->overlay_tmp->imgfmt,
+                                                     SLICE_W, p->align_y));
+    w->video_tmp = talloc_steal(bt, mp_image_alloc(p->video_tmp->imgfmt,
+                                                   SLICE_W, p->align_y));
+    if (!w->overlay_tmp || !w->video_tmp)
+        return false;
+    w->overlay_tmp->params.color = p->overlay_tmp->params.color;
+    w->video_tmp->params.color = p->video_tmp->params.color;
+
+    if (!repack_config_buffers(w->overlay_to_f32, 0, w->overlay_tmp,
+                               0, overlay, NULL))
+        return false;
+
+    if (p->calpha_to_f32) {
+        w->calpha_to_f32 = mp_repack_create_planar(p->calpha_overlay->imgfmt,
+                                                   false, p->rflags);
+        talloc_steal(bt, w->calpha_to_f32);
+        if (!w->calpha_to_f32)
+            return false;
+        w->calpha_tmp = talloc_steal(bt, mp_image_alloc(p->calpha_tmp->imgfmt,
+                                                        SLICE_W, 1));
+        if (!w->calpha_tmp)
+            return false;
+        if (!repack_config_buffers(w->calpha_to_f32, 0, w->calpha_tmp,
+                                   0, p->calpha_overlay, NULL))
+            return false;
+    }
+
+    return true;
+}
+
+// Returns NULL if blending should not be multithreaded.
+static struct blend_threads *get_blend_threads(struct mp_draw_sub_cache *p)
+{
+    if (p->threads)
+        return p->threads->num_threads > 1 ? p->threads : NULL;
+
+    struct blend_threads *bt = talloc_zero(p, struct blend_threads);
+    pthread_mutex_init(&bt->lock, NULL);
+    pthread_cond_init(&bt->wakeup, NULL);
+    talloc_set_destructor(bt, destroy_blend_threads);
+    p->threads = bt;
+
+    bt->workers[0] = main_blend_worker(p);
+    bt->num_threads = 1;
+
+    int num = MPCLAMP(av_cpu_count(), 1, MAX_BLEND_THREADS);
+    if (num < 2 || p->h < MIN_BAND_H * 2)
+        return NULL;
+
+    for (int n = 1; n < num; n++) {
+        if (!init_blend_worker(p, bt, &bt->workers[n]))
+            return NULL;
+    }
+
+    bt->pool = mp_thread_pool_create(bt, num - 1, num - 1, num - 1);
+    if (!bt->pool)
+        return NULL;
+
+    bt->num_threads = num;
+    return bt;
+}
+
+static void blend_worker_fn(void *ctx)
+{
+    struct blend_worker *w = ctx;
+    struct blend_threads *bt = w->bt;
+
+    w->ok = blend_lines(w->p, w, w->dst, w->y0, w->y1);
+
+    mp_mutex_lock(&bt->lock);
+    bt->pending--;
+    if (!bt->pending)
+        pthread_cond_signal(&bt->wakeup);
+    mp_mutex_unlock(&bt->lock);
+}
+
+static bool blend_overlay_with_video(struct mp_draw_sub_cache *p,
+                                     struct mp_image *dst)
+{
+    // Restrict the work to the lines that contain OSD.
+    int y0 = dst->h, y1 = 0;
+    for (int y = 0; y < dst->h; y += p->align_y) {
+        struct slice *line = &p->slices[y * p->s_w];
+        for (int sx = 0; sx < p->s_w; sx++) {
+            if (line[sx].x0 < line[sx].x1) {
+                y0 = MPMIN(y0, y);
+                y1 = y + p->align_y;
+                break;
+            }
+        }
+    }
+    y1 = MPMIN(y1, dst->h);
+    if (y0 >= y1)
+        return true;
+
+    struct blend_threads *bt = get_blend_threads(p);
+    int num = bt ? MPMIN(bt->num_threads, (y1 - y0) / MIN_BAND_H) : 1;
+    if (num < 2) {
+        struct blend_worker w = main_blend_worker(p);
+        return blend_lines(p, &w, dst, y0, y1);
+    }
+
+    // Bands must start on macro-pixel boundaries.
+    int lines = (y1 - y0) / p->align_y;
+    for (int n = 0; n < num; n++) {
+        struct blend_worker *w = &bt->workers[n];
+        w->p = p;
+        w->bt = bt;
+        w->dst = dst;
+        w->y0 = y0 + lines * n / num * p->align_y;
+        w->y1 = n == num - 1 ? y1 : y0 + lines * (n + 1) / num * p->align_y;
+        w->ok = false;
+    }
+
+    mp_mutex_lock(&bt->lock);
+    bt->pending = num - 1;
+    mp_mutex_unlock(&bt->lock);
+
+    for (int n = 1; n < num; n++) {
+        if (!mp_thread_pool_queue(bt->pool, blend_worker_fn, &bt->workers[n]))
+            blend_worker_fn(&bt->workers[n]);
+    }
+
+    bool ok = blend_lines(p, &bt->workers[0], dst, bt->workers[0].y0,
+                          bt->workers[0].y1);
+
+    mp_mutex_lock(&bt->lock);
+    while (bt->pending)
+        pthread_cond_wait(&bt->wakeup, &bt->lock);
+    mp_mutex_unlock(&bt->lock);
+
+    for (int n = 1; n < num; n++)
+        ok &= bt->workers[n].ok;
+
+    return ok;
+}
+
 static bool convert_overlay_part(struct mp_draw_sub_cache *p,
                                  int x0, int y0, int w, int h)
 {
@@ -539,6 +743,9 @@ static bool reinit_to_video(struct mp_draw_sub_cache *p)
     int rflags = REPACK_CREATE_EXPAND_8BIT;
     bool use_shortcut = false;
 
+    struct draw_bmp_dsp dsp;
+    draw_bmp_dsp_init(&dsp);
+
     p->video_to_f32 = mp_repack_create_planar(params->imgfmt, false, rflags);
     talloc_steal(p, p->video_to_f32);
     if (!p->video_to_f32)
@@ -551,7 +758,7 @@ static bool reinit_to_video(struct mp_draw_sub_cache *p)
 
         if (vfdesc.component_type == MP_COMPONENT_TYPE_UINT &&
             vfdesc.component_size == 1 && vfdesc.component_pad == 0)
-            p->blend_line = blend_line_u8;
+            p->blend_line = dsp.blend_line_u8;
     }
 
     // If no special blender is available, blend in float.
@@ -568,9 +775,11 @@ static bool reinit_to_video(struct mp_draw_sub_cache *p)
         mp_get_regular_imgfmt(&vfdesc, mp_repack_get_format_dst(p->video_to_f32));
         mp_assert(vfdesc.component_type == MP_COMPONENT_TYPE_FLOAT);
 
-        p->blend_line = blend_line_f32;
+        p->blend_line = dsp.blend_line_f32;
     }
 
+    p->rflags = rflags;
+
     p->scale_in_tiles = SCALE_IN_TILES;
 
     int vid_f32_fmt = mp_repack_get_format_dst(p->video_to_f32);
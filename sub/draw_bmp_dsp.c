@@ -0,0 +1,230 @@
+/*
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include <libavutil/cpu.h>
+
+#include "draw_bmp_dsp.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DSP_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define DSP_NEON 1
+#include <arm_neon.h>
+#endif
+
+// x / 255 rounded down, exact for x in [0, 65535].
+#define DIV255(x) (((x) * 0x8081u) >> 23)
+
+static void blend_line_f32_c(void *dst, void *src, void *src_a, int w)
+{
+    float *dst_f = dst;
+    float *src_f = src;
+    float *src_a_f = src_a;
+
+    for (int x = 0; x < w; x++)
+        dst_f[x] = src_f[x] + dst_f[x] * (1.0f - src_a_f[x]);
+}
+
+static void blend_line_u8_c(void *dst, void *src, void *src_a, int w)
+{
+    uint8_t *dst_i = dst;
+    uint8_t *src_i = src;
+    uint8_t *src_a_i = src_a;
+
+    for (int x = 0; x < w; x++)
+        dst_i[x] = src_i[x] + DIV255(dst_i[x] * (255u - src_a_i[x]));
+}
+
+#ifdef DSP_X86
+
+#define TARGET(t) __attribute__((target(t)))
+
+TARGET("sse2")
+static void blend_line_f32_sse2(void *dst, void *src, void *src_a, int w)
+{
+    float *dst_f = dst;
+    float *src_f = src;
+    float *src_a_f = src_a;
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    int x = 0;
+    for (; x + 4 <= w; x += 4) {
+        __m128 d = _mm_loadu_ps(dst_f + x);
+        __m128 ia = _mm_sub_ps(one, _mm_loadu_ps(src_a_f + x));
+        _mm_storeu_ps(dst_f + x, _mm_add_ps(_mm_loadu_ps(src_f + x),
+                                            _mm_mul_ps(d, ia)));
+    }
+    blend_line_f32_c(dst_f + x, src_f + x, src_a_f + x, w - x);
+}
+
+// Blend 8 pixels given as 16 bit lanes; returns 16 bit results.
+TARGET("sse2")
+static inline __m128i blend8_sse2(__m128i s, __m128i d, __m128i a)
+{
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i magic = _mm_set1_epi16((short)0x8081);
+    __m128i t = _mm_mullo_epi16(d, _mm_sub_epi16(c255, a));
+    t = _mm_srli_epi16(_mm_mulhi_epu16(t, magic), 7);
+    return _mm_add_epi16(s, t);
+}
+
+TARGET("sse2")
+static void blend_line_u8_sse2(void *dst, void *src, void *src_a, int w)
+{
+    uint8_t *dst_i = dst;
+    uint8_t *src_i = src;
+    uint8_t *src_a_i = src_a;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo8 = _mm_set1_epi16(0xFF);
+
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst_i + x));
+        __m128i s = _mm_loadu_si128((const __m128i *)(src_i + x));
+        __m128i a = _mm_loadu_si128((const __m128i *)(src_a_i + x));
+        __m128i lo = blend8_sse2(_mm_unpacklo_epi8(s, zero),
+                                 _mm_unpacklo_epi8(d, zero),
+                                 _mm_unpacklo_epi8(a, zero));
+        __m128i hi = blend8_sse2(_mm_unpackhi_epi8(s, zero),
+                                 _mm_unpackhi_epi8(d, zero),
+                                 _mm_unpackhi_epi8(a, zero));
+        // Wrap around like the C version on bogus (non-premultiplied) input.
+        lo = _mm_and_si128(lo, lo8);
+        hi = _mm_and_si128(hi, lo8);
+        _mm_storeu_si128((__m128i *)(dst_i + x), _mm_packus_epi16(lo, hi));
+    }
+    blend_line_u8_c(dst_i + x, src_i + x, src_a_i + x, w - x);
+}
+
+TARGET("avx2")
+static void blend_line_f32_avx2(void *dst, void *src, void *src_a, int w)
+{
+    float *dst_f = dst;
+    float *src_f = src;
+    float *src_a_f = src_a;
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m256 d = _mm256_loadu_ps(dst_f + x);
+        __m256 ia = _mm256_sub_ps(one, _mm256_loadu_ps(src_a_f + x));
+        // No FMA: it would change rounding compared to the C version.
+        _mm256_storeu_ps(dst_f + x, _mm256_add_ps(_mm256_loadu_ps(src_f + x),
+                                                  _mm256_mul_ps(d, ia)));
+    }
+    blend_line_f32_c(dst_f + x, src_f + x, src_a_f + x, w - x);
+}
+
+TARGET("avx2")
+static void blend_line_u8_avx2(void *dst, void *src, void *src_a, int w)
+{
+    uint8_t *dst_i = dst;
+    uint8_t *src_i = src;
+    uint8_t *src_a_i = src_a;
+    const __m256i c255 = _mm256_set1_epi16(255);
+    const __m256i magic = _mm256_set1_epi16((short)0x8081);
+
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m256i d = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(dst_i + x)));
+        __m256i s = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src_i + x)));
+        __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src_a_i + x)));
+        __m256i t = _mm256_mullo_epi16(d, _mm256_sub_epi16(c255, a));
+        t = _mm256_srli_epi16(_mm256_mulhi_epu16(t, magic), 7);
+        t = _mm256_and_si256(_mm256_add_epi16(s, t), c255);
+        __m128i r = _mm_packus_epi16(_mm256_castsi256_si128(t),
+                                     _mm256_extracti128_si256(t, 1));
+        _mm_storeu_si128((__m128i *)(dst_i + x), r);
+    }
+    blend_line_u8_c(dst_i + x, src_i + x, src_a_i + x, w - x);
+}
+
+#endif /* DSP_X86 */
+
+#ifdef DSP_NEON
+
+static void blend_line_f32_neon(void *dst, void *src, void *src_a, int w)
+{
+    float *dst_f = dst;
+    float *src_f = src;
+    float *src_a_f = src_a;
+    const float32x4_t one = vdupq_n_f32(1.0f);
+
+    int x = 0;
+    for (; x + 4 <= w; x += 4) {
+        float32x4_t d = vld1q_f32(dst_f + x);
+        float32x4_t ia = vsubq_f32(one, vld1q_f32(src_a_f + x));
+        vst1q_f32(dst_f + x, vaddq_f32(vld1q_f32(src_f + x), vmulq_f32(d, ia)));
+    }
+    blend_line_f32_c(dst_f + x, src_f + x, src_a_f + x, w - x);
+}
+
+static void blend_line_u8_neon(void *dst, void *src, void *src_a, int w)
+{
+    uint8_t *dst_i = dst;
+    uint8_t *src_i = src;
+    uint8_t *src_a_i = src_a;
+
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint8x8_t ia = vmvn_u8(vld1_u8(src_a_i + x)); // 255 - a
+        uint16x8_t t = vmull_u8(vld1_u8(dst_i + x), ia);
+        uint32x4_t lo = vmull_n_u16(vget_low_u16(t), 0x8081);
+        uint32x4_t hi = vmull_n_u16(vget_high_u16(t), 0x8081);
+        uint16x8_t q = vcombine_u16(vshrn_n_u32(lo, 16), vshrn_n_u32(hi, 16));
+        uint8x8_t r = vmovn_u16(vshrq_n_u16(q, 7));
+        vst1_u8(dst_i + x, vadd_u8(vld1_u8(src_i + x), r));
+    }
+    blend_line_u8_c(dst_i + x, src_i + x, src_a_i + x, w - x);
+}
+
+#endif /* DSP_NEON */
+
+void draw_bmp_dsp_init(struct draw_bmp_dsp *dsp)
+{
+    *dsp = (struct draw_bmp_dsp){
+        .name = "c",
+        .blend_line_u8 = blend_line_u8_c,
+        .blend_line_f32 = blend_line_f32_c,
+    };
+
+    int flags = av_get_cpu_flags();
+    (void)flags;
+
+#ifdef DSP_X86
+    if (flags & AV_CPU_FLAG_SSE2) {
+        dsp->name = "sse2";
+        dsp->blend_line_u8 = blend_line_u8_sse2;
+        dsp->blend_line_f32 = blend_line_f32_sse2;
+    }
+    if (flags & AV_CPU_FLAG_AVX2) {
+        dsp->name = "avx2";
+        dsp->blend_line_u8 = blend_line_u8_avx2;
+        dsp->blend_line_f32 = blend_line_f32_avx2;
+    }
+#endif
+#ifdef DSP_NEON
+    if (flags & AV_CPU_FLAG_NEON) {
+        dsp->name = "neon";
+        dsp->blend_line_u8 = blend_line_u8_neon;
+        dsp->blend_line_f32 = blend_line_f32_neon;
+    }
+#endif
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Line blenders used by draw_bmp.c. The u8 variants are bit-exact with the C
+// version.
+struct draw_bmp_dsp {
+    const char *name;
+
+    // dst[x] = src[x] + dst[x] * (1 - src_a[x]) for x in [0, w), with
+    // premultiplied alpha.
+    void (*blend_line_u8)(void *dst, void *src, void *src_a, int w);
+    void (*blend_line_f32)(void *dst, void *src, void *src_a, int w);
+};
+
+// Select the fastest implementations supported by the CPU.
+void draw_bmp_dsp_init(struct draw_bmp_dsp *dsp);
@@ -46,6 +46,11 @@ struct sd_functions {
                                        int format, double pts);
     char *(*get_text)(struct sd *sd, double pts, enum sd_text_type type);
     struct sd_times (*get_times)(struct sd *sd, double pts);
+
+    // Optional. Set *res to the time range around pts in which get_bitmaps()
+    // returns the same output (with the same arguments). Return false if this
+    // is not known, e.g. because of animations.
+    bool (*get_static_times)(struct sd *sd, double pts, struct sd_times *res);
 };
 
 // lavc_conv.c
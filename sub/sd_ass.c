@@ -37,6 +37,20 @@
 #include "ass_mp.h"
 #include "sd.h"
 
+// Index over ass_track->events for lookups by time. Covers events[0..num-1],
+// and is updated when new events are appended.
+struct event_index {
+    int *by_start;          // event numbers, sorted by (Start, number)
+    int *by_end;            // event numbers, sorted by (end, number)
+    long long *max_end;     // max. end per node of a segment tree over by_start
+    int tree_size;          // number of leaves in max_end (power of 2)
+    bool tree_valid;
+    int num;
+    bool dirty;             // indexed events were removed or changed
+    int *found;             // result of index_find()
+    int num_found;
+};
+
 struct sd_ass_priv {
     struct ass_library *ass_library;
     struct ass_renderer *ass_renderer;
@@ -55,8 +69,10 @@ struct sd_ass_priv {
     struct mp_image_params video_params;
     struct mp_image_params last_params;
     struct mp_osd_res osd;
-    int64_t *seen_packets;
+    int64_t *seen_packets;      // hash set of packet positions, -1 = unused
     int num_seen_packets;
+    int seen_packets_size;
+    struct event_index index;
     bool duration_unknown;
 };
 
@@ -296,27 +312,53 @@ static void filter_and_add(struct sd *sd, struct demux_packet *pkt)
         talloc_free(pkt);
 }
 
+static bool add_seen_packet(struct sd_ass_priv *priv, int64_t pos)
+{
+    uint32_t mask = priv->seen_packets_size - 1;
+    uint32_t i = ((uint64_t)pos * 0x9E3779B97F4A7C15ull) >> 32;
+    for (;; i++) {
+        int64_t *p = &priv->seen_packets[i & mask];
+        if (*p == pos)
+            return true;
+        if (*p < 0) {
+            *p = pos;
+            priv->num_seen_packets++;
+            return false;
+        }
+    }
+}
+
+static void clear_seen_packets(struct sd_ass_priv *priv)
+{
+    if (priv->num_seen_packets) {
+        memset(priv->seen_packets, -1,
+               priv->seen_packets_size * sizeof(priv->seen_packets[0]));
+    }
+    priv->num_seen_packets = 0;
+}
+
 // Test if the packet with the given file position (used as unique ID) was
 // already consumed. Return false if the packet is new (and add it to the
 // internal list), and return true if it was already seen.
 static bool check_packet_seen(struct sd *sd, int64_t pos)
 {
     struct sd_ass_priv *priv = sd->priv;
-    int a = 0;
-    int b = priv->num_seen_packets;
-    while (a < b) {
-        int mid = a + (b - a) / 2;
-        int64_t val = priv->seen_packets[mid];
-        if (pos == val)
-            return true;
-        if (pos > val) {
-            a = mid + 1;
-        } else {
-            b = mid;
+    // Keep the hash table at most half full.
+    if (priv->num_seen_packets * 2 >= priv->seen_packets_size) {
+        int64_t *old = priv->seen_packets;
+        int old_size = priv->seen_packets_size;
+        priv->seen_packets_size = MPMAX(old_size * 2, 256);
+        priv->seen_packets = talloc_array(priv, int64_t, priv->seen_packets_size);
+        memset(priv->seen_packets, -1,
+               priv->seen_packets_size * sizeof(priv->seen_packets[0]));
+        priv->num_seen_packets = 0;
+        for (int n = 0; n < old_size; n++) {
+            if (old[n] >= 0)
+                add_seen_packet(priv, old[n]);
         }
+        talloc_free(old);
     }
-    MP_TARRAY_INSERT_AT(priv, priv->seen_packets, priv->num_seen_packets, a, pos);
-    return false;
+    return add_seen_packet(priv, pos);
 }
 
 #define UNKNOWN_DURATION (INT_MAX / 1000)
@@ -352,6 +394,7 @@ static void decode(struct sd *sd, struct demux_packet *packet)
             filter_and_add(sd, &pkt2);
         }
         if (ctx->duration_unknown) {
+            ctx->index.dirty = true;
             for (int n = track->n_events - 2; n >= 0; n--) {
                 if (track->events[n].Duration == UNKNOWN_DURATION * 1000) {
                     if (track->events[n].Start != track->events[n + 1].Start) {
@@ -479,6 +522,219 @@ static bool has_overrides(char *s)
            strstr(s, "\\iclip") || strstr(s, "\\org") || strstr(s, "\\p");
 }
 
+static long long event_end(ASS_Event *event)
+{
+    return event->Start + event->Duration;
+}
+
+// Number of indexed events with Start <= ts.
+static int index_count_start(struct sd_ass_priv *ctx, long long ts)
+{
+    ASS_Event *events = ctx->ass_track->events;
+    int a = 0, b = ctx->index.num;
+    while (a < b) {
+        int mid = a + (b - a) / 2;
+        if (events[ctx->index.by_start[mid]].Start <= ts) {
+            a = mid + 1;
+        } else {
+            b = mid;
+        }
+    }
+    return a;
+}
+
+// Number of indexed events with an end <= ts.
+static int index_count_end(struct sd_ass_priv *ctx, long long ts)
+{
+    ASS_Event *events = ctx->ass_track->events;
+    int a = 0, b = ctx->index.num;
+    while (a < b) {
+        int mid = a + (b - a) / 2;
+        if (event_end(&events[ctx->index.by_end[mid]]) <= ts) {
+            a = mid + 1;
+        } else {
+            b = mid;
+        }
+    }
+    return a;
+}
+
+static void index_set_leaf(struct event_index *idx, int pos, long long end)
+{
+    int node = idx->tree_size + pos;
+    idx->max_end[node] = end;
+    for (node /= 2; node > 0; node /= 2)
+        idx->max_end[node] = MPMAX(idx->max_end[node * 2],
+                                   idx->max_end[node * 2 + 1]);
+}
+
+// Add events[n], which must come after all indexed events.
+static void index_add(struct sd_ass_priv *ctx, int n)
+{
+    struct event_index *idx = &ctx->index;
+    ASS_Event *event = &ctx->ass_track->events[n];
+
+    // Sorting by event number means new events go after all equal times.
+    int pos = index_count_start(ctx, event->Start);
+    int num = idx->num;
+    MP_TARRAY_INSERT_AT(ctx, idx->by_start, num, pos, n);
+    num = idx->num;
+    MP_TARRAY_INSERT_AT(ctx, idx->by_end, num,
+                        index_count_end(ctx, event_end(event)), n);
+    idx->num++;
+
+    // Events usually come in order, so the tree rarely needs a rebuild.
+    if (idx->tree_valid && pos == idx->num - 1 && pos < idx->tree_size) {
+        index_set_leaf(idx, pos, event_end(event));
+    } else {
+        idx->tree_valid = false;
+    }
+}
+
+struct sort_key {
+    long long t;
+    int n;
+};
+
+static int cmp_sort_key(const void *a, const void *b)
+{
+    const struct sort_key *ka = a, *kb = b;
+    if (ka->t != kb->t)
+        return ka->t < kb->t ? -1 : 1;
+    return ka->n - kb->n;
+}
+
+static void index_sort(int *list, struct sort_key *keys, int num)
+{
+    qsort(keys, num, sizeof(keys[0]), cmp_sort_key);
+    for (int n = 0; n < num; n++)
+        list[n] = keys[n].n;
+}
+
+// Bring the index up to date with the event list.
+static void index_update(struct sd_ass_priv *ctx)
+{
+    struct event_index *idx = &ctx->index;
+    ASS_Track *track = ctx->ass_track;
+
+    if (idx->dirty || track->n_events < idx->num) {
+        int num = track->n_events;
+        MP_TARRAY_GROW(ctx, idx->by_start, num);
+        MP_TARRAY_GROW(ctx, idx->by_end, num);
+        struct sort_key *keys = talloc_array(NULL, struct sort_key, num);
+        for (int n = 0; n < num; n++)
+            keys[n] = (struct sort_key){track->events[n].Start, n};
+        index_sort(idx->by_start, keys, num);
+        for (int n = 0; n < num; n++)
+            keys[n] = (struct sort_key){event_end(&track->events[n]), n};
+        index_sort(idx->by_end, keys, num);
+        talloc_free(keys);
+        idx->num = num;
+        idx->dirty = false;
+        idx->tree_valid = false;
+    }
+
+    for (int n = idx->num; n < track->n_events; n++)
+        index_add(ctx, n);
+
+    if (!idx->tree_valid) {
+        // Leave room for appending.
+        idx->tree_size = 1;
+        while (idx->tree_size <= idx->num)
+            idx->tree_size *= 2;
+        idx->max_end = talloc_realloc(ctx, idx->max_end, long long,
+                                      idx->tree_size * 2);
+        long long *leaves = idx->max_end + idx->tree_size;
+        for (int n = 0; n < idx->tree_size; n++) {
+            leaves[n] = n < idx->num ?
+                event_end(&track->events[idx->by_start[n]]) : LLONG_MIN;
+        }
+        for (int n = idx->tree_size - 1; n > 0; n--)
+            idx->max_end[n] = MPMAX(idx->max_end[n * 2], idx->max_end[n * 2 + 1]);
+        idx->tree_valid = true;
+    }
+}
+
+static void index_find_node(struct sd_ass_priv *ctx, int node, int lo, int hi,
+                            int count, long long min_end)
+{
+    struct event_index *idx = &ctx->index;
+    if (lo >= count || idx->max_end[node] <= min_end)
+        return;
+    if (node >= idx->tree_size) {
+        MP_TARRAY_APPEND(ctx, idx->found, idx->num_found, idx->by_start[lo]);
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    index_find_node(ctx, node * 2, lo, mid, count, min_end);
+    index_find_node(ctx, node * 2 + 1, mid, hi, count, min_end);
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+// Find all events with Start <= max_start and an end > min_end. The event
+// numbers are returned in ctx->index.found, in event list order.
+static int index_find(struct sd_ass_priv *ctx, long long max_start,
+                      long long min_end)
+{
+    struct event_index *idx = &ctx->index;
+    index_update(ctx);
+    idx->num_found = 0;
+    index_find_node(ctx, 1, 0, idx->tree_size, index_count_start(ctx, max_start),
+                    min_end);
+    if (idx->num_found > 1)
+        qsort(idx->found, idx->num_found, sizeof(idx->found[0]), cmp_int);
+    return idx->num_found;
+}
+
+// Same as ass_step_sub(), but using the index.
+static long long step_sub(struct sd_ass_priv *ctx, long long now, int movement)
+{
+    struct event_index *idx = &ctx->index;
+    ASS_Event *events = ctx->ass_track->events;
+    index_update(ctx);
+
+    if (!idx->num)
+        return 0;
+
+    int best = -1;
+    long long target = now;
+    int direction = (movement > 0 ? 1 : -1) * !!movement;
+    do {
+        int closest = -1;
+        long long closest_time = now;
+        if (direction < 0) {
+            // Latest end before target; the first such event in list order.
+            int k = index_count_end(ctx, target - 1);
+            if (k > 0) {
+                closest_time = event_end(&events[idx->by_end[k - 1]]);
+                closest = idx->by_end[index_count_end(ctx, closest_time - 1)];
+            }
+        } else if (direction > 0) {
+            int k = index_count_start(ctx, target);
+            if (k < idx->num) {
+                closest = idx->by_start[k];
+                closest_time = events[closest].Start;
+            }
+        } else {
+            int k = index_count_start(ctx, target - 1);
+            if (k > 0) {
+                closest = idx->by_start[k - 1];
+                closest_time = events[closest].Start;
+            }
+        }
+        target = closest_time + direction;
+        movement -= direction;
+        if (closest >= 0)
+            best = closest;
+    } while (movement);
+
+    return best >= 0 ? events[best].Start - now : 0;
+}
+
 #define END(ev) ((ev)->Start + (ev)->Duration)
 
 static long long find_timestamp(struct sd *sd, double pts)
@@ -497,20 +753,14 @@ static long long find_timestamp(struct sd *sd, double pts)
     int threshold = SUB_GAP_THRESHOLD * 1000;
     int keep = SUB_GAP_KEEP * 1000;
 
-    // Find the "current" event.
-    ASS_Event *ev[2] = {0};
-    int n_ev = 0;
-    for (int n = 0; n < track->n_events; n++) {
-        ASS_Event *event = &track->events[n];
-        if (ts >= event->Start - threshold && ts <= END(event) + threshold) {
-            if (n_ev >= MP_ARRAY_SIZE(ev))
-                return ts; // multiple overlaps - give up (probably complex subs)
-            ev[n_ev++] = event;
-        }
-    }
-
-    if (n_ev != 2)
+    // Find the "current" event. If there are more than 2, give up (probably
+    // complex subs).
+    if (index_find(priv, ts + threshold, ts - threshold - 1) != 2)
         return ts;
+    ASS_Event *ev[2] = {
+        &track->events[priv->index.found[0]],
+        &track->events[priv->index.found[1]],
+    };
 
     // Simple/minor heuristic against destroying typesetting.
     if (ev[0]->Style != ev[1]->Style || has_overrides(ev[0]->Text) ||
@@ -595,7 +845,8 @@ static struct sub_bitmaps *get_bitmaps(struct sd *sd, struct mp_osd_res dim,
     long long ts = find_timestamp(sd, pts);
     if (ctx->duration_unknown && pts != MP_NOPTS_VALUE) {
         mp_ass_flush_old_events(track, ts);
-        ctx->num_seen_packets = 0;
+        ctx->index.dirty = true;
+        clear_seen_packets(ctx);
         sd->preload_ok = false;
     }
 
@@ -699,23 +950,22 @@ static char *get_text_buf(struct sd *sd, double pts, enum sd_text_type type)
 
     struct buf b = {ctx->last_text, sizeof(ctx->last_text) - 1};
 
-    for (int i = 0; i < track->n_events; ++i) {
-        ASS_Event *event = track->events + i;
-        if (ipts >= event->Start && ipts < event->Start + event->Duration) {
-            if (event->Text) {
-                int start = b.len;
-                if (type == SD_TEXT_TYPE_PLAIN) {
-                    ass_to_plaintext(&b, event->Text);
-                } else {
-                    char *t = event->Text;
-                    while (*t)
-                        append(&b, *t++);
-                }
-                if (is_whitespace_only(&b.start[start], b.len - start)) {
-                    b.len = start;
-                } else {
-                    append(&b, '\n');
-                }
+    int num = index_find(ctx, ipts, ipts);
+    for (int i = 0; i < num; ++i) {
+        ASS_Event *event = track->events + ctx->index.found[i];
+        if (event->Text) {
+            int start = b.len;
+            if (type == SD_TEXT_TYPE_PLAIN) {
+                ass_to_plaintext(&b, event->Text);
+            } else {
+                char *t = event->Text;
+                while (*t)
+                    append(&b, *t++);
+            }
+            if (is_whitespace_only(&b.start[start], b.len - start)) {
+                b.len = start;
+            } else {
+                append(&b, '\n');
             }
         }
     }
@@ -744,24 +994,76 @@ static struct sd_times get_times(struct sd *sd, double pts)
 
     long long ipts = find_timestamp(sd, pts);
 
-    for (int i = 0; i < track->n_events; ++i) {
-        ASS_Event *event = track->events + i;
-        if (ipts >= event->Start && ipts < event->Start + event->Duration) {
-            double start = event->Start / 1000.0;
-            double end = event->Duration == UNKNOWN_DURATION ?
-                MP_NOPTS_VALUE : (event->Start + event->Duration) / 1000.0;
+    int num = index_find(ctx, ipts, ipts);
+    for (int i = 0; i < num; ++i) {
+        ASS_Event *event = track->events + ctx->index.found[i];
+        double start = event->Start / 1000.0;
+        double end = event->Duration == UNKNOWN_DURATION ?
+            MP_NOPTS_VALUE : (event->Start + event->Duration) / 1000.0;
 
-            if (res.start == MP_NOPTS_VALUE || res.start > start)
-                res.start = start;
+        if (res.start == MP_NOPTS_VALUE || res.start > start)
+            res.start = start;
 
-            if (res.end == MP_NOPTS_VALUE || res.end < end)
-                res.end = end;
-        }
+        if (res.end == MP_NOPTS_VALUE || res.end < end)
+            res.end = end;
     }
 
     return res;
 }
 
+// Whether the event can look different at different times.
+static bool is_animated(ASS_Event *event)
+{
+    static const char *const tags[] = {"\\t(", "\\move", "\\fad", "\\k",
+                                       "\\K", NULL};
+    if (event->Effect && event->Effect[0])
+        return true;
+    for (int n = 0; event->Text && tags[n]; n++) {
+        if (strstr(event->Text, tags[n]))
+            return true;
+    }
+    return false;
+}
+
+static bool get_static_times(struct sd *sd, double pts, struct sd_times *res)
+{
+    struct sd_ass_priv *ctx = sd->priv;
+    ASS_Track *track = ctx->ass_track;
+
+    if (pts == MP_NOPTS_VALUE || ctx->duration_unknown)
+        return false;
+
+    // find_timestamp() might map pts to a different time.
+    if (sd->opts->sub_fix_timing && sd->opts->ass_style_override)
+        return false;
+
+    long long ts = find_timestamp(sd, pts);
+    long long lo = LLONG_MIN, hi = LLONG_MAX;
+
+    int num = index_find(ctx, ts, ts);
+    for (int i = 0; i < num; ++i) {
+        ASS_Event *event = track->events + ctx->index.found[i];
+        if (is_animated(event))
+            return false;
+        lo = MPMAX(lo, event->Start);
+        hi = MPMIN(hi, event_end(event));
+    }
+
+    // The next event to start, and the last one to end.
+    struct event_index *idx = &ctx->index;
+    int next = index_count_start(ctx, ts);
+    if (next < idx->num)
+        hi = MPMIN(hi, track->events[idx->by_start[next]].Start);
+    int prev = index_count_end(ctx, ts);
+    if (prev > 0)
+        lo = MPMAX(lo, event_end(&track->events[idx->by_end[prev - 1]]));
+
+    // find_timestamp() rounds pts to milliseconds.
+    res->start = lo == LLONG_MIN ? -INFINITY : (lo - 0.5) / 1000.0;
+    res->end = hi == LLONG_MAX ? INFINITY : (hi - 0.5) / 1000.0;
+    return true;
+}
+
 static void fill_plaintext(struct sd *sd, double pts)
 {
     struct sd_ass_priv *ctx = sd->priv;
@@ -806,7 +1108,8 @@ static void reset(struct sd *sd)
     struct sd_ass_priv *ctx = sd->priv;
     if (sd->opts->sub_clear_on_seek || ctx->duration_unknown || ctx->clear_once) {
         ass_flush_events(ctx->ass_track);
-        ctx->num_seen_packets = 0;
+        ctx->index.dirty = true;
+        clear_seen_packets(ctx);
         sd->preload_ok = false;
         ctx->clear_once = false;
     }
@@ -832,7 +1135,7 @@ static int control(struct sd *sd, enum sd_ctrl cmd, void *arg)
     case SD_CTRL_SUB_STEP: {
         double *a = arg;
         long long ts = llrint(a[0] * 1000.0);
-        long long res = ass_step_sub(ctx->ass_track, ts, a[1]);
+        long long res = step_sub(ctx, ts, a[1]);
         if (!res)
             return false;
         // Try to account for overlapping durations
@@ -859,6 +1162,7 @@ static int control(struct sd *sd, enum sd_ctrl cmd, void *arg)
 
             assobjects_destroy(sd);
             assobjects_init(sd);
+            ctx->index.dirty = true;
         }
         ctx->ass_configured = false; // ass always needs to be reconfigured
         return CONTROL_OK;
@@ -876,6 +1180,7 @@ const struct sd_functions sd_ass = {
     .get_bitmaps = get_bitmaps,
     .get_text = get_text,
     .get_times = get_times,
+    .get_static_times = get_static_times,
     .control = control,
     .reset = reset,
     .select = enable_output,
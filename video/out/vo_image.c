@@ -20,17 +20,22 @@
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
+#include <libavutil/cpu.h>
 #include <libswscale/swscale.h>
 
 #include "misc/bstr.h"
+#include "misc/thread_pool.h"
 #include "osdep/io.h"
+#include "osdep/threads.h"
 #include "options/m_config.h"
 #include "options/path.h"
 #include "misc/dmpv_talloc.h"
 #include "common/common.h"
 #include "common/msg.h"
+#include "common/stats.h"
 #include "video/out/vo.h"
 #include "video/csputils.h"
 #include "video/mp_image.h"
@@ -49,6 +54,7 @@ static const struct m_sub_options image_writer_conf = {
 struct vo_image_opts {
     struct image_writer_opts *opts;
     char *outdir;
+    int threads;
 };
 
 #define OPT_BASE_STRUCT struct vo_image_opts
@@ -57,16 +63,36 @@ static const struct m_sub_options vo_image_conf = {
     .opts = (const struct m_option[]) {
         {"vo-image", OPT_SUBSTRUCT(opts, image_writer_conf)},
         {"vo-image-outdir", OPT_STRING(outdir), .flags = M_OPT_FILE},
+        {"vo-image-threads", OPT_CHOICE(threads, {"auto", 0}, {"no", -1}),
+            M_RANGE(1, 64)},
         {0},
     },
     .size = sizeof(struct vo_image_opts),
 };
 
+// Maximum number of frames waiting for or being written per thread.
+#define FRAMES_PER_THREAD 2
+
 struct priv {
     struct vo_image_opts *opts;
 
     struct mp_image *current;
     int frame;
+
+    // Writing images asynchronously. If pool is NULL, write synchronously.
+    struct mp_thread_pool *pool;
+    int max_queued;
+    struct stats_ctx *stats;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    int num_queued;         // frames not written yet; protected by lock
+};
+
+struct write_job {
+    struct vo *vo;
+    struct mp_image *image;
+    char *filename;
 };
 
 static bool checked_mkdir(struct vo *vo, const char *buf)
@@ -102,6 +128,36 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
     osd_draw_on_image(vo->osd, dim, frame->current->pts, OSD_DRAW_SUB_ONLY, p->current);
 }
 
+static void write_job_fn(void *ctx)
+{
+    struct write_job *job = ctx;
+    struct vo *vo = job->vo;
+    struct priv *p = vo->priv;
+
+    write_image(job->image, p->opts->opts, job->filename, vo->global, vo->log,
+                true);
+    talloc_free(job);
+
+    stats_event(p->stats, "frames");
+
+    mp_mutex_lock(&p->lock);
+    p->num_queued--;
+    stats_value(p->stats, "queue-depth", p->num_queued);
+    pthread_cond_broadcast(&p->wakeup);
+    mp_mutex_unlock(&p->lock);
+}
+
+// Wait until at most max frames are still being written.
+static void wait_queue(struct vo *vo, int max)
+{
+    struct priv *p = vo->priv;
+
+    mp_mutex_lock(&p->lock);
+    while (p->num_queued > max)
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    mp_mutex_unlock(&p->lock);
+}
+
 static void flip_page(struct vo *vo)
 {
     struct priv *p = vo->priv;
@@ -110,17 +166,39 @@ static void flip_page(struct vo *vo)
 
     (p->frame)++;
 
-    void *t = talloc_new(NULL);
-    char *filename = talloc_asprintf(t, "%08d.%s", p->frame,
-                                     image_writer_file_ext(p->opts->opts));
+    struct write_job *job = talloc_zero(NULL, struct write_job);
+    job->vo = vo;
+    job->filename = talloc_asprintf(job, "%08d.%s", p->frame,
+                                    image_writer_file_ext(p->opts->opts));
 
     if (p->opts->outdir && strlen(p->opts->outdir))
-        filename = mp_path_join(t, p->opts->outdir, filename);
+        job->filename = mp_path_join(job, p->opts->outdir, job->filename);
+
+    MP_INFO(vo, "Saving %s\n", job->filename);
+
+    if (!p->pool) {
+        job->image = p->current;
+        write_image(job->image, p->opts->opts, job->filename, vo->global,
+                    vo->log, true);
+        talloc_free(job);
+        return;
+    }
 
-    MP_INFO(vo, "Saving %s\n", filename);
-    write_image(p->current, p->opts->opts, filename, vo->global, vo->log, true);
+    job->image = mp_image_new_ref(p->current);
+    MP_HANDLE_OOM(job->image);
+    talloc_steal(job, job->image);
 
-    talloc_free(t);
+    // Blocking the VO thread here makes vo_is_ready_for_frame() return false,
+    // which stops the player from decoding further ahead.
+    wait_queue(vo, p->max_queued - 1);
+
+    mp_mutex_lock(&p->lock);
+    p->num_queued++;
+    stats_value(p->stats, "queue-depth", p->num_queued);
+    mp_mutex_unlock(&p->lock);
+
+    // Can't fail, because the pool was created with all threads.
+    mp_thread_pool_queue(p->pool, write_job_fn, job);
 }
 
 static int query_format(struct vo *vo, int fmt)
@@ -132,6 +210,13 @@ static int query_format(struct vo *vo, int fmt)
 
 static void uninit(struct vo *vo)
 {
+    struct priv *p = vo->priv;
+
+    wait_queue(vo, 0);
+    talloc_free(p->pool);
+    talloc_free(p->stats);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wakeup);
 }
 
 static int preinit(struct vo *vo)
@@ -140,6 +225,21 @@ static int preinit(struct vo *vo)
     p->opts = mp_get_config_group(vo, vo->global, &vo_image_conf);
     if (p->opts->outdir && !checked_mkdir(vo, p->opts->outdir))
         return -1;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wakeup, NULL);
+
+    int threads = p->opts->threads;
+    if (threads == 0)
+        threads = MPCLAMP(av_cpu_count(), 1, 16);
+    if (threads > 0) {
+        p->pool = mp_thread_pool_create(NULL, threads, threads, threads);
+        if (!p->pool)
+            MP_WARN(vo, "Could not create writer threads.\n");
+        p->max_queued = threads * FRAMES_PER_THREAD;
+        p->stats = stats_ctx_create(NULL, vo->global, "vo_image");
+        MP_VERBOSE(vo, "Writing images with %d threads.\n", threads);
+    }
     return 0;
 }
 
@@ -22,6 +22,7 @@
 
 #include "common/common.h"
 #include "repack.h"
+#include "repack_dsp.h"
 #include "video/csputils.h"
 #include "video/fmt-conversion.h"
 #include "video/img_format.h"
@@ -88,6 +89,12 @@ struct mp_repack {
     bool configured;
 };
 
+static const struct repack_dsp *get_dsp(struct mp_repack *rp)
+{
+    static const struct repack_dsp none;
+    return rp->flags & REPACK_CREATE_NO_SIMD ? &none : repack_dsp_get();
+}
+
 // depth = number of LSB in use
 static int find_gbrp_format(int depth, int num_planes)
 {
@@ -140,7 +147,8 @@ static void copy_plane(struct mp_image *dst, int dst_x, int dst_y,
 }
 
 // Swap endian for one line.
-static void swap_endian(struct mp_image *dst, int dst_x, int dst_y,
+static void swap_endian(const struct repack_dsp *dsp,
+                        struct mp_image *dst, int dst_x, int dst_y,
                         struct mp_image *src, int src_x, int src_y,
                         int w, int endian_size)
 {
@@ -161,6 +169,10 @@ static void swap_endian(struct mp_image *dst, int dst_x, int dst_y,
             void *restrict d = mp_image_pixel_ptr_ny(dst, p, dst_x, dst_y + y);
             switch (endian_size) {
             case 2:
+                if (dsp->bswap16) {
+                    dsp->bswap16(d, s, num_words);
+                    break;
+                }
                 for (int x = 0; x < num_words; x++)
                     ((uint16_t *)d)[x] = av_bswap16(((uint16_t *)s)[x]);
                 break;
@@ -319,6 +331,34 @@ static const struct regular_repacker regular_repackers[] = {
     {32, 10, 0, 3, pa_ccc10z2,  un_ccc10x2},
 };
 
+typedef void (*scanline_fn)(void *restrict a, void *restrict b[], int w);
+
+// Return a vectorized version of the given regular_repackers[] function, or
+// the function itself if there is none.
+static scanline_fn simd_scanline(struct mp_repack *rp, scanline_fn fn)
+{
+    const struct repack_dsp *dsp = get_dsp(rp);
+    const struct {
+        scanline_fn c, simd;
+    } map[] = {
+        {un_cc8,    dsp->un_cc8},
+        {pa_cc8,    dsp->pa_cc8},
+        {un_cc16,   dsp->un_cc16},
+        {pa_cc16,   dsp->pa_cc16},
+        {un_cccc8,  dsp->un_cccc8},
+        {pa_cccc8,  dsp->pa_cccc8},
+        {un_ccc8x8, dsp->un_ccc8x8},
+        {pa_ccc8z8, dsp->pa_ccc8z8},
+        {un_x8ccc8, dsp->un_x8ccc8},
+        {pa_z8ccc8, dsp->pa_z8ccc8},
+    };
+    for (int n = 0; n < MP_ARRAY_SIZE(map); n++) {
+        if (map[n].c == fn && map[n].simd)
+            return map[n].simd;
+    }
+    return fn;
+}
+
 static void packed_repack(struct mp_repack *rp,
                           struct mp_image *a, int a_x, int a_y,
                           struct mp_image *b, int b_x, int b_y, int w)
@@ -395,7 +435,7 @@ static void setup_packed_packer(struct mp_repack *rp)
             continue;
 
         rp->repack = packed_repack;
-        rp->packed_repack_scanline = repack_cb;
+        rp->packed_repack_scanline = simd_scanline(rp, repack_cb);
         rp->imgfmt_b = planar_fmt;
         for (int n = 0; n < num_real_components; n++) {
             // Determine permutation that maps component order between the two
@@ -785,7 +825,7 @@ static void setup_nv_packer(struct mp_repack *rp)
 
         rp->repack = repack_nv;
         rp->passthrough_y = true;
-        rp->packed_repack_scanline = repack_cb;
+        rp->packed_repack_scanline = simd_scanline(rp, repack_cb);
         rp->imgfmt_b = planar_fmt;
         rp->components[0] = desc.planes[1].components[0] - 1;
         rp->components[1] = desc.planes[1].components[1] - 1;
@@ -821,9 +861,14 @@ static void repack_float(struct mp_repack *rp,
 {
     mp_assert(rp->f32_comp_size == 1 || rp->f32_comp_size == 2);
 
+    const struct repack_dsp *dsp = get_dsp(rp);
     void (*packer)(void *restrict a, float *restrict b, int w, float fm, float fb, uint32_t max)
-        = rp->pack ? (rp->f32_comp_size == 1 ? pa_f32_8 : pa_f32_16)
-                   : (rp->f32_comp_size == 1 ? un_f32_8 : un_f32_16);
+        = rp->pack ? (rp->f32_comp_size == 1 ? dsp->pa_f32_8 : dsp->pa_f32_16)
+                   : (rp->f32_comp_size == 1 ? dsp->un_f32_8 : dsp->un_f32_16);
+    if (!packer) {
+        packer = rp->pack ? (rp->f32_comp_size == 1 ? pa_f32_8 : pa_f32_16)
+                          : (rp->f32_comp_size == 1 ? un_f32_8 : un_f32_16);
+    }
 
     for (int p = 0; p < b->num_planes; p++) {
         int h = (1 << b->fmt.chroma_ys) - (1 << b->fmt.ys[p]) + 1;
@@ -917,8 +962,8 @@ void repack_line(struct mp_repack *rp, int dst_x, int dst_y,
             break;
         }
         case REPACK_STEP_ENDIAN:
-            swap_endian(rs->buf[1], dx, dy, rs->buf[0], sx, sy, w,
-                        rp->endian_size);
+            swap_endian(get_dsp(rp), rs->buf[1], dx, dy, rs->buf[0], sx, sy,
+                        w, rp->endian_size);
             break;
         case REPACK_STEP_FLOAT:
             repack_float(rp, buf_a, a_x, a_y, buf_b, b_x, b_y, w);
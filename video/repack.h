@@ -14,6 +14,9 @@ enum {
     // For mp_repack_create_planar(). If specified, the planar format uses a
     // float 32 bit sample format. No range expansion is done.
     REPACK_CREATE_PLANAR_F32    = (1 << 2),
+
+    // Use only the C versions of the scanline functions (for testing).
+    REPACK_CREATE_NO_SIMD       = (1 << 3),
 };
 
 struct mp_repack;
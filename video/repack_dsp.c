@@ -0,0 +1,569 @@
+/*
+ * This file is part of dmpv.
+ *
+ * dmpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * dmpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with dmpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <pthread.h>
+
+#include <libavutil/bswap.h>
+#include <libavutil/cpu.h>
+
+#include "common/common.h"
+#include "repack_dsp.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DSP_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define DSP_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Scalar code for the remaining pixels at the end of a line. These must match
+// the C versions in repack.c.
+
+static void tail_un_cc(void *restrict src, void *restrict dst[], int x, int w,
+                       int size)
+{
+    for (; x < w; x++) {
+        if (size == 1) {
+            uint16_t c = ((uint16_t *)src)[x];
+            ((uint8_t *)dst[0])[x] = c & 0xFFu;
+            ((uint8_t *)dst[1])[x] = c >> 8;
+        } else {
+            uint32_t c = ((uint32_t *)src)[x];
+            ((uint16_t *)dst[0])[x] = c & 0xFFFFu;
+            ((uint16_t *)dst[1])[x] = c >> 16;
+        }
+    }
+}
+
+static void tail_pa_cc(void *restrict dst, void *restrict src[], int x, int w,
+                       int size)
+{
+    for (; x < w; x++) {
+        if (size == 1) {
+            ((uint16_t *)dst)[x] = ((uint8_t *)src[0])[x] |
+                                   ((uint16_t)((uint8_t *)src[1])[x] << 8);
+        } else {
+            ((uint32_t *)dst)[x] = ((uint16_t *)src[0])[x] |
+                                   ((uint32_t)((uint16_t *)src[1])[x] << 16);
+        }
+    }
+}
+
+// Unpack the byte components c0..c3 of 32 bit pixels; dst[n] receives
+// component first + n, for n in [0, num).
+static void tail_un_c8(void *restrict src, void *restrict dst[], int x, int w,
+                       int first, int num)
+{
+    for (; x < w; x++) {
+        uint32_t c = ((uint32_t *)src)[x];
+        for (int n = 0; n < num; n++)
+            ((uint8_t *)dst[n])[x] = (c >> ((first + n) * 8)) & 0xFFu;
+    }
+}
+
+static void tail_pa_c8(void *restrict dst, void *restrict src[], int x, int w,
+                       int first, int num)
+{
+    for (; x < w; x++) {
+        uint32_t c = 0;
+        for (int n = 0; n < num; n++)
+            c |= (uint32_t)((uint8_t *)src[n])[x] << ((first + n) * 8);
+        ((uint32_t *)dst)[x] = c;
+    }
+}
+
+static void tail_un_f32(void *restrict src, float *restrict dst, int x, int w,
+                        float m, float o, int size)
+{
+    for (; x < w; x++) {
+        dst[x] = (size == 1 ? ((uint8_t *)src)[x] : ((uint16_t *)src)[x])
+                 * m + o;
+    }
+}
+
+static void tail_pa_f32(void *restrict dst, float *restrict src, int x, int w,
+                        float m, float o, uint32_t p_max, int size)
+{
+    for (; x < w; x++) {
+        long v = MPCLAMP(lrint((src[x] + o) * m), 0, (long)p_max);
+        if (size == 1) {
+            ((uint8_t *)dst)[x] = v;
+        } else {
+            ((uint16_t *)dst)[x] = v;
+        }
+    }
+}
+
+#ifdef DSP_X86
+
+#define TARGET(t) __attribute__((target(t)))
+
+TARGET("sse2")
+static void un_cc8_sse2(void *restrict src, void *restrict dst[], int w)
+{
+    const __m128i mask = _mm_set1_epi16(0xFF);
+    uint8_t *s = src, *d0 = dst[0], *d1 = dst[1];
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + x * 2 + 16));
+        __m128i c0 = _mm_packus_epi16(_mm_and_si128(a, mask),
+                                      _mm_and_si128(b, mask));
+        __m128i c1 = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128((__m128i *)(d0 + x), c0);
+        _mm_storeu_si128((__m128i *)(d1 + x), c1);
+    }
+    tail_un_cc(src, dst, x, w, 1);
+}
+
+TARGET("sse2")
+static void pa_cc8_sse2(void *restrict dst, void *restrict src[], int w)
+{
+    uint8_t *d = dst, *s0 = src[0], *s1 = src[1];
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i c0 = _mm_loadu_si128((const __m128i *)(s0 + x));
+        __m128i c1 = _mm_loadu_si128((const __m128i *)(s1 + x));
+        _mm_storeu_si128((__m128i *)(d + x * 2), _mm_unpacklo_epi8(c0, c1));
+        _mm_storeu_si128((__m128i *)(d + x * 2 + 16), _mm_unpackhi_epi8(c0, c1));
+    }
+    tail_pa_cc(dst, src, x, w, 1);
+}
+
+TARGET("sse2")
+static void un_cc16_sse2(void *restrict src, void *restrict dst[], int w)
+{
+    uint16_t *s = src, *d0 = dst[0], *d1 = dst[1];
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + x * 2 + 8));
+        // Sign extension makes the signed saturation in packs a no-op.
+        __m128i c0 = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                                     _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        __m128i c1 = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+        _mm_storeu_si128((__m128i *)(d0 + x), c0);
+        _mm_storeu_si128((__m128i *)(d1 + x), c1);
+    }
+    tail_un_cc(src, dst, x, w, 2);
+}
+
+TARGET("sse2")
+static void pa_cc16_sse2(void *restrict dst, void *restrict src[], int w)
+{
+    uint16_t *d = dst, *s0 = src[0], *s1 = src[1];
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i c0 = _mm_loadu_si128((const __m128i *)(s0 + x));
+        __m128i c1 = _mm_loadu_si128((const __m128i *)(s1 + x));
+        _mm_storeu_si128((__m128i *)(d + x * 2), _mm_unpacklo_epi16(c0, c1));
+        _mm_storeu_si128((__m128i *)(d + x * 2 + 8), _mm_unpackhi_epi16(c0, c1));
+    }
+    tail_pa_cc(dst, src, x, w, 2);
+}
+
+// Deinterleave 16 32 bit pixels into 4 vectors of byte components.
+TARGET("ssse3")
+static inline void un_c8x4_ssse3(const uint8_t *s, __m128i c[4])
+{
+    const __m128i shuf = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13,
+                                       2, 6, 10, 14, 3, 7, 11, 15);
+    __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(s + 0)), shuf);
+    __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(s + 16)), shuf);
+    __m128i e = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(s + 32)), shuf);
+    __m128i f = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(s + 48)), shuf);
+    __m128i t0 = _mm_unpacklo_epi32(a, b);
+    __m128i t1 = _mm_unpacklo_epi32(e, f);
+    __m128i t2 = _mm_unpackhi_epi32(a, b);
+    __m128i t3 = _mm_unpackhi_epi32(e, f);
+    c[0] = _mm_unpacklo_epi64(t0, t1);
+    c[1] = _mm_unpackhi_epi64(t0, t1);
+    c[2] = _mm_unpacklo_epi64(t2, t3);
+    c[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+// Inverse of un_c8x4_ssse3().
+TARGET("sse2")
+static inline void pa_c8x4_sse2(uint8_t *d, const __m128i c[4])
+{
+    __m128i t0 = _mm_unpacklo_epi8(c[0], c[1]);
+    __m128i t1 = _mm_unpacklo_epi8(c[2], c[3]);
+    __m128i t2 = _mm_unpackhi_epi8(c[0], c[1]);
+    __m128i t3 = _mm_unpackhi_epi8(c[2], c[3]);
+    _mm_storeu_si128((__m128i *)(d + 0), _mm_unpacklo_epi16(t0, t1));
+    _mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(t0, t1));
+    _mm_storeu_si128((__m128i *)(d + 32), _mm_unpacklo_epi16(t2, t3));
+    _mm_storeu_si128((__m128i *)(d + 48), _mm_unpackhi_epi16(t2, t3));
+}
+
+#define UN_C8_SSSE3(name, first, num)                                       \
+    TARGET("ssse3")                                                         \
+    static void name(void *restrict src, void *restrict dst[], int w) {     \
+        int x = 0;                                                          \
+        for (; x + 16 <= w; x += 16) {                                      \
+            __m128i c[4];                                                   \
+            un_c8x4_ssse3((uint8_t *)src + x * 4, c);                       \
+            for (int n = 0; n < (num); n++)                                 \
+                _mm_storeu_si128((__m128i *)((uint8_t *)dst[n] + x),        \
+                                 c[(first) + n]);                           \
+        }                                                                   \
+        tail_un_c8(src, dst, x, w, first, num);                             \
+    }
+
+#define PA_C8_SSE2(name, first, num)                                        \
+    TARGET("sse2")                                                          \
+    static void name(void *restrict dst, void *restrict src[], int w) {     \
+        int x = 0;                                                          \
+        for (; x + 16 <= w; x += 16) {                                      \
+            __m128i c[4] = {0};                                             \
+            for (int n = 0; n < (num); n++) {                               \
+                c[(first) + n] =                                            \
+                    _mm_loadu_si128((const __m128i *)((uint8_t *)src[n] + x)); \
+            }                                                               \
+            pa_c8x4_sse2((uint8_t *)dst + x * 4, c);                        \
+        }                                                                   \
+        tail_pa_c8(dst, src, x, w, first, num);                             \
+    }
+
+UN_C8_SSSE3(un_cccc8_ssse3,  0, 4)
+PA_C8_SSE2(pa_cccc8_sse2,    0, 4)
+UN_C8_SSSE3(un_ccc8x8_ssse3, 0, 3)
+PA_C8_SSE2(pa_ccc8z8_sse2,   0, 3)
+UN_C8_SSSE3(un_x8ccc8_ssse3, 1, 3)
+PA_C8_SSE2(pa_z8ccc8_sse2,   1, 3)
+
+TARGET("sse2")
+static inline __m128 un_f32_sse2(__m128i v, __m128 m, __m128 o)
+{
+    return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), m), o);
+}
+
+TARGET("sse2")
+static void un_f32_8_sse2(void *restrict src, float *restrict dst, int w,
+                          float m, float o, uint32_t unused)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 vm = _mm_set1_ps(m), vo = _mm_set1_ps(o);
+    uint8_t *s = src;
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps(dst + x + 0, un_f32_sse2(_mm_unpacklo_epi16(lo, zero), vm, vo));
+        _mm_storeu_ps(dst + x + 4, un_f32_sse2(_mm_unpackhi_epi16(lo, zero), vm, vo));
+        _mm_storeu_ps(dst + x + 8, un_f32_sse2(_mm_unpacklo_epi16(hi, zero), vm, vo));
+        _mm_storeu_ps(dst + x + 12, un_f32_sse2(_mm_unpackhi_epi16(hi, zero), vm, vo));
+    }
+    tail_un_f32(src, dst, x, w, m, o, 1);
+}
+
+TARGET("sse2")
+static void un_f32_16_sse2(void *restrict src, float *restrict dst, int w,
+                           float m, float o, uint32_t unused)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 vm = _mm_set1_ps(m), vo = _mm_set1_ps(o);
+    uint16_t *s = src;
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+        _mm_storeu_ps(dst + x + 0, un_f32_sse2(_mm_unpacklo_epi16(v, zero), vm, vo));
+        _mm_storeu_ps(dst + x + 4, un_f32_sse2(_mm_unpackhi_epi16(v, zero), vm, vo));
+    }
+    tail_un_f32(src, dst, x, w, m, o, 2);
+}
+
+// Clamping before the conversion gives the same result as clamping the lrint()
+// result, and also maps NaN to 0 (maxps returns the second operand).
+TARGET("sse2")
+static inline __m128i pa_f32_sse2(const float *s, __m128 m, __m128 o,
+                                  __m128 p_max)
+{
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(s), o), m);
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), p_max);
+    return _mm_cvtps_epi32(v);
+}
+
+TARGET("sse2")
+static void pa_f32_8_sse2(void *restrict dst, float *restrict src, int w,
+                          float m, float o, uint32_t p_max)
+{
+    const __m128 vm = _mm_set1_ps(m), vo = _mm_set1_ps(o);
+    const __m128 vmax = _mm_set1_ps(p_max);
+    uint8_t *d = dst;
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i a = pa_f32_sse2(src + x + 0, vm, vo, vmax);
+        __m128i b = pa_f32_sse2(src + x + 4, vm, vo, vmax);
+        __m128i c = pa_f32_sse2(src + x + 8, vm, vo, vmax);
+        __m128i e = pa_f32_sse2(src + x + 12, vm, vo, vmax);
+        __m128i v = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, e));
+        _mm_storeu_si128((__m128i *)(d + x), v);
+    }
+    tail_pa_f32(dst, src, x, w, m, o, p_max, 1);
+}
+
+TARGET("sse2")
+static void pa_f32_16_sse2(void *restrict dst, float *restrict src, int w,
+                           float m, float o, uint32_t p_max)
+{
+    const __m128 vm = _mm_set1_ps(m), vo = _mm_set1_ps(o);
+    const __m128 vmax = _mm_set1_ps(p_max);
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+    uint16_t *d = dst;
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        // Bias to signed range, so the signed saturation in packs is a no-op.
+        __m128i a = _mm_sub_epi32(pa_f32_sse2(src + x + 0, vm, vo, vmax), bias32);
+        __m128i b = _mm_sub_epi32(pa_f32_sse2(src + x + 4, vm, vo, vmax), bias32);
+        __m128i v = _mm_xor_si128(_mm_packs_epi32(a, b), bias16);
+        _mm_storeu_si128((__m128i *)(d + x), v);
+    }
+    tail_pa_f32(dst, src, x, w, m, o, p_max, 2);
+}
+
+TARGET("sse2")
+static void bswap16_sse2(uint16_t *dst, const uint16_t *src, int n)
+{
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *)(dst + x), v);
+    }
+    for (; x < n; x++)
+        dst[x] = av_bswap16(src[x]);
+}
+
+#endif /* DSP_X86 */
+
+#ifdef DSP_NEON
+
+static void un_cc8_neon(void *restrict src, void *restrict dst[], int w)
+{
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        uint8x16x2_t v = vld2q_u8((uint8_t *)src + x * 2);
+        vst1q_u8((uint8_t *)dst[0] + x, v.val[0]);
+        vst1q_u8((uint8_t *)dst[1] + x, v.val[1]);
+    }
+    tail_un_cc(src, dst, x, w, 1);
+}
+
+static void pa_cc8_neon(void *restrict dst, void *restrict src[], int w)
+{
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        uint8x16x2_t v = {{ vld1q_u8((uint8_t *)src[0] + x),
+                            vld1q_u8((uint8_t *)src[1] + x) }};
+        vst2q_u8((uint8_t *)dst + x * 2, v);
+    }
+    tail_pa_cc(dst, src, x, w, 1);
+}
+
+static void un_cc16_neon(void *restrict src, void *restrict dst[], int w)
+{
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8x2_t v = vld2q_u16((uint16_t *)src + x * 2);
+        vst1q_u16((uint16_t *)dst[0] + x, v.val[0]);
+        vst1q_u16((uint16_t *)dst[1] + x, v.val[1]);
+    }
+    tail_un_cc(src, dst, x, w, 2);
+}
+
+static void pa_cc16_neon(void *restrict dst, void *restrict src[], int w)
+{
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8x2_t v = {{ vld1q_u16((uint16_t *)src[0] + x),
+                            vld1q_u16((uint16_t *)src[1] + x) }};
+        vst2q_u16((uint16_t *)dst + x * 2, v);
+    }
+    tail_pa_cc(dst, src, x, w, 2);
+}
+
+#define UN_C8_NEON(name, first, num)                                        \
+    static void name(void *restrict src, void *restrict dst[], int w) {     \
+        int x = 0;                                                          \
+        for (; x + 16 <= w; x += 16) {                                      \
+            uint8x16x4_t v = vld4q_u8((uint8_t *)src + x * 4);              \
+            for (int n = 0; n < (num); n++)                                 \
+                vst1q_u8((uint8_t *)dst[n] + x, v.val[(first) + n]);        \
+        }                                                                   \
+        tail_un_c8(src, dst, x, w, first, num);                             \
+    }
+
+#define PA_C8_NEON(name, first, num)                                        \
+    static void name(void *restrict dst, void *restrict src[], int w) {     \
+        int x = 0;                                                          \
+        for (; x + 16 <= w; x += 16) {                                      \
+            uint8x16x4_t v;                                                 \
+            for (int n = 0; n < 4; n++)                                     \
+                v.val[n] = vdupq_n_u8(0);                                   \
+            for (int n = 0; n < (num); n++)                                 \
+                v.val[(first) + n] = vld1q_u8((uint8_t *)src[n] + x);       \
+            vst4q_u8((uint8_t *)dst + x * 4, v);                            \
+        }                                                                   \
+        tail_pa_c8(dst, src, x, w, first, num);                             \
+    }
+
+UN_C8_NEON(un_cccc8_neon,  0, 4)
+PA_C8_NEON(pa_cccc8_neon,  0, 4)
+UN_C8_NEON(un_ccc8x8_neon, 0, 3)
+PA_C8_NEON(pa_ccc8z8_neon, 0, 3)
+UN_C8_NEON(un_x8ccc8_neon, 1, 3)
+PA_C8_NEON(pa_z8ccc8_neon, 1, 3)
+
+static inline float32x4_t un_f32_neon(uint32x4_t v, float m, float o)
+{
+    return vaddq_f32(vmulq_n_f32(vcvtq_f32_u32(v), m), vdupq_n_f32(o));
+}
+
+static void un_f32_8_neon(void *restrict src, float *restrict dst, int w,
+                          float m, float o, uint32_t unused)
+{
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8_t v = vmovl_u8(vld1_u8((uint8_t *)src + x));
+        vst1q_f32(dst + x + 0, un_f32_neon(vmovl_u16(vget_low_u16(v)), m, o));
+        vst1q_f32(dst + x + 4, un_f32_neon(vmovl_u16(vget_high_u16(v)), m, o));
+    }
+    tail_un_f32(src, dst, x, w, m, o, 1);
+}
+
+static void un_f32_16_neon(void *restrict src, float *restrict dst, int w,
+                           float m, float o, uint32_t unused)
+{
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8_t v = vld1q_u16((uint16_t *)src + x);
+        vst1q_f32(dst + x + 0, un_f32_neon(vmovl_u16(vget_low_u16(v)), m, o));
+        vst1q_f32(dst + x + 4, un_f32_neon(vmovl_u16(vget_high_u16(v)), m, o));
+    }
+    tail_un_f32(src, dst, x, w, m, o, 2);
+}
+
+// See pa_f32_sse2() for why clamping first is fine.
+static inline uint32x4_t pa_f32_neon(const float *s, float m, float o,
+                                     float32x4_t p_max)
+{
+    float32x4_t v = vmulq_n_f32(vaddq_f32(vld1q_f32(s), vdupq_n_f32(o)), m);
+    v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0)), p_max);
+    return vcvtnq_u32_f32(v);
+}
+
+static void pa_f32_8_neon(void *restrict dst, float *restrict src, int w,
+                          float m, float o, uint32_t p_max)
+{
+    const float32x4_t vmax = vdupq_n_f32(p_max);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8_t v = vcombine_u16(vmovn_u32(pa_f32_neon(src + x, m, o, vmax)),
+                                    vmovn_u32(pa_f32_neon(src + x + 4, m, o, vmax)));
+        vst1_u8((uint8_t *)dst + x, vmovn_u16(v));
+    }
+    tail_pa_f32(dst, src, x, w, m, o, p_max, 1);
+}
+
+static void pa_f32_16_neon(void *restrict dst, float *restrict src, int w,
+                           float m, float o, uint32_t p_max)
+{
+    const float32x4_t vmax = vdupq_n_f32(p_max);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8_t v = vcombine_u16(vmovn_u32(pa_f32_neon(src + x, m, o, vmax)),
+                                    vmovn_u32(pa_f32_neon(src + x + 4, m, o, vmax)));
+        vst1q_u16((uint16_t *)dst + x, v);
+    }
+    tail_pa_f32(dst, src, x, w, m, o, p_max, 2);
+}
+
+static void bswap16_neon(uint16_t *dst, const uint16_t *src, int n)
+{
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        uint8x16_t v = vreinterpretq_u8_u16(vld1q_u16(src + x));
+        vst1q_u16(dst + x, vreinterpretq_u16_u8(vrev16q_u8(v)));
+    }
+    for (; x < n; x++)
+        dst[x] = av_bswap16(src[x]);
+}
+
+#endif /* DSP_NEON */
+
+static struct repack_dsp repack_dsp;
+static pthread_once_t repack_dsp_once = PTHREAD_ONCE_INIT;
+
+static void repack_dsp_init(void)
+{
+    struct repack_dsp *dsp = &repack_dsp;
+
+    int flags = av_get_cpu_flags();
+    (void)flags;
+
+#ifdef DSP_X86
+    if (flags & AV_CPU_FLAG_SSE2) {
+        dsp->un_cc8 = un_cc8_sse2;
+        dsp->pa_cc8 = pa_cc8_sse2;
+        dsp->un_cc16 = un_cc16_sse2;
+        dsp->pa_cc16 = pa_cc16_sse2;
+        dsp->pa_cccc8 = pa_cccc8_sse2;
+        dsp->pa_ccc8z8 = pa_ccc8z8_sse2;
+        dsp->pa_z8ccc8 = pa_z8ccc8_sse2;
+        dsp->un_f32_8 = un_f32_8_sse2;
+        dsp->pa_f32_8 = pa_f32_8_sse2;
+        dsp->un_f32_16 = un_f32_16_sse2;
+        dsp->pa_f32_16 = pa_f32_16_sse2;
+        dsp->bswap16 = bswap16_sse2;
+    }
+    if (flags & AV_CPU_FLAG_SSSE3) {
+        dsp->un_cccc8 = un_cccc8_ssse3;
+        dsp->un_ccc8x8 = un_ccc8x8_ssse3;
+        dsp->un_x8ccc8 = un_x8ccc8_ssse3;
+    }
+#endif
+#ifdef DSP_NEON
+    if (flags & AV_CPU_FLAG_NEON) {
+        dsp->un_cc8 = un_cc8_neon;
+        dsp->pa_cc8 = pa_cc8_neon;
+        dsp->un_cc16 = un_cc16_neon;
+        dsp->pa_cc16 = pa_cc16_neon;
+        dsp->un_cccc8 = un_cccc8_neon;
+        dsp->pa_cccc8 = pa_cccc8_neon;
+        dsp->un_ccc8x8 = un_ccc8x8_neon;
+        dsp->pa_ccc8z8 = pa_ccc8z8_neon;
+        dsp->un_x8ccc8 = un_x8ccc8_neon;
+        dsp->pa_z8ccc8 = pa_z8ccc8_neon;
+        dsp->un_f32_8 = un_f32_8_neon;
+        dsp->pa_f32_8 = pa_f32_8_neon;
+        dsp->un_f32_16 = un_f32_16_neon;
+        dsp->pa_f32_16 = pa_f32_16_neon;
+        dsp->bswap16 = bswap16_neon;
+    }
+#endif
+}
+
+const struct repack_dsp *repack_dsp_get(void)
+{
+    pthread_once(&repack_dsp_once, repack_dsp_init);
+    return &repack_dsp;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+// Vectorized versions of some repack.c scanline functions. The naming and
+// semantics are the same as the pa_/un_ functions in repack.c. Entries are
+// NULL if the CPU has no faster version.
+struct repack_dsp {
+    // Packed <-> planar, see regular_repackers[] in repack.c.
+    void (*un_cc8)(void *restrict src, void *restrict dst[], int w);
+    void (*pa_cc8)(void *restrict dst, void *restrict src[], int w);
+    void (*un_cc16)(void *restrict src, void *restrict dst[], int w);
+    void (*pa_cc16)(void *restrict dst, void *restrict src[], int w);
+    void (*un_cccc8)(void *restrict src, void *restrict dst[], int w);
+    void (*pa_cccc8)(void *restrict dst, void *restrict src[], int w);
+    void (*un_ccc8x8)(void *restrict src, void *restrict dst[], int w);
+    void (*pa_ccc8z8)(void *restrict dst, void *restrict src[], int w);
+    void (*un_x8ccc8)(void *restrict src, void *restrict dst[], int w);
+    void (*pa_z8ccc8)(void *restrict dst, void *restrict src[], int w);
+
+    // Integer <-> float, see repack_float().
+    void (*un_f32_8)(void *restrict src, float *restrict dst, int w, float m,
+                     float o, uint32_t unused);
+    void (*pa_f32_8)(void *restrict dst, float *restrict src, int w, float m,
+                     float o, uint32_t p_max);
+    void (*un_f32_16)(void *restrict src, float *restrict dst, int w, float m,
+                      float o, uint32_t unused);
+    void (*pa_f32_16)(void *restrict dst, float *restrict src, int w, float m,
+                      float o, uint32_t p_max);
+
+    // Swap bytes of n 16 bit words. dst and src may be the same.
+    void (*bswap16)(uint16_t *dst, const uint16_t *src, int n);
+};
+
+// Return the functions supported by the CPU. The result is statically
+// allocated and never changes.
+const struct repack_dsp *repack_dsp_get(void);
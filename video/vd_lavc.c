@@ -1138,7 +1138,7 @@ static int send_packet(struct mp_filter *vd, struct demux_packet *pkt)
     if (ctx->hw_probing && ctx->num_sent_packets < 32 &&
         ctx->opts->software_fallback <= 32)
     {
-        pkt = pkt ? demux_copy_packet(pkt) : NULL;
+        pkt = pkt ? demux_copy_packet(NULL, pkt) : NULL;
         MP_TARRAY_APPEND(ctx, ctx->sent_packets, ctx->num_sent_packets, pkt);
     }
 